@@ -10,12 +10,10 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<DatasetReader.h>
 
 using namespace std;
 
-void LoadImages(const string &strAssociationFilename, vector<string> &vstrImageLeft,
-                vector<string> &vstrImageRight, vector<string> &vstrImageFilenamesD, vector<double> &vTimestamps);
-
 int main(int argc, char **argv)
 {
     if(argc != 5)
@@ -24,15 +22,11 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    // Retrieve paths to images
-    vector<string> vstrImageLeft;
-    vector<string> vstrImageRight;
-    vector<string> vstrImageDepth;
-    vector<double> vTimestamps;
+    // Retrieve paths to images. Images are decoded ahead of time by the reader threads.
     string strAssociationFilename = string(argv[4]);
-    LoadImages(strAssociationFilename, vstrImageLeft, vstrImageRight, vstrImageDepth, vTimestamps);
+    ORB_SLAM3::DatasetReader reader(string(argv[3]), strAssociationFilename, ORB_SLAM3::DatasetReader::ASSOCIATION_STEREO_RGBD);
 
-    int nImages  = vstrImageLeft.size();
+    int nImages  = reader.Size();
 
     // Create SLAM system. It initializes all system threads and gets ready to process frames.
     ORB_SLAM3::System SLAM(argv[1],argv[2],ORB_SLAM3::System::STEREO,true);
@@ -42,7 +36,7 @@ int main(int argc, char **argv)
     vTimesTrack.resize(nImages);
 
     // 主循环
-    cv::Mat imLeft, imRight, imD;
+    ORB_SLAM3::DatasetFrame frame;
     double tReadImage, tTrack;
     for(int ni=0; ni<nImages; ni++)
     {
@@ -50,10 +44,13 @@ int main(int argc, char **argv)
 //        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
 
 
-        // Read left and right images from file
-        imLeft = cv::imread(string(argv[3])+"/"+vstrImageLeft[ni],cv::IMREAD_UNCHANGED);
-        imRight = cv::imread(string(argv[3])+"/"+vstrImageRight[ni],cv::IMREAD_UNCHANGED);
-        imD = cv::imread(string(argv[3])+"/"+vstrImageDepth[ni],cv::IMREAD_UNCHANGED);
+        // Get the prefetched left, right and depth images
+        if(!reader.Next(frame) || frame.empty())
+            return 1;
+
+        cv::Mat &imLeft = frame.imLeft;
+        cv::Mat &imRight = frame.imRight;
+        cv::Mat &imD = frame.imDepth;
 
 //        std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
 //
@@ -61,14 +58,7 @@ int main(int argc, char **argv)
 //
 //        cout<< tReadImage<<endl;
 
-        double tframe = vTimestamps[ni];
-
-        if(imLeft.empty())
-        {
-            cerr << endl << "Failed to load image at: "
-                 << string(vstrImageLeft[ni]) << endl;
-            return 1;
-        }
+        double tframe = frame.timestamp;
 
 #ifdef COMPILEDWITHC11
         std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
@@ -103,9 +93,9 @@ int main(int argc, char **argv)
         // Wait to load the next frame
 //        double T=0;
 //        if(ni<nImages-1)
-//            T = vTimestamps[ni+1]-tframe;       //如果当前图像不是最后一帧
+//            T = reader.GetTimestamp(ni+1)-tframe;       //如果当前图像不是最后一帧
 //        else if(ni>0)
-//            T = tframe-vTimestamps[ni-1];       //如果是最后一帧
+//            T = tframe-reader.GetTimestamp(ni-1);       //如果是最后一帧
 
 //        if(ttrack<T)
 //            usleep((T-ttrack)*1e6);
@@ -135,41 +125,3 @@ int main(int argc, char **argv)
 
 }
 
-
-void LoadImages(const string &strAssociationFilename, vector<string> &vstrImageLeft,
-                vector<string> &vstrImageRight, vector<string> &vstrImageFilenamesD, vector<double> &vTimestamps)
-{
-    ifstream fAssociation;
-    fAssociation.open(strAssociationFilename.c_str());
-    while (!fAssociation.eof())
-    {
-        string s;
-        getline(fAssociation, s);
-        if(!s.empty())
-        {
-            stringstream ss;
-            ss << s;
-            double t;
-            string sImageLeft, sImageRight, sD;
-            ss >> t;        //  时间戳
-            vTimestamps.push_back(t);
-            ss >> sImageLeft;       //  左图路径
-            vstrImageLeft.push_back(sImageLeft);
-            ss >> sImageRight;      // 右图路径
-            vstrImageRight.push_back(sImageRight);
-            ss >> t;        //  深度图时间戳，在这里其实是不需要的
-            ss >> sD;       //  深度图路径
-            vstrImageFilenamesD.push_back(sD);
-
-        }
-
-    }
-
-
-}
-
-
-
-
-
-
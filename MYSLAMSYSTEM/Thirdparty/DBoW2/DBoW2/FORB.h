@@ -60,6 +60,21 @@ public:
    */
   static void fromString(TDescriptor &a, const std::string &s);
 
+  /**
+   * Copies the L bytes of the descriptor into p
+   * @param a descriptor
+   * @param p (out) buffer of at least L bytes
+   */
+  static void toBytes(const TDescriptor &a, unsigned char *p);
+
+  /**
+   * Returns a descriptor that points to the L bytes at p without copying
+   * them, so p must outlive it
+   * @param a (out) descriptor
+   * @param p buffer of L bytes
+   */
+  static void fromBytes(TDescriptor &a, const unsigned char *p);
+
   /**
    * Returns a mat with the descriptors in float format
    * @param descriptors
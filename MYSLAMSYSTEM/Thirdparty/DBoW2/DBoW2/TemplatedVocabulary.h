@@ -3,6 +3,8 @@
  * Added functions: Save and Load from text files without using cv::FileStorage.
  * Date: August 2015
  * Raúl Mur-Artal
+ *
+ * Added functions: Save and Load (memory-mapped) from binary files.
  */
 
 /**
@@ -26,6 +28,14 @@
 #include <algorithm>
 #include <opencv2/core/core.hpp>
 #include <limits>
+#include <memory>
+#include <cstring>
+#include <stdint.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "FeatureVector.h"
 #include "BowVector.h"
@@ -37,6 +47,39 @@ using namespace std;
 
 namespace DBoW2 {
 
+/// Header of the binary vocabulary format. The node arrays follow it in the
+/// file, each one starting at a multiple of BINARY_VOC_ALIGN bytes, so that
+/// the file can be memory-mapped and the arrays used in place:
+///   parents  uint32[nodes]
+///   word ids uint32[nodes]  (BINARY_VOC_NO_WORD for non-leaf nodes)
+///   weights  double[nodes]
+///   descriptors  uint8[nodes * descriptor_size]
+/// The file is written in host byte order (checked through endian_tag).
+struct BinaryVocabularyHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t endian_tag;
+  int32_t k;
+  int32_t L;
+  int32_t scoring;
+  int32_t weighting;
+  uint32_t nodes;
+  uint32_t words;
+  uint32_t descriptor_size;
+  uint32_t reserved;
+  uint64_t parents_offset;
+  uint64_t word_ids_offset;
+  uint64_t weights_offset;
+  uint64_t descriptors_offset;
+};
+
+static const char BINARY_VOC_MAGIC[8] = {'D','B','o','W','2','B','I','N'};
+static const uint32_t BINARY_VOC_VERSION = 1;
+static const uint32_t BINARY_VOC_ENDIAN_TAG = 0x01020304;
+static const uint32_t BINARY_VOC_NO_WORD = 0xFFFFFFFF;
+static const uint64_t BINARY_VOC_ALIGN = 64;
+
 /// @param TDescriptor class of descriptor
 /// @param F class of descriptor functions
 template<class TDescriptor, class F>
@@ -246,6 +289,23 @@ public:
    */
   void saveToTextFile(const std::string &filename) const;  
 
+  /**
+   * Loads the vocabulary from a binary file written by saveToBinaryFile.
+   * The file is memory-mapped and the node descriptors point into the
+   * mapping, which is kept alive as long as this vocabulary (or a copy of
+   * it) uses it. F must provide fromBytes.
+   * @param filename
+   * @return false if the file cannot be mapped or is not a valid vocabulary
+   */
+  bool loadFromBinaryFile(const std::string &filename);
+
+  /**
+   * Saves the vocabulary into a binary file. F must provide toBytes.
+   * @param filename
+   * @return false if the file cannot be written
+   */
+  bool saveToBinaryFile(const std::string &filename) const;
+
   /**
    * Saves the vocabulary into a file
    * @param filename
@@ -425,6 +485,10 @@ protected:
   /// Words of the vocabulary (tree leaves)
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Binary file the node descriptors point into, if loaded with
+  /// loadFromBinaryFile (shared by copies of this vocabulary)
+  std::shared_ptr<const unsigned char> m_mapping;
   
 };
 
@@ -547,6 +611,7 @@ TemplatedVocabulary<TDescriptor,F>::operator=
   this->m_words.clear();
   
   this->m_nodes = voc.m_nodes;
+  this->m_mapping = voc.m_mapping;
   this->createWords();
   
   return *this;
@@ -1345,6 +1410,7 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
 
     m_words.clear();
     m_nodes.clear();
+    m_mapping.reset();
 
     string s;
     getline(f,s);
@@ -1450,6 +1516,206 @@ void TemplatedVocabulary<TDescriptor,F>::saveToTextFile(const std::string &filen
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::loadFromBinaryFile(const std::string &filename)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BinaryVocabularyHeader))
+  {
+    close(fd);
+    return false;
+  }
+
+  const size_t size = st.st_size;
+  void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED)
+    return false;
+
+  std::shared_ptr<const unsigned char> mapping(
+    static_cast<const unsigned char*>(data),
+    [size](const unsigned char *p){ munmap(const_cast<unsigned char*>(p), size); });
+
+  const unsigned char *base = mapping.get();
+  const BinaryVocabularyHeader &h =
+    *reinterpret_cast<const BinaryVocabularyHeader*>(base);
+
+  if(memcmp(h.magic, BINARY_VOC_MAGIC, sizeof(h.magic)) != 0 ||
+    h.version != BINARY_VOC_VERSION || h.endian_tag != BINARY_VOC_ENDIAN_TAG ||
+    h.descriptor_size != (uint32_t)F::L || h.nodes == 0 || h.words > h.nodes ||
+    h.k < 0 || h.k > 20 || h.L < 1 || h.L > 10 ||
+    h.scoring < 0 || h.scoring > 5 || h.weighting < 0 || h.weighting > 3)
+  {
+    std::cerr << "Vocabulary loading failure: This is not a correct binary file!" << endl;
+    return false;
+  }
+
+  // written as offset <= size && n <= (size - offset) / elem_size so that
+  // corrupted offsets cannot wrap around
+  const uint64_t n = h.nodes;
+  auto fits = [size, n](uint64_t offset, uint64_t elem_size)
+  {
+    return elem_size > 0 && offset <= size && n <= (size - offset) / elem_size;
+  };
+  if(!fits(h.parents_offset, sizeof(uint32_t)) ||
+    !fits(h.word_ids_offset, sizeof(uint32_t)) ||
+    !fits(h.weights_offset, sizeof(double)) ||
+    !fits(h.descriptors_offset, h.descriptor_size) ||
+    h.parents_offset % BINARY_VOC_ALIGN || h.word_ids_offset % BINARY_VOC_ALIGN ||
+    h.weights_offset % BINARY_VOC_ALIGN || h.descriptors_offset % BINARY_VOC_ALIGN)
+  {
+    std::cerr << "Vocabulary loading failure: The binary file is truncated!" << endl;
+    return false;
+  }
+
+  const uint32_t *parents = reinterpret_cast<const uint32_t*>(base + h.parents_offset);
+  const uint32_t *word_ids = reinterpret_cast<const uint32_t*>(base + h.word_ids_offset);
+  const double *weights = reinterpret_cast<const double*>(base + h.weights_offset);
+  const unsigned char *descriptors = base + h.descriptors_offset;
+
+  m_words.clear();
+  m_nodes.clear();
+  m_mapping.reset();
+
+  m_k = h.k;
+  m_L = h.L;
+  m_scoring = (ScoringType)h.scoring;
+  m_weighting = (WeightingType)h.weighting;
+  createScoringObject();
+
+  // nodes are stored so that parents come before their children, as in
+  // the text format, and children keep their order
+  m_nodes.resize(n);
+  m_words.resize(h.words, NULL);
+  for(NodeId nid = 0; nid < n; ++nid)
+  {
+    Node &node = m_nodes[nid];
+    node.id = nid;
+    node.weight = weights[nid];
+
+    if(nid > 0)
+    {
+      const NodeId pid = parents[nid];
+      if(pid >= nid)
+      {
+        std::cerr << "Vocabulary loading failure: Wrong node order in binary file!" << endl;
+        m_nodes.clear();
+        m_words.clear();
+        return false;
+      }
+      node.parent = pid;
+      m_nodes[pid].children.push_back(nid);
+      F::fromBytes(node.descriptor, descriptors + (size_t)nid * h.descriptor_size);
+    }
+
+    const WordId wid = word_ids[nid];
+    if(wid != BINARY_VOC_NO_WORD)
+    {
+      if(wid >= h.words || m_words[wid] != NULL)
+      {
+        std::cerr << "Vocabulary loading failure: Wrong word id in binary file!" << endl;
+        m_nodes.clear();
+        m_words.clear();
+        return false;
+      }
+      node.word_id = wid;
+      m_words[wid] = &node;
+    }
+  }
+
+  for(size_t wid = 0; wid < m_words.size(); ++wid)
+  {
+    if(m_words[wid] == NULL)
+    {
+      std::cerr << "Vocabulary loading failure: Missing word in binary file!" << endl;
+      m_nodes.clear();
+      m_words.clear();
+      return false;
+    }
+  }
+
+  m_mapping = mapping;
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::saveToBinaryFile(const std::string &filename) const
+{
+  const uint64_t n = m_nodes.size();
+  // keeps the sections aligned for in-place use after mapping
+  struct Align
+  {
+    static uint64_t up(uint64_t offset)
+    {
+      return (offset + BINARY_VOC_ALIGN - 1) / BINARY_VOC_ALIGN * BINARY_VOC_ALIGN;
+    }
+  };
+
+  BinaryVocabularyHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, BINARY_VOC_MAGIC, sizeof(h.magic));
+  h.version = BINARY_VOC_VERSION;
+  h.endian_tag = BINARY_VOC_ENDIAN_TAG;
+  h.k = m_k;
+  h.L = m_L;
+  h.scoring = m_scoring;
+  h.weighting = m_weighting;
+  h.nodes = n;
+  h.words = m_words.size();
+  h.descriptor_size = F::L;
+  h.parents_offset = Align::up(sizeof(h));
+  h.word_ids_offset = Align::up(h.parents_offset + n * sizeof(uint32_t));
+  h.weights_offset = Align::up(h.word_ids_offset + n * sizeof(uint32_t));
+  h.descriptors_offset = Align::up(h.weights_offset + n * sizeof(double));
+
+  std::vector<uint32_t> parents(n, 0);
+  std::vector<uint32_t> word_ids(n, BINARY_VOC_NO_WORD);
+  std::vector<double> weights(n, 0);
+  std::vector<unsigned char> descriptors(n * F::L, 0);
+  for(size_t i = 0; i < n; ++i)
+  {
+    const Node &node = m_nodes[i];
+    weights[i] = node.weight;
+    if(i > 0)
+    {
+      parents[i] = node.parent;
+      F::toBytes(node.descriptor, &descriptors[i * F::L]);
+      if(node.isLeaf())
+        word_ids[i] = node.word_id;
+    }
+  }
+
+  std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if(!f.is_open())
+    return false;
+
+  const char zeros[BINARY_VOC_ALIGN] = {0};
+  uint64_t pos = 0;
+  // writes a section at the given offset, padding from the current position
+  auto write_at = [&](uint64_t offset, const void *data, uint64_t bytes)
+  {
+    f.write(zeros, offset - pos);
+    f.write(static_cast<const char*>(data), bytes);
+    pos = offset + bytes;
+  };
+
+  write_at(0, &h, sizeof(h));
+  write_at(h.parents_offset, parents.data(), n * sizeof(uint32_t));
+  write_at(h.word_ids_offset, word_ids.data(), n * sizeof(uint32_t));
+  write_at(h.weights_offset, weights.data(), n * sizeof(double));
+  write_at(h.descriptors_offset, descriptors.data(), n * F::L);
+
+  return f.good();
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::save(const std::string &filename) const
 {
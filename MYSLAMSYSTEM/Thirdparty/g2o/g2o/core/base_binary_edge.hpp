@@ -70,13 +70,20 @@ void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::constructQuadraticForm()
     from->lockQuadraticForm();
     to->lockQuadraticForm();
 #endif
+    // while the BlockSolver builds the system in parallel, the diagonal blocks go to the accumulator of this thread
+    QuadraticFormAccumulator* accumulator = QuadraticFormAccumulator::current();
+    typename VertexXiType::HessianBlockType fromA(accumulator && fromNotFixed ? accumulator->A(from->hessianIndex()) : from->A().data());
+    Eigen::Map<Matrix<double, VertexXiType::Dimension, 1> > fromB(accumulator && fromNotFixed ? accumulator->b(from->hessianIndex()) : from->b().data());
+    typename VertexXjType::HessianBlockType toA(accumulator && toNotFixed ? accumulator->A(to->hessianIndex()) : to->A().data());
+    Eigen::Map<Matrix<double, VertexXjType::Dimension, 1> > toB(accumulator && toNotFixed ? accumulator->b(to->hessianIndex()) : to->b().data());
+
     const InformationType& omega = _information;
     Matrix<double, D, 1> omega_r = - omega * _error;
     if (this->robustKernel() == 0) {
       if (fromNotFixed) {
         Matrix<double, VertexXiType::Dimension, D> AtO = A.transpose() * omega;
-        from->b().noalias() += A.transpose() * omega_r;
-        from->A().noalias() += AtO*A;
+        fromB.noalias() += A.transpose() * omega_r;
+        fromA.noalias() += AtO*A;
         if (toNotFixed ) {
           if (_hessianRowMajor) // we have to write to the block as transposed
             _hessianTransposed.noalias() += B.transpose() * AtO.transpose();
@@ -85,8 +92,8 @@ void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::constructQuadraticForm()
         }
       } 
       if (toNotFixed) {
-        to->b().noalias() += B.transpose() * omega_r;
-        to->A().noalias() += B.transpose() * omega * B;
+        toB.noalias() += B.transpose() * omega_r;
+        toA.noalias() += B.transpose() * omega * B;
       }
     } else { // robust (weighted) error according to some kernel
       double error = this->chi2();
@@ -98,8 +105,8 @@ void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::constructQuadraticForm()
 
       omega_r *= rho[1];
       if (fromNotFixed) {
-        from->b().noalias() += A.transpose() * omega_r;
-        from->A().noalias() += A.transpose() * weightedOmega * A;
+        fromB.noalias() += A.transpose() * omega_r;
+        fromA.noalias() += A.transpose() * weightedOmega * A;
         if (toNotFixed ) {
           if (_hessianRowMajor) // we have to write to the block as transposed
             _hessianTransposed.noalias() += B.transpose() * weightedOmega * A;
@@ -108,8 +115,8 @@ void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::constructQuadraticForm()
         }
       } 
       if (toNotFixed) {
-        to->b().noalias() += B.transpose() * omega_r;
-        to->A().noalias() += B.transpose() * weightedOmega * B;
+        toB.noalias() += B.transpose() * omega_r;
+        toA.noalias() += B.transpose() * weightedOmega * B;
       }
     }
 #ifdef G2O_OPENMP
@@ -33,6 +33,7 @@
 #include <Eigen/Core>
 
 #include "optimizable_graph.h"
+#include "quadratic_form_accumulator.h"
 
 namespace g2o {
 
@@ -180,8 +180,10 @@ void BaseMultiEdge<D, E>::computeQuadraticForm(const InformationType& omega, con
       MatrixXd AtO = A.transpose() * omega;
       int fromDim = from->dimension();
       assert(fromDim >= 0);
-      Eigen::Map<MatrixXd> fromMap(from->hessianData(), fromDim, fromDim);
-      Eigen::Map<VectorXd> fromB(from->bData(), fromDim);
+      // while the BlockSolver builds the system in parallel, the diagonal block goes to the accumulator of this thread
+      QuadraticFormAccumulator* accumulator = QuadraticFormAccumulator::current();
+      Eigen::Map<MatrixXd> fromMap(accumulator ? accumulator->A(from->hessianIndex()) : from->hessianData(), fromDim, fromDim);
+      Eigen::Map<VectorXd> fromB(accumulator ? accumulator->b(from->hessianIndex()) : from->bData(), fromDim);
 
       // ii block in the hessian
 #ifdef G2O_OPENMP
@@ -53,17 +53,22 @@ void BaseUnaryEdge<D, E, VertexXiType>::constructQuadraticForm()
 #ifdef G2O_OPENMP
     from->lockQuadraticForm();
 #endif
+    // while the BlockSolver builds the system in parallel, the diagonal block goes to the accumulator of this thread
+    QuadraticFormAccumulator* accumulator = QuadraticFormAccumulator::current();
+    typename VertexXiType::HessianBlockType fromA(accumulator ? accumulator->A(from->hessianIndex()) : from->A().data());
+    Eigen::Map<Matrix<double, VertexXiType::Dimension, 1> > fromB(accumulator ? accumulator->b(from->hessianIndex()) : from->b().data());
+
     if (this->robustKernel()) {
       double error = this->chi2();
       Eigen::Vector3d rho;
       this->robustKernel()->robustify(error, rho);
       InformationType weightedOmega = this->robustInformation(rho);
 
-      from->b().noalias() -= rho[1] * A.transpose() * omega * _error;
-      from->A().noalias() += A.transpose() * weightedOmega * A;
+      fromB.noalias() -= rho[1] * A.transpose() * omega * _error;
+      fromA.noalias() += A.transpose() * weightedOmega * A;
     } else {
-      from->b().noalias() -= A.transpose() * omega * _error;
-      from->A().noalias() += A.transpose() * omega * A;
+      fromB.noalias() -= A.transpose() * omega * _error;
+      fromA.noalias() += A.transpose() * omega * A;
     }
 #ifdef G2O_OPENMP
     from->unlockQuadraticForm();
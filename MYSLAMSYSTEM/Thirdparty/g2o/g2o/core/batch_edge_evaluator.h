@@ -0,0 +1,70 @@
+// g2o - General Graph Optimization
+// Copyright (C) 2011 R. Kuemmerle, G. Grisetti, W. Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef G2O_BATCH_EDGE_EVALUATOR_H
+#define G2O_BATCH_EDGE_EVALUATOR_H
+
+#include "optimizable_graph.h"
+
+#include <vector>
+
+namespace g2o {
+
+  /**
+   * \brief evaluates a set of edges of the same type together
+   *
+   * An evaluator registered at the SparseOptimizer computes the error vectors
+   * of the active edges it accepts in one pass, e.g., with the data laid out
+   * for vectorization, instead of calling computeError() for each of them.
+   * The edges remain regular members of the graph. The solver still calls
+   * linearizeOplus() for each edge to fill the Jacobians into the workspace,
+   * which is expected to copy them from the evaluator.
+   */
+  class BatchEdgeEvaluator
+  {
+    public:
+      virtual ~BatchEdgeEvaluator() {}
+
+      /**
+       * called by SparseOptimizer::initializeOptimization(). Collect the edges
+       * which are evaluated by this evaluator and set taken[i] for them.
+       * Edges already taken by another evaluator have to be skipped.
+       */
+      virtual void setActiveEdges(const std::vector<OptimizableGraph::Edge*>& activeEdges, std::vector<bool>& taken) = 0;
+
+      //! compute the error vectors of the collected edges and store them in the edges
+      virtual void computeErrors() = 0;
+
+      /**
+       * compute the error vectors and the Jacobians of the collected edges,
+       * called before the linear system is built
+       */
+      virtual void linearize() = 0;
+  };
+
+} // end namespace
+
+#endif
@@ -32,6 +32,9 @@
 #include "sparse_block_matrix.h"
 #include "sparse_block_matrix_diagonal.h"
 #include "openmp_mutex.h"
+#include "quadratic_form_accumulator.h"
+#include "optimizable_graph.h"
+#include "jacobian_workspace.h"
 #include "../../config.h"
 
 namespace g2o {
@@ -141,12 +144,45 @@ namespace g2o {
 
       virtual void multiplyHessian(double* dest, const double* src) const { _Hpp->multiplySymmetricUpperTriangle(dest, src);}
 
+      /**
+       * number of threads used for linearizing the edges, building the Hessian and
+       * computing the Schur complement. With more than one thread the edges are
+       * linearized concurrently, hence their linearizeOplus() must not modify the
+       * vertices, i.e., the edges need analytic Jacobians.
+       */
+      void setNumThreads(int numThreads);
+      int numThreads() const { return _numThreads;}
+
     protected:
+      //! minimum amount of work per thread, smaller problems are solved on the calling thread
+      static const int MinEdgesPerThread = 256;
+      static const int MinLandmarksPerThread = 128;
+
+      //! per-thread buffers for the Schur complement
+      struct SchurThreadData {
+        std::vector<PoseMatrixType, Eigen::aligned_allocator<PoseMatrixType> > blocks;
+        std::vector<double> coefficients;
+      };
+
       void resize(int* blockPoseIndices, int numPoseBlocks, 
           int* blockLandmarkIndices, int numLandmarkBlocks, int totalDim);
 
       void deallocate();
 
+      //! assign the active edges to the threads for buildSystem()
+      void partitionEdges();
+      //! linearize the edges in [begin, end) and add their quadratic form to the system
+      void linearizeEdges(OptimizableGraph::Edge* const* begin, OptimizableGraph::Edge* const* end, JacobianWorkspace& jacobianWorkspace);
+      //! build the system with several threads, each accumulating the vertex blocks on its own
+      void buildSystemParallel();
+      /**
+       * marginalize the landmarks [begin, end) into the Schur complement. If target is given,
+       * the products are accumulated there instead of _Hschur and _coefficients.
+       */
+      void schurComplement(int begin, int end, SchurThreadData* target);
+      //! compute the Schur complement with several threads
+      void schurComplementParallel(int numThreads);
+
       SparseBlockMatrix<PoseMatrixType>* _Hpp;
       SparseBlockMatrix<LandmarkMatrixType>* _Hll;
       SparseBlockMatrix<PoseLandmarkMatrixType>* _Hpl;
@@ -173,6 +209,21 @@ namespace g2o {
 
       int _numPoses, _numLandmarks;
       int _sizePoses, _sizeLandmarks;
+
+      int _numThreads;
+      // edges ordered such that the edges of a thread are contiguous, see partitionEdges()
+      bool _edgesPartitioned;
+      bool _reuseStructure;       ///< keep the structure of the last buildStructure(), see SparseOptimizer::setStructureCaching()
+      int _structureVersion;      ///< SparseOptimizer::structureVersion() at the last buildStructure()
+      std::vector<OptimizableGraph::Edge*> _parallelEdges;
+      std::vector<int> _threadEdgeBegin;
+      std::vector<OptimizableGraph::Edge*> _serialEdges;
+      std::vector<QuadraticFormAccumulator> _accumulators;
+      std::vector<JacobianWorkspace> _jacobianWorkspaces;
+      // the blocks of _HschurTransposedCCS enumerated column by column
+      std::vector<int> _schurBlockBegin;
+      std::vector<PoseMatrixType*> _schurBlocks;
+      std::vector<SchurThreadData> _schurThreadData;
   };
 
 
@@ -25,6 +25,7 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "sparse_optimizer.h"
+#include "../stuff/parallel.h"
 #include <Eigen/LU>
 #include <fstream>
 #include <iomanip>
@@ -59,6 +60,10 @@ BlockSolver<Traits>::BlockSolver(LinearSolverType* linearSolver) :
   _sizePoses=0;
   _sizeLandmarks=0;
   _doSchur=true;
+  _numThreads=1;
+  _edgesPartitioned=false;
+  _reuseStructure=false;
+  _structureVersion=-1;
 }
 
 template <typename Traits>
@@ -144,6 +149,11 @@ bool BlockSolver<Traits>::buildStructure(bool zeroBlocks)
 {
   assert(_optimizer);
 
+  _edgesPartitioned = false;
+  if (_reuseStructure)
+    return true;
+  _structureVersion = _optimizer->structureVersion();
+
   size_t sparseDim = 0;
   _numPoses=0;
   _numLandmarks=0;
@@ -291,12 +301,24 @@ bool BlockSolver<Traits>::buildStructure(bool zeroBlocks)
   delete schurMatrixLookup;
   _Hschur->fillSparseBlockMatrixCCSTransposed(*_HschurTransposedCCS);
 
+  // enumerate the blocks of the Schur complement for accumulating them per thread
+  _schurBlocks.clear();
+  _schurBlockBegin.resize(_HschurTransposedCCS->blockCols().size() + 1);
+  for (size_t i = 0; i < _HschurTransposedCCS->blockCols().size(); ++i) {
+    _schurBlockBegin[i] = _schurBlocks.size();
+    const typename SparseBlockMatrixCCS<PoseMatrixType>::SparseColumn& column = _HschurTransposedCCS->blockCols()[i];
+    for (typename SparseBlockMatrixCCS<PoseMatrixType>::SparseColumn::const_iterator it = column.begin(); it != column.end(); ++it)
+      _schurBlocks.push_back(it->block);
+  }
+  _schurBlockBegin.back() = _schurBlocks.size();
+
   return true;
 }
 
 template <typename Traits>
 bool BlockSolver<Traits>::updateStructure(const std::vector<HyperGraph::Vertex*>& vset, const HyperGraph::EdgeSet& edges)
 {
+  _edgesPartitioned = false;
   for (std::vector<HyperGraph::Vertex*>::const_iterator vit = vset.begin(); vit != vset.end(); ++vit) {
     OptimizableGraph::Vertex* v = static_cast<OptimizableGraph::Vertex*>(*vit);
     int dim = v->dimension();
@@ -351,34 +373,13 @@ bool BlockSolver<Traits>::updateStructure(const std::vector<HyperGraph::Vertex*>
 }
 
 template <typename Traits>
-bool BlockSolver<Traits>::solve(){
-  //cerr << __PRETTY_FUNCTION__ << endl;
-  if (! _doSchur){
-    double t=get_monotonic_time();
-    bool ok = _linearSolver->solve(*_Hpp, _x, _b);
-    G2OBatchStatistics* globalStats = G2OBatchStatistics::globalStats();
-    if (globalStats) {
-      globalStats->timeLinearSolver = get_monotonic_time() - t;
-      globalStats->hessianDimension = globalStats->hessianPoseDimension = _Hpp->cols();
-    }
-    return ok;
-  }
-
-  // schur thing
-
-  // backup the coefficient matrix
-  double t=get_monotonic_time();
-
-  // _Hschur = _Hpp, but keeping the pattern of _Hschur
-  _Hschur->clear();
-  _Hpp->add(_Hschur);
-
-  //_DInvSchur->clear();
-  memset (_coefficients, 0, _sizePoses*sizeof(double));
+void BlockSolver<Traits>::schurComplement(int begin, int end, SchurThreadData* target)
+{
+  double* coefficients = target ? &target->coefficients[0] : _coefficients;
 # ifdef G2O_OPENMP
-# pragma omp parallel for default (shared) schedule(dynamic, 10)
+# pragma omp parallel for default (shared) schedule(dynamic, 10) if (target == 0)
 # endif
-  for (int landmarkIndex = 0; landmarkIndex < static_cast<int>(_Hll->blockCols().size()); ++landmarkIndex) {
+  for (int landmarkIndex = begin; landmarkIndex < end; ++landmarkIndex) {
     const typename SparseBlockMatrix<LandmarkMatrixType>::IntBlockMap& marginalizeColumn = _Hll->blockCols()[landmarkIndex];
     assert(marginalizeColumn.size() == 1 && "more than one block in _Hll column");
 
@@ -406,7 +407,7 @@ bool BlockSolver<Traits>::solve(){
 
       PoseLandmarkMatrixType BDinv = (*Bi)*(Dinv);
       assert(_HplCCS->rowBaseOfBlock(i1) < _sizePoses && "Index out of bounds");
-      typename PoseVectorType::MapType Bb(&_coefficients[_HplCCS->rowBaseOfBlock(i1)], Bi->rows());
+      typename PoseVectorType::MapType Bb(&coefficients[_HplCCS->rowBaseOfBlock(i1)], Bi->rows());
 #    ifdef G2O_OPENMP
       ScopedOpenMPMutex mutexLock(&_coefficientsMutex[i1]);
 #    endif
@@ -425,11 +426,72 @@ bool BlockSolver<Traits>::solve(){
           ++targetColumnIt;
         assert(targetColumnIt != _HschurTransposedCCS->blockCols()[i1].end() && targetColumnIt->row == i2 && "invalid iterator, something wrong with the matrix structure");
         PoseMatrixType* Hi1i2 = targetColumnIt->block;//_Hschur->block(i1,i2);
+        if (target)
+          Hi1i2 = &target->blocks[_schurBlockBegin[i1] + (targetColumnIt - _HschurTransposedCCS->blockCols()[i1].begin())];
         assert(Hi1i2);
         (*Hi1i2).noalias() -= BDinv*Bj->transpose();
       }
     }
   }
+}
+
+template <typename Traits>
+void BlockSolver<Traits>::schurComplementParallel(int numThreads)
+{
+  const int numLandmarks = _Hll->blockCols().size();
+  _schurThreadData.resize(numThreads);
+  parallelInvoke(numThreads, [this, numThreads, numLandmarks](int thread) {
+      SchurThreadData& data = _schurThreadData[thread];
+      data.blocks.resize(_schurBlocks.size());
+      for (size_t i = 0; i < _schurBlocks.size(); ++i)
+        data.blocks[i].setZero(_schurBlocks[i]->rows(), _schurBlocks[i]->cols());
+      data.coefficients.assign(_sizePoses, 0.);
+      schurComplement(numLandmarks * thread / numThreads, numLandmarks * (thread + 1) / numThreads, &data);
+  });
+
+  // sum up the products of the threads
+  const int numBlocks = _schurBlocks.size();
+  parallelInvoke(numThreads, [this, numThreads, numBlocks](int thread) {
+      for (int i = numBlocks * thread / numThreads; i < numBlocks * (thread + 1) / numThreads; ++i)
+        for (size_t j = 0; j < _schurThreadData.size(); ++j)
+          *_schurBlocks[i] += _schurThreadData[j].blocks[i];
+      for (int i = _sizePoses * thread / numThreads; i < _sizePoses * (thread + 1) / numThreads; ++i)
+        for (size_t j = 0; j < _schurThreadData.size(); ++j)
+          _coefficients[i] += _schurThreadData[j].coefficients[i];
+  });
+}
+
+template <typename Traits>
+bool BlockSolver<Traits>::solve(){
+  //cerr << __PRETTY_FUNCTION__ << endl;
+  if (! _doSchur){
+    double t=get_monotonic_time();
+    bool ok = _linearSolver->solve(*_Hpp, _x, _b);
+    G2OBatchStatistics* globalStats = G2OBatchStatistics::globalStats();
+    if (globalStats) {
+      globalStats->timeLinearSolver = get_monotonic_time() - t;
+      globalStats->hessianDimension = globalStats->hessianPoseDimension = _Hpp->cols();
+    }
+    return ok;
+  }
+
+  // schur thing
+
+  // backup the coefficient matrix
+  double t=get_monotonic_time();
+
+  // _Hschur = _Hpp, but keeping the pattern of _Hschur
+  _Hschur->clear();
+  _Hpp->add(_Hschur);
+
+  //_DInvSchur->clear();
+  memset (_coefficients, 0, _sizePoses*sizeof(double));
+  const int numLandmarks = _Hll->blockCols().size();
+  const int numThreads = numThreadsForItems(_numThreads, numLandmarks, MinLandmarksPerThread);
+  if (numThreads > 1)
+    schurComplementParallel(numThreads);
+  else
+    schurComplement(0, numLandmarks, 0);
   //cerr << "Solve [marginalize] = " <<  get_monotonic_time()-t << endl;
 
   // _bschur = _b for calling solver, and not touching _b
@@ -501,6 +563,9 @@ bool BlockSolver<Traits>::computeMarginals(SparseBlockMatrix<MatrixXd>& spinv, c
 template <typename Traits>
 bool BlockSolver<Traits>::buildSystem()
 {
+  // Jacobians of the edges handled by batch evaluators, linearizeOplus() copies them
+  _optimizer->linearizeBatchEdges();
+
   // clear b vector
 # ifdef G2O_OPENMP
 # pragma omp parallel for default (shared) if (_optimizer->indexMapping().size() > 1000)
@@ -516,32 +581,36 @@ bool BlockSolver<Traits>::buildSystem()
     _Hpl->clear();
   }
 
-  // resetting the terms for the pairwise constraints
-  // built up the current system by storing the Hessian blocks in the edges and vertices
+  if (numThreadsForItems(_numThreads, _optimizer->activeEdges().size(), MinEdgesPerThread) > 1) {
+    buildSystemParallel();
+  } else {
+    // resetting the terms for the pairwise constraints
+    // built up the current system by storing the Hessian blocks in the edges and vertices
 # ifndef G2O_OPENMP
-  // no threading, we do not need to copy the workspace
-  JacobianWorkspace& jacobianWorkspace = _optimizer->jacobianWorkspace();
+    // no threading, we do not need to copy the workspace
+    JacobianWorkspace& jacobianWorkspace = _optimizer->jacobianWorkspace();
 # else
-  // if running with threads need to produce copies of the workspace for each thread
-  JacobianWorkspace jacobianWorkspace = _optimizer->jacobianWorkspace();
+    // if running with threads need to produce copies of the workspace for each thread
+    JacobianWorkspace jacobianWorkspace = _optimizer->jacobianWorkspace();
 # pragma omp parallel for default (shared) firstprivate(jacobianWorkspace) if (_optimizer->activeEdges().size() > 100)
 # endif
-  for (int k = 0; k < static_cast<int>(_optimizer->activeEdges().size()); ++k) {
-    OptimizableGraph::Edge* e = _optimizer->activeEdges()[k];
-    e->linearizeOplus(jacobianWorkspace); // jacobian of the nodes' oplus (manifold)
-    e->constructQuadraticForm();
+    for (int k = 0; k < static_cast<int>(_optimizer->activeEdges().size()); ++k) {
+      OptimizableGraph::Edge* e = _optimizer->activeEdges()[k];
+      e->linearizeOplus(jacobianWorkspace); // jacobian of the nodes' oplus (manifold)
+      e->constructQuadraticForm();
 #  ifndef NDEBUG
-    for (size_t i = 0; i < e->vertices().size(); ++i) {
-      const OptimizableGraph::Vertex* v = static_cast<const OptimizableGraph::Vertex*>(e->vertex(i));
-      if (! v->fixed()) {
-        bool hasANan = arrayHasNaN(jacobianWorkspace.workspaceForVertex(i), e->dimension() * v->dimension());
-        if (hasANan) {
-          cerr << "buildSystem(): NaN within Jacobian for edge " << e << " for vertex " << i << endl;
-          break;
+      for (size_t i = 0; i < e->vertices().size(); ++i) {
+        const OptimizableGraph::Vertex* v = static_cast<const OptimizableGraph::Vertex*>(e->vertex(i));
+        if (! v->fixed()) {
+          bool hasANan = arrayHasNaN(jacobianWorkspace.workspaceForVertex(i), e->dimension() * v->dimension());
+          if (hasANan) {
+            cerr << "buildSystem(): NaN within Jacobian for edge " << e << " for vertex " << i << endl;
+            break;
+          }
         }
       }
-    }
 #  endif
+    }
   }
 
   // flush the current system in a sparse block matrix
@@ -560,6 +629,121 @@ bool BlockSolver<Traits>::buildSystem()
 }
 
 
+template <typename Traits>
+void BlockSolver<Traits>::partitionEdges()
+{
+  const SparseOptimizer::EdgeContainer& activeEdges = _optimizer->activeEdges();
+  const int numVertices = _optimizer->indexMapping().size();
+
+  // An edge with two free vertices writes the off-diagonal block of this pair, which other edges might share.
+  // Ordering the edges by the larger Hessian index of their free vertices keeps the edges of a block together,
+  // in BA these are the observations of one landmark. Edges with more than two free vertices write several
+  // off-diagonal blocks and are processed serially.
+  std::vector<int> keys(activeEdges.size());
+  std::vector<int> keyBegin(numVertices + 1, 0);
+  _serialEdges.clear();
+  for (size_t k = 0; k < activeEdges.size(); ++k) {
+    OptimizableGraph::Edge* e = activeEdges[k];
+    int numFree = 0;
+    int key = 0;
+    for (size_t i = 0; i < e->vertices().size(); ++i) {
+      int idx = static_cast<const OptimizableGraph::Vertex*>(e->vertex(i))->hessianIndex();
+      if (idx < 0)
+        continue;
+      ++numFree;
+      key = std::max(key, idx);
+    }
+    if (numFree > 2) {
+      keys[k] = -1;
+      _serialEdges.push_back(e);
+    } else {
+      keys[k] = key;
+      ++keyBegin[key + 1];
+    }
+  }
+  for (int i = 0; i < numVertices; ++i)
+    keyBegin[i + 1] += keyBegin[i];
+
+  const int numParallelEdges = keyBegin[numVertices];
+  _parallelEdges.resize(numParallelEdges);
+  std::vector<int> sortedKeys(numParallelEdges);
+  for (size_t k = 0; k < activeEdges.size(); ++k) {
+    if (keys[k] < 0)
+      continue;
+    int pos = keyBegin[keys[k]]++;
+    _parallelEdges[pos] = activeEdges[k];
+    sortedKeys[pos] = keys[k];
+  }
+
+  // split into contiguous ranges of equal size without separating edges with the same key
+  const int numThreads = numThreadsForItems(_numThreads, activeEdges.size(), MinEdgesPerThread);
+  _threadEdgeBegin.resize(numThreads + 1);
+  _threadEdgeBegin[0] = 0;
+  for (int t = 1; t < numThreads; ++t) {
+    int begin = std::max(numParallelEdges * t / numThreads, _threadEdgeBegin[t - 1]);
+    while (begin > 0 && begin < numParallelEdges && sortedKeys[begin] == sortedKeys[begin - 1])
+      ++begin;
+    _threadEdgeBegin[t] = begin;
+  }
+  _threadEdgeBegin[numThreads] = numParallelEdges;
+
+  std::vector<int> dims(numVertices);
+  for (int i = 0; i < numVertices; ++i)
+    dims[i] = _optimizer->indexMapping()[i]->dimension();
+  _accumulators.resize(numThreads);
+  for (int t = 0; t < numThreads; ++t)
+    _accumulators[t].resize(dims);
+  _jacobianWorkspaces.assign(numThreads, _optimizer->jacobianWorkspace());
+
+  _edgesPartitioned = true;
+}
+
+template <typename Traits>
+void BlockSolver<Traits>::linearizeEdges(OptimizableGraph::Edge* const* begin, OptimizableGraph::Edge* const* end, JacobianWorkspace& jacobianWorkspace)
+{
+  for (OptimizableGraph::Edge* const* it = begin; it != end; ++it) {
+    OptimizableGraph::Edge* e = *it;
+    e->linearizeOplus(jacobianWorkspace);
+    e->constructQuadraticForm();
+  }
+}
+
+template <typename Traits>
+void BlockSolver<Traits>::buildSystemParallel()
+{
+  if (! _edgesPartitioned)
+    partitionEdges();
+
+  const int numThreads = _threadEdgeBegin.size() - 1;
+  OptimizableGraph::Edge* const* edges = _parallelEdges.empty() ? 0 : &_parallelEdges[0];
+  parallelInvoke(numThreads, [this, edges](int thread) {
+      QuadraticFormAccumulator::setCurrent(&_accumulators[thread]);
+      linearizeEdges(edges + _threadEdgeBegin[thread], edges + _threadEdgeBegin[thread + 1], _jacobianWorkspaces[thread]);
+      QuadraticFormAccumulator::setCurrent(0);
+  });
+
+  // the remaining edges write to the vertices directly
+  if (! _serialEdges.empty())
+    linearizeEdges(&_serialEdges[0], &_serialEdges[0] + _serialEdges.size(), _optimizer->jacobianWorkspace());
+
+  // sum up the diagonal blocks and the gradients of the threads
+  const int numVertices = _optimizer->indexMapping().size();
+  parallelInvoke(numThreads, [this, numThreads, numVertices](int thread) {
+      for (int i = numVertices * thread / numThreads; i < numVertices * (thread + 1) / numThreads; ++i) {
+        OptimizableGraph::Vertex* v = _optimizer->indexMapping()[i];
+        for (size_t j = 0; j < _accumulators.size(); ++j)
+          _accumulators[j].flush(i, v->hessianData(), v->bData());
+      }
+  });
+}
+
+template <typename Traits>
+void BlockSolver<Traits>::setNumThreads(int numThreads)
+{
+  _numThreads = std::max(1, numThreads);
+  _edgesPartitioned = false;
+}
+
 template <typename Traits>
 bool BlockSolver<Traits>::setLambda(double lambda, bool backup)
 {
@@ -606,7 +790,14 @@ void BlockSolver<Traits>::restoreDiagonal()
 template <typename Traits>
 bool BlockSolver<Traits>::init(SparseOptimizer* optimizer, bool online)
 {
+  // the index mapping is the one of our last buildStructure(), keep the blocks and the
+  // symbolic factorization. Only the set of active edges may have changed.
+  _reuseStructure = ! online && _Hpp && optimizer == _optimizer && optimizer->structureReused()
+    && _structureVersion == optimizer->structureVersion();
+  _edgesPartitioned = false;
   _optimizer = optimizer;
+  if (_reuseStructure)
+    return true;
   if (! online) {
     if (_Hpp)
       _Hpp->clear();
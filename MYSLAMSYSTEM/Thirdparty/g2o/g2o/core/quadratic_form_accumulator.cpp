@@ -0,0 +1,70 @@
+// g2o - General Graph Optimization
+// Copyright (C) 2011 R. Kuemmerle, G. Grisetti, W. Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "quadratic_form_accumulator.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace g2o {
+
+thread_local QuadraticFormAccumulator* QuadraticFormAccumulator::_current = 0;
+
+void QuadraticFormAccumulator::resize(const std::vector<int>& dims)
+{
+  _dims = dims;
+  _offsets.resize(dims.size());
+  _used.assign(dims.size(), 0);
+  size_t size = 0;
+  for (size_t i = 0; i < dims.size(); ++i) {
+    _offsets[i] = size;
+    size += dims[i] * (dims[i] + 1);
+    // keep every block aligned to a cache line, the vertices map their blocks as aligned matrices
+    size = (size + 7) & ~size_t(7);
+  }
+  _data.resize(size);
+}
+
+void QuadraticFormAccumulator::clearBlock(int hessianIndex)
+{
+  const int dim = _dims[hessianIndex];
+  memset(&_data[_offsets[hessianIndex]], 0, dim * (dim + 1) * sizeof(double));
+  _used[hessianIndex] = 1;
+}
+
+void QuadraticFormAccumulator::flush(int hessianIndex, double* A, double* b)
+{
+  if (! _used[hessianIndex])
+    return;
+  const int dim = _dims[hessianIndex];
+  const double* data = &_data[_offsets[hessianIndex]];
+  Eigen::Map<Eigen::VectorXd>(A, dim * dim) += Eigen::Map<const Eigen::VectorXd>(data, dim * dim);
+  Eigen::Map<Eigen::VectorXd>(b, dim) += Eigen::Map<const Eigen::VectorXd>(data + dim * dim, dim);
+  _used[hessianIndex] = 0;
+}
+
+} // end namespace
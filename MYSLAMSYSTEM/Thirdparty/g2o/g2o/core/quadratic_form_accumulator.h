@@ -0,0 +1,96 @@
+// g2o - General Graph Optimization
+// Copyright (C) 2011 R. Kuemmerle, G. Grisetti, W. Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef G2O_QUADRATIC_FORM_ACCUMULATOR_H
+#define G2O_QUADRATIC_FORM_ACCUMULATOR_H
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+#include <vector>
+#include <cassert>
+
+namespace g2o {
+
+  /**
+   * \brief per-thread storage for the diagonal blocks and the gradients of the vertices
+   *
+   * While the BlockSolver builds the linear system with several threads, the edges
+   * processed by a thread add the contribution to their vertices to the accumulator
+   * of this thread instead of writing to the vertices, which are shared between the
+   * threads. The accumulators are summed into the vertices afterwards.
+   * Off-diagonal blocks are written directly, the BlockSolver assigns all the edges
+   * writing to the same off-diagonal block to the same thread.
+   */
+  class QuadraticFormAccumulator
+  {
+    public:
+      /**
+       * allocate the storage, dims[i] is the dimension of the vertex with hessianIndex i
+       */
+      void resize(const std::vector<int>& dims);
+
+      //! the diagonal block (column major) of the vertex, set to zero on the first access
+      double* A(int hessianIndex)
+      {
+        assert(hessianIndex >= 0 && hessianIndex < (int)_offsets.size());
+        if (! _used[hessianIndex])
+          clearBlock(hessianIndex);
+        return &_data[_offsets[hessianIndex]];
+      }
+      //! the gradient of the vertex, set to zero on the first access
+      double* b(int hessianIndex)
+      {
+        assert(hessianIndex >= 0 && hessianIndex < (int)_offsets.size());
+        if (! _used[hessianIndex])
+          clearBlock(hessianIndex);
+        return &_data[_offsets[hessianIndex] + _dims[hessianIndex] * _dims[hessianIndex]];
+      }
+
+      /**
+       * add the accumulated block and gradient of the vertex to A and b and
+       * reset it. Vertices which were not touched since the last flush are skipped.
+       */
+      void flush(int hessianIndex, double* A, double* b);
+
+      //! the accumulator of the calling thread, 0 if the edges write to the vertices
+      static QuadraticFormAccumulator* current() { return _current;}
+      static void setCurrent(QuadraticFormAccumulator* accumulator) { _current = accumulator;}
+
+    protected:
+      void clearBlock(int hessianIndex);
+
+      std::vector<int> _offsets;
+      std::vector<int> _dims;
+      std::vector<char> _used;
+      std::vector<double, Eigen::aligned_allocator<double> > _data;
+
+      static thread_local QuadraticFormAccumulator* _current;
+  };
+
+} // end namespace
+
+#endif
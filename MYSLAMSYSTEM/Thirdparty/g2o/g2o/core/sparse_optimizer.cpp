@@ -35,6 +35,7 @@
 
 #include "estimate_propagator.h"
 #include "optimization_algorithm.h"
+#include "batch_edge_evaluator.h"
 #include "batch_stats.h"
 #include "hyper_graph_action.h"
 #include "robust_kernel.h"
@@ -48,7 +49,9 @@ namespace g2o{
 
 
   SparseOptimizer::SparseOptimizer() :
-    _forceStopFlag(0), _verbose(false), _algorithm(0), _computeBatchStatistics(false)
+    _forceStopFlag(0), _verbose(false), _algorithm(0),
+    _structureCaching(false), _structureReused(false), _structureCached(false), _structureVersion(0),
+    _computeBatchStatistics(false)
   {
     _graphActions.resize(AT_NUM_ELEMENTS);
   }
@@ -67,11 +70,15 @@ namespace g2o{
         (*(*it))(this);
     }
 
+    for (size_t i = 0; i < _batchEvaluators.size(); ++i)
+      _batchEvaluators[i]->computeErrors();
+    const EdgeContainer& edges = _batchEvaluators.empty() ? _activeEdges : _unbatchedEdges;
+
 #   ifdef G2O_OPENMP
-#   pragma omp parallel for default (shared) if (_activeEdges.size() > 50)
+#   pragma omp parallel for default (shared) if (edges.size() > 50)
 #   endif
-    for (int k = 0; k < static_cast<int>(_activeEdges.size()); ++k) {
-      OptimizableGraph::Edge* e = _activeEdges[k];
+    for (int k = 0; k < static_cast<int>(edges.size()); ++k) {
+      OptimizableGraph::Edge* e = edges[k];
       e->computeError();
     }
 
@@ -263,7 +270,13 @@ namespace g2o{
       _activeEdges.push_back(*it);
 
     sortVectorContainers();
-    return buildIndexMapping(_activeVertices);
+    bool ok = true;
+    if (! reuseStructure()) {
+      ok = buildIndexMapping(_activeVertices);
+      cacheStructure();
+    }
+    assignBatchEdges();
+    return ok;
   }
 
   bool SparseOptimizer::initializeOptimization(HyperGraph::EdgeSet& eset){
@@ -287,7 +300,122 @@ namespace g2o{
       _activeVertices.push_back(*it);
 
     sortVectorContainers();
-    return buildIndexMapping(_activeVertices);
+    bool ok = true;
+    if (! reuseStructure()) {
+      ok = buildIndexMapping(_activeVertices);
+      cacheStructure();
+    }
+    assignBatchEdges();
+    return ok;
+  }
+
+  bool SparseOptimizer::addBatchEvaluator(BatchEdgeEvaluator* evaluator)
+  {
+    if (find(_batchEvaluators.begin(), _batchEvaluators.end(), evaluator) != _batchEvaluators.end())
+      return false;
+    _batchEvaluators.push_back(evaluator);
+    return true;
+  }
+
+  bool SparseOptimizer::removeBatchEvaluator(BatchEdgeEvaluator* evaluator)
+  {
+    vector<BatchEdgeEvaluator*>::iterator it = find(_batchEvaluators.begin(), _batchEvaluators.end(), evaluator);
+    if (it == _batchEvaluators.end())
+      return false;
+    _batchEvaluators.erase(it);
+    // the edges of the evaluator are computed one by one again
+    assignBatchEdges();
+    return true;
+  }
+
+  void SparseOptimizer::assignBatchEdges()
+  {
+    _unbatchedEdges.clear();
+    if (_batchEvaluators.empty())
+      return;
+    vector<bool> taken(_activeEdges.size(), false);
+    for (size_t i = 0; i < _batchEvaluators.size(); ++i)
+      _batchEvaluators[i]->setActiveEdges(_activeEdges, taken);
+    for (size_t k = 0; k < _activeEdges.size(); ++k) {
+      if (! taken[k])
+        _unbatchedEdges.push_back(_activeEdges[k]);
+    }
+  }
+
+  void SparseOptimizer::linearizeBatchEdges()
+  {
+    for (size_t i = 0; i < _batchEvaluators.size(); ++i)
+      _batchEvaluators[i]->linearize();
+  }
+
+  void SparseOptimizer::setStructureCaching(bool structureCaching)
+  {
+    _structureCaching = structureCaching;
+    if (! _structureCaching)
+      invalidateStructure();
+  }
+
+  bool SparseOptimizer::reuseStructure()
+  {
+    _structureReused = false;
+    if (! _structureCaching || ! _structureCached)
+      return false;
+
+    // the vertices of the last index mapping have to keep their role
+    for (size_t i = 0; i < _cachedIvMap.size(); ++i) {
+      OptimizableGraph::Vertex* v = _cachedIvMap[i];
+      if (v->fixed() || v->marginalized() != _cachedMarginalized[i])
+        return false;
+    }
+    // no new non-fixed vertex and no new edge
+    for (size_t i = 0; i < _activeVertices.size(); ++i) {
+      OptimizableGraph::Vertex* v = _activeVertices[i];
+      if (! v->fixed() && ! binary_search(_cachedVertexSet.begin(), _cachedVertexSet.end(), v))
+        return false;
+    }
+    for (size_t i = 0; i < _activeEdges.size(); ++i) {
+      if (! binary_search(_cachedEdgeSet.begin(), _cachedEdgeSet.end(), _activeEdges[i]))
+        return false;
+    }
+
+    // keep the old active vertices, the memory of the Hessian blocks stays mapped
+    _activeVertices = _cachedActiveVertices;
+    _ivMap = _cachedIvMap;
+    for (size_t i = 0; i < _ivMap.size(); ++i)
+      _ivMap[i]->setHessianIndex(i);
+    _structureReused = true;
+    return true;
+  }
+
+  void SparseOptimizer::cacheStructure()
+  {
+    ++_structureVersion;
+    _structureReused = false;
+    _structureCached = _structureCaching && _ivMap.size() > 0;
+    if (! _structureCached) {
+      _cachedIvMap.clear();
+      _cachedActiveVertices.clear();
+      _cachedMarginalized.clear();
+      _cachedVertexSet.clear();
+      _cachedEdgeSet.clear();
+      return;
+    }
+    _cachedIvMap = _ivMap;
+    _cachedActiveVertices = _activeVertices;
+    _cachedMarginalized.resize(_ivMap.size());
+    for (size_t i = 0; i < _ivMap.size(); ++i)
+      _cachedMarginalized[i] = _ivMap[i]->marginalized();
+    _cachedVertexSet = _ivMap;
+    sort(_cachedVertexSet.begin(), _cachedVertexSet.end());
+    _cachedEdgeSet = _activeEdges;
+    sort(_cachedEdgeSet.begin(), _cachedEdgeSet.end());
+  }
+
+  void SparseOptimizer::invalidateStructure()
+  {
+    _structureCached = false;
+    _structureReused = false;
+    ++_structureVersion;
   }
 
   void SparseOptimizer::setToOrigin(){
@@ -446,6 +574,7 @@ namespace g2o{
 
   bool SparseOptimizer::updateInitialization(HyperGraph::VertexSet& vset, HyperGraph::EdgeSet& eset)
   {
+    invalidateStructure();
     std::vector<HyperGraph::Vertex*> newVertices;
     newVertices.reserve(vset.size());
     _activeVertices.reserve(_activeVertices.size() + vset.size());
@@ -477,6 +606,7 @@ namespace g2o{
 
     //if (newVertices.size() != vset.size())
     //cerr << __PRETTY_FUNCTION__ << ": something went wrong " << PVAR(vset.size()) << " " << PVAR(newVertices.size()) << endl;
+    assignBatchEdges();
     return _algorithm->updateStructure(newVertices, eset);
   }
 
@@ -491,6 +621,8 @@ namespace g2o{
     _ivMap.clear();
     _activeVertices.clear();
     _activeEdges.clear();
+    invalidateStructure();
+    assignBatchEdges();
     OptimizableGraph::clear();
   }
 
@@ -563,6 +695,7 @@ namespace g2o{
   {
     if (_algorithm) // reset the optimizer for the formerly used solver
       _algorithm->setOptimizer(0);
+    invalidateStructure();
     _algorithm = algorithm;
     if (_algorithm)
       _algorithm->setOptimizer(this);
@@ -584,9 +717,17 @@ namespace g2o{
       clearIndexMapping();
       _ivMap.clear();
     }
+    invalidateStructure();
     return HyperGraph::removeVertex(v);
   }
 
+  bool SparseOptimizer::removeEdge(HyperGraph::Edge* e)
+  {
+    // the address of a deleted edge may be reused by a new one
+    invalidateStructure();
+    return HyperGraph::removeEdge(e);
+  }
+
   bool SparseOptimizer::addComputeErrorAction(HyperGraphAction* action)
   {
     std::pair<HyperGraphActionSet::iterator, bool> insertResult = _graphActions[AT_COMPUTEACTIVERROR].insert(action);
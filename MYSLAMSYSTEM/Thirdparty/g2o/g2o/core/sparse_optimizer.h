@@ -41,6 +41,7 @@ namespace g2o {
   class ActivePathCostFunction;
   class OptimizationAlgorithm;
   class EstimatePropagatorCost;
+  class BatchEdgeEvaluator;
 
   class  SparseOptimizer : public OptimizableGraph {
 
@@ -91,6 +92,23 @@ namespace g2o {
      * HACK updating the internal structures for online processing
      */
     virtual bool updateInitialization(HyperGraph::VertexSet& vset, HyperGraph::EdgeSet& eset);
+
+    /**
+     * Keep the block structure of the Hessian across initializeOptimization() calls.
+     * If enabled, a re-initialization whose active edges are a subset of the
+     * ones of the last full initialization, and whose non-fixed vertices are unchanged
+     * (same fixed / marginalized flags), keeps the previous index mapping. The solver
+     * then reuses its block matrices, the Schur pattern and the symbolic factorization.
+     * Vertices that lost all their edges stay in the system with an empty block, hence
+     * this mode requires a damped algorithm (Levenberg-Marquardt).
+     * Typical use: several optimization rounds which only move outlier edges to another level.
+     */
+    void setStructureCaching(bool structureCaching);
+    bool structureCaching() const { return _structureCaching;}
+    //! true, if the last initializeOptimization() reused the previous structure
+    bool structureReused() const { return _structureReused;}
+    //! incremented by each initialization which builds a new index mapping
+    int structureVersion() const { return _structureVersion;}
   
     /**
      * Propagates an initial guess from the vertex specified as origin.
@@ -201,6 +219,7 @@ namespace g2o {
      * graph, you have to store it in your own copy.
      */
     virtual bool removeVertex(HyperGraph::Vertex* v);
+    virtual bool removeEdge(HyperGraph::Edge* e);
 
     /**
      * search for an edge in _activeVertices and return the iterator pointing to it
@@ -278,6 +297,20 @@ namespace g2o {
     
     bool computeBatchStatistics() const { return _computeBatchStatistics;}
 
+    /**
+     * register an evaluator which computes the errors and the Jacobians of a subset of
+     * the active edges in one pass. The evaluator is not owned by the optimizer and
+     * has to stay alive while it is registered.
+     */
+    bool addBatchEvaluator(BatchEdgeEvaluator* evaluator);
+    bool removeBatchEvaluator(BatchEdgeEvaluator* evaluator);
+
+    /**
+     * computes the errors and the Jacobians of the edges handled by the batch evaluators.
+     * Called by the solver before it linearizes the active edges.
+     */
+    void linearizeBatchEdges();
+
     /**** callbacks ****/
     //! add an action to be executed before the error vectors are computed
     bool addComputeErrorAction(HyperGraphAction* action);
@@ -295,6 +328,12 @@ namespace g2o {
     EdgeContainer _activeEdges;        ///< sorted according to EdgeIDCompare
 
     void sortVectorContainers();
+
+    //! hands the active edges to the batch evaluators and collects the remaining ones
+    void assignBatchEdges();
+
+    std::vector<BatchEdgeEvaluator*> _batchEvaluators;
+    EdgeContainer _unbatchedEdges;     ///< active edges not handled by a batch evaluator
  
     OptimizationAlgorithm* _algorithm;
 
@@ -304,6 +343,24 @@ namespace g2o {
     bool buildIndexMapping(SparseOptimizer::VertexContainer& vlist);
     void clearIndexMapping();
 
+    /**
+     * restores the index mapping of the last full initialization, if the current
+     * active edges / vertices fit into it (see setStructureCaching())
+     */
+    bool reuseStructure();
+    void cacheStructure();
+    void invalidateStructure();
+
+    bool _structureCaching;
+    bool _structureReused;
+    bool _structureCached;
+    int _structureVersion;
+    VertexContainer _cachedIvMap;
+    VertexContainer _cachedActiveVertices;
+    std::vector<bool> _cachedMarginalized;
+    VertexContainer _cachedVertexSet;       ///< _cachedIvMap sorted by address
+    EdgeContainer _cachedEdgeSet;        ///< active edges sorted by address
+
     BatchStatisticsContainer _batchStatistics;   ///< global statistics of the optimizer, e.g., timing, num-non-zeros
     bool _computeBatchStatistics;
   };
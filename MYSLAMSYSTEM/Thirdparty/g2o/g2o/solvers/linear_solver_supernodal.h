@@ -0,0 +1,521 @@
+// g2o - General Graph Optimization
+// Copyright (C) 2011 R. Kuemmerle, G. Grisetti, W. Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef G2O_LINEAR_SOLVER_SUPERNODAL_H
+#define G2O_LINEAR_SOLVER_SUPERNODAL_H
+
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+#include <Eigen/Sparse>
+#include <Eigen/OrderingMethods>
+
+#include "../core/linear_solver.h"
+#include "../core/batch_stats.h"
+#include "../stuff/timeutil.h"
+
+#include "../core/eigen_types.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+namespace g2o {
+
+/**
+ * \brief supernodal sparse Cholesky solver, depends only on Eigen
+ *
+ * The blocks of the system are ordered by AMD, then the symbolic factorization is
+ * computed on the block structure. Consecutive columns of the factor with the same
+ * sparsity pattern are grouped into supernodes, which are stored as dense panels.
+ * The numeric factorization is right-looking: each supernode is factorized with a
+ * dense LLT and its update to the ancestors is a dense rank update scattered through
+ * precomputed relative indices. The ordering, the supernodes, the scatter indices and
+ * the positions of the blocks of A in the factor are computed once and re-used as
+ * long as the pattern of A does not change, which is the case for all the iterations
+ * of one optimization.
+ * Compared to LinearSolverEigen (SimplicialLDLT) this pays off for large systems with
+ * dense fronts, i.e., global BA and pose graphs with many loop edges.
+ */
+template <typename MatrixType>
+class LinearSolverSupernodal: public LinearSolver<MatrixType>
+{
+  public:
+    LinearSolverSupernodal() :
+      LinearSolver<MatrixType>(),
+      _init(true), _writeDebug(false), _size(0), _numBlockCols(0), _numUpperBlocks(0)
+    {
+    }
+
+    virtual ~LinearSolverSupernodal()
+    {
+    }
+
+    virtual bool init()
+    {
+      _init = true;
+      return true;
+    }
+
+    bool solve(const SparseBlockMatrix<MatrixType>& A, double* x, double* b)
+    {
+      if (_init || ! samePattern(A))
+        computeSymbolicDecomposition(A);
+      _init = false;
+
+      double t=get_monotonic_time();
+      if (! computeNumericDecomposition(A)) { // the matrix is not positive definite
+        if (_writeDebug) {
+          std::cerr << "Cholesky failure, writing debug.txt (Hessian loadable by Octave)" << std::endl;
+          A.writeOctave("debug.txt");
+        }
+        return false;
+      }
+
+      solveFactorized(x, b);
+      G2OBatchStatistics* globalStats = G2OBatchStatistics::globalStats();
+      if (globalStats) {
+        globalStats->timeNumericDecomposition = get_monotonic_time() - t;
+        globalStats->choleskyNNZ = _values.size();
+      }
+
+      return true;
+    }
+
+    //! write a debug dump of the system matrix if it is not SPD in solve
+    virtual bool writeDebug() const { return _writeDebug;}
+    virtual void setWriteDebug(bool b) { _writeDebug = b;}
+
+    //! number of supernodes of the current factorization
+    int numSupernodes() const { return _supernodes.size();}
+
+  protected:
+    typedef Eigen::Map<MatrixXD, 0, Eigen::OuterStride<> > StridedMap;
+
+    struct Supernode {
+      int firstCol;       ///< first column in the permuted matrix
+      int numCols;
+      int numRows;        ///< rows of the panel, including the diagonal block
+      size_t valueOffset; ///< start of the column major panel in _values
+      int rowOffset;      ///< start of the rows below the diagonal block in _rows
+      int updateOffset;   ///< start of the supernodes updated by this one in _updates
+      int numUpdates;
+    };
+
+    /**
+     * the below-diagonal rows [rowBegin, rowEnd) of a supernode are columns of the target supernode.
+     * _relIndices[relOffset + k] is the row in the target panel of the row rowBegin+k of the source.
+     */
+    struct Update {
+      int target;
+      int rowBegin;
+      int rowEnd;
+      size_t relOffset;
+    };
+
+    //! position of a block of A (upper triangle) in the factor
+    struct BlockTarget {
+      size_t offset;
+      int ld;
+      bool transposed;
+    };
+
+    bool _init;
+    bool _writeDebug;
+
+    int _size;
+    int _numBlockCols;
+    size_t _numUpperBlocks;
+    //! block pattern of the upper triangle of A the symbolic decomposition was computed for
+    std::vector<int> _patternBlockIndices;
+    std::vector<size_t> _patternColPtr;
+    std::vector<int> _patternRows;
+    std::vector<int> _scalarPerm; ///< column of A for each column of the permuted matrix
+    std::vector<Supernode> _supernodes;
+    std::vector<int> _rows;
+    std::vector<Update> _updates;
+    std::vector<int> _relIndices;
+    std::vector<BlockTarget> _blockTargets;
+    std::vector<double> _values;
+
+    VectorXD _workspace;
+    VectorXD _y;
+    VectorXD _tmp;
+
+    /**
+     * true if A has exactly the block sizes and the upper triangle block pattern
+     * recorded by the last symbolic decomposition
+     */
+    bool samePattern(const SparseBlockMatrix<MatrixType>& A) const
+    {
+      if (A.rows() != _size || static_cast<int>(A.blockCols().size()) != _numBlockCols)
+        return false;
+      if (A.rowBlockIndices() != _patternBlockIndices)
+        return false;
+      size_t k = 0;
+      for (size_t c = 0; c < A.blockCols().size(); ++c) {
+        if (_patternColPtr[c] != k)
+          return false;
+        const typename SparseBlockMatrix<MatrixType>::IntBlockMap& column = A.blockCols()[c];
+        for (typename SparseBlockMatrix<MatrixType>::IntBlockMap::const_iterator it = column.begin(); it != column.end(); ++it) {
+          if (it->first > static_cast<int>(c))
+            break;
+          if (k == _patternRows.size() || _patternRows[k] != it->first)
+            return false;
+          ++k;
+        }
+      }
+      return k == _patternRows.size();
+    }
+
+    /**
+     * ordering, supernodes and scatter indices, computed once per pattern of A
+     */
+    void computeSymbolicDecomposition(const SparseBlockMatrix<MatrixType>& A)
+    {
+      double t=get_monotonic_time();
+      const int nb = A.blockCols().size();
+      _size = A.rows();
+      _numBlockCols = nb;
+      assert(A.rows() == A.cols() && "Matrix A is not square");
+
+      // AMD ordering on the block structure
+      std::vector<int> blockPerm(nb); // old block for each new block
+      {
+        typedef Eigen::SparseMatrix<double, Eigen::ColMajor> SparseMatrix;
+        std::vector<Eigen::Triplet<double> > triplets;
+        for (int c = 0; c < nb; ++c){
+          const typename SparseBlockMatrix<MatrixType>::IntBlockMap& column = A.blockCols()[c];
+          for (typename SparseBlockMatrix<MatrixType>::IntBlockMap::const_iterator it = column.begin(); it != column.end(); ++it) {
+            if (it->first > c) // only upper triangle
+              break;
+            triplets.push_back(Eigen::Triplet<double>(it->first, c, 0.));
+          }
+        }
+        SparseMatrix auxBlockMatrix(nb, nb);
+        auxBlockMatrix.setFromTriplets(triplets.begin(), triplets.end());
+        SparseMatrix C;
+        C = auxBlockMatrix.selfadjointView<Eigen::Upper>();
+        Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> P;
+        Eigen::internal::minimum_degree_ordering(C, P);
+        for (int i = 0; i < nb; ++i)
+          blockPerm[i] = P.indices()(i);
+      }
+      std::vector<int> blockPos(nb);
+      std::vector<int> blockDim(nb);
+      std::vector<int> blockBase(nb + 1, 0); // first column of each block in the permuted matrix
+      for (int i = 0; i < nb; ++i) {
+        blockPos[blockPerm[i]] = i;
+        blockDim[i] = A.colsOfBlock(blockPerm[i]);
+        blockBase[i + 1] = blockBase[i] + blockDim[i];
+      }
+      _scalarPerm.resize(_size);
+      for (int i = 0; i < nb; ++i)
+        for (int k = 0; k < blockDim[i]; ++k)
+          _scalarPerm[blockBase[i] + k] = A.colBaseOfBlock(blockPerm[i]) + k;
+
+      // lower triangle of the permuted block pattern, and the pattern of A for samePattern()
+      std::vector<std::vector<int> > adjacency(nb);
+      _numUpperBlocks = 0;
+      _patternBlockIndices = A.rowBlockIndices();
+      _patternColPtr.resize(nb);
+      _patternRows.clear();
+      for (int c = 0; c < nb; ++c){
+        _patternColPtr[c] = _patternRows.size();
+        const typename SparseBlockMatrix<MatrixType>::IntBlockMap& column = A.blockCols()[c];
+        for (typename SparseBlockMatrix<MatrixType>::IntBlockMap::const_iterator it = column.begin(); it != column.end(); ++it) {
+          if (it->first > c)
+            break;
+          ++_numUpperBlocks;
+          _patternRows.push_back(it->first);
+          int pr = blockPos[it->first];
+          int pc = blockPos[c];
+          if (pr != pc)
+            adjacency[std::min(pr, pc)].push_back(std::max(pr, pc));
+        }
+      }
+
+      // symbolic factorization on the blocks: the pattern of column j of L is the pattern of A
+      // joined with the patterns of its children in the elimination tree
+      std::vector<std::vector<int> > structure(nb);
+      std::vector<std::vector<int> > children(nb);
+      std::vector<int> parent(nb, -1);
+      std::vector<int> mark(nb, -1);
+      for (int j = 0; j < nb; ++j) {
+        std::vector<int>& rows = structure[j];
+        for (size_t k = 0; k < adjacency[j].size(); ++k) {
+          int i = adjacency[j][k];
+          if (mark[i] != j) {
+            mark[i] = j;
+            rows.push_back(i);
+          }
+        }
+        for (size_t c = 0; c < children[j].size(); ++c) {
+          const std::vector<int>& childRows = structure[children[j][c]];
+          for (size_t k = 0; k < childRows.size(); ++k) {
+            int i = childRows[k];
+            if (i != j && mark[i] != j) {
+              mark[i] = j;
+              rows.push_back(i);
+            }
+          }
+        }
+        std::sort(rows.begin(), rows.end());
+        if (! rows.empty()) {
+          parent[j] = rows[0];
+          children[rows[0]].push_back(j);
+        }
+      }
+
+      // fundamental supernodes: column j joins the supernode of j-1 if it is the only child of j-1
+      // and the patterns are the same apart from j itself
+      std::vector<int> blockSupernode(nb);
+      std::vector<int> supernodeFirstBlock;
+      for (int j = 0; j < nb; ++j) {
+        bool merge = j > 0 && parent[j - 1] == j && children[j].size() == 1 &&
+          structure[j - 1].size() == structure[j].size() + 1;
+        if (! merge)
+          supernodeFirstBlock.push_back(j);
+        blockSupernode[j] = supernodeFirstBlock.size() - 1;
+      }
+      const int ns = supernodeFirstBlock.size();
+      supernodeFirstBlock.push_back(nb);
+
+      // layout of the panels
+      _supernodes.resize(ns);
+      _rows.clear();
+      std::vector<int> belowBlockBegin(ns + 1, 0); // row blocks below the diagonal of each supernode
+      std::vector<int> belowBlocks;
+      std::vector<int> belowBlockRow;              // first row of these blocks in the panel
+      size_t numValues = 0;
+      for (int s = 0; s < ns; ++s) {
+        Supernode& sn = _supernodes[s];
+        const int lastBlock = supernodeFirstBlock[s + 1] - 1;
+        sn.firstCol = blockBase[supernodeFirstBlock[s]];
+        sn.numCols = blockBase[lastBlock + 1] - sn.firstCol;
+        sn.rowOffset = _rows.size();
+        belowBlockBegin[s] = belowBlocks.size();
+        int row = sn.numCols;
+        const std::vector<int>& rows = structure[lastBlock];
+        for (size_t k = 0; k < rows.size(); ++k) {
+          belowBlocks.push_back(rows[k]);
+          belowBlockRow.push_back(row);
+          for (int d = 0; d < blockDim[rows[k]]; ++d)
+            _rows.push_back(blockBase[rows[k]] + d);
+          row += blockDim[rows[k]];
+        }
+        sn.numRows = row;
+        sn.valueOffset = numValues;
+        numValues += static_cast<size_t>(sn.numRows) * sn.numCols;
+      }
+      belowBlockBegin[ns] = belowBlocks.size();
+      _values.resize(numValues);
+
+      // updates to the ancestors and their relative row indices
+      _updates.clear();
+      _relIndices.clear();
+      std::vector<int> rowMap(_size, -1);
+      size_t maxBelow = 0;
+      for (int s = 0; s < ns; ++s) {
+        Supernode& sn = _supernodes[s];
+        const int numBelow = sn.numRows - sn.numCols;
+        maxBelow = std::max(maxBelow, static_cast<size_t>(numBelow));
+        sn.updateOffset = _updates.size();
+        int k = 0;
+        while (k < numBelow) {
+          const int target = blockSupernode[scalarBlock(blockBase, _rows[sn.rowOffset + k])];
+          const Supernode& tn = _supernodes[target];
+          Update u;
+          u.target = target;
+          u.rowBegin = k;
+          while (k < numBelow && _rows[sn.rowOffset + k] < tn.firstCol + tn.numCols)
+            ++k;
+          u.rowEnd = k;
+          u.relOffset = _relIndices.size();
+          // rows of the target panel
+          for (int r = 0; r < tn.numCols; ++r)
+            rowMap[tn.firstCol + r] = r;
+          for (int r = tn.numCols; r < tn.numRows; ++r)
+            rowMap[_rows[tn.rowOffset + r - tn.numCols]] = r;
+          for (int r = u.rowBegin; r < numBelow; ++r) {
+            assert(rowMap[_rows[sn.rowOffset + r]] >= 0 && "pattern of the factor is not closed");
+            _relIndices.push_back(rowMap[_rows[sn.rowOffset + r]]);
+          }
+          for (int r = 0; r < tn.numCols; ++r)
+            rowMap[tn.firstCol + r] = -1;
+          for (int r = tn.numCols; r < tn.numRows; ++r)
+            rowMap[_rows[tn.rowOffset + r - tn.numCols]] = -1;
+          _updates.push_back(u);
+        }
+        sn.numUpdates = _updates.size() - sn.updateOffset;
+      }
+      _workspace.resize(maxBelow * maxBelow);
+
+      // where the blocks of A go in the panels
+      _blockTargets.clear();
+      _blockTargets.reserve(_numUpperBlocks);
+      for (int c = 0; c < nb; ++c){
+        const typename SparseBlockMatrix<MatrixType>::IntBlockMap& column = A.blockCols()[c];
+        for (typename SparseBlockMatrix<MatrixType>::IntBlockMap::const_iterator it = column.begin(); it != column.end(); ++it) {
+          if (it->first > c)
+            break;
+          const int pr = blockPos[it->first];
+          const int pc = blockPos[c];
+          // the block goes to the lower triangle, transposed if it is above the diagonal after the ordering
+          const int row = std::max(pr, pc);
+          const int col = std::min(pr, pc);
+          const int s = blockSupernode[col];
+          const Supernode& sn = _supernodes[s];
+          int localRow;
+          if (blockSupernode[row] == s) {
+            localRow = blockBase[row] - sn.firstCol;
+          } else {
+            std::vector<int>::const_iterator b = std::lower_bound(belowBlocks.begin() + belowBlockBegin[s], belowBlocks.begin() + belowBlockBegin[s + 1], row);
+            assert(b != belowBlocks.begin() + belowBlockBegin[s + 1] && *b == row);
+            localRow = belowBlockRow[b - belowBlocks.begin()];
+          }
+          BlockTarget bt;
+          bt.ld = sn.numRows;
+          bt.offset = sn.valueOffset + localRow + static_cast<size_t>(blockBase[col] - sn.firstCol) * sn.numRows;
+          bt.transposed = pr < pc;
+          _blockTargets.push_back(bt);
+        }
+      }
+
+      G2OBatchStatistics* globalStats = G2OBatchStatistics::globalStats();
+      if (globalStats)
+        globalStats->timeSymbolicDecomposition = get_monotonic_time() - t;
+    }
+
+    //! block of the permuted matrix containing the column
+    static int scalarBlock(const std::vector<int>& blockBase, int col)
+    {
+      return std::upper_bound(blockBase.begin(), blockBase.end(), col) - blockBase.begin() - 1;
+    }
+
+    bool computeNumericDecomposition(const SparseBlockMatrix<MatrixType>& A)
+    {
+      std::fill(_values.begin(), _values.end(), 0.);
+
+      // scatter A into the panels
+      size_t k = 0;
+      for (size_t c = 0; c < A.blockCols().size(); ++c){
+        const typename SparseBlockMatrix<MatrixType>::IntBlockMap& column = A.blockCols()[c];
+        for (typename SparseBlockMatrix<MatrixType>::IntBlockMap::const_iterator it = column.begin(); it != column.end(); ++it) {
+          if (it->first > static_cast<int>(c))
+            break;
+          const MatrixType& m = *(it->second);
+          const BlockTarget& bt = _blockTargets[k++];
+          if (bt.transposed) {
+            StridedMap dst(&_values[bt.offset], m.cols(), m.rows(), Eigen::OuterStride<>(bt.ld));
+            dst += m.transpose();
+          } else {
+            StridedMap dst(&_values[bt.offset], m.rows(), m.cols(), Eigen::OuterStride<>(bt.ld));
+            dst += m;
+          }
+        }
+      }
+
+      for (size_t s = 0; s < _supernodes.size(); ++s) {
+        const Supernode& sn = _supernodes[s];
+        const int numBelow = sn.numRows - sn.numCols;
+        Eigen::Map<MatrixXD> panel(&_values[sn.valueOffset], sn.numRows, sn.numCols);
+
+        Eigen::Ref<MatrixXD> diagonal = panel.topRows(sn.numCols);
+        Eigen::LLT<Eigen::Ref<MatrixXD>, Eigen::Lower> llt(diagonal);
+        if (llt.info() != Eigen::Success)
+          return false;
+        if (numBelow == 0)
+          continue;
+
+        // L21 = A21 * L11^-T
+        Eigen::Ref<MatrixXD> below = panel.bottomRows(numBelow);
+        diagonal.triangularView<Eigen::Lower>().transpose().solveInPlace<Eigen::OnTheRight>(below);
+
+        // update of the ancestors: L21 * L21^T, only the lower triangle
+        Eigen::Map<MatrixXD> update(_workspace.data(), numBelow, numBelow);
+        update.triangularView<Eigen::Lower>().setZero();
+        update.selfadjointView<Eigen::Lower>().rankUpdate(below);
+        for (int u = sn.updateOffset; u < sn.updateOffset + sn.numUpdates; ++u) {
+          const Update& up = _updates[u];
+          const Supernode& tn = _supernodes[up.target];
+          double* target = &_values[tn.valueOffset];
+          const int* rel = &_relIndices[up.relOffset];
+          for (int j = up.rowBegin; j < up.rowEnd; ++j) {
+            double* targetCol = target + static_cast<size_t>(rel[j - up.rowBegin]) * tn.numRows;
+            const double* updateCol = &update(0, j);
+            for (int i = j; i < numBelow; ++i)
+              targetCol[rel[i - up.rowBegin]] -= updateCol[i];
+          }
+        }
+      }
+      return true;
+    }
+
+    void solveFactorized(double* x, const double* b)
+    {
+      _y.resize(_size);
+      for (int i = 0; i < _size; ++i)
+        _y[i] = b[_scalarPerm[i]];
+
+      // L y = P b
+      for (size_t s = 0; s < _supernodes.size(); ++s) {
+        const Supernode& sn = _supernodes[s];
+        const int numBelow = sn.numRows - sn.numCols;
+        Eigen::Map<const MatrixXD> panel(&_values[sn.valueOffset], sn.numRows, sn.numCols);
+        typename VectorXD::SegmentReturnType ys = _y.segment(sn.firstCol, sn.numCols);
+        panel.topRows(sn.numCols).template triangularView<Eigen::Lower>().solveInPlace(ys);
+        if (numBelow == 0)
+          continue;
+        _tmp.noalias() = panel.bottomRows(numBelow) * ys;
+        const int* rows = &_rows[sn.rowOffset];
+        for (int k = 0; k < numBelow; ++k)
+          _y[rows[k]] -= _tmp[k];
+      }
+
+      // L^T z = y
+      for (int s = static_cast<int>(_supernodes.size()) - 1; s >= 0; --s) {
+        const Supernode& sn = _supernodes[s];
+        const int numBelow = sn.numRows - sn.numCols;
+        Eigen::Map<const MatrixXD> panel(&_values[sn.valueOffset], sn.numRows, sn.numCols);
+        typename VectorXD::SegmentReturnType ys = _y.segment(sn.firstCol, sn.numCols);
+        if (numBelow > 0) {
+          _tmp.resize(numBelow);
+          const int* rows = &_rows[sn.rowOffset];
+          for (int k = 0; k < numBelow; ++k)
+            _tmp[k] = _y[rows[k]];
+          ys.noalias() -= panel.bottomRows(numBelow).transpose() * _tmp;
+        }
+        panel.topRows(sn.numCols).transpose().template triangularView<Eigen::Upper>().solveInPlace(ys);
+      }
+
+      for (int i = 0; i < _size; ++i)
+        x[_scalarPerm[i]] = _y[i];
+    }
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,73 @@
+// g2o - General Graph Optimization
+// Copyright (C) 2011 R. Kuemmerle, G. Grisetti, W. Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef G2O_STUFF_PARALLEL_H
+#define G2O_STUFF_PARALLEL_H
+
+#include <thread>
+#include <vector>
+
+/** @addtogroup utils **/
+// @{
+
+/** \file parallel.h
+ * \brief run a function on several threads
+ **/
+
+namespace g2o {
+
+/**
+ * call f(0), ..., f(numThreads-1) in parallel and wait until all of them returned.
+ * f(0) runs on the calling thread.
+ */
+template <typename F>
+void parallelInvoke(int numThreads, F f)
+{
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads > 1 ? numThreads - 1 : 0);
+  for (int i = 1; i < numThreads; ++i)
+    threads.push_back(std::thread(f, i));
+  f(0);
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+}
+
+/**
+ * number of threads for processing n items when each thread should get at least minItemsPerThread
+ */
+inline int numThreadsForItems(int maxThreads, int n, int minItemsPerThread)
+{
+  int numThreads = n / minItemsPerThread;
+  if (numThreads > maxThreads)
+    numThreads = maxThreads;
+  return numThreads > 1 ? numThreads : 1;
+}
+
+} // end namespace
+
+// @}
+
+#endif
@@ -0,0 +1,257 @@
+// g2o - General Graph Optimization
+// Copyright (C) 2011 R. Kuemmerle, G. Grisetti, W. Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Checks LinearSolverSupernodal against a dense LLT and LinearSolverEigen on
+// random SPD block systems, including systems whose block pattern changes
+// between solves while the number of blocks stays the same.
+
+#include "../g2o/solvers/linear_solver_supernodal.h"
+#include "../g2o/solvers/linear_solver_eigen.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <utility>
+
+using namespace g2o;
+
+typedef SparseBlockMatrix<MatrixXD> SparseBlockMatrixX;
+typedef std::set<std::pair<int, int> > BlockPattern; // (row, col) with row < col
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* what)
+{
+  if (! condition) {
+    std::printf("FAILED: %s\n", what);
+    ++failures;
+  }
+}
+
+double uniform()
+{
+  return std::rand() / static_cast<double>(RAND_MAX) * 2. - 1.;
+}
+
+std::vector<int> randomBlockSizes(int numBlocks, int minSize, int maxSize)
+{
+  std::vector<int> sizes(numBlocks);
+  for (int i = 0; i < numBlocks; ++i)
+    sizes[i] = minSize + std::rand() % (maxSize - minSize + 1);
+  return sizes;
+}
+
+BlockPattern randomPattern(int numBlocks, int numOffDiagonal)
+{
+  BlockPattern pattern;
+  while (static_cast<int>(pattern.size()) < numOffDiagonal) {
+    int r = std::rand() % numBlocks;
+    int c = std::rand() % numBlocks;
+    if (r == c)
+      continue;
+    pattern.insert(std::make_pair(std::min(r, c), std::max(r, c)));
+  }
+  return pattern;
+}
+
+/**
+ * upper triangle of a random SPD matrix with the given block sizes and off-diagonal blocks,
+ * made diagonally dominant
+ */
+SparseBlockMatrixX* randomSystem(const std::vector<int>& sizes, const BlockPattern& pattern, MatrixXD& dense)
+{
+  const int nb = sizes.size();
+  std::vector<int> blockIndices(nb);
+  int n = 0;
+  for (int i = 0; i < nb; ++i) {
+    n += sizes[i];
+    blockIndices[i] = n;
+  }
+  SparseBlockMatrixX* A = new SparseBlockMatrixX(&blockIndices[0], &blockIndices[0], nb, nb);
+
+  dense = MatrixXD::Zero(n, n);
+  for (BlockPattern::const_iterator it = pattern.begin(); it != pattern.end(); ++it) {
+    MatrixXD* b = A->block(it->first, it->second, true);
+    for (int i = 0; i < b->rows(); ++i)
+      for (int j = 0; j < b->cols(); ++j)
+        (*b)(i, j) = uniform();
+    dense.block(A->rowBaseOfBlock(it->first), A->colBaseOfBlock(it->second), b->rows(), b->cols()) = *b;
+    dense.block(A->colBaseOfBlock(it->second), A->rowBaseOfBlock(it->first), b->cols(), b->rows()) = b->transpose();
+  }
+  for (int i = 0; i < nb; ++i) {
+    MatrixXD* b = A->block(i, i, true);
+    const int base = A->rowBaseOfBlock(i);
+    MatrixXD m(sizes[i], sizes[i]);
+    for (int r = 0; r < m.rows(); ++r)
+      for (int c = 0; c < m.cols(); ++c)
+        m(r, c) = uniform();
+    m = (m + m.transpose()).eval();
+    for (int r = 0; r < m.rows(); ++r)
+      m(r, r) += dense.row(base + r).cwiseAbs().sum() + 2. * sizes[i];
+    *b = m;
+    dense.block(base, base, sizes[i], sizes[i]) = m;
+  }
+  return A;
+}
+
+double relativeError(const VectorXD& x, const VectorXD& reference)
+{
+  return (x - reference).norm() / reference.norm();
+}
+
+void solveAndCompare(LinearSolverSupernodal<MatrixXD>& solver, const SparseBlockMatrixX& A, const MatrixXD& dense, const char* what)
+{
+  const int n = dense.rows();
+  VectorXD b(n);
+  for (int i = 0; i < n; ++i)
+    b[i] = uniform();
+  const VectorXD reference = dense.llt().solve(b);
+
+  VectorXD x = VectorXD::Zero(n);
+  VectorXD rhs = b;
+  const bool ok = solver.solve(A, x.data(), rhs.data());
+  check(ok, what);
+  if (ok && relativeError(x, reference) > 1e-10) {
+    std::printf("  relative error %g\n", relativeError(x, reference));
+    check(false, what);
+  }
+}
+
+void testRandomSystems()
+{
+  const int numBlocks[] = {1, 2, 10, 50, 200};
+  for (int t = 0; t < 5; ++t) {
+    const int nb = numBlocks[t];
+    const std::vector<int> sizes = randomBlockSizes(nb, 6, 7);
+    MatrixXD dense;
+    SparseBlockMatrixX* A = randomSystem(sizes, randomPattern(nb, nb * (nb - 1) / 2 < 3 * nb ? nb * (nb - 1) / 2 : 3 * nb), dense);
+    LinearSolverSupernodal<MatrixXD> solver;
+    solver.init();
+    solveAndCompare(solver, *A, dense, "random system matches dense LLT");
+    delete A;
+  }
+}
+
+void testAgainstLinearSolverEigen()
+{
+  const int nb = 300;
+  const std::vector<int> sizes = randomBlockSizes(nb, 6, 7);
+  MatrixXD dense;
+  SparseBlockMatrixX* A = randomSystem(sizes, randomPattern(nb, 4 * nb), dense);
+  const int n = dense.rows();
+  VectorXD b(n);
+  for (int i = 0; i < n; ++i)
+    b[i] = uniform();
+
+  LinearSolverSupernodal<MatrixXD> supernodal;
+  LinearSolverEigen<MatrixXD> eigen;
+  supernodal.init();
+  eigen.init();
+  VectorXD x1 = VectorXD::Zero(n), x2 = VectorXD::Zero(n);
+  VectorXD b1 = b, b2 = b;
+  check(supernodal.solve(*A, x1.data(), b1.data()), "supernodal solve");
+  check(eigen.solve(*A, x2.data(), b2.data()), "eigen solve");
+  check(relativeError(x1, x2) < 1e-10, "supernodal matches LinearSolverEigen");
+  delete A;
+}
+
+// same pattern, new values: the symbolic decomposition is re-used
+void testNewValuesSamePattern()
+{
+  const int nb = 40;
+  const std::vector<int> sizes = randomBlockSizes(nb, 6, 7);
+  const BlockPattern pattern = randomPattern(nb, 3 * nb);
+  LinearSolverSupernodal<MatrixXD> solver;
+  solver.init();
+  for (int i = 0; i < 3; ++i) {
+    MatrixXD dense;
+    SparseBlockMatrixX* A = randomSystem(sizes, pattern, dense);
+    solveAndCompare(solver, *A, dense, "same pattern, new values");
+    delete A;
+  }
+}
+
+// the off-diagonal blocks move but their number, the number of block columns and the size do not
+void testPatternChangeSameCounts()
+{
+  const int nb = 30;
+  const std::vector<int> sizes = randomBlockSizes(nb, 6, 6);
+  LinearSolverSupernodal<MatrixXD> solver;
+  solver.init();
+  for (int i = 0; i < 5; ++i) {
+    MatrixXD dense;
+    SparseBlockMatrixX* A = randomSystem(sizes, randomPattern(nb, 2 * nb), dense);
+    solveAndCompare(solver, *A, dense, "pattern changed with the same block counts");
+    delete A;
+  }
+
+  // same blocks, different block sizes: 6+7 instead of 7+6 keeps the dimension
+  std::vector<int> sizes1(nb, 6), sizes2(nb, 6);
+  sizes1[0] = 7; sizes1[1] = 6;
+  sizes2[0] = 6; sizes2[1] = 7;
+  const BlockPattern pattern = randomPattern(nb, 2 * nb);
+  MatrixXD dense1, dense2;
+  SparseBlockMatrixX* A1 = randomSystem(sizes1, pattern, dense1);
+  SparseBlockMatrixX* A2 = randomSystem(sizes2, pattern, dense2);
+  solveAndCompare(solver, *A1, dense1, "block sizes changed, first system");
+  solveAndCompare(solver, *A2, dense2, "block sizes changed, second system");
+  delete A1;
+  delete A2;
+}
+
+void testNotPositiveDefinite()
+{
+  const std::vector<int> sizes(3, 6);
+  MatrixXD dense;
+  SparseBlockMatrixX* A = randomSystem(sizes, randomPattern(3, 2), dense);
+  *A->block(1, 1) = -MatrixXD::Identity(6, 6);
+  LinearSolverSupernodal<MatrixXD> solver;
+  solver.init();
+  VectorXD x = VectorXD::Zero(18), b = VectorXD::Ones(18);
+  check(! solver.solve(*A, x.data(), b.data()), "indefinite system is rejected");
+  delete A;
+}
+
+} // namespace
+
+int main()
+{
+  std::srand(42);
+  testRandomSystems();
+  testAgainstLinearSolverEigen();
+  testNewValuesSamePattern();
+  testPatternChangeSameCounts();
+  testNotPositiveDefinite();
+
+  if (failures) {
+    std::printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  std::printf("all checks passed\n");
+  return 0;
+}
@@ -36,6 +36,11 @@ public:
 
     static g2o::SE3Quat toSE3Quat(const cv::Mat &cvT);
     static g2o::SE3Quat toSE3Quat(const g2o::Sim3 &gSim3);
+    static g2o::SE3Quat toSE3Quat(const cv::Matx44f &T);
+
+    // 定长矩阵,不分配堆内存
+    static cv::Matx44f toMatx44f(const cv::Mat &T);
+    static cv::Matx44f toMatx44f(const g2o::SE3Quat &SE3);
 
     static cv::Mat toCvMat(const g2o::SE3Quat &SE3);
     static cv::Mat toCvMat(const g2o::Sim3 &Sim3);
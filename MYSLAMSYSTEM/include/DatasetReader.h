@@ -0,0 +1,106 @@
+//
+// 数据集读取: 解析KITTI/TUM/自定义关联文件,并用多个线程提前解码图像
+//
+#ifndef ORB_SLAM3_DATASETREADER_H
+#define ORB_SLAM3_DATASETREADER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM3
+{
+
+// 一帧数据. 对于TUM RGB-D, imLeft为彩色图, imRight为空
+struct DatasetFrame
+{
+    int id = -1;
+    double timestamp = 0;
+    cv::Mat imLeft, imRight, imDepth;
+
+    bool empty() const { return imLeft.empty(); }
+};
+
+class DatasetReader
+{
+public:
+    enum eFormat{
+        KITTI=0,                    // image_0/ image_1/ times.txt
+        TUM_RGBD=1,                 // "t rgb t depth"
+        ASSOCIATION_STEREO=2,       // "left right t"         (my_slam)
+        ASSOCIATION_STEREO_RGBD=3   // "t left right t depth" (slam_demo)
+    };
+
+    /**
+     * @param[in] strSequencePath   图像路径相对的序列根目录
+     * @param[in] strListFile       关联文件. KITTI为空时使用strSequencePath/times.txt
+     * @param[in] format            文件格式
+     * @param[in] nThreads          解码线程数
+     * @param[in] nBufferSize       环形缓冲区大小,即最多提前解码的帧数
+     * @param[in] strCacheDir       非空时,解码后的原始像素缓存到该目录,之后通过mmap读取,跳过PNG解码.
+     *                              缓存文件名包含序列路径和格式的哈希,文件头记录源图像路径,读取时校验,
+     *                              同一个缓存目录可以给多个序列使用
+     */
+    DatasetReader(const std::string &strSequencePath, const std::string &strListFile, const eFormat format,
+                  const int nThreads = 2, const int nBufferSize = 8, const std::string &strCacheDir = std::string());
+    ~DatasetReader();
+
+    // 帧数
+    int Size() const;
+    double GetTimestamp(const int i) const;
+
+    // 按顺序取出下一帧,必要时等待解码完成. 读完所有帧后返回false
+    // 图像读取失败时返回true,但frame.empty()为真
+    bool Next(DatasetFrame &frame);
+
+    // 停止并回收解码线程
+    void Stop();
+
+protected:
+
+    struct Entry
+    {
+        double timestamp;
+        std::string strLeft, strRight, strDepth;
+    };
+
+    struct Slot
+    {
+        DatasetFrame frame;
+        bool bReady = false;
+    };
+
+    bool LoadList(const std::string &strListFile);
+    void Run();
+    void Decode(const int id, DatasetFrame &frame);
+
+    bool ReadCache(const int id, DatasetFrame &frame);
+    void WriteCache(const int id, const DatasetFrame &frame);
+    std::string CacheFile(const int id) const;
+    // 缓存文件头中记录的源图像,用于校验缓存是否对应这一帧
+    std::string CacheKey(const int id) const;
+
+    std::string mstrSequencePath;
+    std::string mstrCacheDir;
+    eFormat mFormat;
+    std::vector<Entry> mvEntries;
+
+    // 环形缓冲区, 第id帧存放在mvSlots[id % mvSlots.size()]
+    std::vector<Slot> mvSlots;
+    int mnNextDecode;
+    int mnNextConsume;
+    bool mbStop;
+    std::mutex mMutex;
+    std::condition_variable mcvDecoded;
+    std::condition_variable mcvConsumed;
+
+    std::vector<std::thread> mvThreads;
+};
+
+} // namespace ORB_SLAM3
+
+#endif // ORB_SLAM3_DATASETREADER_H
@@ -0,0 +1,81 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ESSENTIALGRAPH_H
+#define ESSENTIALGRAPH_H
+
+#include <vector>
+#include <unordered_map>
+
+namespace ORB_SLAM3
+{
+
+class KeyFrame;
+class Map;
+
+/**
+ * @brief 本质图的连接关系,在多次闭环矫正之间保留
+ *
+ * 每个关键帧缓存它在本质图中的邻居: 父关键帧、闭环边,以及共视权重不小于minFeat的关键帧
+ * (去掉父关键帧、子关键帧和闭环边). 关键帧的共视关系、生成树或闭环边改变时 KeyFrame::GetConnectionsVersion
+ * 会变化, Update 只重新读取这些关键帧(多线程),其余关键帧直接沿用上一次的结果.
+ * 邻居是否已删除、id先后等依赖其他关键帧状态的条件仍由使用者在建图时判断
+ */
+class EssentialGraph
+{
+public:
+    struct Node
+    {
+        unsigned long nId;
+        unsigned long nVersion;
+        bool bValid;
+        KeyFrame *pParent;
+        std::vector<KeyFrame *> vpLoopEdges;
+        std::vector<KeyFrame *> vpCovisibles;
+    };
+
+    explicit EssentialGraph(const int minFeat = 100);
+
+    // 清空缓存,并绑定到地图pMap
+    void Reset(Map *pMap);
+    Map *GetMap() const { return mpMap; }
+
+    // 与地图中的关键帧vpKFs同步: 丢弃不在其中的关键帧,重新读取连接关系变化过的关键帧
+    void Update(const std::vector<KeyFrame *> &vpKFs);
+
+    // 最近一次 Update 之后pKF的邻居,pKF不在其中时返回NULL
+    const Node *GetNode(KeyFrame *pKF) const;
+
+    int GetMinFeat() const { return mnMinFeat; }
+
+    // 最近一次 Update 重新读取的关键帧数
+    int GetNumRefreshed() const { return mnRefreshed; }
+
+protected:
+    // 读取pKF当前的连接关系
+    void Refresh(KeyFrame *pKF, Node &node) const;
+
+    Map *mpMap;
+    int mnMinFeat;
+    std::unordered_map<KeyFrame *, Node> mmNodes;
+    int mnRefreshed;
+};
+
+} // namespace ORB_SLAM3
+
+#endif // ESSENTIALGRAPH_H
@@ -52,6 +52,12 @@ class ORBextractor;
 class PythonClient;
 class Object;
 
+// 检测框的紧凑表示(已包含2个像素的外扩),按帧存储为连续数组
+struct DetectBox
+{
+    float left, top, right, bottom;
+};
+
 class Frame
 {
 public:
@@ -93,6 +99,14 @@ public:
     void SetPose(cv::Mat Tcw);
     void GetPose(cv::Mat &Tcw);
 
+    // 定长矩阵版本,用于跟踪的热点路径. mTcw等cv::Mat成员仍然同步更新
+    void SetPose_(const cv::Matx44f &Tcw);
+    inline cv::Matx44f GetPose_(){
+        return mTcwx;
+    }
+    // Twc
+    cv::Matx44f GetPoseInverse_();
+
     // Set IMU velocity
     void SetVelocity(const cv::Mat &Vwb);
 
@@ -122,6 +136,11 @@ public:
     // Check if a MapPoint is in the frustum of the camera
     // and fill variables of the MapPoint to be used by the tracking
     bool isInFrustum(MapPoint* pMP, float viewingCosLimit);
+    // 同上,地图点的世界坐标Px由调用者提供(局部地图点批量判断时预先读取,避免再次加锁)
+    bool isInFrustum(MapPoint* pMP, const cv::Matx31f &Px, float viewingCosLimit);
+
+    // 包围球(世界坐标)是否可能与当前帧的视锥相交. 只剔除完全在视锥外的球,非针孔相机总是返回true
+    bool IsSphereInFrustum(const cv::Matx31f &center, const float radius);
 
     bool ProjectPointDistort(MapPoint* pMP, cv::Point2f &kp, float &u, float &v);
 
@@ -157,6 +176,13 @@ public:
     //判断特征点是否在动态物体内
     bool IsInDynamic(const int& i);
     bool IsInStatic(const int& i);
+
+    //设置帧中的object并批量标记特征点,直接修改objects_cur_后需置位mbDetectBoxesDirty
+    void SetObjects(const vector<std::shared_ptr<Object>> &vObjects);
+    //由objects_cur_生成紧凑的检测框表,并填充vbInDynamic_mvKeys/vbInStatic_mvKeys
+    void UpdateDetectBoxes();
+    //一次遍历标记所有特征点是否位于classMask指定类别的检测框内
+    void LabelKeyPointsInBoxes(const std::vector<cv::KeyPoint> &vKeys, const unsigned int classMask, std::vector<bool> &vbInBox) const;
     //****
 
 
@@ -185,7 +211,6 @@ public:
     // Vocabulary used for relocalization.
     Tracking *mTracker;
     ORBVocabulary* mpORBvocabulary;
-    double orbExtractTime;
     double movingDetectTime;
 
     // Feature extractor. The right is used only in the stereo case.
@@ -320,6 +345,12 @@ public:
     map<int, std::pair<int, int>> matches_in_dynamic;
 
     vector<bool> vbInDynamic_mvKeys;            //位于动态物体区域内的特征点(未做动态检验)
+    vector<bool> vbInStatic_mvKeys;             //位于静态物体区域内的特征点
+
+    vector<DetectBox> mvDetectBoxes;            //objects_cur_的检测框,与objects_cur_一一对应
+    vector<unsigned int> mvDetectClassBits;     //每个检测框的类别掩码位
+    unsigned int mnDetectClassMask = 0;           //帧中出现的所有类别的掩码
+    bool mbDetectBoxesDirty = true;              //objects_cur_改变后检测框表需要重新生成
 
     std::vector<cv::KeyPoint> mvKeys_after;
 
@@ -363,8 +394,10 @@ private:
     cv::Mat mtcw;
     //==mtwc
 
+    cv::Matx44f mTcwx;
     cv::Matx31f mOwx;
     cv::Matx33f mRcwx;
+    cv::Matx33f mRwcx;
     cv::Matx31f mtcwx;
 
     cv::Mat mImDepth;
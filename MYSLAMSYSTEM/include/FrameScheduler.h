@@ -0,0 +1,78 @@
+//
+// 输入帧调度: 按时间戳控制输入节奏,跟踪跟不上时按策略丢帧,并统计跟踪延迟
+//
+#ifndef ORB_SLAM3_FRAMESCHEDULER_H
+#define ORB_SLAM3_FRAMESCHEDULER_H
+
+#include <mutex>
+#include <chrono>
+
+namespace ORB_SLAM3
+{
+
+class FrameScheduler
+{
+public:
+    // 丢帧策略
+    enum ePolicy{
+        BLOCK=0,                // 不丢帧,队列满时阻塞提交者(离线处理)
+        LATEST_FRAME_WINS=1,    // 只保留最新的一帧,新帧到来时丢弃所有未处理的旧帧
+        BOUNDED_LATENCY=2       // 丢弃等待时间超过mMaxLatency的帧,队列满时丢弃最旧的帧
+    };
+    // 丢帧只发生在构造Frame之前,已经预处理的帧一定会被跟踪
+
+    struct Stats
+    {
+        int nSubmitted = 0;
+        int nDropped = 0;
+        int nTracked = 0;
+        double lastLatency = 0;     // 最近一帧从提交到得到位姿的时间(s)
+        double meanLatency = 0;
+        double maxLatency = 0;
+        double streamLag = 0;       // 最新提交帧与最新跟踪帧的时间戳之差(s)
+    };
+
+    FrameScheduler();
+
+    // 设置丢帧策略, maxLatency只用于BOUNDED_LATENCY
+    void SetPolicy(const ePolicy policy, const double maxLatency = 0.1);
+    ePolicy GetPolicy();
+
+    // 按时间戳控制节奏: rate为回放速度(1为实时), rate<=0 表示不控制
+    void SetPacing(const double rate);
+
+    // 提交前调用,必要时休眠直到该帧按时间戳应当到达的时刻. 返回提交时刻
+    double Pace(const double timestamp);
+
+    // 等待时间是否超过上限(只对BOUNDED_LATENCY有效)
+    bool IsStale(const double submitTime);
+
+    void RecordSubmitted(const double timestamp);
+    void RecordDropped();
+    void RecordTracked(const double timestamp, const double submitTime);
+
+    Stats GetStats();
+    void Reset();
+
+    // 单调时钟,单位秒
+    static double Now();
+
+protected:
+    std::mutex mMutex;
+
+    ePolicy mPolicy;
+    double mMaxLatency;
+
+    double mRate;
+    bool mbPaceStarted;
+    double mFirstTimestamp;
+    double mFirstWallTime;
+
+    Stats mStats;
+    double mSumLatency;
+    double mLastSubmittedStamp;
+};
+
+} // namespace ORB_SLAM3
+
+#endif // ORB_SLAM3_FRAMESCHEDULER_H
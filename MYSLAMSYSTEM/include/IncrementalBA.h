@@ -0,0 +1,230 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCREMENTALBA_H
+#define INCREMENTALBA_H
+
+#include <map>
+#include <vector>
+#include <unordered_map>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+#include "Thirdparty/g2o/g2o/types/se3quat.h"
+
+namespace ORB_SLAM3
+{
+
+class GeometricCamera;
+class Map;
+
+/**
+ * @brief 增量式的全局BA(iSAM风格),闭环后代替每次从头构建、从头求解的全局BA
+ *
+ * 在多次调用之间保留线性化后的投影因子、消去地图点(Schur补)后的关键帧信息矩阵以及它的Cholesky分解.
+ * 每次调用先与地图同步: 新关键帧按id顺序追加到消元顺序的末尾,新的或变化的观测只改动相关地图点的
+ * Schur补贡献,被删除的关键帧、地图点和观测减去各自的贡献. 之后做若干次高斯牛顿迭代,每次只重新
+ * 线性化增量超过阈值的变量(和它们关联的因子),Cholesky分解只从第一个被改动的列开始重算.
+ * 关键帧按时间顺序消元,两次闭环之间新增的关键帧都在末尾,需要重算的列数由闭环改动的范围决定.
+ * 增减贡献会累积舍入误差,每隔若干次调用整体重建一次信息矩阵,同时压缩掉已删除的变量.
+ *
+ * 与 Optimizer::GlobalBundleAdjustemnt 相同,不使用鲁棒核,地图的第一个关键帧固定;只使用左目观测
+ */
+class IncrementalBA
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+    typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+    // 相机参数. pCamera 非空时单目观测用它的投影模型(非针孔相机),双目观测按针孔计算
+    struct Calibration
+    {
+        double fx, fy, cx, cy, bf;
+        GeometricCamera *pCamera;
+    };
+
+    // 地图点在一个关键帧中的观测, obs = (u, v, ur), ur<0 表示单目观测
+    struct Observation
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        unsigned long nPoseId;
+        Eigen::Vector3d obs;
+        double invSigma2;
+    };
+    typedef std::vector<Observation, Eigen::aligned_allocator<Observation> > Observations;
+
+    struct Stats
+    {
+        int nPoses, nPoints, nFactors;
+        int nColumns;       // 信息矩阵的列数(不含固定的关键帧)
+        int nRelinPoses;    // 最近一次调用中重新线性化的关键帧和地图点数(含新增)
+        int nRelinPoints;
+        int nRefactored;    // 最近一次调用中重新分解的列数(各次迭代累加)
+        bool bRebuilt;      // 最近一次调用是否整体重建
+    };
+
+    IncrementalBA();
+
+    // 清空所有状态,并绑定到地图pMap
+    void Reset(Map *pMap);
+    Map *GetMap() const { return mpMap; }
+
+    // 与地图同步: BeginSync 之后先对每个关键帧调用 SetPose,再对每个地图点调用 SetPoint,
+    // 最后 EndSync 删除本次没有出现的关键帧和地图点
+    void BeginSync();
+    void SetPose(const unsigned long nId, const g2o::SE3Quat &Tcw, const bool bFixed, const Calibration &calib);
+    void SetPoint(const unsigned long nId, const Eigen::Vector3d &Xw, const Observations &vObs);
+    void EndSync();
+
+    // 最多迭代nIterations次,所有变量的增量都小于重新线性化的阈值时提前结束.
+    // pbStopFlag 置位时在两次迭代之间退出. 返回完成的迭代次数
+    int Optimize(const int nIterations, bool *pbStopFlag = NULL);
+
+    // 当前估计. 变量不存在,或者地图点的观测少于2个没有参与优化时返回false
+    bool GetPose(const unsigned long nId, g2o::SE3Quat &Tcw) const;
+    bool GetPoint(const unsigned long nId, Eigen::Vector3d &Xw) const;
+
+    Stats GetStats() const { return mStats; }
+
+protected:
+    struct Factor
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        int nPose;                      // 在 mvPoses 中的下标
+        Eigen::Vector3d obs;
+        double invSigma2;
+        // 线性化点处的误差和雅克比,单目时第3行为0
+        Eigen::Vector3d e;
+        Eigen::Matrix<double, 3, 6> Jc;
+        Eigen::Matrix3d Jp;
+    };
+    typedef std::vector<Factor, Eigen::aligned_allocator<Factor> > Factors;
+
+    struct Pose
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        unsigned long nId;
+        g2o::SE3Quat lin;           // 线性化点
+        g2o::SE3Quat linMap;        // 地图中的位姿与估计相差太大时,下一次重新线性化的位置
+        Vector6d delta;             // 估计为 exp(delta)*lin
+        Calibration calib;
+        int nCol;                   // 在信息矩阵中的列,固定的关键帧为-1
+        bool bFixed;
+        bool bAlive;
+        bool bSeen;                 // 本次同步中出现过
+        bool bRelin;                // 下一次迭代需要重新线性化
+        bool bMapMoved;
+    };
+
+    struct Point
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        unsigned long nId;
+        Eigen::Vector3d lin;
+        Eigen::Vector3d linMap;
+        Eigen::Vector3d delta;
+        Factors factors;
+        Eigen::Matrix3d HppInv;     // 加入信息矩阵时(阻尼后)Hpp的逆
+        Eigen::Vector3d bp;
+        bool bAlive;
+        bool bSeen;
+        bool bRelin;
+        bool bMapMoved;
+        bool bActive;               // Schur补贡献已经加入信息矩阵
+    };
+
+    // 信息矩阵的一列,只存下三角(行号>=列号)
+    typedef std::map<int, Matrix6d, std::less<int>, Eigen::aligned_allocator<std::pair<const int, Matrix6d> > > BlockColumn;
+
+    // Cholesky因子L的一列: 对角块(下三角)和对角线以下的非零块,按行号升序
+    struct LColumn
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        Matrix6d D;
+        std::vector<int> rows;
+        std::vector<Matrix6d, Eigen::aligned_allocator<Matrix6d> > blocks;
+    };
+
+    // 在pose和point的线性化点处计算因子的误差和雅克比
+    void Linearize(const Pose &pose, const Point &point, Factor &factor) const;
+
+    // 把地图点的Schur补贡献加入(sign=1)或移出(sign=-1)信息矩阵
+    void AccumulatePoint(Point &point, const double sign);
+
+    // 块(r,c)累加到信息矩阵的下三角
+    void AddBlock(const int r, const int c, const Matrix6d &B);
+
+    // 新增一列
+    int AddColumn(const int nPose);
+
+    // 删除关键帧: 移除关联的因子,清空它的列
+    void RemovePose(const int idx);
+
+    // 重新线性化标记过的变量,以及观测了被重新线性化的关键帧的地图点
+    void Relinearize();
+
+    // 从第 mnFirstDirty 列开始重新分解
+    void Factorize();
+
+    // 求解位姿增量,再回代地图点增量. 返回是否还有变量的增量超过阈值
+    bool Solve();
+
+    // 压缩已删除的变量,从线性化的因子重新构建信息矩阵并整体分解
+    void Rebuild();
+
+    Map *mpMap;
+
+    std::vector<Pose, Eigen::aligned_allocator<Pose> > mvPoses;
+    std::vector<Point, Eigen::aligned_allocator<Point> > mvPoints;
+    std::unordered_map<unsigned long, int> mmPoseIdx;
+    std::unordered_map<unsigned long, int> mmPointIdx;
+    int mnAlivePoints;
+
+    // 消去地图点后的关键帧信息矩阵 H*dx = b,按列(关键帧加入的顺序)存放
+    std::vector<int> mvColPose;
+    std::vector<BlockColumn> mvH;
+    std::vector<Vector6d, Eigen::aligned_allocator<Vector6d> > mvB;
+    int mnDeadCols;
+
+    // Cholesky分解 H = L*L^T,以及前代的结果 L*y = b
+    std::vector<LColumn, Eigen::aligned_allocator<LColumn> > mvL;
+    std::vector<std::vector<int> > mvLRowCols;     // L的第r行中非零块所在的列(<r),升序
+    std::vector<Vector6d, Eigen::aligned_allocator<Vector6d> > mvY;
+    std::vector<Vector6d, Eigen::aligned_allocator<Vector6d> > mvDx;
+
+    // 信息矩阵和b中第一个被改动的列,分解和前代从这里开始
+    int mnFirstDirty;
+
+    int mnCalls;
+    Stats mStats;
+
+    // 分解时的工作区
+    std::vector<Matrix6d, Eigen::aligned_allocator<Matrix6d> > mvWork;
+    std::vector<char> mvbWork;
+    std::vector<int> mvWorkRows;
+
+    // AccumulatePoint 的工作区: 每个因子的 Hcp 块和 Hcp*Hpp^-1
+    std::vector<Eigen::Matrix<double, 6, 3>, Eigen::aligned_allocator<Eigen::Matrix<double, 6, 3> > > mvW, mvWH;
+};
+
+} // namespace ORB_SLAM3
+
+#endif // INCREMENTALBA_H
@@ -118,6 +118,9 @@ public:
     void AddMergeEdge(KeyFrame* pKF);
     set<KeyFrame*> GetMergeEdges();
 
+    // 共视关系、生成树或闭环边每次改变时加1,用于判断缓存的本质图连接关系是否过期
+    unsigned long GetConnectionsVersion();
+
     // MapPoint observation functions
     int GetNumberMPs();
     void AddMapPoint(MapPoint* pMP, const size_t &idx);
@@ -193,6 +196,9 @@ public:
     // Variables used by the tracking
     long unsigned int mnTrackReferenceForFrame;
     long unsigned int mnFuseTargetForKF;
+    // UpdateLocalKeyFrames中的共视投票,mnTrackVotesEpoch不是当前投票轮次时mnTrackVotes视为0
+    long unsigned int mnTrackVotesEpoch;
+    int mnTrackVotes;
 
     // Variables used by the local mapping
     long unsigned int mnBALocalForKF;
@@ -202,25 +208,14 @@ public:
     long unsigned int mnNumberOfOpt;
 
     // Variables used by the keyframe database
-    long unsigned int mnLoopQuery;
-    int mnLoopWords;
-    float mLoopScore;
-    long unsigned int mnRelocQuery;
-    int mnRelocWords;
-    float mRelocScore;
-    long unsigned int mnMergeQuery;
-    int mnMergeWords;
-    float mMergeScore;
-    long unsigned int mnPlaceRecognitionQuery; //标记该关键帧被当前关键帧访问到（也就是有公共单词），防止重复添加
-    int mnPlaceRecognitionWords;
-    float mPlaceRecognitionScore; //记录该候选帧与当前帧的相似度
-
+    // 检索时的公共单词数和得分保存在 KeyFrameDatabase 每次查询自己的上下文中
     bool mbCurrentPlaceRecognition;
 
 
     // Variables used by loop closing
     cv::Mat mTcwGBA;
     cv::Mat mTcwBefGBA;
+    cv::Mat mTcwIniGBA;     // 全局BA开始优化时的位姿
     cv::Mat mVwbGBA;
     cv::Mat mVwbBefGBA;
     IMU::Bias mBiasGBA;
@@ -371,6 +366,7 @@ protected:
     std::set<KeyFrame*> mspChildrens;
     std::set<KeyFrame*> mspLoopEdges;
     std::set<KeyFrame*> mspMergeEdges;
+    unsigned long mnConnectionsVersion;
 
     // Bad flags
     bool mbNotErase;
@@ -23,6 +23,7 @@
 #include <vector>
 #include <list>
 #include <set>
+#include <unordered_map>
 
 #include "KeyFrame.h"
 #include "Frame.h"
@@ -34,6 +35,7 @@
 #include <boost/serialization/list.hpp>
 
 #include<mutex>
+#include<shared_mutex>
 
 
 namespace ORB_SLAM3
@@ -73,14 +75,70 @@ public:
 
 protected:
 
+  // 倒排表中的一项: 关键帧的槽位和该单词在关键帧BoW向量中的权重
+  struct InvertedEntry
+  {
+      int nSlot;
+      float weight;
+  };
+
+  // 一次查询用的稠密累加器,按槽位索引. 每次查询独占一个,用完放回池中,所以多个线程可以同时查询
+  struct QueryContext
+  {
+      unsigned long nIndexVersion;             // 与 mnIndexVersion 不同时槽位编号已经变了,全部作废
+      unsigned long nStamp;                    // 槽位的vnSlotStamp不等于nStamp时其余两项无效
+      std::vector<unsigned long> vnSlotStamp;
+      std::vector<int> vnSlotWords;            // 公共单词数
+      std::vector<float> vSlotScores;          // BoW得分
+      std::vector<int> vnTouchedSlots;         // 本次查询访问到的槽位
+  };
+
+  // 加读锁/写锁. 写者先取得mMutexWriter再等读者退出,这期间新的读者也要等,连续不断的查询不会让写者一直等下去
+  std::shared_lock<std::shared_timed_mutex> LockRead();
+  std::unique_lock<std::shared_timed_mutex> LockWrite();
+
+  // 以下两个函数在持有写锁时调用
+  // 把pKF的槽位标记为墓碑,倒排表中的对应项留到 Compact 时再清除
+  void EraseSlot(KeyFrame* pKF);
+  // 清除倒排表中的墓碑,并重新连续编号槽位
+  void Compact();
+
+  // 以下函数在持有读锁时调用
+  // 从池中取出一个查询上下文,并开始一次新的查询
+  QueryContext* AcquireContext();
+  void ReleaseContext(QueryContext* pContext);
+  // 遍历bowVec各单词的倒排表,在累加器中统计每个关键帧与bowVec的公共单词数和L1得分
+  void AccumulateScores(const DBoW2::BowVector &bowVec, QueryContext &context) const;
+  // 在 AccumulateScores 之后调用: 对公共单词数超过阈值(最大公共单词数的0.8倍,且不少于nMinWords)的关键帧打分,
+  // 得分不小于minScore的关键帧与它的10个最佳共视关键帧组成一组,返回每组的累计得分和组内得分最高的关键帧,以及最高的组得分
+  float ScoreAndGroup(const DBoW2::BowVector &bowVec, const int nMinWords, const float minScore, QueryContext &context,
+                      std::vector<pair<float,KeyFrame*> > &vAccScoreAndMatch) const;
+
   // Associated vocabulary
   const ORBVocabulary* mpVoc;
+  // 词典使用L1得分时直接用累加器中的值,否则逐个调用mpVoc->score
+  bool mbL1Score;
 
   // Inverted file
-  std::vector<list<KeyFrame*> > mvInvertedFile;
+  // 每个单词一个连续数组,记录包含该单词的关键帧槽位和权重
+  std::vector<std::vector<InvertedEntry> > mvInvertedFile;
+
+  // 槽位对应的关键帧, NULL表示已删除(墓碑)
+  std::vector<KeyFrame*> mvpSlotKFs;
+  std::unordered_map<KeyFrame*, int> mmKFSlots;
+  int mnDeadSlots;
+  // 槽位重新编号(Compact, clear)的次数
+  unsigned long mnIndexVersion;
+
+  // 查询上下文池, list保证取出的指针一直有效
+  std::list<QueryContext> mlQueryContexts;
+  std::vector<QueryContext*> mvpFreeContexts;
+  std::mutex mMutexContexts;
 
   // Mutex
-  std::mutex mMutex;
+  // 倒排表的读写锁: 查询加读锁, add/erase/clear加写锁
+  std::shared_timed_mutex mMutex;
+  std::mutex mMutexWriter;
 };
 
 } //namespace ORB_SLAM
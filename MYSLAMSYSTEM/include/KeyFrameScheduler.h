@@ -0,0 +1,78 @@
+//
+// 关键帧插入调度: 根据LocalMapping的负载(队列长度、每个关键帧的建图耗时、LBA耗时和被打断的比例)
+// 自适应调整关键帧插入阈值,避免快速运动时关键帧涌入导致局部建图跟不上、LBA反复被打断
+//
+#ifndef ORB_SLAM3_KEYFRAMESCHEDULER_H
+#define ORB_SLAM3_KEYFRAMESCHEDULER_H
+
+#include <mutex>
+
+namespace ORB_SLAM3
+{
+
+class KeyFrameScheduler
+{
+public:
+    // 需要插入关键帧但LocalMapping不空闲时的处理方式
+    enum eDecision{
+        INSERT=0,               // 直接插入
+        INTERRUPT_AND_INSERT=1, // 中断LBA,关键帧进入LocalMapping队列
+        INTERRUPT=2,            // 中断LBA,本帧不插入,等LocalMapping空闲
+        DEFER=3                 // 既不插入也不打断LBA,局部建图负载过高
+    };
+
+    struct Stats
+    {
+        int nRequested = 0;         // 跟踪线程认为需要插入关键帧的次数
+        int nInserted = 0;          // 实际插入的次数
+        int nCritical = 0;          // 其中因跟踪变弱(或IMU时间条件)必须插入的次数
+        int nInterrupts = 0;        // 中断LBA的次数
+        int nDeferred = 0;          // 因负载过高推迟的次数
+        int nLBA = 0;               // LocalMapping执行LBA的次数
+        int nLBAAborted = 0;        // 其中被打断的次数
+        int queueDepth = 0;         // 最近一次决策时LocalMapping队列中的关键帧数
+        int maxQueueDepth = 0;
+        double meanMappingTime = 0; // 每个关键帧的局部建图耗时(s),指数平均
+        double meanLBATime = 0;     // LBA耗时(s),指数平均
+        double meanKFInterval = 0;  // 相邻两次插入的时间间隔(s),指数平均
+        double load = 0;            // 局部建图负载: 建图耗时/插入间隔, >1表示跟不上
+        double abortRate = 0;       // 最近LBA被打断的比例,指数平均
+        float refRatioScale = 1.f;  // 当前对thRefRatio的缩放
+        int minFrames = 0;          // 当前的最小插入间隔(帧)
+    };
+
+    KeyFrameScheduler();
+
+    // 相机帧率,作为跟踪线程的时间预算
+    void SetFrameRate(const float fps);
+
+    // LocalMapping每处理完一个关键帧调用一次. tMapping为该关键帧的总耗时, tLBA为LBA耗时(s)
+    void RecordMapping(const double tMapping, const bool bLBA, const double tLBA, const bool bAborted);
+
+    // 按负载调整参考关键帧跟踪比例阈值,负载越高阈值越低,关键帧越稀疏
+    float AdaptRefRatio(const float thRefRatio);
+
+    // 按负载调整两个关键帧之间的最小帧数,保证插入间隔不短于LocalMapping处理一个关键帧的时间
+    int AdaptMinFrames(const int minFrames, const int maxFrames);
+
+    // 跟踪线程需要插入关键帧时调用
+    // bCritical: 跟踪变弱或IMU时间条件触发,不能推迟; bQueueAllowed: 非单目时关键帧可以在队列中等待
+    eDecision Decide(const bool bLocalMappingIdle, const int nQueued, const bool bCritical, const bool bQueueAllowed);
+
+    Stats GetStats();
+    void Reset();
+
+protected:
+    void RecordInserted();
+
+    std::mutex mMutex;
+
+    double mFramePeriod;
+    double mLastInsertTime;
+    int mnMapped;
+    Stats mStats;
+};
+
+} // namespace ORB_SLAM3
+
+#endif // ORB_SLAM3_KEYFRAMESCHEDULER_H
@@ -27,7 +27,9 @@
 #include "KeyFrameDatabase.h"
 #include "Initializer.h"
 #include "PointCloudMapping.h"
+#include "SPSCQueue.h"
 #include <mutex>
+#include <condition_variable>
 
 
 namespace ORB_SLAM3
@@ -64,6 +66,8 @@ public:
     bool Stop();
     void Release();
     bool isStopped();
+    // 阻塞直到局部建图线程真正停下(或已经结束)
+    void WaitUntilStopped();
     bool stopRequested();
     bool AcceptKeyFrames();
     void SetAcceptKeyFrames(bool flag);
@@ -73,10 +77,15 @@ public:
 
     void RequestFinish();
     bool isFinished();
+    // 阻塞直到局部建图线程退出Run
+    void WaitUntilFinished();
 
     int KeyframesInQueue(){
-        unique_lock<std::mutex> lock(mMutexNewKFs);
-        return mlNewKeyFrames.size();
+        return mqNewKeyFrames.Size();
+    }
+    // 关键帧队列的长度、最大长度和阻塞次数
+    SPSCQueue<KeyFrame*>::Stats GetKeyFrameQueueStats(){
+        return mqNewKeyFrames.GetStats();
     }
 
     bool IsInitializing();
@@ -130,7 +139,7 @@ public:
 protected:
 
     bool CheckNewKeyFrames();
-    void ProcessNewKeyFrame();
+    bool ProcessNewKeyFrame();
     void CreateNewMapPoints();
 
     void MapPointCulling();
@@ -153,12 +162,16 @@ protected:
     bool mbResetRequestedActiveMap;
     Map* mpMapToReset;
     std::mutex mMutexReset;
+    // 复位完成时通知 RequestReset/RequestResetActiveMap
+    std::condition_variable mcvReset;
 
     bool CheckFinish();
     void SetFinish();
     bool mbFinishRequested;
     bool mbFinished;
     std::mutex mMutexFinish;
+    // SetFinish 时通知 WaitUntilFinished
+    std::condition_variable mcvFinished;
 
     Atlas* mpAtlas;
 
@@ -166,20 +179,27 @@ protected:
     Tracking* mpTracker;
     PointCloudMapping* mpPointCloudMapping;
 
-    std::list<KeyFrame*> mlNewKeyFrames, mlNewKeyFrameForDenseMap;
+    // Tracking -> LocalMapping 的关键帧队列(Tracking线程生产,本线程消费)
+    SPSCQueue<KeyFrame*> mqNewKeyFrames;
 
     KeyFrame* mpCurrentKeyFrame;
 
     std::list<MapPoint*> mlpRecentAddedMapPoints;
 
-    std::mutex mMutexNewKFs;
-
     bool mbAbortBA;
 
     bool mbStopped;
     bool mbStopRequested;
     bool mbNotStop;
     std::mutex mMutexStop;
+    std::condition_variable mcvStopped;
+
+    // 唤醒主循环: 新关键帧、停止/释放、复位和结束请求都会唤醒,空闲时线程阻塞等待
+    void WakeUp();
+    void WaitForWakeUp();
+    bool mbWakeUp;
+    std::mutex mMutexWakeUp;
+    std::condition_variable mcvWakeUp;
 
     bool mbAcceptKeyFrames;
     std::mutex mMutexAccept;
@@ -29,10 +29,15 @@
 #include "PointCloudMapping.h"
 
 #include "KeyFrameDatabase.h"
+#include "SPSCQueue.h"
+#include "IncrementalBA.h"
+#include "EssentialGraph.h"
 
 #include <boost/algorithm/string.hpp>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
 namespace ORB_SLAM3
@@ -69,12 +74,28 @@ public:
 
     void InsertKeyFrame(KeyFrame *pKF);
 
+    // 关键帧队列的长度、最大长度和阻塞次数
+    SPSCQueue<KeyFrame*>::Stats GetKeyFrameQueueStats(){
+        return mqLoopKeyFrameQueue.GetStats();
+    }
+
     void RequestReset();
     void RequestResetActiveMap(Map* pMap);
 
     // This function will run in a separate thread
     void RunGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoopKF);
 
+    // 纯视觉地图闭环后使用增量式的全局BA,默认关闭
+    void SetIncrementalBA(const bool bEnable){
+        unique_lock<std::mutex> lock(mMutexGBA);
+        mbIncrementalBA = bEnable;
+    }
+
+    // 每次BoW检索后做几何验证的候选关键帧数(回环、融合各自),默认3
+    void SetNumBoWCandidates(const int nCandidates){
+        mnNumBoWCandidates = nCandidates > 0 ? nCandidates : 1;
+    }
+
     bool isRunningGBA(){
         unique_lock<std::mutex> lock(mMutexGBA);
         return mbRunningGBA;
@@ -83,10 +104,14 @@ public:
         unique_lock<std::mutex> lock(mMutexGBA);
         return mbFinishedGBA;
     }   
+    // 阻塞直到正在运行的全局BA结束
+    void WaitUntilGBAFinished();
 
     void RequestFinish();
 
     bool isFinished();
+    // 阻塞直到回环检测线程退出Run
+    void WaitUntilFinished();
 
     Viewer* mpViewer;
 
@@ -125,6 +150,21 @@ protected:
                                      int &nNumCoincidences, std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs);
     bool DetectCommonRegionsFromLastKF(KeyFrame* pCurrentKF, KeyFrame* pMatchedKF, g2o::Sim3 &gScw, int &nNumProjMatches,
                                             std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs);
+
+    // 一个BoW候选关键帧的几何验证结果
+    struct BoWCandidateResult
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        KeyFrame* pMatchedKF;                   // 候选帧窗口内与当前关键帧匹配的关键帧
+        int nNumProjOptMatches;                 // 优化后投影得到的匹配数, 0表示没有通过验证
+        int nNumCoincidences;                   // 通过验证的当前关键帧共视关键帧数
+        g2o::Sim3 g2oScw;
+        std::vector<MapPoint*> vpMPs;
+        std::vector<MapPoint*> vpMatchedMPs;
+    };
+    // 对一个候选关键帧做几何验证,可在多个线程中同时调用. bStop置位后尽快放弃并返回false
+    bool VerifyBoWCandidate(KeyFrame* pKFi, const set<KeyFrame*> &spConnectedKeyFrames, BoWCandidateResult &result,
+                            const std::atomic<bool> &bStop);
     int FindMatchesByProjection(KeyFrame* pCurrentKF, KeyFrame* pMatchedKFw, g2o::Sim3 &g2oScw,
                                 set<MapPoint*> &spMatchedMPinOrigin, vector<MapPoint*> &vpMapPoints,
                                 vector<MapPoint*> &vpMatchedMapPoints);
@@ -138,17 +178,28 @@ protected:
     void MergeLocal();
     void MergeLocal2();
 
+    // 打断正在运行的全局BA并等待其线程退出,返回是否有全局BA被打断
+    bool PreemptGlobalBundleAdjustment();
+    // 把被打断的全局BA已经优化的结果叠加到矫正后的地图上,作为下一次全局BA的初值
+    void WarmStartGlobalBundleAdjustment(Map* pMap);
+    // 用全局BA的结果(mTcwGBA, mPosGBA)更新地图,没有参与优化的关键帧和地图点沿生成树传播
+    void UpdateMapWithGBA(Map* pActiveMap, unsigned long nLoopKF);
+
     void ResetIfRequested();
     bool mbResetRequested;
     bool mbResetActiveMapRequested;
     Map* mpMapToReset;
     std::mutex mMutexReset;
+    // 复位完成时通知 RequestReset/RequestResetActiveMap
+    std::condition_variable mcvReset;
 
     bool CheckFinish();
     void SetFinish();
     bool mbFinishRequested;
     bool mbFinished;
     std::mutex mMutexFinish;
+    // SetFinish 时通知 WaitUntilFinished
+    std::condition_variable mcvFinished;
 
     Atlas* mpAtlas;
     Tracking* mpTracker;
@@ -160,9 +211,15 @@ protected:
 
     LocalMapping *mpLocalMapper;
 
-    std::list<KeyFrame*> mlpLoopKeyFrameQueue;
+    // LocalMapping -> LoopClosing 的关键帧队列(LocalMapping线程生产,本线程消费)
+    SPSCQueue<KeyFrame*> mqLoopKeyFrameQueue;
 
-    std::mutex mMutexLoopQueue;
+    // 唤醒主循环: 新关键帧、复位和结束请求都会唤醒,空闲时线程阻塞等待
+    void WakeUp();
+    void WaitForWakeUp();
+    bool mbWakeUp;
+    std::mutex mMutexWakeUp;
+    std::condition_variable mcvWakeUp;
 
     // Loop detector parameters
     float mnCovisibilityConsistencyTh;
@@ -182,6 +239,9 @@ protected:
     //-------
     Map* mpLastMap;
 
+    // 每次BoW检索后做几何验证的候选关键帧数. System 在闭环线程启动之后才设置,所以用原子变量
+    std::atomic<int> mnNumBoWCandidates;
+
     bool mbLoopDetected;
     int mnLoopNumCoincidences;
     int mnLoopNumNotFound;
@@ -213,9 +273,24 @@ protected:
     bool mbFinishedGBA;
     bool mbStopGBA;
     std::mutex mMutexGBA;
+    // 全局BA结束(mbRunningGBA置为false)时通知 WaitUntilGBAFinished
+    std::condition_variable mcvGBA;
     std::thread* mpThreadGBA;
     std::thread* mpThreadDML;
 
+    // 被打断的全局BA留下的结果: 对应的闭环关键帧id和已经完成的迭代次数
+    bool mbResumeGBA;
+    unsigned long mnResumeGBAKF;
+    int mnGBAItsDone;
+
+    // 增量式的全局BA,状态只在全局BA线程中访问. 复位请求只置标志,由下一次全局BA清空
+    IncrementalBA mIncrementalBA;
+    bool mbIncrementalBA;
+    bool mbResetIncrementalBA;
+
+    // 闭环矫正时本质图的连接关系,只在闭环线程中访问
+    EssentialGraph mEssentialGraph;
+
     // Fix scale in the stereo/RGB-D case
     bool mbFixScale;
 
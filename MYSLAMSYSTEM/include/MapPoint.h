@@ -26,6 +26,8 @@
 
 #include<opencv2/core/core.hpp>
 #include<mutex>
+#include<memory>
+#include<vector>
 
 #include <boost/serialization/serialization.hpp>
 #include <boost/serialization/array.hpp>
@@ -42,6 +44,17 @@ class MapPoint
 {
 
 public:
+    // 一个关键帧对该地图点的观测,左右目索引为-1表示该目没有观测到
+    struct Observation
+    {
+        KeyFrame* pKF;
+        long unsigned int nKFId;
+        int leftIndex;
+        int rightIndex;
+    };
+    // 观测快照,按关键帧id排序. 快照本身不会再被修改,增删观测时整体替换(写时复制)
+    typedef std::shared_ptr<const std::vector<Observation> > ObservationSnapshot;
+
     MapPoint();
 
     MapPoint(const cv::Mat &Pos, KeyFrame* pRefKF, Map* pMap);
@@ -63,6 +76,17 @@ public:
     std::map<KeyFrame*,std::tuple<int,int>> GetObservations();
     int Observations();
 
+    // 获取当前观测的快照(非空),只复制一个指针. 之后的增删观测不影响已取得的快照
+    ObservationSnapshot GetObservationSnapshot();
+
+    // 遍历所有观测, f(KeyFrame* pKF, int leftIndex, int rightIndex), 不复制观测容器
+    template<class F> void ForEachObservation(F f)
+    {
+        const ObservationSnapshot obs = GetObservationSnapshot();
+        for(std::vector<Observation>::const_iterator it=obs->begin(), itend=obs->end(); it!=itend; it++)
+            f(it->pKF, it->leftIndex, it->rightIndex);
+    }
+
     void AddObservation(KeyFrame* pKF,int idx);
     void EraseObservation(KeyFrame* pKF);
 
@@ -151,7 +175,8 @@ protected:
      cv::Matx31f mWorldPosx;
 
      // Keyframes observing the point and associated index in keyframe
-     std::map<KeyFrame*,std::tuple<int,int> > mObservations;
+     // 按关键帧id排序,空指针表示没有观测. 只在mMutexFeatures下替换
+     ObservationSnapshot mpObservations;
 
      // Mean viewing direction
      cv::Mat mNormalVector;
@@ -26,6 +26,11 @@ public:
         car = 1
     };
 
+    //类别对应的掩码位,用于批量判断特征点所在的检测框
+    static inline unsigned int ClassBit(const int nclass){
+        return (nclass >= 0 && nclass < 32) ? (1u << nclass) : 0u;
+    }
+
 public:
     vector<double> vdetect_parameter;//检测框的四个参数
     int ndetect_class;
@@ -28,6 +28,8 @@
 
 
 namespace ORB_SLAM3 {
+class ProjectionBatch;
+
 class  EdgeSE3ProjectXYZOnlyPose: public  g2o::BaseUnaryEdge<2, Eigen::Vector2d, g2o::VertexSE3Expmap>{
 public:
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -112,6 +114,10 @@ public:
     virtual void linearizeOplus();
 
     GeometricCamera* pCamera;
+
+    // 由ProjectionBatch批量计算时指向该批及边在批内的下标,linearizeOplus直接取批量计算的雅克比
+    ProjectionBatch* mpBatch;
+    int mnBatchIdx;
 };
 
 class  EdgeSE3ProjectXYZToBody: public  g2o::BaseBinaryEdge<2, Eigen::Vector2d, g2o::VertexSBAPointXYZ, g2o::VertexSE3Expmap>{
@@ -0,0 +1,56 @@
+//
+// 简单的并行循环: 每次调用临时创建线程,调用线程也参与计算,返回前等待所有线程结束.
+// 各线程从共享的原子计数器领取下一段下标,先做完的线程自动接手剩余的任务
+//
+#ifndef ORB_SLAM3_PARALLELFOR_H
+#define ORB_SLAM3_PARALLELFOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "Thirdparty/g2o/g2o/stuff/parallel.h"
+
+namespace ORB_SLAM3
+{
+
+// 线程数不超过任务数和CPU核数
+inline int ParallelNumThreads(const int nTasks)
+{
+    return std::max(1, std::min(nTasks, static_cast<int>(std::thread::hardware_concurrency())));
+}
+
+/**
+ * @brief 用nThreads个线程执行 f(i, t), i = 0 ... n-1, t为线程下标(调用线程为0)
+ * 每个线程每次领取nChunk个下标. f 对不同下标的调用必须互不干扰;
+ * 需要提前结束时由 f 自己检查停止标志并直接返回
+ */
+template <typename F>
+void ParallelFor(const int n, const int nChunk, const int nThreads, const F &f)
+{
+    std::atomic<int> nNext(0);
+    auto worker = [&](const int t) {
+        while (true)
+        {
+            const int i0 = nNext.fetch_add(nChunk);
+            if (i0 >= n)
+                break;
+            const int i1 = std::min(n, i0 + nChunk);
+            for (int i = i0; i < i1; i++)
+                f(i, t);
+        }
+    };
+
+    g2o::parallelInvoke(nThreads, worker);
+}
+
+// 执行 f(0) ... f(n-1), 线程数由任务段数决定
+template <typename F>
+void ParallelFor(const int n, const F &f, const int nChunk = 32)
+{
+    ParallelFor(n, nChunk, ParallelNumThreads((n + nChunk - 1) / nChunk), [&f](const int i, const int) { f(i); });
+}
+
+} // namespace ORB_SLAM3
+
+#endif // ORB_SLAM3_PARALLELFOR_H
@@ -0,0 +1,83 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POSESOLVER_H
+#define POSESOLVER_H
+
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "Thirdparty/g2o/g2o/types/se3quat.h"
+
+namespace ORB_SLAM3
+{
+
+class Frame;
+class GeometricCamera;
+
+/**
+ * @brief 纯位姿优化的专用求解器,用于Tracking线程的 Optimizer::PoseOptimization
+ *
+ * 只有一个6维位姿节点,不需要g2o的图结构、稀疏块矩阵和逐边的虚函数调用。
+ * 观测按SoA存放,每次迭代直接累加6x6法方程,Huber核内联计算,
+ * LM的阻尼策略、外点判别和迭代次数与原来的g2o实现保持一致。
+ * 缓冲区在多次调用间复用,每个线程使用一个实例(见 Optimizer::PoseOptimization)
+ */
+class PoseSolver
+{
+public:
+    PoseSolver();
+
+    // 是否能处理该帧. 双相机(mpCamera2)的情况仍然走g2o
+    static bool IsSupported(const Frame *pFrame);
+
+    // 优化pFrame的位姿,更新 mvbOutlier,返回内点数目
+    int Optimize(Frame *pFrame);
+
+private:
+    // 在位姿Tcw下计算所有参与优化的观测的(鲁棒)chi2之和
+    double ComputeChi2(const g2o::SE3Quat &Tcw, const bool bRobust) const;
+
+    // 累加法方程 H*dx = b
+    void BuildSystem(const g2o::SE3Quat &Tcw, const bool bRobust,
+                     Eigen::Matrix<double, 6, 6> &H, Eigen::Matrix<double, 6, 1> &b) const;
+
+    // LM优化,阻尼和终止策略与 g2o::OptimizationAlgorithmLevenberg 相同
+    void Solve(g2o::SE3Quat &Tcw, const int nIterations, const bool bRobust) const;
+
+    // 单个观测的重投影误差 e = obs - proj(Xc),返回误差维数(单目2,双目3)
+    inline int ComputeError(const Eigen::Matrix3d &Rcw, const Eigen::Vector3d &tcw, const size_t k,
+                            Eigen::Vector3d &Xc, Eigen::Vector3d &e) const;
+
+    // 相机参数
+    GeometricCamera *mpCamera;
+    bool mbPinhole;
+    double fx, fy, cx, cy, mbf;
+
+    // SoA观测
+    std::vector<double> mvXw, mvYw, mvZw;   // 地图点世界坐标
+    std::vector<double> mvU, mvV, mvUr;     // 去畸变像素坐标, mvUr<0 表示单目观测
+    std::vector<double> mvInvSigma2;        // 信息矩阵(对角,各向同性)
+    std::vector<int> mvIdx;                 // 对应的特征点索引
+    std::vector<char> mvbInlier;            // 是否参与本轮优化(相当于g2o中的level 0)
+};
+
+} // namespace ORB_SLAM3
+
+#endif // POSESOLVER_H
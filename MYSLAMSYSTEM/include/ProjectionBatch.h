@@ -0,0 +1,109 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROJECTIONBATCH_H
+#define PROJECTIONBATCH_H
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+#include "Thirdparty/g2o/g2o/core/batch_edge_evaluator.h"
+#include "Thirdparty/g2o/g2o/types/types_six_dof_expmap.h"
+
+namespace ORB_SLAM3
+{
+
+class EdgeSE3ProjectXYZ;
+
+/**
+ * @brief 针孔相机单目投影边的批量计算
+ *
+ * 代替逐边的 computeError / linearizeOplus 虚函数调用: 参与优化的 EdgeSE3ProjectXYZ
+ * 按位姿和相机分组,每组LANES条边,以SoA的形式存放观测和三维点,
+ * 投影、误差和手推的雅克比一次计算一组(Eigen::Array,由编译器生成SIMD指令),
+ * 组内共用的位姿和内参只读一次. 误差直接写回边,雅克比由边的 linearizeOplus 从这里拷贝,
+ * 其余优化流程不变. 鱼眼相机和其他类型的边仍然逐条计算.
+ *
+ * 用法: 在 g2o::SparseOptimizer 之后定义,initializeOptimization 之前用 addBatchEvaluator 注册
+ */
+class ProjectionBatch : public g2o::BatchEdgeEvaluator
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+#ifdef __AVX512F__
+    static const int LANES = 8;
+#else
+    static const int LANES = 4;
+#endif
+    typedef Eigen::Array<double, LANES, 1> Lane;
+
+    ProjectionBatch();
+    ~ProjectionBatch();
+
+    // g2o::BatchEdgeEvaluator
+    void setActiveEdges(const std::vector<g2o::OptimizableGraph::Edge *> &activeEdges, std::vector<bool> &taken);
+    void computeErrors();
+    void linearize();
+
+    // 第idx条边在最近一次 linearize 时的雅克比
+    Eigen::Matrix<double, 2, 6> PoseJacobian(const int idx) const;
+    Eigen::Matrix<double, 2, 3> PointJacobian(const int idx) const;
+
+    // 批量计算的边数
+    size_t Size() const { return mnEdges; }
+
+protected:
+    // 同一位姿、同一相机的LANES条边,雅克比按行优先存放
+    struct Block
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        Lane u, v;              // 观测
+        Lane Jpose[12];         // 2x6,误差关于位姿的雅克比
+        Lane Jpoint[6];         // 2x3,误差关于三维点的雅克比
+        double fx, fy, cx, cy;
+        int nPose;              // 在 mvpPoses 中的下标
+    };
+
+    // 解除边与本对象的关联
+    void Release();
+
+    // 读取位姿的当前估计
+    void UpdatePoses();
+
+    // 计算所有组的误差 obs - project(Tcw*Pw) 和(可选)雅克比,误差写回边
+    void Evaluate(const bool bJacobians);
+
+    std::vector<EdgeSE3ProjectXYZ *> mvpEdges;
+
+    // 按批内下标(组号*LANES+组内序号),组末尾的空位为nullptr
+    std::vector<double *> mvpErrors;
+    std::vector<const double *> mvpPoints;  // 三维点节点的估计值
+    size_t mnEdges;
+
+    std::vector<g2o::VertexSE3Expmap *> mvpPoses;
+    std::vector<Eigen::Matrix<double, 3, 4>, Eigen::aligned_allocator<Eigen::Matrix<double, 3, 4> > > mvPoseData;
+
+    std::vector<Block, Eigen::aligned_allocator<Block> > mvBlocks;
+};
+
+} // namespace ORB_SLAM3
+
+#endif // PROJECTIONBATCH_H
@@ -0,0 +1,191 @@
+//
+// 有界的单生产者/单消费者无锁队列,用于线程之间传递关键帧
+// 生产者和消费者只通过两个原子下标同步,入队出队不加锁也不分配内存;
+// 队列满时 Push 阻塞在条件变量上等待消费者腾出空间, TryPush 则直接返回false.
+// 消费者在等待生产者的场合(会形成循环等待)生产者必须用 TryPush
+//
+#ifndef ORB_SLAM3_SPSCQUEUE_H
+#define ORB_SLAM3_SPSCQUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+namespace ORB_SLAM3
+{
+
+template<typename T>
+class SPSCQueue
+{
+public:
+    struct Stats
+    {
+        size_t depth;       // 当前队列长度
+        size_t maxDepth;    // 历史最大长度
+        size_t capacity;
+        uint64_t nPushed;   // 入队总数
+        uint64_t nBlocked;  // 队列满导致生产者阻塞的次数
+        uint64_t nDropped;  // 队列满导致 TryPush 失败的次数
+    };
+
+    // 容量向上取整为2的幂
+    explicit SPSCQueue(const size_t capacity):
+        mHead(0), mTail(0), mMaxDepth(0), mnPushed(0), mnBlocked(0), mnDropped(0), mbProducerWaiting(false)
+    {
+        size_t n = 1;
+        while(n < capacity)
+            n <<= 1;
+        mvBuffer.resize(n);
+        mMask = n - 1;
+    }
+
+    // 生产者调用. 队列满时阻塞直到消费者取走元素
+    void Push(const T &item)
+    {
+        const size_t tail = mTail.load(std::memory_order_relaxed);
+        if(tail - mHead.load(std::memory_order_acquire) > mMask)
+        {
+            mnBlocked.store(mnBlocked.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::unique_lock<std::mutex> lock(mMutexFull);
+            mbProducerWaiting.store(true);
+            mcvFull.wait(lock, [&]{ return tail - mHead.load() <= mMask; });
+            mbProducerWaiting.store(false, std::memory_order_relaxed);
+        }
+
+        Store(tail, item);
+    }
+
+    // 生产者调用. 队列满时不入队,返回false
+    bool TryPush(const T &item)
+    {
+        const size_t tail = mTail.load(std::memory_order_relaxed);
+        if(tail - mHead.load(std::memory_order_acquire) > mMask)
+        {
+            mnDropped.store(mnDropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        Store(tail, item);
+        return true;
+    }
+
+    // 消费者调用. 队列为空时返回false
+    bool TryPop(T &item)
+    {
+        const size_t head = mHead.load(std::memory_order_relaxed);
+        if(head == mTail.load(std::memory_order_acquire))
+            return false;
+
+        item = mvBuffer[head & mMask];
+        SetHead(head + 1);
+        return true;
+    }
+
+    // 消费者调用. 删除队列中满足pred的元素,其余元素保持顺序,返回删除的个数
+    template<typename Pred>
+    size_t RemoveIf(Pred pred)
+    {
+        const size_t head = mHead.load(std::memory_order_relaxed);
+        const size_t tail = mTail.load(std::memory_order_acquire);
+
+        // [head,tail)属于消费者,生产者在head前进之前不会写这些位置. 从后往前把保留的元素挪到队尾一侧
+        size_t w = tail;
+        for(size_t r = tail; r != head;)
+        {
+            --r;
+            if(!pred(mvBuffer[r & mMask]))
+            {
+                --w;
+                if(w != r)
+                    mvBuffer[w & mMask] = mvBuffer[r & mMask];
+            }
+        }
+
+        if(w != head)
+            SetHead(w);
+        return w - head;
+    }
+
+    // 消费者调用. 丢弃队列中的所有元素
+    void Clear()
+    {
+        const size_t tail = mTail.load(std::memory_order_acquire);
+        if(tail != mHead.load(std::memory_order_relaxed))
+            SetHead(tail);
+    }
+
+    size_t Size() const
+    {
+        const size_t tail = mTail.load(std::memory_order_acquire);
+        const size_t head = mHead.load(std::memory_order_acquire);
+        return tail >= head ? tail - head : 0;
+    }
+
+    bool Empty() const
+    {
+        return Size() == 0;
+    }
+
+    Stats GetStats() const
+    {
+        Stats stats;
+        stats.depth = Size();
+        stats.maxDepth = mMaxDepth.load(std::memory_order_relaxed);
+        stats.capacity = mMask + 1;
+        stats.nPushed = mnPushed.load(std::memory_order_relaxed);
+        stats.nBlocked = mnBlocked.load(std::memory_order_relaxed);
+        stats.nDropped = mnDropped.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+protected:
+    // 生产者调用. 写入tail处的元素并发布
+    void Store(const size_t tail, const T &item)
+    {
+        mvBuffer[tail & mMask] = item;
+        mTail.store(tail + 1, std::memory_order_release);
+
+        // 统计量只有生产者写
+        const size_t depth = tail + 1 - mHead.load(std::memory_order_relaxed);
+        if(depth > mMaxDepth.load(std::memory_order_relaxed))
+            mMaxDepth.store(depth, std::memory_order_relaxed);
+        mnPushed.store(mnPushed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void SetHead(const size_t head)
+    {
+        // 与 Push 中 mbProducerWaiting 的写入配对(顺序一致),保证不会漏掉唤醒
+        mHead.store(head);
+        if(mbProducerWaiting.load())
+        {
+            std::unique_lock<std::mutex> lock(mMutexFull);
+            mcvFull.notify_one();
+        }
+    }
+
+    std::vector<T> mvBuffer;
+    size_t mMask;
+
+    // 消费者下标和生产者下标放在不同的缓存行
+    char mPad0[64];
+    std::atomic<size_t> mHead;
+    char mPad1[64];
+    std::atomic<size_t> mTail;
+    char mPad2[64];
+
+    std::atomic<size_t> mMaxDepth;
+    std::atomic<uint64_t> mnPushed;
+    std::atomic<uint64_t> mnBlocked;
+    std::atomic<uint64_t> mnDropped;
+
+    // 只在队列满时使用
+    std::atomic<bool> mbProducerWaiting;
+    std::mutex mMutexFull;
+    std::condition_variable mcvFull;
+};
+
+} // namespace ORB_SLAM3
+
+#endif // ORB_SLAM3_SPSCQUEUE_H
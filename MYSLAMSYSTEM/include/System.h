@@ -25,6 +25,9 @@
 #include<stdlib.h>
 #include<string>
 #include<thread>
+#include<deque>
+#include<functional>
+#include<condition_variable>
 #include<opencv2/core/core.hpp>
 
 #include "Tracking.h"
@@ -40,6 +43,10 @@
 #include "Config.h"
 #include "PointCloudMapping.h"
 #include "PythonClient.h"
+#include "FrameScheduler.h"
+#include "KeyFrameScheduler.h"
+#include "SPSCQueue.h"
+#include "Tracer.h"
 
 class PointCloudMapping;
 class PythonClient;
@@ -79,6 +86,7 @@ public:
 class Viewer;
 class FrameDrawer;
 class Atlas;
+class KeyFrame;
 class Tracking;
 class LocalMapping;
 class LoopClosing;
@@ -125,6 +133,41 @@ public:
 //    cv::Mat TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp, const vector<IMU::Point>& vImuMeas = vector<IMU::Point>(), string filename="");
     cv::Mat TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp, const vector<IMU::Point>& vImuMeas = vector<IMU::Point>());
 
+    // Staged stereo pipeline. Image loading, preprocessing and feature extraction of the next frames
+    // run in a separate thread while the tracking thread estimates the pose of the current one.
+    // Results are delivered in submission order through the callback (called from the tracking thread).
+    typedef std::function<void(const double &timestamp, const cv::Mat &Tcw)> TrackCallback;
+    void StartStereoPipeline(const TrackCallback &callback = TrackCallback(), const int nQueueSize = 4);
+    // Blocks while the input queue is full. Returns false if the pipeline is not running.
+    bool SubmitStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp);
+    // The images are read from disk inside the preprocessing thread.
+    bool SubmitStereo(const string &strImageLeft, const string &strImageRight, const double &timestamp);
+    // Wait until every submitted frame has been tracked.
+    void FlushStereoPipeline();
+    // Flush and join the pipeline threads. Called by Shutdown().
+    void StopStereoPipeline();
+
+    // Frame scheduling of the stereo pipeline for live sources.
+    // Policy when tracking falls behind: BLOCK the caller, keep only the LATEST frame, or drop frames
+    // that waited longer than maxLatency (seconds) once a newer frame is queued (BOUNDED_LATENCY).
+    void SetFramePolicy(const FrameScheduler::ePolicy policy, const double maxLatency = 0.1);
+    // Pace SubmitStereo by the frame timestamps. rate is the playback speed (1 = real time, <=0 disables).
+    void SetFramePacing(const double rate);
+    // Submitted/dropped/tracked counters, submit-to-pose latency and tracking lag.
+    FrameScheduler::Stats GetFrameStats();
+    // Keyframe insertion decisions and the LocalMapping load (queue depth, mapping/LBA time, LBA abort rate)
+    // that drives the adaptive insertion thresholds.
+    KeyFrameScheduler::Stats GetKeyFrameStats();
+    // Depth, high-water mark and producer stalls of the keyframe hand-off queues
+    // (Tracking -> LocalMapping and LocalMapping -> LoopClosing).
+    SPSCQueue<KeyFrame*>::Stats GetLocalMappingQueueStats();
+    SPSCQueue<KeyFrame*>::Stats GetLoopClosingQueueStats();
+
+    // Per-stage timing of the hot paths (TRACE_SCOPE). Can also be enabled with System.Tracing in the settings file.
+    void EnableTracing(const bool bEnabled);
+    // Print per-stage latency percentiles and save <prefix>_stages.csv and <prefix>_trace.json (chrome://tracing).
+    void SaveTracing(const string &strPrefix);
+
     // Process the given rgbd frame. Depthmap must be registered to the RGB frame.
     // Input image: RGB (CV_8UC3) or grayscale (CV_8U). RGB is converted to grayscale.
     // Input depthmap: Float (CV_32F).
@@ -209,6 +252,23 @@ public:
 
 private:
 
+    // Apply pending localization mode changes and resets before tracking a new frame
+    void CheckModeAndReset();
+    // True if a localization mode change or reset is waiting for CheckModeAndReset
+    bool ModeOrResetPending();
+
+    // Stereo pipeline stages
+    struct StereoRequest
+    {
+        double timestamp;
+        double submitTime;
+        cv::Mat imLeft, imRight;
+        string strImageLeft, strImageRight;
+    };
+    bool PushStereoRequest(StereoRequest &request);
+    void RunStereoPreprocess();
+    void RunStereoTracking();
+
     // Input sensor
     eSensor mSensor;
 
@@ -264,6 +324,26 @@ private:
     std::vector<MapPoint*> mTrackedMapPoints;
     std::vector<cv::KeyPoint> mTrackedKeyPointsUn;
     std::mutex mMutexState;
+
+    // Stereo pipeline: bounded queues between submit -> preprocess -> tracking
+    std::thread* mptStereoPreprocess;
+    std::thread* mptStereoTracking;
+    std::mutex mMutexPipeline;
+    std::condition_variable mcvPipeline;
+    std::deque<StereoRequest> mqStereoRequests;
+    std::deque<StereoInput*> mqStereoInputs;
+    size_t mnPipelineQueueSize;
+    int mnPipelinePending;
+    bool mbPipelineRunning;
+    bool mbPipelineFinish;
+    bool mbPipelineTracking;    // the tracking stage is working on a frame
+    TrackCallback mTrackCallback;
+
+    // Pacing and drop policy of the stereo pipeline
+    FrameScheduler mFrameScheduler;
+
+    // Output prefix of the tracing results written at Shutdown (System.TracingOutput)
+    string mStrTracingOutput;
 };
 
 }// namespace ORB_SLAM
@@ -0,0 +1,138 @@
+//
+// 热路径计时: RAII作用域计时器,每个线程一个无锁环形缓冲区,每个阶段一个HDR延迟直方图
+// 运行时开关,关闭时每个作用域只有一次原子读的开销
+// 导出Chrome trace JSON(chrome://tracing)和CSV(每个阶段的 p50/p90/p99)
+//
+#ifndef ORB_SLAM3_TRACER_H
+#define ORB_SLAM3_TRACER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+namespace ORB_SLAM3
+{
+
+class Tracer
+{
+public:
+    // 单个计时事件
+    struct Event
+    {
+        uint64_t start;     // ns, 相对于Tracer创建时刻
+        uint64_t duration;  // ns
+        int stage;
+    };
+
+    // 阶段统计,时间单位ms
+    struct StageStats
+    {
+        std::string name;
+        uint64_t count;
+        double mean, p50, p90, p99, max;
+    };
+
+    static const int MAX_STAGES = 128;
+
+    static inline bool IsEnabled()
+    {
+        return mbEnabled.load(std::memory_order_relaxed);
+    }
+
+    static void SetEnabled(const bool bEnabled);
+
+    // 注册阶段名,返回阶段id. 同名返回相同id
+    static int RegisterStage(const char* name);
+
+    // 为当前线程命名,显示在Chrome trace中
+    static void SetThreadName(const std::string &name);
+
+    // 纳秒时间戳,相对于Tracer创建时刻
+    static uint64_t Now();
+
+    // 记录一个事件: 写入当前线程的环形缓冲区并更新阶段直方图
+    static void Record(const int stage, const uint64_t start, const uint64_t end);
+
+    // 统计与导出
+    static std::vector<StageStats> GetStats();
+    static void PrintStats();
+    static bool SaveStatsCSV(const std::string &filename);
+    static bool SaveChromeTrace(const std::string &filename);
+    // 清空直方图和已收集的事件
+    static void Clear();
+
+private:
+    class ThreadBuffer;
+    class Histogram;
+
+    static Tracer& Instance();
+    Tracer();
+    ~Tracer();
+
+    ThreadBuffer* GetThreadBuffer();
+    void Collect();
+    void RunCollector();
+    void WakeCollector();
+
+    static std::atomic<bool> mbEnabled;
+
+    std::chrono::steady_clock::time_point mT0;
+
+    std::mutex mMutexStages;
+    std::atomic<int> mnStages;
+    std::string mvStageNames[MAX_STAGES];
+    Histogram* mvHistograms;
+
+    std::mutex mMutexBuffers;
+    std::vector<ThreadBuffer*> mvBuffers;
+
+    // 缓冲区半满时后台线程把环形缓冲区中的事件搬到这里,导出前也会搬一次
+    std::mutex mMutexEvents;
+    std::vector<std::pair<int, Event> > mvEvents;   // (线程序号, 事件)
+    uint64_t mnDroppedEvents;
+
+    std::mutex mMutexCollector;
+    std::thread* mptCollector;
+    std::condition_variable mcvCollector;
+    bool mbStopCollector;
+    bool mbCollectRequested;
+};
+
+// 作用域计时器,析构时记录
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(const int stage) : mStage(stage), mbActive(Tracer::IsEnabled())
+    {
+        if(mbActive)
+            mStart = Tracer::Now();
+    }
+
+    ~ScopedTimer()
+    {
+        if(mbActive)
+            Tracer::Record(mStage, mStart, Tracer::Now());
+    }
+
+private:
+    int mStage;
+    bool mbActive;
+    uint64_t mStart;
+};
+
+} // namespace ORB_SLAM3
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// 计时当前作用域, 例如 TRACE_SCOPE("Tracking::TrackLocalMap");
+#define TRACE_SCOPE(name) \
+    static const int TRACE_CONCAT(trace_stage_, __LINE__) = ORB_SLAM3::Tracer::RegisterStage(name); \
+    ORB_SLAM3::ScopedTimer TRACE_CONCAT(trace_timer_, __LINE__)(TRACE_CONCAT(trace_stage_, __LINE__))
+
+#endif // ORB_SLAM3_TRACER_H
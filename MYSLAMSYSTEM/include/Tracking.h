@@ -37,10 +37,12 @@
 #include "MapDrawer.h"
 #include "System.h"
 #include "ImuTypes.h"
+#include "KeyFrameScheduler.h"
 
 #include "GeometricCamera.h"
 
 #include <mutex>
+#include <atomic>
 #include <unordered_set>
 
 #include "PointCloudMapping.h"
@@ -57,6 +59,17 @@ class LoopClosing;
 class System;
 class PythonClient;
 
+// 双目预处理阶段的输出(灰度转换 + 特征提取构造Frame)
+// 预处理不访问跟踪状态,因此在流水线中可以提前于Track()执行
+struct StereoInput
+{
+    double timestamp;
+    double submitTime = 0;      // 提交到流水线的时刻,用于统计跟踪延迟
+    cv::Mat imLeft, imRight;    // 原始输入图像,生成关键帧和稠密地图时使用
+    cv::Mat imGray;
+    Frame frame;
+};
+
 class Tracking
 {  
 
@@ -76,6 +89,11 @@ public:
     // 输入图像输出位姿Tcw
 //    cv::Mat GrabImageStereo(const cv::Mat &imRectLeft,const cv::Mat &imRectRight, const double &timestamp, string filename);
     cv::Mat GrabImageStereo(const cv::Mat &imRectLeft,const cv::Mat &imRectRight, const double &timestamp);
+    // GrabImageStereo拆分成的两个阶段,供System中的跟踪流水线使用
+    // PreprocessStereo只读取相机和提取器参数,可以与上一帧的TrackStereoInput并行;
+    // 但它会修改Frame的静态状态(初始化标志、动态检测用的上一帧灰度图), Reset/ResetActiveMap 不能与它并行
+    void PreprocessStereo(const cv::Mat &imRectLeft,const cv::Mat &imRectRight, const double &timestamp, StereoInput &input);
+    cv::Mat TrackStereoInput(StereoInput &input);
     cv::Mat GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp, string filename);
     cv::Mat GrabImageStereo_RGBD(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const cv::Mat &imD, const double &timestamp, string filename);
     cv::Mat GrabImageMonocular(const cv::Mat &im, const double &timestamp, string filename);
@@ -88,6 +106,9 @@ public:
     void SetViewer(Viewer* pViewer);
     void SetStepByStep(bool bSet);
 
+    // 关键帧插入调度,LocalMapping通过它上报负载
+    KeyFrameScheduler* GetKeyFrameScheduler();
+
     // Load new settings
     // The focal lenght should be similar or scale prediction will fail when projecting points
     // 更换新的标定参数，未使用
@@ -230,6 +251,9 @@ protected:
     bool PredictStateIMU();         //用IMU预测位姿
 
     bool Relocalization();          //重定位
+    // 用一个候选关键帧重定位: BoW匹配, MLPnP RANSAC, 位姿优化和投影补充匹配, 结果写入frame(当前帧的副本)
+    // 内点达到50个返回true. bFound被其它候选置位后尽快放弃
+    bool RelocalizeWithCandidate(KeyFrame* pKF, Frame &frame, const std::atomic<bool> &bFound);
 
     void UpdateLocalMap();          //更新局部地图
     void UpdateLocalPoints();       //更新局部地图点
@@ -295,7 +319,21 @@ protected:
     //Local Map
     KeyFrame* mpReferenceKF;
     std::vector<KeyFrame*> mvpLocalKeyFrames;
+    // UpdateLocalKeyFrames投票: 每次投票递增的轮次号,和本轮得票的关键帧(复用内存,不需要逐帧清空)
+    long unsigned int mnKFVoteEpoch = 0;
+    std::vector<KeyFrame*> mvpVotedKeyFrames;
     std::vector<MapPoint*> mvpLocalMapPoints;
+    // 局部地图点的世界坐标(与mvpLocalMapPoints一一对应,在UpdateLocalPoints中读取)
+    std::vector<cv::Matx31f> mvLocalMapPointPos;
+    // 局部地图点按关键帧分组,组内按Morton序排列后每LOCAL_POINT_CLUSTER_SIZE个点一组,用包围球成组剔除视野外的点
+    struct LocalPointCluster
+    {
+        int begin, end;         // mvpLocalMapPoints中的下标范围[begin,end)
+        cv::Matx31f center;
+        float radius;
+    };
+    static const int LOCAL_POINT_CLUSTER_SIZE = 32;
+    std::vector<LocalPointCluster> mvLocalPointClusters;
     
     // System
     System* mpSystem;
@@ -319,6 +357,9 @@ protected:
     int mMinFrames;
     int mMaxFrames;
 
+    // 根据LocalMapping负载调整插入阈值
+    KeyFrameScheduler mKeyFrameScheduler;
+
     int mnFirstImuFrameId;
     // 经过多少帧后可以重置IMU，一般设置为和帧率相同，对应的时间是1s
     int mnFramesToResetIMU;
@@ -349,7 +390,7 @@ protected:
     bool mbCreatedMap;
 
     //Motion Model
-    cv::Mat mVelocity;      // 恒速模型的速度。通过位姿增量获得或者IMU积分得到
+    cv::Matx44f mVelocity;  // 恒速模型的速度。通过位姿增量获得或者IMU积分得到,mbVelocity为false时无效
     bool mbVelocity{false};
 
     //Color order (true RGB, false BGR, ignored if grayscale)
@@ -26,6 +26,7 @@
 #include "System.h"
 
 #include <mutex>
+#include <condition_variable>
 
 namespace ORB_SLAM3
 {
@@ -49,9 +50,14 @@ public:
     void RequestStop();
 
     bool isFinished();
+    // 阻塞直到可视化线程退出Run
+    void WaitUntilFinished();
 
     bool isStopped();
 
+    // 阻塞直到可视化线程响应 RequestStop
+    void WaitUntilStopped();
+
     bool isStepByStep();
 
     void Release();
@@ -81,10 +87,13 @@ private:
     bool mbFinishRequested;
     bool mbFinished;
     std::mutex mMutexFinish;
+    // SetFinish 时通知 WaitUntilFinished
+    std::condition_variable mcvFinished;
 
     bool mbStopped;
     bool mbStopRequested;
     std::mutex mMutexStop;
+    std::condition_variable mcvStop;
 
     bool mbStopTrack;
 
@@ -11,66 +11,51 @@
 
 #include<System.h>
 #include <PythonClient.h>
+#include <DatasetReader.h>
 
 using namespace std;
 
-void LoadImages(const string &strAssociationFilename, vector<string> &vstrImageLeft, vector<string> &vstrImageRight);
-void LoadImages_new(const string &strAssociationFilename, vector<string> &vstrImageLeft, vector<string> &vstrImageRight, vector<double> &vTimestamps);
-
 int main(int argc, char **argv)
 {
-    if(argc != 5)
+    if(argc != 5 && argc != 6)
     {
-        cerr << endl << "Usage: ./stereo_kitti path_to_vocabulary path_to_settings path_to_sequence" << endl;
+        cerr << endl << "Usage: ./my_slam path_to_vocabulary path_to_settings path_to_sequence path_to_association (path_to_frame_cache)" << endl;
         return 1;
     }
 
     std::chrono::steady_clock::time_point beforetime = std::chrono::steady_clock::now();
 
     // Retrieve paths to images
-    vector<string> vstrImageLeft;
-    vector<string> vstrImageRight;
-    vector<double> vTimestamps;
-
+    // 图像由读取器的线程提前解码,可选的缓存目录保存解码后的原始像素
     string strAssociationFilename = string(argv[4]);
-    LoadImages_new(strAssociationFilename, vstrImageLeft, vstrImageRight, vTimestamps);
-
-    int nImages  = vstrImageLeft.size();
-
+    string strCacheDir = argc == 6 ? string(argv[5]) : string();
+    ORB_SLAM3::DatasetReader reader(string(argv[3]), strAssociationFilename, ORB_SLAM3::DatasetReader::ASSOCIATION_STEREO, 2, 8, strCacheDir);
 
     ORB_SLAM3::System SLAM(argv[1],argv[2],ORB_SLAM3::System::STEREO,true);
 
     // 主循环
-    cv::Mat imLeft, imRight;
+    // 特征提取在流水线的预处理线程中进行,与上一帧的跟踪并行
+    // 实时回放可以设置 SLAM.SetFramePacing(1.0) 和 SLAM.SetFramePolicy(ORB_SLAM3::FrameScheduler::LATEST_FRAME_WINS)
+    SLAM.StartStereoPipeline();
 
-    for(int ni=0; ni<nImages; ni++)
+    ORB_SLAM3::DatasetFrame frame;
+    while(reader.Next(frame))
     {
-        // Read left and right images from file
-        imLeft = cv::imread(string(argv[3])+"/"+vstrImageLeft[ni],cv::IMREAD_UNCHANGED);
-        imRight = cv::imread(string(argv[3])+"/"+vstrImageRight[ni],cv::IMREAD_UNCHANGED);
-        double tframe = vTimestamps[ni];
-
-
-        if(imLeft.empty())
-        {
-            cerr << endl << "Failed to load image at: "
-                 << string(vstrImageLeft[ni]) << endl;
+        if(frame.empty())
             return 1;
-        }
-
 
         // Pass the images to the SLAM system
-        SLAM.TrackStereo(imLeft, imRight, tframe);
-
-        // Wait to load the next frame
-//            usleep(100000);
-
+        SLAM.SubmitStereo(frame.imLeft, frame.imRight, frame.timestamp);
     }
 
     // Stop all threads
 //    SLAM.save();
     SLAM.Shutdown();
 
+    ORB_SLAM3::FrameScheduler::Stats stats = SLAM.GetFrameStats();
+    cout << "tracked frames: " << stats.nTracked << " dropped: " << stats.nDropped
+         << " mean latency: " << stats.meanLatency << " max latency: " << stats.maxLatency << endl;
+
 //    保存相机轨迹
 //    SLAM.SaveTrajectoryKITTI("seq_Trajectory.txt");
 
@@ -81,60 +66,3 @@ int main(int argc, char **argv)
     return 0;
 }
 
-
-void LoadImages(const string &strAssociationFilename, vector<string> &vstrImageLeft,
-                vector<string> &vstrImageRight)
-{
-    ifstream fAssociation;
-    fAssociation.open(strAssociationFilename.c_str());
-    while (!fAssociation.eof())
-    {
-        string s;
-        getline(fAssociation, s);
-        if(!s.empty())
-        {
-            stringstream ss;
-            ss << s;
-            double t;
-            string sImageLeft, sImageRight;
-            ss >> t;        //  时间戳
-//            vTimestamps.push_back(t);
-            ss >> sImageLeft;       //  左图路径
-            vstrImageLeft.push_back(sImageLeft);
-            ss >> sImageRight;      // 右图路径
-            vstrImageRight.push_back(sImageRight);
-
-        }
-    }
-}
-
-
-void LoadImages_new(const string &strAssociationFilename, vector<string> &vstrImageLeft,
-                vector<string> &vstrImageRight, vector<double> &vTimestamps)
-{
-    ifstream fAssociation;
-    fAssociation.open(strAssociationFilename.c_str());
-    while (!fAssociation.eof())
-    {
-        string s;
-        getline(fAssociation, s);
-        if(!s.empty())
-        {
-            stringstream ss;
-            ss << s;
-            string sImageLeft, sImageRight;
-            double sTimestamps;
-            ss >> sImageLeft;       //  左图路径
-            vstrImageLeft.push_back(sImageLeft);
-            ss >> sImageRight;      // 右图路径
-            vstrImageRight.push_back(sImageRight);
-            ss >> sTimestamps;
-//            cout<<setw(6)<<setfill('0')<<sTimestamps<<endl;
-            vTimestamps.push_back(sTimestamps);
-
-        }
-    }
-}
-
-
-
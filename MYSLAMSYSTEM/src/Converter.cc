@@ -54,6 +54,38 @@ g2o::SE3Quat Converter::toSE3Quat(const cv::Mat &cvT)
     return g2o::SE3Quat(R,t);
 }
 
+g2o::SE3Quat Converter::toSE3Quat(const cv::Matx44f &T)
+{
+    Eigen::Matrix<double,3,3> R;
+    R << T(0,0), T(0,1), T(0,2),
+         T(1,0), T(1,1), T(1,2),
+         T(2,0), T(2,1), T(2,2);
+
+    Eigen::Matrix<double,3,1> t(T(0,3), T(1,3), T(2,3));
+
+    return g2o::SE3Quat(R,t);
+}
+
+//4x4变换矩阵cv::Mat(CV_32F)->cv::Matx44f
+cv::Matx44f Converter::toMatx44f(const cv::Mat &T)
+{
+    return cv::Matx44f(T.at<float>(0,0), T.at<float>(0,1), T.at<float>(0,2), T.at<float>(0,3),
+                       T.at<float>(1,0), T.at<float>(1,1), T.at<float>(1,2), T.at<float>(1,3),
+                       T.at<float>(2,0), T.at<float>(2,1), T.at<float>(2,2), T.at<float>(2,3),
+                       T.at<float>(3,0), T.at<float>(3,1), T.at<float>(3,2), T.at<float>(3,3));
+}
+
+//g2o::SE3Quat->cv::Matx44f
+cv::Matx44f Converter::toMatx44f(const g2o::SE3Quat &SE3)
+{
+    const Eigen::Matrix<double,4,4> m = SE3.to_homogeneous_matrix();
+    cv::Matx44f T;
+    for(int i=0;i<4;i++)
+        for(int j=0; j<4; j++)
+            T(i,j)=m(i,j);
+    return T;
+}
+
 //李代数se3转换为变换矩阵：g2o::SE3Quat->cv::Mat
 cv::Mat Converter::toCvMat(const g2o::SE3Quat &SE3)
 {
@@ -0,0 +1,343 @@
+//
+// 数据集读取: 解析KITTI/TUM/自定义关联文件,并用多个线程提前解码图像
+//
+
+#include "DatasetReader.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <functional>
+
+#include <opencv2/imgcodecs.hpp>
+
+using namespace std;
+
+namespace ORB_SLAM3
+{
+
+// 缓存文件头: 魔数, 版本, 数据集格式, 源图像路径长度 + 源图像路径, 3幅图像(左,右,深度)的 rows, cols, type
+static const int32_t CACHE_MAGIC = 0x4342524f; // "ORBC"
+static const int32_t CACHE_VERSION = 2;
+static const int CACHE_IMAGES = 3;
+
+DatasetReader::DatasetReader(const string &strSequencePath, const string &strListFile, const eFormat format,
+                             const int nThreads, const int nBufferSize, const string &strCacheDir):
+    mstrSequencePath(strSequencePath), mstrCacheDir(strCacheDir), mFormat(format),
+    mnNextDecode(0), mnNextConsume(0), mbStop(false)
+{
+    string strList = strListFile;
+    if(mFormat==KITTI && strList.empty())
+        strList = mstrSequencePath + "/times.txt";
+
+    if(!LoadList(strList))
+    {
+        cerr << "Failed to open dataset list at: " << strList << endl;
+        return;
+    }
+
+    if(!mstrCacheDir.empty())
+        mkdir(mstrCacheDir.c_str(), 0755);
+
+    mvSlots.resize(max(nBufferSize,1));
+
+    const int nWorkers = max(nThreads,1);
+    for(int i=0; i<nWorkers; i++)
+        mvThreads.push_back(thread(&DatasetReader::Run, this));
+}
+
+DatasetReader::~DatasetReader()
+{
+    Stop();
+}
+
+int DatasetReader::Size() const
+{
+    return mvEntries.size();
+}
+
+double DatasetReader::GetTimestamp(const int i) const
+{
+    return mvEntries[i].timestamp;
+}
+
+bool DatasetReader::LoadList(const string &strListFile)
+{
+    ifstream f(strListFile.c_str());
+    if(!f.is_open())
+        return false;
+
+    string s;
+    while(getline(f,s))
+    {
+        if(s.empty() || s[0]=='#')
+            continue;
+
+        stringstream ss(s);
+        Entry e;
+        double t;
+        switch(mFormat)
+        {
+        case KITTI:
+        {
+            ss >> e.timestamp;
+            stringstream name;
+            name << setfill('0') << setw(6) << mvEntries.size() << ".png";
+            e.strLeft = "image_0/" + name.str();
+            e.strRight = "image_1/" + name.str();
+            break;
+        }
+        case TUM_RGBD:
+            ss >> e.timestamp >> e.strLeft >> t >> e.strDepth;
+            break;
+        case ASSOCIATION_STEREO:
+            ss >> e.strLeft >> e.strRight >> e.timestamp;
+            break;
+        case ASSOCIATION_STEREO_RGBD:
+            ss >> e.timestamp >> e.strLeft >> e.strRight >> t >> e.strDepth;
+            break;
+        }
+        mvEntries.push_back(e);
+    }
+    return true;
+}
+
+void DatasetReader::Stop()
+{
+    {
+        unique_lock<mutex> lock(mMutex);
+        mbStop = true;
+    }
+    mcvConsumed.notify_all();
+    mcvDecoded.notify_all();
+
+    for(size_t i=0; i<mvThreads.size(); i++)
+        if(mvThreads[i].joinable())
+            mvThreads[i].join();
+    mvThreads.clear();
+}
+
+bool DatasetReader::Next(DatasetFrame &frame)
+{
+    unique_lock<mutex> lock(mMutex);
+    if(mnNextConsume >= (int)mvEntries.size() || mbStop)
+        return false;
+
+    Slot &slot = mvSlots[mnNextConsume % mvSlots.size()];
+    mcvDecoded.wait(lock, [&]{ return slot.bReady || mbStop; });
+    if(!slot.bReady)
+        return false;
+
+    frame = slot.frame;
+    slot.frame = DatasetFrame();
+    slot.bReady = false;
+    mnNextConsume++;
+
+    lock.unlock();
+    mcvConsumed.notify_all();
+    return true;
+}
+
+// 解码线程: 领取下一帧编号,只有环形缓冲区中对应的槽位已被取走才开始解码
+void DatasetReader::Run()
+{
+    while(1)
+    {
+        int id;
+        {
+            unique_lock<mutex> lock(mMutex);
+            mcvConsumed.wait(lock, [&]{
+                return mbStop || mnNextDecode >= (int)mvEntries.size() ||
+                       mnNextDecode < mnNextConsume + (int)mvSlots.size(); });
+            if(mbStop || mnNextDecode >= (int)mvEntries.size())
+                break;
+            id = mnNextDecode++;
+        }
+
+        DatasetFrame frame;
+        Decode(id, frame);
+
+        {
+            unique_lock<mutex> lock(mMutex);
+            Slot &slot = mvSlots[id % mvSlots.size()];
+            slot.frame = frame;
+            slot.bReady = true;
+        }
+        mcvDecoded.notify_all();
+    }
+}
+
+void DatasetReader::Decode(const int id, DatasetFrame &frame)
+{
+    const Entry &e = mvEntries[id];
+    frame.id = id;
+    frame.timestamp = e.timestamp;
+
+    if(!mstrCacheDir.empty() && ReadCache(id, frame))
+        return;
+
+    frame.imLeft = cv::imread(mstrSequencePath + "/" + e.strLeft, cv::IMREAD_UNCHANGED);
+    if(!e.strRight.empty())
+        frame.imRight = cv::imread(mstrSequencePath + "/" + e.strRight, cv::IMREAD_UNCHANGED);
+    if(!e.strDepth.empty())
+        frame.imDepth = cv::imread(mstrSequencePath + "/" + e.strDepth, cv::IMREAD_UNCHANGED);
+
+    if(frame.imLeft.empty())
+    {
+        cerr << endl << "Failed to load image at: " << mstrSequencePath << "/" << e.strLeft << endl;
+        return;
+    }
+
+    if(!mstrCacheDir.empty())
+        WriteCache(id, frame);
+}
+
+// 文件名中带上序列路径和格式的哈希,不同序列共用缓存目录时互不覆盖
+string DatasetReader::CacheFile(const int id) const
+{
+    stringstream key;
+    key << mstrSequencePath << "|" << mFormat;
+    const size_t hash = std::hash<string>()(key.str());
+
+    stringstream ss;
+    ss << mstrCacheDir << "/" << hex << setfill('0') << setw(16) << hash << "_"
+       << dec << setw(6) << id << ".raw";
+    return ss.str();
+}
+
+string DatasetReader::CacheKey(const int id) const
+{
+    const Entry &e = mvEntries[id];
+    return mstrSequencePath + "/" + e.strLeft + "|" + e.strRight + "|" + e.strDepth;
+}
+
+// 从缓存文件mmap读取原始像素,只需一次内存拷贝
+// 文件头中的格式和源图像路径与这一帧不一致、图像尺寸或类型不合法、数据长度不符时都视为没有缓存
+bool DatasetReader::ReadCache(const int id, DatasetFrame &frame)
+{
+    const string strFile = CacheFile(id);
+    int fd = open(strFile.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)(sizeof(int32_t)*4))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* pMap = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(pMap == MAP_FAILED)
+        return false;
+
+    const unsigned char* pData = static_cast<const unsigned char*>(pMap);
+    const unsigned char* pEnd = pData + st.st_size;
+
+    // 文件头按字节读取,源图像路径之后的字段不一定对齐
+    auto readInt = [&](int32_t &v){
+        if((size_t)(pEnd - pData) < sizeof(int32_t))
+            return false;
+        memcpy(&v, pData, sizeof(int32_t));
+        pData += sizeof(int32_t);
+        return true;
+    };
+
+    const string strKey = CacheKey(id);
+    int32_t magic = 0, version = 0, format = 0, nKey = 0;
+    bool bOk = readInt(magic) && readInt(version) && readInt(format) && readInt(nKey) &&
+               magic == CACHE_MAGIC && version == CACHE_VERSION && format == mFormat &&
+               nKey == (int32_t)strKey.size() && (size_t)(pEnd - pData) >= strKey.size() &&
+               memcmp(pData, strKey.data(), strKey.size()) == 0;
+    if(bOk)
+        pData += strKey.size();
+
+    int32_t dims[3*CACHE_IMAGES];
+    for(int i=0; i<3*CACHE_IMAGES && bOk; i++)
+        bOk = readInt(dims[i]);
+
+    cv::Mat* vIms[CACHE_IMAGES] = {&frame.imLeft, &frame.imRight, &frame.imDepth};
+    for(int i=0; i<CACHE_IMAGES && bOk; i++)
+    {
+        const int rows = dims[3*i], cols = dims[1+3*i], type = dims[2+3*i];
+        if(rows==0 && cols==0)
+            continue;
+        if(rows<=0 || cols<=0 || type<0 || CV_MAT_TYPE(type)!=type || CV_MAT_DEPTH(type)>CV_64F)
+        {
+            bOk = false;
+            break;
+        }
+        // 先用除法比较,避免 rows*cols*elemSize 溢出
+        const size_t nRowBytes = (size_t)cols*CV_ELEM_SIZE(type);
+        if((size_t)rows > (size_t)(pEnd - pData)/nRowBytes)
+        {
+            bOk = false;
+            break;
+        }
+        const size_t nBytes = (size_t)rows*nRowBytes;
+        cv::Mat im(rows, cols, type);
+        memcpy(im.data, pData, nBytes);
+        pData += nBytes;
+        *vIms[i] = im;
+    }
+    bOk = bOk && pData == pEnd;
+
+    munmap(pMap, st.st_size);
+
+    if(!bOk)
+    {
+        frame.imLeft.release();
+        frame.imRight.release();
+        frame.imDepth.release();
+    }
+    return bOk;
+}
+
+// 写入缓存,先写临时文件再重命名,避免并发读到不完整的文件
+void DatasetReader::WriteCache(const int id, const DatasetFrame &frame)
+{
+    const string strFile = CacheFile(id);
+    const string strTmp = strFile + ".tmp";
+    ofstream f(strTmp.c_str(), ios::binary);
+    if(!f.is_open())
+        return;
+
+    const string strKey = CacheKey(id);
+    const int32_t header[4] = {CACHE_MAGIC, CACHE_VERSION, (int32_t)mFormat, (int32_t)strKey.size()};
+    f.write(reinterpret_cast<const char*>(header), sizeof(header));
+    f.write(strKey.data(), strKey.size());
+
+    const cv::Mat vIms[CACHE_IMAGES] = {frame.imLeft, frame.imRight, frame.imDepth};
+    int32_t dims[3*CACHE_IMAGES];
+    for(int i=0; i<CACHE_IMAGES; i++)
+    {
+        dims[3*i] = vIms[i].rows;
+        dims[1+3*i] = vIms[i].cols;
+        dims[2+3*i] = vIms[i].type();
+    }
+    f.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+
+    for(int i=0; i<CACHE_IMAGES; i++)
+    {
+        if(vIms[i].empty())
+            continue;
+        const cv::Mat im = vIms[i].isContinuous() ? vIms[i] : vIms[i].clone();
+        f.write(reinterpret_cast<const char*>(im.data), im.total()*im.elemSize());
+    }
+    f.close();
+
+    if(f.good())
+        rename(strTmp.c_str(), strFile.c_str());
+    else
+        remove(strTmp.c_str());
+}
+
+} // namespace ORB_SLAM3
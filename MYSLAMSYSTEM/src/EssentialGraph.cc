@@ -0,0 +1,113 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "EssentialGraph.h"
+
+#include <algorithm>
+#include <atomic>
+#include <unordered_set>
+
+#include "KeyFrame.h"
+#include "ParallelFor.h"
+
+namespace ORB_SLAM3
+{
+
+// 每个线程一次领取的关键帧数
+static const int kChunk = 32;
+
+EssentialGraph::EssentialGraph(const int minFeat): mpMap(static_cast<Map*>(NULL)), mnMinFeat(minFeat), mnRefreshed(0)
+{
+}
+
+void EssentialGraph::Reset(Map *pMap)
+{
+    mpMap = pMap;
+    mmNodes.clear();
+    mnRefreshed = 0;
+}
+
+void EssentialGraph::Refresh(KeyFrame *pKF, Node &node) const
+{
+    // 先读版本号: 读取过程中连接关系又变了的话,下一次 Update 会再读一次
+    node.nId = pKF->mnId;
+    node.nVersion = pKF->GetConnectionsVersion();
+    node.bValid = true;
+    node.pParent = pKF->GetParent();
+
+    const std::set<KeyFrame *> sLoopEdges = pKF->GetLoopEdges();
+    node.vpLoopEdges.assign(sLoopEdges.begin(), sLoopEdges.end());
+
+    node.vpCovisibles.clear();
+    const std::vector<KeyFrame *> vpConnectedKFs = pKF->GetCovisiblesByWeight(mnMinFeat);
+    for(size_t i = 0; i < vpConnectedKFs.size(); i++)
+    {
+        KeyFrame *pKFn = vpConnectedKFs[i];
+        if(pKFn && pKFn != node.pParent && !pKF->hasChild(pKFn) && !sLoopEdges.count(pKFn))
+            node.vpCovisibles.push_back(pKFn);
+    }
+}
+
+void EssentialGraph::Update(const std::vector<KeyFrame *> &vpKFs)
+{
+    // 增删节点只在这里串行进行,之后各线程只修改各自关键帧的节点
+    std::unordered_set<KeyFrame *> sKFs(vpKFs.begin(), vpKFs.end());
+    for(std::unordered_map<KeyFrame *, Node>::iterator it = mmNodes.begin(); it != mmNodes.end();)
+    {
+        if(!sKFs.count(it->first))
+            it = mmNodes.erase(it);
+        else
+            ++it;
+    }
+
+    std::vector<Node *> vpNodes(vpKFs.size());
+    for(size_t i = 0; i < vpKFs.size(); i++)
+    {
+        std::unordered_map<KeyFrame *, Node>::iterator it = mmNodes.find(vpKFs[i]);
+        if(it == mmNodes.end())
+        {
+            it = mmNodes.emplace(vpKFs[i], Node()).first;
+            it->second.bValid = false;
+        }
+        vpNodes[i] = &it->second;
+    }
+
+    const int nKFs = vpKFs.size();
+    std::atomic<int> nRefreshed(0);
+    ParallelFor(nKFs, [&](const int i){
+        KeyFrame *pKF = vpKFs[i];
+        Node &node = *vpNodes[i];
+        // 同一地址上可能是新的关键帧,用id区分
+        if(node.bValid && node.nId == pKF->mnId && node.nVersion == pKF->GetConnectionsVersion())
+            return;
+        Refresh(pKF, node);
+        nRefreshed++;
+    }, kChunk);
+
+    mnRefreshed = nRefreshed;
+}
+
+const EssentialGraph::Node *EssentialGraph::GetNode(KeyFrame *pKF) const
+{
+    std::unordered_map<KeyFrame *, Node>::const_iterator it = mmNodes.find(pKF);
+    if(it == mmNodes.end() || !it->second.bValid)
+        return static_cast<const Node *>(NULL);
+    return &it->second;
+}
+
+} // namespace ORB_SLAM3
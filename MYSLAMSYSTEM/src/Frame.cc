@@ -26,6 +26,7 @@
 #include "ORBmatcher.h"
 #include "GeometricCamera.h"
 #include "Object.h"
+#include "Tracer.h"
 
 #include <thread>
 #include <include/CameraModels/Pinhole.h>
@@ -87,7 +88,11 @@ Frame::Frame(const Frame &frame)
      monoLeft(frame.monoLeft), monoRight(frame.monoRight), mvLeftToRightMatch(frame.mvLeftToRightMatch),
      mvRightToLeftMatch(frame.mvRightToLeftMatch), mvStereo3Dpoints(frame.mvStereo3Dpoints),
      mTlr(frame.mTlr.clone()), mRlr(frame.mRlr.clone()), mtlr(frame.mtlr.clone()), mTrl(frame.mTrl.clone()),
-     mTrlx(frame.mTrlx), mTlrx(frame.mTlrx), mOwx(frame.mOwx), mRcwx(frame.mRcwx), mtcwx(frame.mtcwx), mpPythonClient(frame.mpPythonClient)
+     mTrlx(frame.mTrlx), mTlrx(frame.mTlrx), mTcwx(frame.mTcwx), mOwx(frame.mOwx), mRcwx(frame.mRcwx), mRwcx(frame.mRwcx), mtcwx(frame.mtcwx), mpPythonClient(frame.mpPythonClient),
+     objects_cur_(frame.objects_cur_), vbInDynamic_mvKeys(frame.vbInDynamic_mvKeys), vbInStatic_mvKeys(frame.vbInStatic_mvKeys),
+     mvDetectBoxes(frame.mvDetectBoxes),
+     mvDetectClassBits(frame.mvDetectClassBits), mnDetectClassMask(frame.mnDetectClassMask),
+     mbDetectBoxesDirty(frame.mbDetectBoxesDirty)
 {
     for(int i=0;i<FRAME_GRID_COLS;i++)
         for(int j=0; j<FRAME_GRID_ROWS; j++){
@@ -245,8 +250,9 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const cv::Mat &imgrg
          mImuCalib(ImuCalib), mpImuPreintegrated(NULL), mpPrevFrame(pPrevF),mpImuPreintegratedFrame(NULL), mpReferenceKF(static_cast<KeyFrame*>(NULL)), mbImuPreintegrated(false),
          mpCamera(pCamera) ,mpCamera2(nullptr), mpPythonClient(P), mTracker(pTracker)
 {
-    // Step 1 帧的ID 自增
-    mnId=nNextId++;
+    // Step 1 这个构造函数在双目流水线的预处理线程中调用,帧ID由跟踪阶段分配(Tracking::TrackStereoInput),
+    // 这里不修改 nNextId
+    mnId=0;
 
     mimgray = imLeft.clone();
 //    imgLeft = imLeft;
@@ -269,10 +275,11 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const cv::Mat &imgrg
     mvInvLevelSigma2 = mpORBextractorLeft->GetInverseScaleSigmaSquares();
 
     // ORB extraction
-    std::chrono::steady_clock::time_point t11 = std::chrono::steady_clock::now();
-
-    ExtractORBKeyPoints(0, imLeft);
-    ExtractORBKeyPoints(1, imRight);
+    {
+        TRACE_SCOPE("Frame::ExtractORBKeyPoints");
+        ExtractORBKeyPoints(0, imLeft);
+        ExtractORBKeyPoints(1, imRight);
+    }
 
     //////////////
 
@@ -301,12 +308,12 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const cv::Mat &imgrg
         flag_mov = CheckMovingKeyPoints(imgrgb, imLeft,mvKeysTemp,T_M);
 //        cout << "check time =" << tc*1000 <<  endl;
     }
-    std::chrono::steady_clock::time_point t22 = std::chrono::steady_clock::now();
-    orbExtractTime= std::chrono::duration_cast<std::chrono::duration<double> >(t22 - t11).count();
-    cout<<"orbExtractTime: "<<orbExtractTime<<endl;
 
-    ExtractORBDesp(0,imLeft, 0, 0);
-    ExtractORBDesp(1,imRight, 0, 0);
+    {
+        TRACE_SCOPE("Frame::ExtractORBDesp");
+        ExtractORBDesp(0,imLeft, 0, 0);
+        ExtractORBDesp(1,imRight, 0, 0);
+    }
 
 
     /////下面是原来的版本，这里需要注释
@@ -848,6 +855,20 @@ void Frame::GetPose(cv::Mat &Tcw)
     Tcw = mTcw.clone();
 }
 
+void Frame::SetPose_(const cv::Matx44f &Tcw)
+{
+    mTcw = cv::Mat(Tcw);
+    UpdatePoseMatrices();
+}
+
+cv::Matx44f Frame::GetPoseInverse_()
+{
+    return cv::Matx44f(mRwcx(0,0), mRwcx(0,1), mRwcx(0,2), mOwx(0),
+                       mRwcx(1,0), mRwcx(1,1), mRwcx(1,2), mOwx(1),
+                       mRwcx(2,0), mRwcx(2,1), mRwcx(2,2), mOwx(2),
+                       0.0f, 0.0f, 0.0f, 1.0f);
+}
+
 void Frame::SetNewBias(const IMU::Bias &b)
 {
     mImuBias = b;
@@ -891,25 +912,25 @@ void Frame::UpdatePoseMatrices()
     // mtcw：   世界坐标系到相机坐标系的平移向量
     // mRwc：   相机坐标系到世界坐标系的旋转矩阵
 
+    // 先用定长矩阵计算,避免cv::Mat运算产生的临时矩阵
+    mTcwx = Converter::toMatx44f(mTcw);
+    mRcwx = mTcwx.get_minor<3,3>(0,0);
+    mtcwx = mTcwx.get_minor<3,1>(0,3);
+    // mRcw求逆即可
+    mRwcx = mRcwx.t();
+    // mTcw 求逆后是当前相机坐标系变换到世界坐标系下，对应的光心变换到世界坐标系下就是 mTcw的逆 中对应的平移向量
+    mOwx = -mRwcx*mtcwx;
+
 	//从变换矩阵中提取出旋转矩阵
     //注意，rowRange这个只取到范围的左边界，而不取右边界
     mRcw = mTcw.rowRange(0,3).colRange(0,3);
 
-    // mRcw求逆即可
-    mRwc = mRcw.t();
-
     // 从变换矩阵中提取出旋转矩阵
     mtcw = mTcw.rowRange(0,3).col(3);
 
-    // mTcw 求逆后是当前相机坐标系变换到世界坐标系下，对应的光心变换到世界坐标系下就是 mTcw的逆 中对应的平移向量
-    mOw = -mRcw.t()*mtcw;
-
-    // Static matrix
-    mOwx =  cv::Matx31f(mOw.at<float>(0), mOw.at<float>(1), mOw.at<float>(2));
-    mRcwx = cv::Matx33f(mRcw.at<float>(0,0), mRcw.at<float>(0,1), mRcw.at<float>(0,2),
-                        mRcw.at<float>(1,0), mRcw.at<float>(1,1), mRcw.at<float>(1,2),
-                        mRcw.at<float>(2,0), mRcw.at<float>(2,1), mRcw.at<float>(2,2));
-    mtcwx = cv::Matx31f(mtcw.at<float>(0), mtcw.at<float>(1), mtcw.at<float>(2));
+    // cv::Mat版本供其它模块使用
+    mRwc = cv::Mat(mRwcx);
+    mOw = cv::Mat(mOwx);
 
 }
 
@@ -947,6 +968,15 @@ cv::Mat Frame::GetImuPose()
  * @return false                        地图点不合格，抛弃
  */
 bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
+{
+    // 3D in absolute coordinates
+    // Step 1 获得这个地图点的世界坐标
+    if(Nleft == -1)
+        return isInFrustum(pMP, pMP->GetWorldPos2(), viewingCosLimit);
+    return isInFrustum(pMP, cv::Matx31f(), viewingCosLimit);
+}
+
+bool Frame::isInFrustum(MapPoint *pMP, const cv::Matx31f &Px, float viewingCosLimit)
 {
     if(Nleft == -1){
         // cout << "\na";
@@ -956,12 +986,6 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
         pMP->mTrackProjX = -1;
         pMP->mTrackProjY = -1;
 
-        // 3D in absolute coordinates
-		// Step 1 获得这个地图点的世界坐标
-        cv::Matx31f Px = pMP->GetWorldPos2();
-
-        // cout << "b";
-
         // 3D in camera coordinates
 		// 根据当前帧(粗糙)位姿转化到当前相机坐标系下的三维点Pc
         const cv::Matx31f Pc = mRcwx * Px + mtcwx;
@@ -1056,6 +1080,42 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
     }
 }
 
+/**
+ * @brief 判断包围球是否可能在当前帧视野内,用于成组剔除局部地图点
+ *
+ * 针孔相机的视锥由图像边界(mnMinX,mnMaxX,mnMinY,mnMaxY)反投影得到的四个平面和成像平面z=0围成
+ * 球心到任一平面外侧的距离大于半径时,球内所有点都不可能通过isInFrustum的深度和图像边界检查
+ * @param[in] center    球心,世界坐标
+ * @param[in] radius    半径
+ * @return false        整个球都在视锥外
+ */
+bool Frame::IsSphereInFrustum(const cv::Matx31f &center, const float radius)
+{
+    if(Nleft != -1 || mpCamera->GetType() != mpCamera->CAM_PINHOLE)
+        return true;
+
+    const cv::Matx31f Pc = mRcwx * center + mtcwx;
+    const float x = Pc(0), y = Pc(1), z = Pc(2);
+
+    // 整个球都在相机后方
+    if(z + radius < 0.0f)
+        return false;
+
+    // 视锥侧面 x = a*z, 外侧到平面的距离为 (x - a*z)/sqrt(1+a^2) (右侧), (a*z - x)/sqrt(1+a^2) (左侧)
+    const float aMin = (mnMinX-cx)*invfx, aMax = (mnMaxX-cx)*invfx;
+    const float bMin = (mnMinY-cy)*invfy, bMax = (mnMaxY-cy)*invfy;
+    if(x - aMax*z > radius*sqrt(1.0f+aMax*aMax))
+        return false;
+    if(aMin*z - x > radius*sqrt(1.0f+aMin*aMin))
+        return false;
+    if(y - bMax*z > radius*sqrt(1.0f+bMax*bMax))
+        return false;
+    if(bMin*z - y > radius*sqrt(1.0f+bMin*bMin))
+        return false;
+
+    return true;
+}
+
 bool Frame::ProjectPointDistort(MapPoint* pMP, cv::Point2f &kp, float &u, float &v)
 {
 
@@ -1250,6 +1310,7 @@ bool Frame::PosInGrid(const cv::KeyPoint &kp, int &posX, int &posY)
  */
 void Frame::ComputeBoW()
 {
+    TRACE_SCOPE("Frame::ComputeBoW");
     // 判断是否以前已经计算过了，计算过了就跳过
     if(mBowVec.empty())
     {
@@ -1373,6 +1434,7 @@ void Frame::ComputeImageBounds(const cv::Mat &imLeft)
  */
 void Frame::ComputeStereoMatches()
 {
+    TRACE_SCOPE("Frame::ComputeStereoMatches");
     /*两帧图像稀疏立体匹配（即：ORB特征点匹配，非逐像素的密集匹配，但依然满足行对齐）
      * 输入：两帧立体矫正后的图像img_left 和 img_right 对应的orb特征点集
      * 过程：
@@ -1674,6 +1736,7 @@ cv::Mat Frame::UnprojectStereo(const int &i)
 
 void Frame::ProcessMovingObject(const cv::Mat &imgray)
 {
+    TRACE_SCOPE("Frame::ProcessMovingObject");
 
     // Clear the previous data
     F_prepoint.clear();
@@ -1806,81 +1869,100 @@ void Frame::ProcessMovingObject(const cv::Mat &imgray)
 
 
 //****
+// 更新帧中的object,立即重新生成检测框表并批量标记特征点
+void Frame::SetObjects(const vector<std::shared_ptr<Object>> &vObjects) {
+    objects_cur_ = vObjects;
+    UpdateDetectBoxes();
+}
+
+// 由objects_cur_生成紧凑的检测框表,避免每次判断时拷贝vector<double>,
+// 并一次性标记位于动态(person)和静态(car)检测框内的特征点
+void Frame::UpdateDetectBoxes() {
+    mbDetectBoxesDirty = false;
+    mvDetectBoxes.resize(objects_cur_.size());
+    mvDetectClassBits.resize(objects_cur_.size());
+    mnDetectClassMask = 0;
+    for (size_t k = 0; k < objects_cur_.size(); ++k) {
+        const vector<double> &box = objects_cur_[k]->vdetect_parameter;
+        DetectBox &db = mvDetectBoxes[k];
+        db.left = static_cast<float>(box[0] - 2);
+        db.top = static_cast<float>(box[1] - 2);
+        db.right = static_cast<float>(box[2] + 2);
+        db.bottom = static_cast<float>(box[3] + 2);
+        mvDetectClassBits[k] = Object::ClassBit(objects_cur_[k]->ndetect_class);
+        mnDetectClassMask |= mvDetectClassBits[k];
+    }
+
+    LabelKeyPointsInBoxes(mvKeys, Object::ClassBit(Object::person), vbInDynamic_mvKeys);
+    LabelKeyPointsInBoxes(mvKeys, Object::ClassBit(Object::car), vbInStatic_mvKeys);
+}
+
+// 对所有特征点一次性判断是否位于classMask类别的检测框内
+// 外层遍历检测框,内层对特征点坐标数组做无分支比较,便于编译器向量化
+void Frame::LabelKeyPointsInBoxes(const std::vector<cv::KeyPoint> &vKeys, const unsigned int classMask, std::vector<bool> &vbInBox) const {
+    const size_t nKeys = vKeys.size();
+    vbInBox.assign(nKeys, false);
+    if (nKeys == 0 || !(mnDetectClassMask & classMask))
+        return;
+
+    std::vector<float> vu(nKeys), vv(nKeys);
+    for (size_t i = 0; i < nKeys; ++i) {
+        vu[i] = vKeys[i].pt.x;
+        vv[i] = vKeys[i].pt.y;
+    }
+
+    std::vector<unsigned char> vIn(nKeys, 0);
+    const float *pu = vu.data();
+    const float *pv = vv.data();
+    unsigned char *pIn = vIn.data();
+    for (size_t k = 0; k < mvDetectBoxes.size(); ++k) {
+        if (!(mvDetectClassBits[k] & classMask))
+            continue;
+        const float left = mvDetectBoxes[k].left;
+        const float top = mvDetectBoxes[k].top;
+        const float right = mvDetectBoxes[k].right;
+        const float bottom = mvDetectBoxes[k].bottom;
+        for (size_t i = 0; i < nKeys; ++i)
+            pIn[i] |= (pu[i] > left) & (pu[i] < right) & (pv[i] > top) & (pv[i] < bottom);
+    }
+
+    for (size_t i = 0; i < nKeys; ++i)
+        vbInBox[i] = vIn[i] != 0;
+}
+
 // 判断kp是否在bounding_box_(txt读入的数据)内. objects_cur_存储帧中的object,由frame.cc引入
 // 判断特征点是否在所有的检测框内
 bool Frame::IsInBox(const int& i, int& box_id) {
+    if (mbDetectBoxesDirty)
+        UpdateDetectBoxes();
     const cv::KeyPoint& kp = mvKeysUn[i];
-    float kp_u  = kp.pt.x;
-    float kp_v = kp.pt.y;
-    bool in_box = false;
-    for (int k = 0; k < objects_cur_.size(); ++k) {     //遍历所有物体
-        vector<double> box = objects_cur_[k]->vdetect_parameter;
-        double left = box[0];
-        double top = box[1];
-        double right = box[2];
-        double bottom = box[3];
-        if (kp_u > left - 2 && kp_u < right + 2
-            && kp_v > top - 2 && kp_v < bottom + 2) {
-            in_box = true;
+    const float kp_u = kp.pt.x;
+    const float kp_v = kp.pt.y;
+    for (size_t k = 0; k < mvDetectBoxes.size(); ++k) {     //遍历所有物体
+        const DetectBox &box = mvDetectBoxes[k];
+        if (kp_u > box.left && kp_u < box.right
+            && kp_v > box.top && kp_v < box.bottom) {
             box_id = k;
-            break;
+            return true;
         }
     }
-    return in_box;
+    return false;
 }
 
 //判断kp是否在bounding_box_(txt读入的数据)内. objects_cur_存储帧中的object,由frame.cc引入
 //判断特征点是否在动态的目标框内
 bool Frame::IsInDynamic(const int& i) {
-    const cv::KeyPoint& kp = mvKeys[i];
-    float kp_u  = kp.pt.x;
-    float kp_v = kp.pt.y;
-    bool in_dynamic = false;
-
-    for (int k = 0; k < objects_cur_.size(); ++k) {//遍历所有物体
-        int obj_class = objects_cur_[k]->ndetect_class;
-
-        if (obj_class == 3){
-            vector<double> box = objects_cur_[k]->vdetect_parameter;//获取物体框
-            double left = box[0];
-            double top = box[1];
-            double right = box[2];
-            double bottom = box[3];
-
-            if (kp_u > left - 2 && kp_u < right + 2
-                && kp_v > top - 2 && kp_v < bottom + 2) {
-                in_dynamic = true;
-            }
-        }
-    }
-    return in_dynamic;
+    if (mbDetectBoxesDirty || vbInDynamic_mvKeys.size() != mvKeys.size())
+        UpdateDetectBoxes();
+    return vbInDynamic_mvKeys[i];
 }
 
 //判断kp是否在bounding_box_(txt读入的数据)内. objects_cur_存储帧中的object,由frame.cc引入
 //判断特征点是否在静态的目标框内
 bool Frame::IsInStatic(const int& i) {
-    const cv::KeyPoint& kp = mvKeys[i];
-    float kp_u  = kp.pt.x;
-    float kp_v = kp.pt.y;
-    bool in_static = false;
-
-    for (int k = 0; k < objects_cur_.size(); ++k) {//遍历所有物体
-        int obj_class = objects_cur_[k]->ndetect_class;
-
-        if (obj_class == 1){
-            vector<double> box = objects_cur_[k]->vdetect_parameter;//获取物体框
-            double left = box[0];
-            double top = box[1];
-            double right = box[2];
-            double bottom = box[3];
-
-            if (kp_u > left - 2 && kp_u < right + 2
-                && kp_v > top - 2 && kp_v < bottom + 2) {
-                in_static = true;
-            }
-        }
-    }
-    return in_static;
+    if (mbDetectBoxesDirty || vbInStatic_mvKeys.size() != mvKeys.size())
+        UpdateDetectBoxes();
+    return vbInStatic_mvKeys[i];
 }
 
 
@@ -2130,6 +2212,7 @@ cv::Mat Frame::UnprojectStereoFishEye(const int &i){
 
 int Frame::CheckMovingKeyPoints(const cv::Mat &imrgbd, const cv::Mat &imGray, std::vector<std::vector<cv::KeyPoint>>& mvKeysT,std::vector<cv::Point2f> T)
 {
+    TRACE_SCOPE("Frame::CheckMovingKeyPoints");
     cv::Mat imgbefore = imrgbd.clone();
     cv::Mat img_before_box = imrgbd.clone();
     cv::Mat imgafter = imrgbd.clone();
@@ -0,0 +1,118 @@
+//
+// 输入帧调度: 按时间戳控制输入节奏,跟踪跟不上时按策略丢帧,并统计跟踪延迟
+//
+
+#include "FrameScheduler.h"
+
+#include <thread>
+#include <algorithm>
+
+using namespace std;
+
+namespace ORB_SLAM3
+{
+
+FrameScheduler::FrameScheduler():
+    mPolicy(BLOCK), mMaxLatency(0.1), mRate(0), mbPaceStarted(false), mFirstTimestamp(0), mFirstWallTime(0),
+    mSumLatency(0), mLastSubmittedStamp(0)
+{
+}
+
+double FrameScheduler::Now()
+{
+    return chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void FrameScheduler::SetPolicy(const ePolicy policy, const double maxLatency)
+{
+    unique_lock<mutex> lock(mMutex);
+    mPolicy = policy;
+    mMaxLatency = maxLatency;
+}
+
+FrameScheduler::ePolicy FrameScheduler::GetPolicy()
+{
+    unique_lock<mutex> lock(mMutex);
+    return mPolicy;
+}
+
+void FrameScheduler::SetPacing(const double rate)
+{
+    unique_lock<mutex> lock(mMutex);
+    mRate = rate;
+    mbPaceStarted = false;
+}
+
+double FrameScheduler::Pace(const double timestamp)
+{
+    double target;
+    {
+        unique_lock<mutex> lock(mMutex);
+        const double now = Now();
+        if(mRate <= 0)
+            return now;
+
+        // 第一帧作为时间基准
+        if(!mbPaceStarted)
+        {
+            mbPaceStarted = true;
+            mFirstTimestamp = timestamp;
+            mFirstWallTime = now;
+            return now;
+        }
+        target = mFirstWallTime + (timestamp - mFirstTimestamp) / mRate;
+        if(target <= now)
+            return now;
+    }
+
+    this_thread::sleep_for(chrono::duration<double>(target - Now()));
+    return Now();
+}
+
+bool FrameScheduler::IsStale(const double submitTime)
+{
+    unique_lock<mutex> lock(mMutex);
+    return mPolicy == BOUNDED_LATENCY && Now() - submitTime > mMaxLatency;
+}
+
+void FrameScheduler::RecordSubmitted(const double timestamp)
+{
+    unique_lock<mutex> lock(mMutex);
+    mStats.nSubmitted++;
+    mLastSubmittedStamp = timestamp;
+}
+
+void FrameScheduler::RecordDropped()
+{
+    unique_lock<mutex> lock(mMutex);
+    mStats.nDropped++;
+}
+
+void FrameScheduler::RecordTracked(const double timestamp, const double submitTime)
+{
+    unique_lock<mutex> lock(mMutex);
+    const double latency = Now() - submitTime;
+    mStats.nTracked++;
+    mStats.lastLatency = latency;
+    mStats.maxLatency = max(mStats.maxLatency, latency);
+    mSumLatency += latency;
+    mStats.meanLatency = mSumLatency / mStats.nTracked;
+    mStats.streamLag = mLastSubmittedStamp - timestamp;
+}
+
+FrameScheduler::Stats FrameScheduler::GetStats()
+{
+    unique_lock<mutex> lock(mMutex);
+    return mStats;
+}
+
+void FrameScheduler::Reset()
+{
+    unique_lock<mutex> lock(mMutex);
+    mStats = Stats();
+    mSumLatency = 0;
+    mLastSubmittedStamp = 0;
+    mbPaceStarted = false;
+}
+
+} // namespace ORB_SLAM3
@@ -0,0 +1,777 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "IncrementalBA.h"
+
+#include <algorithm>
+#include <climits>
+
+#include <Eigen/Dense>
+
+#include "CameraModels/GeometricCamera.h"
+
+namespace ORB_SLAM3
+{
+
+// 增量超过阈值的变量在下一次迭代重新线性化: 旋转(弧度)、平移和地图点坐标(地图单位)
+static const double kRelinRot = 2e-3;
+static const double kRelinTrans = 5e-3;
+static const double kRelinPoint = 5e-3;
+// 对角块的相对阻尼,单目的尺度等不可观方向上分解仍然正定
+static const double kDamping = 1e-4;
+// 每隔这么多次调用整体重建一次
+static const int kRebuildPeriod = 10;
+
+static bool PoseExceeds(const IncrementalBA::Vector6d &d)
+{
+    return d.head<3>().norm() > kRelinRot || d.tail<3>().norm() > kRelinTrans;
+}
+
+IncrementalBA::IncrementalBA(): mpMap(static_cast<Map*>(NULL)), mnAlivePoints(0), mnDeadCols(0), mnFirstDirty(0), mnCalls(0),
+    mStats()
+{
+}
+
+void IncrementalBA::Reset(Map *pMap)
+{
+    mpMap = pMap;
+    mvPoses.clear();
+    mvPoints.clear();
+    mmPoseIdx.clear();
+    mmPointIdx.clear();
+    mnAlivePoints = 0;
+    mvColPose.clear();
+    mvH.clear();
+    mvB.clear();
+    mnDeadCols = 0;
+    mvL.clear();
+    mvLRowCols.clear();
+    mvY.clear();
+    mvDx.clear();
+    mnFirstDirty = 0;
+    mnCalls = 0;
+    mStats = Stats();
+}
+
+void IncrementalBA::BeginSync()
+{
+    for(size_t i = 0; i < mvPoses.size(); i++)
+        mvPoses[i].bSeen = false;
+    for(size_t i = 0; i < mvPoints.size(); i++)
+        mvPoints[i].bSeen = false;
+
+    mStats.nRelinPoses = 0;
+    mStats.nRelinPoints = 0;
+    mStats.nRefactored = 0;
+    mStats.bRebuilt = false;
+}
+
+int IncrementalBA::AddColumn(const int nPose)
+{
+    const int col = mvColPose.size();
+    mvColPose.push_back(nPose);
+    mvH.emplace_back();
+    mvB.push_back(Vector6d::Zero());
+    mvL.emplace_back();
+    mvLRowCols.emplace_back();
+    mvY.push_back(Vector6d::Zero());
+    mvDx.push_back(Vector6d::Zero());
+    mnFirstDirty = std::min(mnFirstDirty, col);
+    return col;
+}
+
+void IncrementalBA::SetPose(const unsigned long nId, const g2o::SE3Quat &Tcw, const bool bFixed, const Calibration &calib)
+{
+    std::unordered_map<unsigned long, int>::iterator it = mmPoseIdx.find(nId);
+    if(it == mmPoseIdx.end())
+    {
+        Pose pose;
+        pose.nId = nId;
+        pose.lin = Tcw;
+        pose.linMap = Tcw;
+        pose.delta.setZero();
+        pose.calib = calib;
+        pose.bFixed = bFixed;
+        pose.bAlive = true;
+        pose.bSeen = true;
+        pose.bRelin = false;
+        pose.bMapMoved = false;
+
+        const int idx = mvPoses.size();
+        pose.nCol = bFixed ? -1 : AddColumn(idx);
+        mvPoses.push_back(pose);
+        mmPoseIdx[nId] = idx;
+        mStats.nRelinPoses++;
+        return;
+    }
+
+    Pose &pose = mvPoses[it->second];
+    pose.bSeen = true;
+
+    // 地图中的位姿被局部BA或闭环矫正改动过,与当前估计相差太大时以地图为准重新线性化
+    const g2o::SE3Quat est = g2o::SE3Quat::exp(pose.delta) * pose.lin;
+    if(PoseExceeds((Tcw * est.inverse()).log()))
+    {
+        pose.linMap = Tcw;
+        pose.bMapMoved = true;
+        pose.bRelin = true;
+    }
+}
+
+void IncrementalBA::SetPoint(const unsigned long nId, const Eigen::Vector3d &Xw, const Observations &vObs)
+{
+    // 只保留本次同步中出现过的关键帧上的观测
+    Factors factors;
+    factors.reserve(vObs.size());
+    for(size_t i = 0; i < vObs.size(); i++)
+    {
+        std::unordered_map<unsigned long, int>::const_iterator itPose = mmPoseIdx.find(vObs[i].nPoseId);
+        if(itPose == mmPoseIdx.end() || !mvPoses[itPose->second].bSeen)
+            continue;
+
+        Factor factor;
+        factor.nPose = itPose->second;
+        factor.obs = vObs[i].obs;
+        factor.invSigma2 = vObs[i].invSigma2;
+        factors.push_back(factor);
+    }
+
+    int idx;
+    std::unordered_map<unsigned long, int>::iterator it = mmPointIdx.find(nId);
+    if(it == mmPointIdx.end())
+    {
+        Point point;
+        point.nId = nId;
+        point.lin = Xw;
+        point.linMap = Xw;
+        point.delta.setZero();
+        point.HppInv.setZero();
+        point.bp.setZero();
+        point.bAlive = true;
+        point.bSeen = true;
+        point.bRelin = false;
+        point.bMapMoved = false;
+        point.bActive = false;
+
+        idx = mvPoints.size();
+        mvPoints.push_back(point);
+        mmPointIdx[nId] = idx;
+        mnAlivePoints++;
+        mStats.nRelinPoints++;
+    }
+    else
+    {
+        idx = it->second;
+        Point &point = mvPoints[idx];
+        point.bSeen = true;
+
+        const bool bMoved = (Xw - (point.lin + point.delta)).norm() > kRelinPoint;
+
+        bool bSame = factors.size() == point.factors.size();
+        for(size_t i = 0; bSame && i < factors.size(); i++)
+        {
+            const Factor &a = factors[i];
+            const Factor &b = point.factors[i];
+            bSame = a.nPose == b.nPose && a.obs == b.obs && a.invSigma2 == b.invSigma2;
+        }
+
+        if(bSame)
+        {
+            if(bMoved)
+            {
+                point.linMap = Xw;
+                point.bMapMoved = true;
+                point.bRelin = true;
+            }
+            return;
+        }
+
+        // 观测变了: 移出旧的贡献,重新线性化所有因子
+        if(point.bActive)
+        {
+            AccumulatePoint(point, -1.0);
+            point.bActive = false;
+        }
+        if(bMoved)
+        {
+            point.lin = Xw;
+            point.delta.setZero();
+            point.bRelin = false;
+            point.bMapMoved = false;
+            mStats.nRelinPoints++;
+        }
+    }
+
+    Point &point = mvPoints[idx];
+    point.factors.swap(factors);
+    for(size_t i = 0; i < point.factors.size(); i++)
+        Linearize(mvPoses[point.factors[i].nPose], point, point.factors[i]);
+
+    if(point.factors.size() >= 2)
+    {
+        AccumulatePoint(point, 1.0);
+        point.bActive = true;
+    }
+}
+
+void IncrementalBA::EndSync()
+{
+    for(size_t i = 0; i < mvPoses.size(); i++)
+    {
+        if(mvPoses[i].bAlive && !mvPoses[i].bSeen)
+            RemovePose(i);
+    }
+
+    for(size_t i = 0; i < mvPoints.size(); i++)
+    {
+        Point &point = mvPoints[i];
+        if(!point.bAlive || point.bSeen)
+            continue;
+
+        if(point.bActive)
+            AccumulatePoint(point, -1.0);
+        point.bActive = false;
+        point.bAlive = false;
+        point.factors.clear();
+        mmPointIdx.erase(point.nId);
+        mnAlivePoints--;
+    }
+}
+
+void IncrementalBA::RemovePose(const int idx)
+{
+    for(size_t i = 0; i < mvPoints.size(); i++)
+    {
+        Point &point = mvPoints[i];
+        if(!point.bAlive)
+            continue;
+
+        bool bObserved = false;
+        for(size_t j = 0; j < point.factors.size() && !bObserved; j++)
+            bObserved = point.factors[j].nPose == idx;
+        if(!bObserved)
+            continue;
+
+        if(point.bActive)
+        {
+            AccumulatePoint(point, -1.0);
+            point.bActive = false;
+        }
+        point.factors.erase(std::remove_if(point.factors.begin(), point.factors.end(),
+                                           [idx](const Factor &f) { return f.nPose == idx; }),
+                            point.factors.end());
+        if(point.factors.size() >= 2)
+        {
+            AccumulatePoint(point, 1.0);
+            point.bActive = true;
+        }
+    }
+
+    Pose &pose = mvPoses[idx];
+    if(pose.nCol >= 0)
+    {
+        // 关联的贡献都已移出,除了舍入误差这一列已经是0,直接清空
+        const int c = pose.nCol;
+        mvH[c].clear();
+        mvB[c].setZero();
+        for(int i = 0; i < c; i++)
+        {
+            if(mvH[i].erase(c))
+                mnFirstDirty = std::min(mnFirstDirty, i);
+        }
+        mnFirstDirty = std::min(mnFirstDirty, c);
+        mvColPose[c] = -1;
+        mnDeadCols++;
+        pose.nCol = -1;
+    }
+    pose.bAlive = false;
+    mmPoseIdx.erase(pose.nId);
+}
+
+void IncrementalBA::Linearize(const Pose &pose, const Point &point, Factor &factor) const
+{
+    const Eigen::Matrix3d R = pose.lin.rotation().toRotationMatrix();
+    const Eigen::Vector3d Xc = R * point.lin + pose.lin.translation();
+    const double x = Xc[0];
+    const double y = Xc[1];
+    const double invz = 1.0 / Xc[2];
+    const double invz_2 = invz * invz;
+    const Calibration &K = pose.calib;
+    const bool bStereo = factor.obs[2] >= 0;
+
+    // 投影关于相机坐标的雅克比
+    Eigen::Matrix3d P = Eigen::Matrix3d::Zero();
+    if(!bStereo && K.pCamera)
+    {
+        const Eigen::Vector2d uv = K.pCamera->project(Xc);
+        factor.e << factor.obs[0] - uv[0], factor.obs[1] - uv[1], 0.0;
+        P.topRows<2>() = K.pCamera->projectJac(Xc);
+    }
+    else
+    {
+        const double u = K.fx * x * invz + K.cx;
+        const double v = K.fy * y * invz + K.cy;
+        factor.e << factor.obs[0] - u, factor.obs[1] - v, 0.0;
+        P(0, 0) = K.fx * invz;
+        P(0, 2) = -K.fx * x * invz_2;
+        P(1, 1) = K.fy * invz;
+        P(1, 2) = -K.fy * y * invz_2;
+        if(bStereo)
+        {
+            factor.e[2] = factor.obs[2] - (u - K.bf * invz);
+            P(2, 0) = P(0, 0);
+            P(2, 2) = P(0, 2) + K.bf * invz_2;
+        }
+    }
+
+    // 与 EdgeSE3ProjectXYZ::linearizeOplus 相同: 误差关于位姿左扰动的雅克比 -P*[-Xc^ I],关于地图点的雅克比 -P*R
+    for(int r = 0; r < 3; r++)
+    {
+        const double p0 = P(r, 0), p1 = P(r, 1), p2 = P(r, 2);
+        factor.Jc(r, 0) = p1 * Xc[2] - p2 * y;
+        factor.Jc(r, 1) = p2 * x - p0 * Xc[2];
+        factor.Jc(r, 2) = p0 * y - p1 * x;
+        factor.Jc(r, 3) = -p0;
+        factor.Jc(r, 4) = -p1;
+        factor.Jc(r, 5) = -p2;
+    }
+    factor.Jp = -P * R;
+}
+
+void IncrementalBA::AddBlock(const int r, const int c, const Matrix6d &B)
+{
+    BlockColumn &column = r >= c ? mvH[c] : mvH[r];
+    const int row = r >= c ? r : c;
+    BlockColumn::iterator it = column.find(row);
+    if(it == column.end())
+        column.emplace(row, r >= c ? B : Matrix6d(B.transpose()));
+    else if(r >= c)
+        it->second += B;
+    else
+        it->second += B.transpose();
+}
+
+void IncrementalBA::AccumulatePoint(Point &point, const double sign)
+{
+    const Factors &factors = point.factors;
+
+    // 加入时计算并保存Hpp^-1和bp,移出时用同一组值,保证加减完全抵消
+    if(sign > 0)
+    {
+        Eigen::Matrix3d Hpp = Eigen::Matrix3d::Zero();
+        Eigen::Vector3d bp = Eigen::Vector3d::Zero();
+        for(size_t i = 0; i < factors.size(); i++)
+        {
+            Hpp.noalias() += factors[i].invSigma2 * factors[i].Jp.transpose() * factors[i].Jp;
+            bp.noalias() -= factors[i].invSigma2 * factors[i].Jp.transpose() * factors[i].e;
+        }
+        Hpp.diagonal() *= 1.0 + kDamping;
+        point.HppInv = Hpp.inverse();
+        point.bp = bp;
+    }
+
+    // H_cc -= W*Hpp^-1*W^T, b_c -= W*Hpp^-1*bp, 其中 W = Hcp
+    const size_t N = factors.size();
+    mvW.resize(N);
+    mvWH.resize(N);
+    int nFirst = INT_MAX;
+    for(size_t i = 0; i < N; i++)
+    {
+        const Factor &f = factors[i];
+        const int col = mvPoses[f.nPose].nCol;
+        if(col < 0)
+            continue;
+
+        const Eigen::Matrix<double, 6, 3> JcT = f.Jc.transpose();
+        mvW[i].noalias() = f.invSigma2 * JcT * f.Jp;
+        mvWH[i].noalias() = mvW[i] * point.HppInv;
+        mvB[col] += sign * (-f.invSigma2 * JcT * f.e - mvWH[i] * point.bp);
+        nFirst = std::min(nFirst, col);
+    }
+
+    for(size_t i = 0; i < N; i++)
+    {
+        const int ci = mvPoses[factors[i].nPose].nCol;
+        if(ci < 0)
+            continue;
+
+        for(size_t j = 0; j <= i; j++)
+        {
+            const int cj = mvPoses[factors[j].nPose].nCol;
+            if(cj < 0)
+                continue;
+
+            Matrix6d B = -mvWH[i] * mvW[j].transpose();
+            if(i == j)
+                B.noalias() += factors[i].invSigma2 * factors[i].Jc.transpose() * factors[i].Jc;
+            AddBlock(ci, cj, sign * B);
+        }
+    }
+
+    if(nFirst < mnFirstDirty)
+        mnFirstDirty = nFirst;
+}
+
+void IncrementalBA::Relinearize()
+{
+    std::vector<char> vbPose(mvPoses.size(), 0);
+    bool bAnyPose = false;
+    for(size_t i = 0; i < mvPoses.size(); i++)
+    {
+        if(mvPoses[i].bAlive && mvPoses[i].bRelin)
+        {
+            vbPose[i] = 1;
+            bAnyPose = true;
+        }
+    }
+
+    // 先移出所有受影响地图点的贡献,它们的因子要在新的线性化点处重算
+    std::vector<int> vAffected;
+    for(size_t i = 0; i < mvPoints.size(); i++)
+    {
+        Point &point = mvPoints[i];
+        if(!point.bAlive)
+            continue;
+
+        bool bAffected = point.bRelin;
+        for(size_t j = 0; !bAffected && bAnyPose && j < point.factors.size(); j++)
+            bAffected = vbPose[point.factors[j].nPose];
+        if(!bAffected)
+            continue;
+
+        if(point.bActive)
+        {
+            AccumulatePoint(point, -1.0);
+            point.bActive = false;
+        }
+        vAffected.push_back(i);
+    }
+
+    for(size_t i = 0; i < mvPoses.size(); i++)
+    {
+        if(!vbPose[i])
+            continue;
+
+        Pose &pose = mvPoses[i];
+        pose.lin = pose.bMapMoved ? pose.linMap : g2o::SE3Quat::exp(pose.delta) * pose.lin;
+        pose.delta.setZero();
+        pose.bRelin = false;
+        pose.bMapMoved = false;
+        mStats.nRelinPoses++;
+    }
+
+    for(size_t k = 0; k < vAffected.size(); k++)
+    {
+        Point &point = mvPoints[vAffected[k]];
+        if(point.bRelin)
+        {
+            point.lin = point.bMapMoved ? point.linMap : Eigen::Vector3d(point.lin + point.delta);
+            point.delta.setZero();
+            point.bRelin = false;
+            point.bMapMoved = false;
+            mStats.nRelinPoints++;
+        }
+
+        for(size_t j = 0; j < point.factors.size(); j++)
+            Linearize(mvPoses[point.factors[j].nPose], point, point.factors[j]);
+        if(point.factors.size() >= 2)
+        {
+            AccumulatePoint(point, 1.0);
+            point.bActive = true;
+        }
+    }
+}
+
+void IncrementalBA::Factorize()
+{
+    const int n = mvColPose.size();
+    const int k = mnFirstDirty;
+    if(k >= n)
+        return;
+
+    // 第k列之前的L不变,去掉后面各行中来自第k列及以后的记录
+    for(int r = k; r < n; r++)
+    {
+        std::vector<int> &vCols = mvLRowCols[r];
+        vCols.erase(std::lower_bound(vCols.begin(), vCols.end(), k), vCols.end());
+    }
+
+    mvWork.resize(n);
+    mvbWork.resize(n, 0);
+
+    // 左视(left-looking)的块Cholesky: L(:,j) 由 H(:,j) 减去前面各列的贡献得到
+    for(int j = k; j < n; j++)
+    {
+        mvWorkRows.clear();
+        for(BlockColumn::const_iterator it = mvH[j].begin(); it != mvH[j].end(); ++it)
+        {
+            mvWork[it->first] = it->second;
+            mvbWork[it->first] = 1;
+            mvWorkRows.push_back(it->first);
+        }
+        if(!mvbWork[j])
+        {
+            mvWork[j].setZero();
+            mvbWork[j] = 1;
+            mvWorkRows.push_back(j);
+        }
+
+        // 没有任何约束的列(已删除的关键帧)取单位阵
+        Matrix6d &Hjj = mvWork[j];
+        if(Hjj.diagonal().maxCoeff() <= 0)
+            Hjj.setIdentity();
+        else
+            Hjj.diagonal() *= 1.0 + kDamping;
+
+        const std::vector<int> &vCols = mvLRowCols[j];
+        for(size_t q = 0; q < vCols.size(); q++)
+        {
+            const LColumn &Li = mvL[vCols[q]];
+            const size_t pos = std::lower_bound(Li.rows.begin(), Li.rows.end(), j) - Li.rows.begin();
+            const Matrix6d LjiT = Li.blocks[pos].transpose();
+            for(size_t p = pos; p < Li.rows.size(); p++)
+            {
+                const int r = Li.rows[p];
+                if(!mvbWork[r])
+                {
+                    mvWork[r].setZero();
+                    mvbWork[r] = 1;
+                    mvWorkRows.push_back(r);
+                }
+                mvWork[r].noalias() -= Li.blocks[p] * LjiT;
+            }
+        }
+
+        LColumn &Lj = mvL[j];
+        Eigen::LLT<Matrix6d> llt(mvWork[j]);
+        if(llt.info() != Eigen::Success)
+        {
+            // 舍入误差导致不正定时加大阻尼
+            Matrix6d Djj = mvWork[j];
+            double eps = 1e-9 * std::max(Djj.diagonal().cwiseAbs().maxCoeff(), 1.0);
+            for(int t = 0; t < 10 && llt.info() != Eigen::Success; t++)
+            {
+                Djj.diagonal().array() += eps;
+                llt.compute(Djj);
+                eps *= 10.0;
+            }
+        }
+        Lj.D = llt.matrixL();
+
+        std::sort(mvWorkRows.begin(), mvWorkRows.end());
+        Lj.rows.clear();
+        Lj.blocks.clear();
+        for(size_t p = 0; p < mvWorkRows.size(); p++)
+        {
+            const int r = mvWorkRows[p];
+            mvbWork[r] = 0;
+            if(r == j)
+                continue;
+
+            // L(r,j) = W(r)*D^-T
+            Lj.rows.push_back(r);
+            Lj.blocks.push_back(Lj.D.triangularView<Eigen::Lower>().solve(mvWork[r].transpose()).transpose());
+            mvLRowCols[r].push_back(j);
+        }
+    }
+
+    mStats.nRefactored += n - k;
+}
+
+bool IncrementalBA::Solve()
+{
+    const int n = mvColPose.size();
+
+    // 前代 L*y = b,第 mnFirstDirty 列之前的结果不变
+    for(int j = std::min(mnFirstDirty, n); j < n; j++)
+    {
+        Vector6d y = mvB[j];
+        const std::vector<int> &vCols = mvLRowCols[j];
+        for(size_t q = 0; q < vCols.size(); q++)
+        {
+            const LColumn &Li = mvL[vCols[q]];
+            const size_t pos = std::lower_bound(Li.rows.begin(), Li.rows.end(), j) - Li.rows.begin();
+            y.noalias() -= Li.blocks[pos] * mvY[vCols[q]];
+        }
+        mvY[j] = mvL[j].D.triangularView<Eigen::Lower>().solve(y);
+    }
+    mnFirstDirty = n;
+
+    // 回代 L^T*dx = y
+    for(int j = n - 1; j >= 0; j--)
+    {
+        const LColumn &Lj = mvL[j];
+        Vector6d y = mvY[j];
+        for(size_t p = 0; p < Lj.rows.size(); p++)
+            y.noalias() -= Lj.blocks[p].transpose() * mvDx[Lj.rows[p]];
+        mvDx[j] = Lj.D.transpose().triangularView<Eigen::Upper>().solve(y);
+    }
+
+    bool bRelin = false;
+    for(size_t i = 0; i < mvPoses.size(); i++)
+    {
+        Pose &pose = mvPoses[i];
+        if(!pose.bAlive)
+            continue;
+
+        if(pose.nCol >= 0)
+            pose.delta = mvDx[pose.nCol];
+        else
+            pose.delta.setZero();
+        if(PoseExceeds(pose.delta))
+        {
+            pose.bRelin = true;
+            bRelin = true;
+        }
+    }
+
+    // 地图点增量: dp = Hpp^-1*(bp - Hpc*dc)
+    for(size_t i = 0; i < mvPoints.size(); i++)
+    {
+        Point &point = mvPoints[i];
+        if(!point.bAlive || !point.bActive)
+            continue;
+
+        Eigen::Vector3d r = point.bp;
+        for(size_t j = 0; j < point.factors.size(); j++)
+        {
+            const Factor &f = point.factors[j];
+            const int col = mvPoses[f.nPose].nCol;
+            if(col >= 0)
+                r.noalias() -= f.invSigma2 * f.Jp.transpose() * (f.Jc * mvDx[col]);
+        }
+        point.delta = point.HppInv * r;
+        if(point.delta.norm() > kRelinPoint)
+        {
+            point.bRelin = true;
+            bRelin = true;
+        }
+    }
+
+    return bRelin;
+}
+
+void IncrementalBA::Rebuild()
+{
+    // 压缩已删除的变量
+    std::vector<int> vPoseMap(mvPoses.size(), -1);
+    std::vector<Pose, Eigen::aligned_allocator<Pose> > vPoses;
+    vPoses.reserve(mvPoses.size());
+    mmPoseIdx.clear();
+    for(size_t i = 0; i < mvPoses.size(); i++)
+    {
+        if(!mvPoses[i].bAlive)
+            continue;
+        vPoseMap[i] = vPoses.size();
+        mmPoseIdx[mvPoses[i].nId] = vPoses.size();
+        vPoses.push_back(mvPoses[i]);
+    }
+    mvPoses.swap(vPoses);
+
+    std::vector<Point, Eigen::aligned_allocator<Point> > vPoints;
+    vPoints.reserve(mnAlivePoints);
+    mmPointIdx.clear();
+    for(size_t i = 0; i < mvPoints.size(); i++)
+    {
+        if(!mvPoints[i].bAlive)
+            continue;
+        mmPointIdx[mvPoints[i].nId] = vPoints.size();
+        vPoints.push_back(mvPoints[i]);
+        Factors &factors = vPoints.back().factors;
+        for(size_t j = 0; j < factors.size(); j++)
+            factors[j].nPose = vPoseMap[factors[j].nPose];
+    }
+    mvPoints.swap(vPoints);
+
+    // 按关键帧加入的顺序重新分配列,从保存的线性化结果重新累加
+    mvColPose.clear();
+    mvH.clear();
+    mvB.clear();
+    mvL.clear();
+    mvLRowCols.clear();
+    mvY.clear();
+    mvDx.clear();
+    mnDeadCols = 0;
+    for(size_t i = 0; i < mvPoses.size(); i++)
+        mvPoses[i].nCol = mvPoses[i].bFixed ? -1 : AddColumn(i);
+    mnFirstDirty = 0;
+
+    for(size_t i = 0; i < mvPoints.size(); i++)
+    {
+        if(mvPoints[i].bActive)
+            AccumulatePoint(mvPoints[i], 1.0);
+    }
+
+    mStats.bRebuilt = true;
+}
+
+int IncrementalBA::Optimize(const int nIterations, bool *pbStopFlag)
+{
+    mnCalls++;
+    if(mnCalls % kRebuildPeriod == 0 || mnDeadCols * 5 > (int)mvColPose.size())
+        Rebuild();
+
+    int it = 0;
+    while(it < nIterations && !(pbStopFlag && *pbStopFlag))
+    {
+        Relinearize();
+        Factorize();
+        const bool bRelin = Solve();
+        it++;
+        if(!bRelin)
+            break;
+    }
+
+    mStats.nPoses = mmPoseIdx.size();
+    mStats.nPoints = 0;
+    mStats.nFactors = 0;
+    for(size_t i = 0; i < mvPoints.size(); i++)
+    {
+        if(!mvPoints[i].bAlive || !mvPoints[i].bActive)
+            continue;
+        mStats.nPoints++;
+        mStats.nFactors += mvPoints[i].factors.size();
+    }
+    mStats.nColumns = mvColPose.size() - mnDeadCols;
+
+    return it;
+}
+
+bool IncrementalBA::GetPose(const unsigned long nId, g2o::SE3Quat &Tcw) const
+{
+    std::unordered_map<unsigned long, int>::const_iterator it = mmPoseIdx.find(nId);
+    if(it == mmPoseIdx.end())
+        return false;
+
+    const Pose &pose = mvPoses[it->second];
+    Tcw = g2o::SE3Quat::exp(pose.delta) * pose.lin;
+    return true;
+}
+
+bool IncrementalBA::GetPoint(const unsigned long nId, Eigen::Vector3d &Xw) const
+{
+    std::unordered_map<unsigned long, int>::const_iterator it = mmPointIdx.find(nId);
+    if(it == mmPointIdx.end() || !mvPoints[it->second].bActive)
+        return false;
+
+    const Point &point = mvPoints[it->second];
+    Xw = point.lin + point.delta;
+    return true;
+}
+
+} // namespace ORB_SLAM3
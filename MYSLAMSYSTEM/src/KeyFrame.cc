@@ -39,15 +39,14 @@ namespace ORB_SLAM3
 KeyFrame::KeyFrame():
         mnFrameId(0),  mTimeStamp(0), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
         mfGridElementWidthInv(0), mfGridElementHeightInv(0),
-        mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0), mnBALocalForMerge(0),
-        mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnMergeQuery(0), mnMergeWords(0), mnBAGlobalForKF(0),
-        fx(0), fy(0), cx(0), cy(0), invfx(0), invfy(0), mnPlaceRecognitionQuery(0), mnPlaceRecognitionWords(0), mPlaceRecognitionScore(0),
+        mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnTrackVotesEpoch(0), mnTrackVotes(0), mnBALocalForKF(0), mnBAFixedForKF(0), mnBALocalForMerge(0), mnBAGlobalForKF(0),
+        fx(0), fy(0), cx(0), cy(0), invfx(0), invfy(0),
         mbf(0), mb(0), mThDepth(0), N(0), mvKeys(static_cast<vector<cv::KeyPoint> >(NULL)), mvKeysUn(static_cast<vector<cv::KeyPoint> >(NULL)),
         mvuRight(static_cast<vector<float> >(NULL)), mvDepth(static_cast<vector<float> >(NULL)), /*mDescriptors(NULL),*/
         /*mBowVec(NULL), mFeatVec(NULL),*/ mnScaleLevels(0), mfScaleFactor(0),
         mfLogScaleFactor(0), mvScaleFactors(0), mvLevelSigma2(0),
         mvInvLevelSigma2(0), mnMinX(0), mnMinY(0), mnMaxX(0),
-        mnMaxY(0), /*mK(NULL),*/  mPrevKF(static_cast<KeyFrame*>(NULL)), mNextKF(static_cast<KeyFrame*>(NULL)), mbFirstConnection(true), mpParent(NULL), mbNotErase(false),
+        mnMaxY(0), /*mK(NULL),*/  mPrevKF(static_cast<KeyFrame*>(NULL)), mNextKF(static_cast<KeyFrame*>(NULL)), mbFirstConnection(true), mpParent(NULL), mnConnectionsVersion(0), mbNotErase(false),
         mbToBeErased(false), mbBad(false), mHalfBaseline(0), mbCurrentPlaceRecognition(false), mbHasHessian(false), mnMergeCorrectedForKF(0),
         NLeft(0),NRight(0), mnNumberOfOpt(0), imgH(0), imgW(0)
 {
@@ -57,8 +56,7 @@ KeyFrame::KeyFrame():
 KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     bImu(pMap->isImuInitialized()), mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
     mfGridElementWidthInv(F.mfGridElementWidthInv), mfGridElementHeightInv(F.mfGridElementHeightInv),
-    mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0), mnBALocalForMerge(0),
-    mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnBAGlobalForKF(0), mnPlaceRecognitionQuery(0), mnPlaceRecognitionWords(0), mPlaceRecognitionScore(0),
+    mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnTrackVotesEpoch(0), mnTrackVotes(0), mnBALocalForKF(0), mnBAFixedForKF(0), mnBALocalForMerge(0), mnBAGlobalForKF(0),
     fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), invfx(F.invfx), invfy(F.invfy),
     mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(F.mvKeys), mvKeysUn(F.mvKeysUn),
     mvuRight(F.mvuRight), mvDepth(F.mvDepth), mDescriptors(F.mDescriptors.clone()),
@@ -67,7 +65,7 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     mvInvLevelSigma2(F.mvInvLevelSigma2), mnMinX(F.mnMinX), mnMinY(F.mnMinY), mnMaxX(F.mnMaxX),
     mnMaxY(F.mnMaxY), mK(F.mK), mPrevKF(NULL), mNextKF(NULL), mpImuPreintegrated(F.mpImuPreintegrated),
     mImuCalib(F.mImuCalib), mvpMapPoints(F.mvpMapPoints), mpKeyFrameDB(pKFDB),
-    mpORBvocabulary(F.mpORBvocabulary), mbFirstConnection(true), mpParent(NULL), mDistCoef(F.mDistCoef), mbNotErase(false), mnDataset(F.mnDataset),
+    mpORBvocabulary(F.mpORBvocabulary), mbFirstConnection(true), mpParent(NULL), mnConnectionsVersion(0), mDistCoef(F.mDistCoef), mbNotErase(false), mnDataset(F.mnDataset),
     mbToBeErased(false), mbBad(false), mHalfBaseline(F.mb/2), mpMap(pMap), mbCurrentPlaceRecognition(false), mNameFile(F.mNameFile), mbHasHessian(false), mnMergeCorrectedForKF(0),
     mpCamera(F.mpCamera), mpCamera2(F.mpCamera2),
     mvLeftToRightMatch(F.mvLeftToRightMatch),mvRightToLeftMatch(F.mvRightToLeftMatch),mTlr(F.mTlr.clone()),
@@ -118,8 +116,7 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
 KeyFrame::KeyFrame(Frame &F, Map* pMap, KeyFrameDatabase* pKFDB, const cv::Mat &imgRGB, const cv::Mat &imgRGB_r):
         bImu(pMap->isImuInitialized()), mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
         mfGridElementWidthInv(F.mfGridElementWidthInv), mfGridElementHeightInv(F.mfGridElementHeightInv),
-        mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0), mnBALocalForMerge(0),
-        mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnBAGlobalForKF(0), mnPlaceRecognitionQuery(0), mnPlaceRecognitionWords(0), mPlaceRecognitionScore(0),
+        mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnTrackVotesEpoch(0), mnTrackVotes(0), mnBALocalForKF(0), mnBAFixedForKF(0), mnBALocalForMerge(0), mnBAGlobalForKF(0),
         fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), invfx(F.invfx), invfy(F.invfy),
         mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(F.mvKeys), mvKeysUn(F.mvKeysUn),
         mvuRight(F.mvuRight), mvDepth(F.mvDepth), mDescriptors(F.mDescriptors.clone()),
@@ -128,7 +125,7 @@ KeyFrame::KeyFrame(Frame &F, Map* pMap, KeyFrameDatabase* pKFDB, const cv::Mat &
         mvInvLevelSigma2(F.mvInvLevelSigma2), mnMinX(F.mnMinX), mnMinY(F.mnMinY), mnMaxX(F.mnMaxX),
         mnMaxY(F.mnMaxY), mK(F.mK), mPrevKF(NULL), mNextKF(NULL), mpImuPreintegrated(F.mpImuPreintegrated),
         mImuCalib(F.mImuCalib), mvpMapPoints(F.mvpMapPoints), mpKeyFrameDB(pKFDB),
-        mpORBvocabulary(F.mpORBvocabulary), mbFirstConnection(true), mpParent(NULL), mDistCoef(F.mDistCoef), mbNotErase(false), mnDataset(F.mnDataset),
+        mpORBvocabulary(F.mpORBvocabulary), mbFirstConnection(true), mpParent(NULL), mnConnectionsVersion(0), mDistCoef(F.mDistCoef), mbNotErase(false), mnDataset(F.mnDataset),
         mbToBeErased(false), mbBad(false), mHalfBaseline(F.mb/2), mpMap(pMap), mbCurrentPlaceRecognition(false), mNameFile(F.mNameFile), mbHasHessian(false), mnMergeCorrectedForKF(0),
         mpCamera(F.mpCamera), mpCamera2(F.mpCamera2),
         mvLeftToRightMatch(F.mvLeftToRightMatch),mvRightToLeftMatch(F.mvRightToLeftMatch),mTlr(F.mTlr.clone()),
@@ -414,6 +411,7 @@ void KeyFrame::UpdateBestCovisibles()
     // 权重从大到小
     mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
     mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
+    mnConnectionsVersion++;
 }
 
 // 得到与该关键帧连接（>15个共视地图点）的关键帧(没有排序的)
@@ -631,20 +629,16 @@ void KeyFrame::UpdateConnections(bool upParent)
         if(pMP->isBad())
             continue;
 
-        // 对于每一个MapPoint点，observations记录了可以观测到该MapPoint的所有关键帧
-        map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
-
-        for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-        {
-            if(mit->first->mnId==mnId || mit->first->isBad() || mit->first->GetMap() != mpMap)
-                continue;
+        // 对于每一个MapPoint点，遍历可以观测到该MapPoint的所有关键帧
+        pMP->ForEachObservation([&](KeyFrame* pKFi, int, int){
+            if(pKFi->mnId==mnId || pKFi->isBad() || pKFi->GetMap() != mpMap)
+                return;
 			// 这里的操作非常精彩！
             // map[key] = value，当要插入的键存在时，会覆盖键对应的原来的值。如果键不存在，则添加一组键值对
-            // mit->first 是地图点看到的关键帧，同一个关键帧看到的地图点会累加到该关键帧计数
+            // pKFi 是地图点看到的关键帧，同一个关键帧看到的地图点会累加到该关键帧计数
             // 所以最后KFcounter 第一个参数表示某个关键帧，第2个参数表示该关键帧看到了多少当前帧的地图点，也就是共视程度
-            KFcounter[mit->first]++;
-
-        }
+            KFcounter[pKFi]++;
+        });
     }
 
     // This should not happen
@@ -716,6 +710,7 @@ void KeyFrame::UpdateConnections(bool upParent)
         mConnectedKeyFrameWeights = KFcounter;
         mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
         mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
+        mnConnectionsVersion++;
 
 //        if(mbFirstConnection && mnId!=mpMap->GetInitKFid())
 //        {
@@ -763,6 +758,7 @@ void KeyFrame::AddChild(KeyFrame *pKF)
 {
     unique_lock<mutex> lockCon(mMutexConnections);
     mspChildrens.insert(pKF);
+    mnConnectionsVersion++;
 }
 
 // 删除某个子关键帧
@@ -770,6 +766,7 @@ void KeyFrame::EraseChild(KeyFrame *pKF)
 {
     unique_lock<mutex> lockCon(mMutexConnections);
     mspChildrens.erase(pKF);
+    mnConnectionsVersion++;
 }
 
 // 改变当前关键帧的父关键帧
@@ -786,6 +783,7 @@ void KeyFrame::ChangeParent(KeyFrame *pKF)
 
     mpParent = pKF;
     pKF->AddChild(this);
+    mnConnectionsVersion++;
 }
 
 //获取当前关键帧的子关键帧
@@ -820,6 +818,7 @@ void KeyFrame::AddLoopEdge(KeyFrame *pKF)
     unique_lock<mutex> lockCon(mMutexConnections);
     mbNotErase = true;
     mspLoopEdges.insert(pKF);
+    mnConnectionsVersion++;
 }
 
 // 获取和当前关键帧形成闭环关系的关键帧
@@ -841,6 +840,12 @@ set<KeyFrame*> KeyFrame::GetMergeEdges()
     unique_lock<mutex> lockCon(mMutexConnections);
     return mspMergeEdges;
 }
+
+unsigned long KeyFrame::GetConnectionsVersion()
+{
+    unique_lock<mutex> lockCon(mMutexConnections);
+    return mnConnectionsVersion;
+}
 // 设置当前关键帧不要在优化的过程中被删除. 由回环检测线程调用
 void KeyFrame::SetNotErase()
 {
@@ -1015,6 +1020,7 @@ void KeyFrame::SetBadFlag()
         }
 		// 标记当前关键帧已经死了
         mbBad = true;
+        mnConnectionsVersion++;
     }
 
 
@@ -0,0 +1,154 @@
+//
+// 关键帧插入调度: 根据LocalMapping的负载(队列长度、每个关键帧的建图耗时、LBA耗时和被打断的比例)
+// 自适应调整关键帧插入阈值,避免快速运动时关键帧涌入导致局部建图跟不上、LBA反复被打断
+//
+
+#include "KeyFrameScheduler.h"
+
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+namespace ORB_SLAM3
+{
+
+// 指数平均的权重
+static const double kSmoothing = 0.2;
+// 负载超过该值开始放宽插入条件
+static const double kLoadLow = 0.8;
+// 负载超过该值时减小LocalMapping队列的上限
+static const double kLoadHigh = 1.0;
+// LBA被打断的比例超过该值时,非必须的关键帧不再打断LBA
+static const double kMaxAbortRate = 0.5;
+// thRefRatio缩放的下限
+static const float kMinRefRatioScale = 0.6f;
+
+static double Now()
+{
+    return chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline double Smooth(const double mean, const double value, const int n)
+{
+    // 第一个样本直接作为初值
+    return n <= 1 ? value : (1 - kSmoothing) * mean + kSmoothing * value;
+}
+
+KeyFrameScheduler::KeyFrameScheduler():
+    mFramePeriod(1.0 / 30), mLastInsertTime(0), mnMapped(0)
+{
+}
+
+void KeyFrameScheduler::SetFrameRate(const float fps)
+{
+    unique_lock<mutex> lock(mMutex);
+    mFramePeriod = fps > 0 ? 1.0 / fps : 1.0 / 30;
+}
+
+void KeyFrameScheduler::RecordMapping(const double tMapping, const bool bLBA, const double tLBA, const bool bAborted)
+{
+    unique_lock<mutex> lock(mMutex);
+    mnMapped++;
+    mStats.meanMappingTime = Smooth(mStats.meanMappingTime, tMapping, mnMapped);
+    if(bLBA)
+    {
+        mStats.nLBA++;
+        if(bAborted)
+            mStats.nLBAAborted++;
+        mStats.meanLBATime = Smooth(mStats.meanLBATime, tLBA, mStats.nLBA);
+        mStats.abortRate = Smooth(mStats.abortRate, bAborted ? 1.0 : 0.0, mStats.nLBA);
+    }
+
+    if(mStats.meanKFInterval > 0)
+        mStats.load = mStats.meanMappingTime / max(mStats.meanKFInterval, mFramePeriod);
+}
+
+float KeyFrameScheduler::AdaptRefRatio(const float thRefRatio)
+{
+    unique_lock<mutex> lock(mMutex);
+    float scale = 1.f;
+    if(mStats.load > kLoadLow)
+        scale = max(kMinRefRatioScale, static_cast<float>(1.0 - 0.4 * (mStats.load - kLoadLow)));
+    mStats.refRatioScale = scale;
+    return thRefRatio * scale;
+}
+
+int KeyFrameScheduler::AdaptMinFrames(const int minFrames, const int maxFrames)
+{
+    unique_lock<mutex> lock(mMutex);
+    int n = minFrames;
+    if(mStats.load > kLoadLow)
+    {
+        // LocalMapping处理一个关键帧需要的帧数
+        const int nMapping = static_cast<int>(ceil(mStats.meanMappingTime / mFramePeriod));
+        n = max(minFrames, min(nMapping, maxFrames));
+    }
+    mStats.minFrames = n;
+    return n;
+}
+
+KeyFrameScheduler::eDecision KeyFrameScheduler::Decide(const bool bLocalMappingIdle, const int nQueued,
+                                                       const bool bCritical, const bool bQueueAllowed)
+{
+    unique_lock<mutex> lock(mMutex);
+    mStats.nRequested++;
+    if(bCritical)
+        mStats.nCritical++;
+    mStats.queueDepth = nQueued;
+    mStats.maxQueueDepth = max(mStats.maxQueueDepth, nQueued);
+
+    if(bLocalMappingIdle)
+    {
+        RecordInserted();
+        return INSERT;
+    }
+
+    // LBA经常被打断,说明关键帧来得比LBA完成得快. 非必须的关键帧等LocalMapping空闲再插入
+    if(!bCritical && mStats.abortRate > kMaxAbortRate)
+    {
+        mStats.nDeferred++;
+        return DEFER;
+    }
+
+    mStats.nInterrupts++;
+
+    // 负载过高时队列中最多只留一个关键帧,必须插入的关键帧沿用原来的上限
+    const int nMaxQueued = (bCritical || mStats.load <= kLoadHigh) ? 3 : 1;
+    if(bQueueAllowed && nQueued < nMaxQueued)
+    {
+        RecordInserted();
+        return INTERRUPT_AND_INSERT;
+    }
+
+    return INTERRUPT;
+}
+
+void KeyFrameScheduler::RecordInserted()
+{
+    const double now = Now();
+    mStats.nInserted++;
+    if(mLastInsertTime > 0)
+    {
+        mStats.meanKFInterval = Smooth(mStats.meanKFInterval, now - mLastInsertTime, mStats.nInserted - 1);
+        mStats.load = mStats.meanMappingTime / max(mStats.meanKFInterval, mFramePeriod);
+    }
+    mLastInsertTime = now;
+}
+
+KeyFrameScheduler::Stats KeyFrameScheduler::GetStats()
+{
+    unique_lock<mutex> lock(mMutex);
+    return mStats;
+}
+
+void KeyFrameScheduler::Reset()
+{
+    unique_lock<mutex> lock(mMutex);
+    mStats = Stats();
+    mLastInsertTime = 0;
+    mnMapped = 0;
+}
+
+} // namespace ORB_SLAM3
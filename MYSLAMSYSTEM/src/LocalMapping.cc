@@ -23,6 +23,7 @@
 #include "Optimizer.h"
 #include "Converter.h"
 #include "Config.h"
+#include "Tracer.h"
 
 #include<mutex>
 #include<chrono>
@@ -32,7 +33,7 @@ namespace ORB_SLAM3
 
 LocalMapping::LocalMapping(System* pSys, Atlas *pAtlas, const float bMonocular, bool bInertial, const string &_strSeqName):
     mpSystem(pSys), mbMonocular(bMonocular), mbInertial(bInertial), mbResetRequested(false), mbResetRequestedActiveMap(false), mbFinishRequested(false), mbFinished(true), mpAtlas(pAtlas), bInitializing(false),
-    mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true),
+    mqNewKeyFrames(64), mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true), mbWakeUp(false),
     mbNewInit(false), mIdxInit(0), mScale(1.0), mInitSect(0), mbNotBA1(true), mbNotBA2(true), infoInertial(Eigen::MatrixXd::Zero(9,9))
 {
     /*
@@ -76,6 +77,7 @@ void LocalMapping::SetTracker(Tracking *pTracker)
 // 线程主函数
 void LocalMapping::Run()
 {
+    Tracer::SetThreadName("LocalMapping");
     mbFinished = false;
     // 主循环
     while(1)
@@ -87,6 +89,9 @@ void LocalMapping::Run()
         // 等待处理的关键帧列表不为空
         if(CheckNewKeyFrames())
         {
+            // 本关键帧的建图耗时和LBA耗时,上报给跟踪线程的关键帧调度
+            const std::chrono::steady_clock::time_point tStartKF = std::chrono::steady_clock::now();
+            double tLBA = 0;
 
 #ifdef REGISTER_TIMES
             double timeLBA_ms = 0;
@@ -95,8 +100,8 @@ void LocalMapping::Run()
             std::chrono::steady_clock::time_point time_StartProcessKF = std::chrono::steady_clock::now();
 #endif
             // Step 2 处理列表中的关键帧，包括计算BoW、更新观测、描述子、共视图，插入到地图等
-            mlNewKeyFrameForDenseMap = mlNewKeyFrames;
-            ProcessNewKeyFrame();
+            if(!ProcessNewKeyFrame())
+                continue;
 #ifdef REGISTER_TIMES
             std::chrono::steady_clock::time_point time_EndProcessKF = std::chrono::steady_clock::now();
 
@@ -145,7 +150,9 @@ void LocalMapping::Run()
                     // 局部地图BA，不包括IMU数据
                     // 注意这里的第二个参数是按地址传递的,当这里的 mbAbortBA 状态发生变化时，能够及时执行/停止BA
                     // 局部地图优化，不包括IMU信息。优化关键帧位姿、地图点
+                    const std::chrono::steady_clock::time_point tStartLBA = std::chrono::steady_clock::now();
                     Optimizer::LocalBundleAdjustment(mpCurrentKeyFrame,&mbAbortBA, mpCurrentKeyFrame->GetMap(),num_FixedKF_BA,num_OptKF_BA,num_MPs_BA,num_edges_BA);
+                    tLBA = std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now() - tStartLBA).count();
                     b_doneLBA = true;
                 }
 #ifdef REGISTER_TIMES
@@ -186,8 +193,10 @@ void LocalMapping::Run()
 			// Step 10 将当前帧加入到闭环检测队列中
             mpLoopCloser->InsertKeyFrame(mpCurrentKeyFrame);
 
-            for(auto pKF : mlNewKeyFrameForDenseMap)
-                mpPointCloudMapping->insertKeyFrame(pKF);  //给点云地图插入关键帧
+            mpPointCloudMapping->insertKeyFrame(mpCurrentKeyFrame);  //给点云地图插入关键帧
+
+            const double tMapping = std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now() - tStartKF).count();
+            mpTracker->GetKeyFrameScheduler()->RecordMapping(tMapping, b_doneLBA, tLBA, b_doneLBA && mbAbortBA);
 
 #ifdef REGISTER_TIMES
             std::chrono::steady_clock::time_point time_EndLocalMap = std::chrono::steady_clock::now();
@@ -201,8 +210,8 @@ void LocalMapping::Run()
             // Safe area to stop
             while(isStopped() && !CheckFinish())
             {
-				// 如果还没有结束利索,那么等等它
-                usleep(3000);
+				// 等待 Release 或结束请求
+                WaitForWakeUp();
             }
             // 然后确定终止了就跳出这个线程的主循环
             if(CheckFinish())
@@ -218,7 +227,9 @@ void LocalMapping::Run()
         if(CheckFinish())
             break;
 
-        usleep(3000);
+        // 没有新的关键帧时阻塞,直到有新的关键帧或停止/复位/结束请求
+        if(!CheckNewKeyFrames())
+            WaitForWakeUp();
     }
     // 设置线程已经终止
     SetFinish();
@@ -227,34 +238,48 @@ void LocalMapping::Run()
 // 插入关键帧,由外部（Tracking）线程调用;这里只是插入到列表中,等待线程主函数对其进行处理
 void LocalMapping::InsertKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexNewKFs);
-    // 将关键帧插入到列表中
-    mlNewKeyFrames.push_back(pKF);
+    // 将关键帧插入到队列中
+    mqNewKeyFrames.Push(pKF);
     mbAbortBA=true;
+    WakeUp();
+}
+
+// 唤醒主循环. 调用前状态必须已经修改,主循环被唤醒后会重新检查所有状态
+void LocalMapping::WakeUp()
+{
+    {
+        unique_lock<mutex> lock(mMutexWakeUp);
+        mbWakeUp = true;
+    }
+    mcvWakeUp.notify_one();
+}
+
+// 主循环调用,阻塞直到被唤醒
+void LocalMapping::WaitForWakeUp()
+{
+    unique_lock<mutex> lock(mMutexWakeUp);
+    mcvWakeUp.wait(lock, [this]{ return mbWakeUp; });
+    mbWakeUp = false;
 }
 
 // 查看列表中是否有等待被插入的关键帧,
 bool LocalMapping::CheckNewKeyFrames()
 {
-    unique_lock<mutex> lock(mMutexNewKFs);
-    return(!mlNewKeyFrames.empty());
+    return !mqNewKeyFrames.Empty();
 }
 
 /**
  * @brief 处理列表中的关键帧，包括计算BoW、更新观测、描述子、共视图，插入到地图等
- * 
+ * @return 队列为空时返回false
  */
-void LocalMapping::ProcessNewKeyFrame()
+bool LocalMapping::ProcessNewKeyFrame()
 {
+    TRACE_SCOPE("LocalMapping::ProcessNewKeyFrame");
     // Step 1：从缓冲队列中取出一帧关键帧
     // 该关键帧队列是Tracking线程向LocalMapping中插入的关键帧组成
-    {
-        unique_lock<mutex> lock(mMutexNewKFs);
-        // 取出列表中最前面的关键帧，作为当前要处理的关键帧
-        mpCurrentKeyFrame = mlNewKeyFrames.front();
-        // 取出最前面的关键帧后，在原来的列表里删掉该关键帧
-        mlNewKeyFrames.pop_front();
-    }
+    // 取出队列中最前面的关键帧，作为当前要处理的关键帧
+    if(!mqNewKeyFrames.TryPop(mpCurrentKeyFrame))
+        return false;
 
     // Compute Bags of Words structures
     // Step 2：计算该关键帧特征点的Bow信息
@@ -299,6 +324,7 @@ void LocalMapping::ProcessNewKeyFrame()
     // Insert Keyframe in Map
     // Step 5：将该关键帧插入到地图中
     mpAtlas->AddKeyFrame(mpCurrentKeyFrame);
+    return true;
 }
 
 /**
@@ -306,8 +332,7 @@ void LocalMapping::ProcessNewKeyFrame()
  */
 void LocalMapping::EmptyQueue()
 {
-    while(CheckNewKeyFrames())
-        ProcessNewKeyFrame();
+    while(ProcessNewKeyFrame());
 }
 /**
  * @brief 检查新增地图点，根据地图点的观测情况剔除质量不好的新增的地图点
@@ -315,6 +340,7 @@ void LocalMapping::EmptyQueue()
  */
 void LocalMapping::MapPointCulling()
 {
+    TRACE_SCOPE("LocalMapping::MapPointCulling");
     // Check Recent Added MapPoints
     list<MapPoint*>::iterator lit = mlpRecentAddedMapPoints.begin();
     const unsigned long int nCurrentKFid = mpCurrentKeyFrame->mnId;
@@ -372,6 +398,7 @@ void LocalMapping::MapPointCulling()
  */
 void LocalMapping::CreateNewMapPoints()
 {
+    TRACE_SCOPE("LocalMapping::CreateNewMapPoints");
     // Retrieve neighbor keyframes in covisibility graph
     // nn表示搜索最佳共视关键帧的数目
     // 不同传感器下要求不一样,单目的时候需要有更多的具有较好共视关系的关键帧来建立地图
@@ -810,6 +837,7 @@ void LocalMapping::CreateNewMapPoints()
  */
 void LocalMapping::SearchInNeighbors()
 {
+    TRACE_SCOPE("LocalMapping::SearchInNeighbors");
     // Retrieve neighbor keyframes
     // Step 1：获得当前关键帧在共视图中权重排名前nn的邻接关键帧
     // 开始之前先定义几个概念
@@ -1007,10 +1035,12 @@ cv::Matx33f LocalMapping::ComputeF12_(KeyFrame *&pKF1, KeyFrame *&pKF2)
 // 外部线程调用,请求停止当前线程的工作; 其实是回环检测线程调用,来避免在进行全局优化的过程中局部建图线程添加新的关键帧
 void LocalMapping::RequestStop()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    mbStopRequested = true;
-    unique_lock<mutex> lock2(mMutexNewKFs);
-    mbAbortBA = true;
+    {
+        unique_lock<mutex> lock(mMutexStop);
+        mbStopRequested = true;
+        mbAbortBA = true;
+    }
+    WakeUp();
 }
 
 // 检查是否要把当前的局部建图线程停止工作,运行的时候要检查是否有终止请求,如果有就执行. 由run函数调用
@@ -1021,6 +1051,7 @@ bool LocalMapping::Stop()
     if(mbStopRequested && !mbNotStop)
     {
         mbStopped = true;
+        mcvStopped.notify_all();
         cout << "Local Mapping STOP" << endl;
         return true;
     }
@@ -1035,6 +1066,13 @@ bool LocalMapping::isStopped()
     return mbStopped;
 }
 
+// 等待 Stop() 或 SetFinish() 把 mbStopped 置为true
+void LocalMapping::WaitUntilStopped()
+{
+    unique_lock<mutex> lock(mMutexStop);
+    mcvStopped.wait(lock, [this]{ return mbStopped; });
+}
+
 // 求外部线程调用，为true，表示外部线程请求停止 local mapping
 bool LocalMapping::stopRequested()
 {
@@ -1045,15 +1083,19 @@ bool LocalMapping::stopRequested()
 // 释放当前还在缓冲区中的关键帧指针
 void LocalMapping::Release()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    unique_lock<mutex> lock2(mMutexFinish);
-    if(mbFinished)
-        return;
-    mbStopped = false;
-    mbStopRequested = false;
-    for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
-        delete *lit;
-    mlNewKeyFrames.clear();
+    {
+        unique_lock<mutex> lock(mMutexStop);
+        unique_lock<mutex> lock2(mMutexFinish);
+        if(mbFinished)
+            return;
+        mbStopped = false;
+        mbStopRequested = false;
+        // 局部建图线程已经停下,此时由调用者代替它作为队列的消费者
+        KeyFrame* pKF;
+        while(mqNewKeyFrames.TryPop(pKF))
+            delete pKF;
+    }
+    WakeUp();
 
     cout << "Local Mapping RELEASE" << endl;
 }
@@ -1079,12 +1121,17 @@ void LocalMapping::SetAcceptKeyFrames(bool flag)
  */
 bool LocalMapping::SetNotStop(bool flag)
 {
-    unique_lock<mutex> lock(mMutexStop);
+    {
+        unique_lock<mutex> lock(mMutexStop);
 
-    if(flag && mbStopped)
-        return false;
+        if(flag && mbStopped)
+            return false;
 
-    mbNotStop = flag;
+        mbNotStop = flag;
+    }
+    // 可能有被推迟的停止请求
+    if(!flag)
+        WakeUp();
 
     return true;
 }
@@ -1103,6 +1150,7 @@ void LocalMapping::InterruptBA()
  */
 void LocalMapping::KeyFrameCulling()
 {
+    TRACE_SCOPE("LocalMapping::KeyFrameCulling");
     // Check redundant keyframes (only local keyframes)
     // A keyframe is considered redundant if the 90% of the MapPoints it sees, are seen
     // in at least other 3 keyframes (in the same or finer scale)
@@ -1189,16 +1237,15 @@ void LocalMapping::KeyFrameCulling()
                         const int &scaleLevel = (pKF -> NLeft == -1) ? pKF->mvKeysUn[i].octave
                                                                      : (i < pKF -> NLeft) ? pKF -> mvKeys[i].octave
                                                                                           : pKF -> mvKeysRight[i].octave;
-                        const map<KeyFrame*, tuple<int,int>> observations = pMP->GetObservations();
+                        const MapPoint::ObservationSnapshot observations = pMP->GetObservationSnapshot();
                         int nObs=0;
                         // 遍历观测到该地图点的关键帧
-                        for(map<KeyFrame*, tuple<int,int>>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+                        for(vector<MapPoint::Observation>::const_iterator mit=observations->begin(), mend=observations->end(); mit!=mend; mit++)
                         {
-                            KeyFrame* pKFi = mit->first;
+                            KeyFrame* pKFi = mit->pKF;
                             if(pKFi==pKF)
                                 continue;
-                            tuple<int,int> indexes = mit->second;
-                            int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
+                            int leftIndex = mit->leftIndex, rightIndex = mit->rightIndex;
                             int scaleLeveli = -1;
                             if(pKFi -> NLeft == -1)
                                 scaleLeveli = pKFi->mvKeysUn[leftIndex].octave;
@@ -1313,16 +1360,12 @@ void LocalMapping::RequestReset()
         cout << "LM: Map reset recieved" << endl;
         mbResetRequested = true;
     }
+    WakeUp();
     cout << "LM: Map reset, waiting..." << endl;
     // 一直等到局部建图线程响应之后才可以退出
-    while(1)
     {
-        {
-            unique_lock<mutex> lock2(mMutexReset);
-            if(!mbResetRequested)
-                break;
-        }
-        usleep(3000);
+        unique_lock<mutex> lock(mMutexReset);
+        mcvReset.wait(lock, [this]{ return !mbResetRequested; });
     }
     cout << "LM: Map reset, Done!!!" << endl;
 }
@@ -1338,16 +1381,12 @@ void LocalMapping::RequestResetActiveMap(Map* pMap)
         mbResetRequestedActiveMap = true;
         mpMapToReset = pMap;
     }
+    WakeUp();
     cout << "LM: Active map reset, waiting..." << endl;
 
-    while(1)
     {
-        {
-            unique_lock<mutex> lock2(mMutexReset);
-            if(!mbResetRequestedActiveMap)
-                break;
-        }
-        usleep(3000);
+        unique_lock<mutex> lock(mMutexReset);
+        mcvReset.wait(lock, [this]{ return !mbResetRequestedActiveMap; });
     }
     cout << "LM: Active map reset, Done!!!" << endl;
 }
@@ -1363,7 +1402,7 @@ void LocalMapping::ResetIfRequested()
             executed_reset = true;
 
             cout << "LM: Reseting Atlas in Local Mapping..." << endl;
-            mlNewKeyFrames.clear();
+            mqNewKeyFrames.Clear();
             mlpRecentAddedMapPoints.clear();
         	// 恢复为false表示复位过程完成
             mbResetRequested=false;
@@ -1383,7 +1422,7 @@ void LocalMapping::ResetIfRequested()
         if(mbResetRequestedActiveMap) {
             executed_reset = true;
             cout << "LM: Reseting current map in Local Mapping..." << endl;
-            mlNewKeyFrames.clear();
+            mqNewKeyFrames.Clear();
             mlpRecentAddedMapPoints.clear();
 
             // Inertial parameters
@@ -1397,14 +1436,20 @@ void LocalMapping::ResetIfRequested()
         }
     }
     if(executed_reset)
+    {
+        mcvReset.notify_all();
         cout << "LM: Reset free the mutex" << endl;
+    }
 
 }
 // 请求终止当前线程
 void LocalMapping::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    WakeUp();
 }
 
 /**
@@ -1423,8 +1468,10 @@ void LocalMapping::SetFinish()
 {
     unique_lock<mutex> lock(mMutexFinish);
     mbFinished = true;    
+    mcvFinished.notify_all();
     unique_lock<mutex> lock2(mMutexStop);
     mbStopped = true;
+    mcvStopped.notify_all();
 }
 
 /**
@@ -1436,6 +1483,13 @@ bool LocalMapping::isFinished()
     return mbFinished;
 }
 
+// 等待 SetFinish() 把 mbFinished 置为true
+void LocalMapping::WaitUntilFinished()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mcvFinished.wait(lock, [this]{ return mbFinished; });
+}
+
 /**
  * @brief 返回是否正在做IMU的初始化，在tracking里面使用，如果为true，暂不添加关键帧
  */
@@ -24,18 +24,28 @@
 #include "Optimizer.h"
 #include "ORBmatcher.h"
 #include "G2oTypes.h"
+#include "Tracer.h"
+#include "ParallelFor.h"
 
 #include<mutex>
 #include<thread>
+#include<algorithm>
 
 
 namespace ORB_SLAM3
 {
 
+// 一次全局BA的迭代次数
+static const int kGBAIterations = 10;
+// 热启动的全局BA至少迭代的次数,新的闭环带来的误差也需要优化
+static const int kMinGBAIterations = 3;
+
 LoopClosing::LoopClosing(Atlas *pAtlas, KeyFrameDatabase *pDB, ORBVocabulary *pVoc, const bool bFixScale):
     mbResetRequested(false), mbResetActiveMapRequested(false), mbFinishRequested(false), mbFinished(true), mpAtlas(pAtlas),
+    mqLoopKeyFrameQueue(1024), mbWakeUp(false),
     mpKeyFrameDB(pDB), mpORBVocabulary(pVoc), mpMatchedKF(NULL), mLastLoopKFid(0), mbRunningGBA(false), mbFinishedGBA(true),
-    mbStopGBA(false), mpThreadGBA(NULL), mbFixScale(bFixScale), mnFullBAIdx(0), mnLoopNumCoincidences(0), mnMergeNumCoincidences(0),
+    mbStopGBA(false), mpThreadGBA(NULL), mbResumeGBA(false), mnResumeGBAKF(0), mnGBAItsDone(0),
+    mbIncrementalBA(false), mbResetIncrementalBA(false), mbFixScale(bFixScale), mnFullBAIdx(0), mnNumBoWCandidates(3), mnLoopNumCoincidences(0), mnMergeNumCoincidences(0),
     mbLoopDetected(false), mbMergeDetected(false), mnLoopNumNotFound(0), mnMergeNumNotFound(0)
 {
     // 连续性阈值
@@ -57,14 +67,15 @@ void LoopClosing::SetLocalMapper(LocalMapping *pLocalMapper)
 // 回环线程主函数
 void LoopClosing::Run()
 {
+    Tracer::SetThreadName("LoopClosing");
     mbFinished =false;
 
     // 线程主循环
     while(1)
     {
         // Loopclosing中的关键帧是LocalMapping发送过来的，LocalMapping是Tracking中发过来的
-        // 在LocalMapping中通过 InsertKeyFrame 将关键帧插入闭环检测队列mlpLoopKeyFrameQueue
-        // Step 1 查看闭环检测队列mlpLoopKeyFrameQueue中有没有关键帧进来
+        // 在LocalMapping中通过 InsertKeyFrame 将关键帧插入闭环检测队列mqLoopKeyFrameQueue
+        // Step 1 查看闭环检测队列mqLoopKeyFrameQueue中有没有关键帧进来
         if(CheckNewKeyFrames())
         {
             if(mpLastCurrentKF) // 这部分后续未使用
@@ -274,7 +285,9 @@ void LoopClosing::Run()
             break;
         }
 
-        usleep(5000);
+        // 队列为空时阻塞,直到有新的关键帧或复位/结束请求
+        if(!CheckNewKeyFrames())
+            WaitForWakeUp();
     }
 
     //ofstream f_stats;
@@ -294,10 +307,34 @@ void LoopClosing::Run()
 // 将某个关键帧加入到回环检测的过程中,由局部建图线程调用
 void LoopClosing::InsertKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexLoopQueue);
     // 注意：这里第0个关键帧不能够参与到回环检测的过程中,因为第0关键帧定义了整个地图的世界坐标系
-    if(pKF->mnId!=0)
-        mlpLoopKeyFrameQueue.push_back(pKF);
+    if(pKF->mnId==0)
+        return;
+    // 闭环线程矫正闭环或者等待全局BA时会等局部建图停下来,这里不能阻塞局部建图,队列满了就让这个关键帧不参与闭环检测
+    if(!mqLoopKeyFrameQueue.TryPush(pKF))
+    {
+        Verbose::PrintMess("Loop closing queue full, keyframe " + to_string(pKF->mnId) + " skipped", Verbose::VERBOSITY_DEBUG);
+        return;
+    }
+    WakeUp();
+}
+
+// 唤醒主循环. 调用前状态必须已经修改,主循环被唤醒后会重新检查所有状态
+void LoopClosing::WakeUp()
+{
+    {
+        unique_lock<mutex> lock(mMutexWakeUp);
+        mbWakeUp = true;
+    }
+    mcvWakeUp.notify_one();
+}
+
+// 主循环调用,阻塞直到被唤醒
+void LoopClosing::WaitForWakeUp()
+{
+    unique_lock<mutex> lock(mMutexWakeUp);
+    mcvWakeUp.wait(lock, [this]{ return mbWakeUp; });
+    mbWakeUp = false;
 }
 
 /*
@@ -306,8 +343,7 @@ void LoopClosing::InsertKeyFrame(KeyFrame *pKF)
  */
 bool LoopClosing::CheckNewKeyFrames()
 {
-    unique_lock<mutex> lock(mMutexLoopQueue);
-    return(!mlpLoopKeyFrameQueue.empty());
+    return !mqLoopKeyFrameQueue.Empty();
 }
 /**
  * @brief 检测有没有共同区域,包括检测回环和融合匹配,sim3计算,验证
@@ -317,13 +353,12 @@ bool LoopClosing::CheckNewKeyFrames()
  */
 bool LoopClosing::NewDetectCommonRegions()
 {
+    TRACE_SCOPE("LoopClosing::NewDetectCommonRegions");
     {
         // Step 1 从队列中取出一个关键帧,作为当前检测共同区域的关键帧
-        unique_lock<mutex> lock(mMutexLoopQueue);
         // 从队列头开始取，也就是先取早进来的关键帧
-        mpCurrentKF = mlpLoopKeyFrameQueue.front();
-        // 取出关键帧后从队列里弹出该关键帧
-        mlpLoopKeyFrameQueue.pop_front();
+        if(!mqLoopKeyFrameQueue.TryPop(mpCurrentKF))
+            return false;
         // Avoid that a keyframe can be erased while it is being process by this thread
         // 设置当前关键帧不要在优化的过程中被删除
         mpCurrentKF->SetNotErase();
@@ -484,8 +519,8 @@ bool LoopClosing::NewDetectCommonRegions()
 #ifdef REGISTER_TIMES
         std::chrono::steady_clock::time_point time_StartDetectBoW = std::chrono::steady_clock::now();
 #endif
-        // 分别找到3个最好的候选帧, 回环候选帧放在vpLoopBowCand中,融合候选帧放在vpMergeBowCand中
-        mpKeyFrameDB->DetectNBestCandidates(mpCurrentKF, vpLoopBowCand, vpMergeBowCand,3);
+        // 分别找到mnNumBoWCandidates个(默认3个)最好的候选帧, 回环候选帧放在vpLoopBowCand中,融合候选帧放在vpMergeBowCand中
+        mpKeyFrameDB->DetectNBestCandidates(mpCurrentKF, vpLoopBowCand, vpMergeBowCand, mnNumBoWCandidates.load());
 #ifdef REGISTER_TIMES
         std::chrono::steady_clock::time_point time_EndDetectBoW = std::chrono::steady_clock::now();
         timeDetectBoW = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndDetectBoW - time_StartDetectBoW).count();
@@ -603,6 +638,9 @@ bool LoopClosing::DetectAndReffineSim3FromLastKF(KeyFrame* pCurrentKF, KeyFrame*
  * 3. guided matching refinement
  * 4. 利用地图中的共视关键帧验证(共视几何校验)
  * 
+ * 各候选关键帧之间互不依赖,由多个线程同时验证(见 VerifyBoWCandidate), 一旦有候选帧通过了共视几何校验,
+ * 其余线程就放弃还没有做完的候选帧
+ * 
  * @param[in] vpBowCand bow 给出的一些候选关键帧
  * @param[out] pMatchedKF2 最后成功匹配的候选关键帧
  * @param[out] pLastCurrentKF 用于记录当前关键帧为上一个关键帧(后续若仍需要时序几何校验需要记录此信息)
@@ -615,6 +653,73 @@ bool LoopClosing::DetectAndReffineSim3FromLastKF(KeyFrame* pCurrentKF, KeyFrame*
  */
 bool LoopClosing::DetectCommonRegionsFromBoW(std::vector<KeyFrame*> &vpBowCand, KeyFrame* &pMatchedKF2, KeyFrame* &pLastCurrentKF, g2o::Sim3 &g2oScw,
                                              int &nNumCoincidences, std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs)
+{
+    //获取当前帧的共视帧(在共同区域检测中应该避免当前关键帧的共视关键帧中)
+    const set<KeyFrame*> spConnectedKeyFrames = mpCurrentKF->GetConnectedKeyFrames();
+
+    // bow中候选关键帧的数量
+    const int numCandidates = vpBowCand.size();
+    std::vector<BoWCandidateResult, Eigen::aligned_allocator<BoWCandidateResult> > vResults(numCandidates);
+    // 因提前停止而没有验证的候选帧保持为未通过
+    for(int i=0; i<numCandidates; ++i)
+    {
+        vResults[i].nNumProjOptMatches = 0;
+        vResults[i].nNumCoincidences = 0;
+    }
+
+    // 每个线程依次领取一个候选帧, 有候选帧被接受后其他线程停止
+    std::atomic<bool> bAccepted(false);
+    ParallelFor(numCandidates, 1, ParallelNumThreads(numCandidates), [&](const int i, const int){
+        if(bAccepted)
+            return;
+        if(VerifyBoWCandidate(vpBowCand[i], spConnectedKeyFrames, vResults[i], bAccepted))
+            bAccepted = true;
+    });
+
+    // Varibles to select the best numbe
+    // 选出最终的候选帧: 有候选帧通过共视几何校验时只在通过的候选帧中选, 取投影匹配数最多的
+    int nBest = -1;
+    for(int i=0; i<numCandidates; ++i)
+    {
+        if(vResults[i].nNumProjOptMatches <= 0 || (vResults[i].nNumCoincidences < 3 && bAccepted))
+            continue;
+        if(nBest < 0 || vResults[nBest].nNumProjOptMatches < vResults[i].nNumProjOptMatches)
+            nBest = i;
+    }
+
+    // 如果成功找到了共同区域帧把记录的最优值存到输出变量中
+    if(nBest >= 0)
+    {
+        BoWCandidateResult &best = vResults[nBest];
+        pLastCurrentKF = mpCurrentKF;
+        nNumCoincidences = best.nNumCoincidences; // 成功几何验证的帧数
+        pMatchedKF2 = best.pMatchedKF;
+        pMatchedKF2->SetNotErase();
+        g2oScw = best.g2oScw;
+        vpMPs.swap(best.vpMPs);
+        vpMatchedMPs.swap(best.vpMatchedMPs);
+        //如果有三个成功验证则return ture
+        return nNumCoincidences >= 3;
+    }
+
+    // 如果少于3个当前关键帧的共视关键帧验证了这个候选帧,那么返回失败,注意,这里的失败并不代表最终的验证失败,后续会开启时序校验
+    return false;
+}
+
+/**
+ * @brief 对一个BoW候选关键帧做几何验证(DetectCommonRegionsFromBoW 的第1-4步)
+ * 
+ * 只读取当前关键帧和地图,所有中间结果都在局部变量里,可以在多个线程中同时调用
+ * 
+ * @param[in] pKFi 候选关键帧
+ * @param[in] spConnectedKeyFrames 当前关键帧的共视关键帧
+ * @param[out] result 验证结果, 没有通过投影匹配的验证时nNumProjOptMatches为0
+ * @param[in] bStop 其他线程已经接受了一个候选帧, 这时尽快放弃
+ * @return true 通过了共视几何校验(至少3个共视关键帧验证成功)
+ * @return false 没有通过或被放弃
+ */
+bool LoopClosing::VerifyBoWCandidate(KeyFrame* pKFi, const set<KeyFrame*> &spConnectedKeyFrames, BoWCandidateResult &result,
+                                     const std::atomic<bool> &bStop)
 {
     // 一些后面会使用的阀值
     int nBoWMatches = 20; // 最低bow匹配特征点数
@@ -622,17 +727,12 @@ bool LoopClosing::DetectCommonRegionsFromBoW(std::vector<KeyFrame*> &vpBowCand,
     int nSim3Inliers = 20; // sim3 最低内点数 
     int nProjMatches = 50; // 通过投影得到的匹配点数量最低阀值
     int nProjOptMatches = 80; // 通过更小的半径,更严的距离搜索到的匹配点数量
-    /*if(mpTracker->mSensor==System::IMU_MONOCULAR ||mpTracker->mSensor==System::IMU_STEREO)
-    {
-        nBoWMatches = 20;
-        nBoWInliers = 15;
-        nSim3Inliers = 20;
-        nProjMatches = 35;
-        nProjOptMatches = 50;
-    }*/
 
-    //获取当前帧的共视帧(在共同区域检测中应该避免当前关键帧的共视关键帧中)
-    set<KeyFrame*> spConnectedKeyFrames = mpCurrentKF->GetConnectedKeyFrames();
+    result.nNumProjOptMatches = 0;
+    result.nNumCoincidences = 0;
+
+    if(!pKFi || pKFi->isBad())
+        return false;
 
     // 定义最佳共视关键帧的数量
     int nNumCovisibles = 5;
@@ -640,343 +740,221 @@ bool LoopClosing::DetectCommonRegionsFromBoW(std::vector<KeyFrame*> &vpBowCand,
     ORBmatcher matcherBoW(0.9, true);
     // 用与seach by projection
     ORBmatcher matcher(0.75, true);
-    // 没有用到
-    int nNumGuidedMatching = 0;
-
-    // Varibles to select the best numbe
-    // 一些用于统计最优数据的变量,我们最后返回的是最佳的一个关键帧(几何校验匹配数最高的)
 
-    KeyFrame* pBestMatchedKF;
-    int nBestMatchesReproj = 0;
-    int nBestNumCoindicendes = 0;
-    g2o::Sim3 g2oBestScw;
-    std::vector<MapPoint*> vpBestMapPoints;
-    std::vector<MapPoint*> vpBestMatchedMapPoints;
-
-    // bow中候选关键帧的数量
-    int numCandidates = vpBowCand.size();
-    // 这三个变量是作者为了后面打印观察记录的信息,可以忽略
-    vector<int> vnStage(numCandidates, 0);
-    vector<int> vnMatchesStage(numCandidates, 0);
-    int index = 0;
-
-    //对于每个候选关键帧，进行Sim3计算和检验
-    for(KeyFrame* pKFi : vpBowCand)
+    // Current KF against KF with covisibles version
+    // Step 1 获得候选关键帧的局部窗口 W_m
+    // 拿到候选关键帧的5个最优共视帧 
+    std::vector<KeyFrame*> vpCovKFi = pKFi->GetBestCovisibilityKeyFrames(nNumCovisibles);
+    // 再加上候选关键帧自己(这里操作比较迷,看起来只是为了把候选关键帧放到容器的第一顺位)
+    vpCovKFi.push_back(vpCovKFi[0]);
+    vpCovKFi[0] = pKFi;
+
+    // search by bow 返回的参数, 记录窗口Wm中每个关键帧有哪些点能在当前关键帧Ka中通过bow找到匹配点 
+    std::vector<std::vector<MapPoint*> > vvpMatchedMPs;
+    vvpMatchedMPs.resize(vpCovKFi.size());
+
+    // 记录整个窗口中有那些点能在Ka中通过bow找到匹配点(这个set是辅助容器,避免重复添加地图点)
+    std::set<MapPoint*> spMatchedMPi;
+    int numBoWMatches = 0;
+    // 记录窗口中能通过bow在当前关键帧ka中找到最多匹配点的关键帧
+    KeyFrame* pMostBoWMatchesKF = pKFi;
+
+    // 下面两个变量是为了sim3 solver准备的
+    //记录窗口中的地图点能在当前关键帧中找到的匹配的点(数量的上限是当前关键帧地图点的数量)
+    std::vector<MapPoint*> vpMatchedPoints = std::vector<MapPoint*>(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
+    // 记录上面的地图点分别对应窗口中的关键帧(数量的上限是当前关键帧地图点的数量)
+    std::vector<KeyFrame*> vpKeyFrameMatchedMP = std::vector<KeyFrame*>(mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
+
+    //! bug: 以下循环中并没有重新赋值pMostBoWMatchesKF, 一直是初始值: 候选关键帧 
+    // 遍历窗口内Wm的每个关键帧
+    // Step 1.1 通过Bow寻找候选帧窗口内的关键帧地图点与当前关键帧的匹配点
+    for(int j=0; j<vpCovKFi.size(); ++j)
     {
-        //cout << endl << "-------------------------------" << endl;
-        if(!pKFi || pKFi->isBad())
+        if(!vpCovKFi[j] || vpCovKFi[j]->isBad())
             continue;
 
-
-        // Current KF against KF with covisibles version
-        // Step 1 获得候选关键帧的局部窗口 W_m
-        // 拿到候选关键帧的5个最优共视帧 
-        std::vector<KeyFrame*> vpCovKFi = pKFi->GetBestCovisibilityKeyFrames(nNumCovisibles);
-        // 再加上候选关键帧自己(这里操作比较迷,看起来只是为了把候选关键帧放到容器的第一顺位)
-        vpCovKFi.push_back(vpCovKFi[0]);
-        vpCovKFi[0] = pKFi;
-
-        // search by bow 返回的参数, 记录窗口Wm中每个关键帧有哪些点能在当前关键帧Ka中通过bow找到匹配点 
-        std::vector<std::vector<MapPoint*> > vvpMatchedMPs;
-        vvpMatchedMPs.resize(vpCovKFi.size());
-        
-        // 记录整个窗口中有那些点能在Ka中通过bow找到匹配点(这个set是辅助容器,避免重复添加地图点)
-        std::set<MapPoint*> spMatchedMPi;
-        int numBoWMatches = 0;
-        // 记录窗口中能通过bow在当前关键帧ka中找到最多匹配点的关键帧
-        KeyFrame* pMostBoWMatchesKF = pKFi;
-        // 记录窗口中能通过bow在当前关键帧ka中找到最多匹配点的数量
-        int nMostBoWNumMatches = 0;
-
-        // 下面两个变量是为了sim3 solver准备的
-        //记录窗口中的地图点能在当前关键帧中找到的匹配的点(数量的上限是当前关键帧地图点的数量)
-        std::vector<MapPoint*> vpMatchedPoints = std::vector<MapPoint*>(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
-        // 记录上面的地图点分别对应窗口中的关键帧(数量的上限是当前关键帧地图点的数量)
-        std::vector<KeyFrame*> vpKeyFrameMatchedMP = std::vector<KeyFrame*>(mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
-
-        // 记录在W_km中有最多匹配点的帧的局部index, 这个后面没有用到
-        int nIndexMostBoWMatchesKF=0;
-        //! bug: 以下循环中并没有重新赋值pMostBoWMatchesKF, 一直是初始值: 候选关键帧 
-        // 遍历窗口内Wm的每个关键帧
-        // Step 1.1 通过Bow寻找候选帧窗口内的关键帧地图点与当前关键帧的匹配点
-        for(int j=0; j<vpCovKFi.size(); ++j)
+        matcherBoW.SearchByBoW(mpCurrentKF, vpCovKFi[j], vvpMatchedMPs[j]);
+    }
+    // 遍历窗口内的每个关键帧
+    // Step 1.2 把窗口内的匹配点转换为Sim3Solver接口定义的格式
+    for(int j=0; j<vpCovKFi.size(); ++j)
+    {   
+        // 如果窗口中的帧是当前帧的共视帧则放弃这个候选帧
+        if(spConnectedKeyFrames.find(vpCovKFi[j]) != spConnectedKeyFrames.end())
+            return false;
+
+        // 遍历窗口内的某一个关键帧与当前关键帧由bow得到的匹配的地图点
+        // 注意这里每个vvpMatchedMPs[j]的大小都是相等的且等于当前关键帧中的总地图点数量,详细请看searchByBow
+        for(int k=0; k < vvpMatchedMPs[j].size(); ++k)
         {
-            if(!vpCovKFi[j] || vpCovKFi[j]->isBad())
+            // 地图点指针
+            MapPoint* pMPi_j = vvpMatchedMPs[j][k];
+            // 如果指针为空或地图点被标记为bad,则跳过当前循环
+            if(!pMPi_j || pMPi_j->isBad())
                 continue;
 
-            int num = matcherBoW.SearchByBoW(mpCurrentKF, vpCovKFi[j], vvpMatchedMPs[j]);
-            //cout << "BoW: " << num << " putative matches with KF " << vpCovKFi[j]->mnId << endl;
-            if (num > nMostBoWNumMatches)
+            // 窗口内不同关键帧与当前关键帧可能看到相同的3D点, 利用辅助容器避免重复添加
+            if(spMatchedMPi.find(pMPi_j) == spMatchedMPi.end())
             {
-                nMostBoWNumMatches = num;
-                nIndexMostBoWMatchesKF = j;
+                // 利用辅助容器记录添加过的点
+                spMatchedMPi.insert(pMPi_j);
+                // 统计窗口内有多少地图点能在当前关键中找到匹配
+                numBoWMatches++;
+                //记录窗口中的地图点能在当前关键帧中找到的匹配的点
+                vpMatchedPoints[k]= pMPi_j;
+                // 记录上面的地图点分别对应窗口中的关键帧(数量的上限是当前关键帧地图点的数量)
+                vpKeyFrameMatchedMP[k] = vpCovKFi[j];
             }
         }
-        // 标记是否因为窗口内有当前关键帧的共视关键帧
-        bool bAbortByNearKF = false;
-        // 遍历窗口内的每个关键帧
-        // Step 1.2 把窗口内的匹配点转换为Sim3Solver接口定义的格式
-        for(int j=0; j<vpCovKFi.size(); ++j)
-        {   
+    }
 
-            // 如果窗口中的帧是当前帧的共视帧则结束这个循环
-            if(spConnectedKeyFrames.find(vpCovKFi[j]) != spConnectedKeyFrames.end())
-            {
-                bAbortByNearKF = true;
-                //cout << "BoW: Candidate KF aborted by proximity" << endl;
-                break;
-            }
+    // 当窗口内的帧不是当前关键帧的相邻帧且匹配点足够多时才继续
+    // nBoWMatches = 20; // 最低bow匹配特征点数
+    if(numBoWMatches < nBoWMatches || bStop) // TODO pick a good threshold
+        return false;
 
-            //cout << "Matches: " << num << endl;
-            // 遍历窗口内的某一个关键帧与当前关键帧由bow得到的匹配的地图点
-            // 注意这里每个vvpMatchedMPs[j]的大小都是相等的且等于当前关键帧中的总地图点数量,详细请看searchByBow
-            for(int k=0; k < vvpMatchedMPs[j].size(); ++k)
-            {
-                // 地图点指针
-                MapPoint* pMPi_j = vvpMatchedMPs[j][k];
-                // 如果指针为空或地图点被标记为bad,则跳过当前循环
-                if(!pMPi_j || pMPi_j->isBad())
-                    continue;
+    // Step 2 利用RANSAC寻找候选关键帧窗口与当前关键帧的相对位姿T_am的初始值(可能是Sim3)
+    bool bFixedScale = mbFixScale;
+    // 如果是单目带imu的模式且IMU初始化未完成第三阶段，则不固定scale 
+    if(mpTracker->mSensor==System::IMU_MONOCULAR && !mpCurrentKF->GetMap()->GetIniertialBA2())
+        bFixedScale=false;
 
-                // 窗口内不同关键帧与当前关键帧可能看到相同的3D点, 利用辅助容器避免重复添加
-                if(spMatchedMPi.find(pMPi_j) == spMatchedMPi.end())
-                {
-                    // 利用辅助容器记录添加过的点
-                    spMatchedMPi.insert(pMPi_j);
-                    // 统计窗口内有多少地图点能在当前关键中找到匹配
-                    numBoWMatches++;
-                    //记录窗口中的地图点能在当前关键帧中找到的匹配的点
-                    vpMatchedPoints[k]= pMPi_j;
-                    // 记录上面的地图点分别对应窗口中的关键帧(数量的上限是当前关键帧地图点的数量)
-                    vpKeyFrameMatchedMP[k] = vpCovKFi[j];
-                }
-            }
-        }
+    // 初始化sim3 solver
+    // Sim3Solver 的接口与orbslam2略有不同, 因为现在是1-N的对应关系
+    Sim3Solver solver = Sim3Solver(mpCurrentKF, pMostBoWMatchesKF, vpMatchedPoints, bFixedScale, vpKeyFrameMatchedMP);
+    //Sim3Solver Ransac 置信度0.99，至少20个inliers 最多300次迭
+    solver.SetRansacParameters(0.99, nBoWInliers, 300); // at least 15 inliers, nBoWInliers = 15
+
+    bool bNoMore = false;
+    vector<bool> vbInliers;
+    int nInliers;
+    bool bConverge = false;
+    cv::Mat mTcm;
+    // 迭代到收敛
+    while(!bConverge && !bNoMore && !bStop)
+    {
+        mTcm = solver.iterate(20,bNoMore, vbInliers, nInliers, bConverge);
+    }
 
-        //cout <<"BoW: " << numBoWMatches << " independent putative matches" << endl;
-        // 当窗口内的帧不是当前关键帧的相邻帧且匹配点足够多时
-        // Step 2 利用RANSAC寻找候选关键帧窗口与当前关键帧的相对位姿T_am的初始值(可能是Sim3)
-        // nBoWMatches = 20; // 最低bow匹配特征点数
-        if(!bAbortByNearKF && numBoWMatches >= nBoWMatches) // TODO pick a good threshold
+    if(!bConverge || bStop)
+        return false;
+
+    // Step 3 Guide matching refinement: 利用初始的Tam信息,进行双向重投影,并非线性优化得到更精确的Tam
+    // Match by reprojection
+    // 拿到窗口内匹配最多的帧的最佳5个共视帧和它自己组成的窗口
+    vpCovKFi = pMostBoWMatchesKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
+    vpCovKFi.push_back(pMostBoWMatchesKF);
+
+    // 辅助容器,避免重复添加地图点
+    set<MapPoint*> spMapPoints;
+    // 这两个容器是searchByProjection定义的容器
+    // 记录窗口内地图点
+    vector<MapPoint*> vpMapPoints;
+    // 记录每个地图点对应的串口内的关键帧
+    vector<KeyFrame*> vpKeyFrames;
+    // 遍历窗Wm内的所有关键帧
+    for(KeyFrame* pCovKFi : vpCovKFi)
+    {
+        // 遍历窗口内每个关键帧的所有地图点
+        for(MapPoint* pCovMPij : pCovKFi->GetMapPointMatches())
         {
-            /*cout << "-------------------------------" << endl;
-            cout << "Geometric validation with " << numBoWMatches << endl;
-            cout << "KFc: " << mpCurrentKF->mnId << "; KFm: " << pMostBoWMatchesKF->mnId << endl;*/
-            // Geometric validation
-
-            bool bFixedScale = mbFixScale;
-            // 如果是单目带imu的模式且IMU初始化未完成第三阶段，则不固定scale 
-            if(mpTracker->mSensor==System::IMU_MONOCULAR && !mpCurrentKF->GetMap()->GetIniertialBA2())
-                bFixedScale=false;
-
-            // 初始化sim3 solver
-            // Sim3Solver 的接口与orbslam2略有不同, 因为现在是1-N的对应关系
-            Sim3Solver solver = Sim3Solver(mpCurrentKF, pMostBoWMatchesKF, vpMatchedPoints, bFixedScale, vpKeyFrameMatchedMP);
-            //Sim3Solver Ransac 置信度0.99，至少20个inliers 最多300次迭
-            solver.SetRansacParameters(0.99, nBoWInliers, 300); // at least 15 inliers, nBoWInliers = 15
-
-            bool bNoMore = false;
-            vector<bool> vbInliers;
-            int nInliers;
-            bool bConverge = false;
-            cv::Mat mTcm;
-            // 迭代到收敛
-            while(!bConverge && !bNoMore)
-            {
-                mTcm = solver.iterate(20,bNoMore, vbInliers, nInliers, bConverge);
+            // 如果指针为空或者改地图点被标记为bad
+            if(!pCovMPij || pCovMPij->isBad())
+                continue;
+            // 避免重复添加
+            if(spMapPoints.find(pCovMPij) == spMapPoints.end())
+            {   
+                // 辅助容器用来记录点是否已经添加
+                spMapPoints.insert(pCovMPij);
+                // 把地图点和对应关键帧记录下来
+                vpMapPoints.push_back(pCovMPij);
+                vpKeyFrames.push_back(pCovKFi);
             }
+        }
+    }
 
-            //cout << "Num inliers: " << nInliers << endl;
-            // Step 3 Guide matching refinement: 利用初始的Tam信息,进行双向重投影,并非线性优化得到更精确的Tam
-            if(bConverge)
-            {
-                //cout <<"BoW: " << nInliers << " inliers in Sim3Solver" << endl;
-
-                // Match by reprojection
-                //int nNumCovisibles = 5;
-                vpCovKFi.clear();
-                // 拿到窗口内匹配最多的帧的最佳5个共视帧和它自己组成的窗口
-                vpCovKFi = pMostBoWMatchesKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
-                int nInitialCov = vpCovKFi.size();
-                vpCovKFi.push_back(pMostBoWMatchesKF);
-                // 这个后面没有用到
-                set<KeyFrame*> spCheckKFs(vpCovKFi.begin(), vpCovKFi.end());
-
-                // 辅助容器,避免重复添加地图点
-                set<MapPoint*> spMapPoints;
-                // 这两个容器是searchByProjection定义的容器
-                // 记录窗口内地图点
-                vector<MapPoint*> vpMapPoints;
-                // 记录每个地图点对应的串口内的关键帧
-                vector<KeyFrame*> vpKeyFrames;
-                // 遍历窗Wm内的所有关键帧
-                for(KeyFrame* pCovKFi : vpCovKFi)
-                {
-                        // 遍历窗口内每个关键帧的所有地图点
-                    for(MapPoint* pCovMPij : pCovKFi->GetMapPointMatches())
-                    {
-                        // 如果指针为空或者改地图点被标记为bad
-                        if(!pCovMPij || pCovMPij->isBad())
-                            continue;
-                        // 避免重复添加
-                        if(spMapPoints.find(pCovMPij) == spMapPoints.end())
-                        {   
-
-                            // 辅助容器用来记录点是否已经添加
-                            spMapPoints.insert(pCovMPij);
-                            // 把地图点和对应关键帧记录下来
-                            vpMapPoints.push_back(pCovMPij);
-                            vpKeyFrames.push_back(pCovKFi);
-                        }
-                    }
-                }
-                //cout << "Point cloud: " << vpMapPoints.size() << endl;
-
-                // 拿到solver 估计的 Tam初始值, 为后续的非线性优化做准备, 在这里 c 表示当前关键帧, m 表示回环/融合候选帧
-                g2o::Sim3 gScm(Converter::toMatrix3d(solver.GetEstimatedRotation()),Converter::toVector3d(solver.GetEstimatedTranslation()),solver.GetEstimatedScale());
-                // 候选关键帧在其世界坐标系下的坐标
-                g2o::Sim3 gSmw(Converter::toMatrix3d(pMostBoWMatchesKF->GetRotation()),Converter::toVector3d(pMostBoWMatchesKF->GetTranslation()),1.0);
-                // 利用初始的Tam估计确定世界坐标系在当前相机中的位姿
-                g2o::Sim3 gScw = gScm*gSmw; // Similarity matrix of current from the world position
-                // 准备用来SearchByProjection的位姿信息
-                cv::Mat mScw = Converter::toCvMat(gScw);
-
-                // 记录最后searchByProjection的结果
-                vector<MapPoint*> vpMatchedMP;
-                vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
-                vector<KeyFrame*> vpMatchedKF;
-                vpMatchedKF.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
-                // Step 3.1 重新利用之前计算的mScw信息, 通过投影寻找更多的匹配点
-                int numProjMatches = matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpKeyFrames, vpMatchedMP, vpMatchedKF, 8, 1.5);
-
-                // 如果拿到了足够多的匹配点, nProjMatches = 50
-                if(numProjMatches >= nProjMatches)
-                {
-                    // Optimize Sim3 transformation with every matches
-                    Eigen::Matrix<double, 7, 7> mHessian7x7;
-
-                    bool bFixedScale = mbFixScale;
-                    // 在imu模式下imu未完成第3阶段初始化就不固定scale
-                    if(mpTracker->mSensor==System::IMU_MONOCULAR && !mpCurrentKF->GetMap()->GetIniertialBA2())
-                        bFixedScale=false;
-                    // Step 3.2 利用搜索到的更多的匹配点用Sim3优化投影误差得到的更好的 gScm (Tam)
-                    // pKFi是候选关键帧
-                    int numOptMatches = Optimizer::OptimizeSim3(mpCurrentKF, pKFi, vpMatchedMP, gScm, 10, mbFixScale, mHessian7x7, true);
-                    //cout <<"BoW: " << numOptMatches << " inliers in the Sim3 optimization" << endl;
-                    //cout << "Inliers in Sim3 optimization: " << numOptMatches << endl;
-
-                    // Step 3.3 如果内点足够多,用更小的半径搜索匹配点,并且再次进行优化(p.s.这里与论文不符,并没有再次优化)
-                    if(numOptMatches >= nSim3Inliers)
-                    {
-                        //cout <<"BoW: " << numOptMatches << " inliers in Sim3 optimization" << endl;
-                        // 前面已经声明了这些变量了,无需再次声明
-                        g2o::Sim3 gSmw(Converter::toMatrix3d(pMostBoWMatchesKF->GetRotation()),Converter::toVector3d(pMostBoWMatchesKF->GetTranslation()),1.0);
-                        g2o::Sim3 gScw = gScm*gSmw; // Similarity matrix of current from the world position
-                        cv::Mat mScw = Converter::toCvMat(gScw);
-
-                        vector<MapPoint*> vpMatchedMP;
-                        vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
-                        // Step 3.4 重新利用之前计算的mScw信息, 通过更小的半径和更严格的距离的投影寻找匹配点
-                        // 5 : 半径的增益系数(对比之前下降了)---> 更小的半径, 1.0 , hamming distance 的阀值增益系数---> 允许更小的距离
-                        int numProjOptMatches = matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpMatchedMP, 5, 1.0);
-                        //cout <<"BoW: " << numProjOptMatches << " matches after of the Sim3 optimization" << endl;
-                        // 当新的投影得到的内点数量大于nProjOptMatches=80时
-                        if(numProjOptMatches >= nProjOptMatches)
-                        {
-                            // Step 4. 用当前关键帧的相邻关键来验证前面得到的Tam(共视几何校验)
-                            // 统计验证成功的关键帧数量
-                            int nNumKFs = 0;
-                            //vpMatchedMPs = vpMatchedMP;
-                            //vpMPs = vpMapPoints;
-                            // Check the Sim3 transformation with the current KeyFrame covisibles
-                            // Step 4.1 拿到用来验证的关键帧组(后称为验证组): 当前关键帧的共视关键帧，nNumCovisibles = 5;
-                            vector<KeyFrame*> vpCurrentCovKFs = mpCurrentKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
-                            //cout << "---" << endl;
-                            //cout << "BoW: Geometrical validation" << endl;
-                            int j = 0;
-                            // 遍历验证组当有三个关键帧验证成功或遍历所有的关键帧后结束循环
-                            while(nNumKFs < 3 && j<vpCurrentCovKFs.size())
-                            //for(int j=0; j<vpCurrentCovKFs.size(); ++j)
-                            {   
-                                // 拿出验证组中的一个关键帧
-                                KeyFrame* pKFj = vpCurrentCovKFs[j];
-                                // 为 DetectCommonRegionsFromLastKF准备一个初始位姿, 这个用来进行searchByProjection
-                                cv::Mat mTjc = pKFj->GetPose() * mpCurrentKF->GetPoseInverse();
-                                g2o::Sim3 gSjc(Converter::toMatrix3d(mTjc.rowRange(0, 3).colRange(0, 3)),Converter::toVector3d(mTjc.rowRange(0, 3).col(3)),1.0);
-                                g2o::Sim3 gSjw = gSjc * gScw;
-                                int numProjMatches_j = 0;
-                                vector<MapPoint*> vpMatchedMPs_j;
-                                // Step 4.2 几何校验函数, 这个函数里面其实是个searchByProjection : 通过之前计算的位姿转换地图点并通过投影搜索匹配点, 若大于一定数目的任务成功验证一次
-                                bool bValid = DetectCommonRegionsFromLastKF(pKFj,pMostBoWMatchesKF, gSjw,numProjMatches_j, vpMapPoints, vpMatchedMPs_j);
-
-                                if(bValid)
-                                {
-                                    // 统计valid的帧的数量
-                                    nNumKFs++;
-                                }
+    // 拿到solver 估计的 Tam初始值, 为后续的非线性优化做准备, 在这里 c 表示当前关键帧, m 表示回环/融合候选帧
+    g2o::Sim3 gScm(Converter::toMatrix3d(solver.GetEstimatedRotation()),Converter::toVector3d(solver.GetEstimatedTranslation()),solver.GetEstimatedScale());
+    // 候选关键帧在其世界坐标系下的坐标
+    g2o::Sim3 gSmw(Converter::toMatrix3d(pMostBoWMatchesKF->GetRotation()),Converter::toVector3d(pMostBoWMatchesKF->GetTranslation()),1.0);
+    // 利用初始的Tam估计确定世界坐标系在当前相机中的位姿
+    g2o::Sim3 gScw = gScm*gSmw; // Similarity matrix of current from the world position
+    // 准备用来SearchByProjection的位姿信息
+    cv::Mat mScw = Converter::toCvMat(gScw);
+
+    // 记录最后searchByProjection的结果
+    vector<MapPoint*> vpMatchedMP;
+    vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
+    vector<KeyFrame*> vpMatchedKF;
+    vpMatchedKF.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
+    // Step 3.1 重新利用之前计算的mScw信息, 通过投影寻找更多的匹配点
+    int numProjMatches = matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpKeyFrames, vpMatchedMP, vpMatchedKF, 8, 1.5);
+
+    // 如果拿到了足够多的匹配点, nProjMatches = 50
+    if(numProjMatches < nProjMatches || bStop)
+        return false;
 
-                                j++;
-                            }
-                            // 这里又是没有用的代码,只是记录一点信息,可能是为了方便打印检查
-                            if(nNumKFs < 3)
-                            {
-                                vnStage[index] = 8;
-                                vnMatchesStage[index] = nNumKFs;
-                            }
-                            // 记录第二次searchByProjection得到最多匹配点的关键帧的各种信息,最后作为回环帧/融合帧
-                            if(nBestMatchesReproj < numProjOptMatches)
-                            {
-                                nBestMatchesReproj = numProjOptMatches; // 投影匹配的数量
-                                nBestNumCoindicendes = nNumKFs; // 成功验证的帧数
-                                pBestMatchedKF = pMostBoWMatchesKF; // 记录候选帧窗口内与当前关键帧相似度最高的帧
-                                g2oBestScw = gScw; // 记录最优的位姿(这个位姿是由Tam推到出来的 : Taw = Tam * Tmw,这里a表示c)
-                                vpBestMapPoints = vpMapPoints; //  记录所有的地图点
-                                vpBestMatchedMapPoints = vpMatchedMP; // 记录所有的地图点中被成功匹配的点
-                            }
+    // Optimize Sim3 transformation with every matches
+    Eigen::Matrix<double, 7, 7> mHessian7x7;
 
+    // Step 3.2 利用搜索到的更多的匹配点用Sim3优化投影误差得到的更好的 gScm (Tam)
+    // pKFi是候选关键帧
+    int numOptMatches = Optimizer::OptimizeSim3(mpCurrentKF, pKFi, vpMatchedMP, gScm, 10, mbFixScale, mHessian7x7, true);
 
-                        }
+    // Step 3.3 如果内点足够多,用更小的半径搜索匹配点,并且再次进行优化(p.s.这里与论文不符,并没有再次优化)
+    if(numOptMatches < nSim3Inliers || bStop)
+        return false;
 
-                    }
+    gScw = gScm*gSmw; // Similarity matrix of current from the world position
+    mScw = Converter::toCvMat(gScw);
 
-                }
-            }
-        }
-        index++;
-    }
-    // 如果成功找到了共同区域帧把记录的最优值存到输出变量中
-    if(nBestMatchesReproj > 0)
-    {
-        pLastCurrentKF = mpCurrentKF;
-        nNumCoincidences = nBestNumCoindicendes; // 成功几何验证的帧数
-        pMatchedKF2 = pBestMatchedKF;
-        pMatchedKF2->SetNotErase();
-        g2oScw = g2oBestScw;
-        vpMPs = vpBestMapPoints;
-        vpMatchedMPs = vpBestMatchedMapPoints;
-        //如果有三个成功验证则return ture
-        return nNumCoincidences >= 3;
-    }
-    else
-    {
-        // 这里是一些无用的变量, 左值只用来打印检查
-        int maxStage = -1;
-        int maxMatched;
-        for(int i=0; i<vnStage.size(); ++i)
+    vpMatchedMP.assign(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
+    // Step 3.4 重新利用之前计算的mScw信息, 通过更小的半径和更严格的距离的投影寻找匹配点
+    // 5 : 半径的增益系数(对比之前下降了)---> 更小的半径, 1.0 , hamming distance 的阀值增益系数---> 允许更小的距离
+    int numProjOptMatches = matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpMatchedMP, 5, 1.0);
+    // 当新的投影得到的内点数量大于nProjOptMatches=80时
+    if(numProjOptMatches < nProjOptMatches || bStop)
+        return false;
+
+    // Step 4. 用当前关键帧的相邻关键来验证前面得到的Tam(共视几何校验)
+    // 统计验证成功的关键帧数量
+    int nNumKFs = 0;
+    // Check the Sim3 transformation with the current KeyFrame covisibles
+    // Step 4.1 拿到用来验证的关键帧组(后称为验证组): 当前关键帧的共视关键帧，nNumCovisibles = 5;
+    vector<KeyFrame*> vpCurrentCovKFs = mpCurrentKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
+    int j = 0;
+    // 遍历验证组当有三个关键帧验证成功或遍历所有的关键帧后结束循环
+    while(nNumKFs < 3 && j<vpCurrentCovKFs.size() && !bStop)
+    {   
+        // 拿出验证组中的一个关键帧
+        KeyFrame* pKFj = vpCurrentCovKFs[j];
+        // 为 DetectCommonRegionsFromLastKF准备一个初始位姿, 这个用来进行searchByProjection
+        cv::Mat mTjc = pKFj->GetPose() * mpCurrentKF->GetPoseInverse();
+        g2o::Sim3 gSjc(Converter::toMatrix3d(mTjc.rowRange(0, 3).colRange(0, 3)),Converter::toVector3d(mTjc.rowRange(0, 3).col(3)),1.0);
+        g2o::Sim3 gSjw = gSjc * gScw;
+        int numProjMatches_j = 0;
+        vector<MapPoint*> vpMatchedMPs_j;
+        // Step 4.2 几何校验函数, 这个函数里面其实是个searchByProjection : 通过之前计算的位姿转换地图点并通过投影搜索匹配点, 若大于一定数目的任务成功验证一次
+        bool bValid = DetectCommonRegionsFromLastKF(pKFj,pMostBoWMatchesKF, gSjw,numProjMatches_j, vpMapPoints, vpMatchedMPs_j);
+
+        if(bValid)
         {
-            if(vnStage[i] > maxStage)
-            {
-                maxStage = vnStage[i];
-                maxMatched = vnMatchesStage[i];
-            }
+            // 统计valid的帧的数量
+            nNumKFs++;
         }
 
-//        f_succes_pr << mpCurrentKF->mNameFile << " " << std::to_string(maxStage) << endl;
-//        f_succes_pr << "% NumCand: " << std::to_string(numCandidates) << "; matches: " << std::to_string(maxMatched) << endl;
+        j++;
     }
 
-    // 如果少于3个当前关键帧的共视关键帧验证了这个候选帧,那么返回失败,注意,这里的失败并不代表最终的验证失败,后续会开启时序校验
-    return false;
+    // 记录这个候选帧的结果, 由调用者在所有候选帧中选出最好的一个作为回环帧/融合帧
+    result.nNumProjOptMatches = numProjOptMatches; // 投影匹配的数量
+    result.nNumCoincidences = nNumKFs; // 成功验证的帧数
+    result.pMatchedKF = pMostBoWMatchesKF; // 记录候选帧窗口内与当前关键帧相似度最高的帧
+    result.g2oScw = gScw; // 记录最优的位姿(这个位姿是由Tam推到出来的 : Taw = Tam * Tmw,这里a表示c)
+    result.vpMPs = vpMapPoints; //  记录所有的地图点
+    result.vpMatchedMPs = vpMatchedMP; // 记录所有的地图点中被成功匹配的点
+
+    return nNumKFs >= 3;
 }
 
 /**
@@ -1139,40 +1117,27 @@ int LoopClosing::FindMatchesByProjection(KeyFrame* pCurrentKF, KeyFrame* pMatche
 
 void LoopClosing::CorrectLoop()
 {
+    TRACE_SCOPE("LoopClosing::CorrectLoop");
     cout << "Loop detected!" << endl;
 
+    // If a Global Bundle Adjustment is running, preempt it
+    // Step 0：打断全局BA、结束局部地图线程，为闭环矫正做准备
+    // 全局BA在当前迭代结束后退出，已经优化的结果保留下来，闭环矫正后的全局BA从这里继续
+    // 要在请求局部地图停止之前等它退出：如果它恰好已经优化完，会自己停下局部地图更新地图，最后再放开局部地图
+    cout << "Request GBA preemption" << endl;
+    PreemptGlobalBundleAdjustment();
+
     // Send a stop signal to Local Mapping
     // Avoid new keyframes are inserted while correcting the loop
-    // Step 0：结束局部地图线程、全局BA，为闭环矫正做准备
     // 请求局部地图停止，防止在回环矫正时局部地图线程中InsertKeyFrame函数插入新的关键帧
     mpLocalMapper->RequestStop();
-    mpLocalMapper->EmptyQueue(); // Proccess keyframes in the queue
-
-
-    // If a Global Bundle Adjustment is running, abort it
-    cout << "Request GBA abort" << endl;
-    if(isRunningGBA())
-    {
-        // 如果有全局BA在运行，终止掉，迎接新的全局BA
-        unique_lock<mutex> lock(mMutexGBA);
-        mbStopGBA = true;
-        // 记录全局BA次数
-        mnFullBAIdx++;
-
-        if(mpThreadGBA)
-        {
-            cout << "GBA running... Abort!" << endl;
-            mpThreadGBA->detach();
-            delete mpThreadGBA;
-        }
-    }
 
     // Wait until Local Mapping has effectively stopped
     // 一直等到局部地图线程结束再继续
-    while(!mpLocalMapper->isStopped())
-    {
-        usleep(1000);
-    }
+    mpLocalMapper->WaitUntilStopped();
+
+    // 局部建图停下来之后再处理队列中的关键帧: 关键帧队列只允许一个消费者
+    mpLocalMapper->EmptyQueue(); // Proccess keyframes in the queue
 
     // Ensure current keyframe is updated
 	// Step 1：根据共视关系更新当前关键帧与其它关键帧之间的连接关系
@@ -1398,7 +1363,7 @@ void LoopClosing::CorrectLoop()
     {
         //cout << "With 7DoF" << endl;
 		// Step 6：进行EssentialGraph优化，LoopConnections是形成闭环后新生成的连接关系，不包括步骤7中当前帧与闭环匹配帧之间的连接关系
-        Optimizer::OptimizeEssentialGraph(pLoopMap, mpLoopMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, bFixedScale);
+        Optimizer::OptimizeEssentialGraph(pLoopMap, mpLoopMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, bFixedScale, &mEssentialGraph);
     }
 
 
@@ -1426,6 +1391,8 @@ void LoopClosing::CorrectLoop()
     {
 	    // Step 8：新建一个线程用于全局BA优化
     	// OptimizeEssentialGraph只是优化了一些主要关键帧的位姿，这里进行全局BA可以全局优化所有位姿和MapPoints
+        // 之前被打断的全局BA的结果作为初值
+        WarmStartGlobalBundleAdjustment(pLoopMap);
 
         mbRunningGBA = true;
         mbFinishedGBA = false;
@@ -1448,6 +1415,7 @@ void LoopClosing::CorrectLoop()
  */
 void LoopClosing::MergeLocal()
 {
+    TRACE_SCOPE("LoopClosing::MergeLocal");
     Verbose::PrintMess("MERGE: Merge Visual detected!!!!", Verbose::VERBOSITY_NORMAL);
     // 窗口内共视关键帧的数量
     int numTemporalKFs = 15; //TODO (set by parameter): Temporal KFs in the local window if the map is inertial.
@@ -1465,21 +1433,9 @@ void LoopClosing::MergeLocal()
     // 记录是否把全局BA停下
     bool bRelaunchBA = false;
 
-    // If a Global Bundle Adjustment is running, abort it
-    if(isRunningGBA())
-    {
-        unique_lock<mutex> lock(mMutexGBA);
-        mbStopGBA = true;
-
-        mnFullBAIdx++;
-
-        if(mpThreadGBA)
-        {
-            mpThreadGBA->detach();
-            delete mpThreadGBA;
-        }
-        bRelaunchBA = true; //以后还会重新开启
-    }
+    // If a Global Bundle Adjustment is running, preempt it
+    // 以后还会重新开启，并从被打断时的结果继续
+    bRelaunchBA = PreemptGlobalBundleAdjustment();
 
 //    Verbose::PrintMess("MERGE: Request Stop Local Mapping", Verbose::VERBOSITY_DEBUG);
     ///// 请求局部建图线程停止
@@ -1488,10 +1444,7 @@ void LoopClosing::MergeLocal()
 
     // Wait until Local Mapping has effectively stopped
     // 等待局部建图工作停止
-    while(!mpLocalMapper->isStopped())
-    {
-        usleep(1000);
-    }
+    mpLocalMapper->WaitUntilStopped();
     Verbose::PrintMess("MERGE: Local Map stopped", Verbose::VERBOSITY_NORMAL);
 
     mpLocalMapper->EmptyQueue();
@@ -1910,10 +1863,7 @@ void LoopClosing::MergeLocal()
     else{
         mpLocalMapper->RequestStop();
         // Wait until Local Mapping has effectively stopped
-        while(!mpLocalMapper->isStopped())
-        {
-            usleep(1000);
-        }
+        mpLocalMapper->WaitUntilStopped();
 
         // Optimize graph (and update the loop position for each element form the begining to the end)
         // Step 8.2 本质图优化
@@ -1960,12 +1910,17 @@ void LoopClosing::MergeLocal()
 //    mpThreadDML->detach();
 //    cout << "Map updated!" << endl;
 
-    //Essential graph 优化后可以重新开始局部建图了
-    mpLocalMapper->Release();
     // 如果之前停掉了全局的BA,就开启全局BA
     // 这里没有imu, 所以isImuInitialized一定是false, 所以第二个条件（当前地图关键帧数量小于200且地图只有一个）一定是true 
+    const bool bLaunchGBA = bRelaunchBA && (!pCurrentMap->isImuInitialized() || (pCurrentMap->KeyFramesInMap()<200 && mpAtlas->CountMaps()==1));
+    // 热启动要在局部建图停止时更新地图
+    if(bLaunchGBA)
+        WarmStartGlobalBundleAdjustment(pMergeMap);
+
+    //Essential graph 优化后可以重新开始局部建图了
+    mpLocalMapper->Release();
     // Step 9 全局BA
-    if(bRelaunchBA && (!pCurrentMap->isImuInitialized() || (pCurrentMap->KeyFramesInMap()<200 && mpAtlas->CountMaps()==1)))
+    if(bLaunchGBA)
     {
         mbRunningGBA = true;
         mbFinishedGBA = false;
@@ -1990,6 +1945,7 @@ void LoopClosing::MergeLocal()
  */
 void LoopClosing::MergeLocal2()
 {
+    TRACE_SCOPE("LoopClosing::MergeLocal2");
     cout << "Merge detected!!!!" << endl;
     // 没用上
     int numTemporalKFs = 11; //TODO (set by parameter): Temporal KFs in the local window if the map is inertial.
@@ -2014,20 +1970,7 @@ void LoopClosing::MergeLocal2()
     cout << "Check Full Bundle Adjustment" << endl;
     // If a Global Bundle Adjustment is running, abort it
     // Step 1 如果正在进行全局BA，停掉它
-    if(isRunningGBA())
-    {
-        unique_lock<mutex> lock(mMutexGBA);
-        mbStopGBA = true;
-
-        mnFullBAIdx++;
-
-        if(mpThreadGBA)
-        {
-            mpThreadGBA->detach();
-            delete mpThreadGBA;
-        }
-        bRelaunchBA = true;
-    }
+    bRelaunchBA = PreemptGlobalBundleAdjustment();
 
 
     cout << "Request Stop Local Mapping" << endl;
@@ -2035,10 +1978,7 @@ void LoopClosing::MergeLocal2()
     mpLocalMapper->RequestStop();
     // Wait until Local Mapping has effectively stopped
     // 等待直到完全停掉
-    while(!mpLocalMapper->isStopped())
-    {
-        usleep(1000);
-    }
+    mpLocalMapper->WaitUntilStopped();
     cout << "Local Map stopped" << endl;
 
     // 当前关键帧地图的指针
@@ -2310,16 +2250,10 @@ void LoopClosing::RequestReset()
         unique_lock<mutex> lock(mMutexReset);
         mbResetRequested = true;
     }
+    WakeUp();
 
-    while(1)
-    {
-        {
-        unique_lock<mutex> lock2(mMutexReset);
-        if(!mbResetRequested)
-            break;
-        }
-        usleep(5000);
-    }
+    unique_lock<mutex> lock(mMutexReset);
+    mcvReset.wait(lock, [this]{ return !mbResetRequested; });
 }
 
 void LoopClosing::RequestResetActiveMap(Map *pMap)
@@ -2329,16 +2263,10 @@ void LoopClosing::RequestResetActiveMap(Map *pMap)
         mbResetActiveMapRequested = true;
         mpMapToReset = pMap;
     }
+    WakeUp();
 
-    while(1)
-    {
-        {
-            unique_lock<mutex> lock2(mMutexReset);
-            if(!mbResetActiveMapRequested)
-                break;
-        }
-        usleep(3000);
-    }
+    unique_lock<mutex> lock(mMutexReset);
+    mcvReset.wait(lock, [this]{ return !mbResetActiveMapRequested; });
 }
 // 当前线程调用,检查是否有外部线程请求复位当前线程,如果有的话就复位回环检测线程
 void LoopClosing::ResetIfRequested()
@@ -2348,42 +2276,70 @@ void LoopClosing::ResetIfRequested()
     if(mbResetRequested)
     {
         cout << "Loop closer reset requested..." << endl;
-        mlpLoopKeyFrameQueue.clear();   // 清空参与和进行回环检测的关键帧队列
+        mqLoopKeyFrameQueue.Clear();    // 清空参与和进行回环检测的关键帧队列
+        {
+            unique_lock<mutex> lockGBA(mMutexGBA);
+            mbResumeGBA = false;        // 丢弃被打断的全局BA留下的结果
+            mnGBAItsDone = 0;
+            mbResetIncrementalBA = true;
+        }
+        mEssentialGraph.Reset(static_cast<Map*>(NULL));
         mLastLoopKFid=0;                // 上一次没有和任何关键帧形成闭环关系
         mbResetRequested=false;         // 复位请求标志复位
         mbResetActiveMapRequested = false;
+        mcvReset.notify_all();
     }
     else if(mbResetActiveMapRequested)
     {
 
-        for (list<KeyFrame*>::const_iterator it=mlpLoopKeyFrameQueue.begin(); it != mlpLoopKeyFrameQueue.end();)
+        Map* pMapToReset = mpMapToReset;
+        mqLoopKeyFrameQueue.RemoveIf([pMapToReset](KeyFrame* pKFi){ return pKFi->GetMap() == pMapToReset; });
         {
-            KeyFrame* pKFi = *it;
-            if(pKFi->GetMap() == mpMapToReset)
-            {
-                it = mlpLoopKeyFrameQueue.erase(it);
-            }
-            else
-                ++it;
+            unique_lock<mutex> lockGBA(mMutexGBA);
+            mbResumeGBA = false;
+            mnGBAItsDone = 0;
+            mbResetIncrementalBA = true;
         }
+        if(mEssentialGraph.GetMap() == pMapToReset)
+            mEssentialGraph.Reset(static_cast<Map*>(NULL));
 
         mLastLoopKFid=mpAtlas->GetLastInitKFid(); //TODO old variable, it is not use in the new algorithm
         mbResetActiveMapRequested=false;
+        mcvReset.notify_all();
 
     }
 }
 
 void LoopClosing::RunGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoopKF)
 {
+    TRACE_SCOPE("LoopClosing::RunGlobalBundleAdjustment");
     Verbose::PrintMess("Starting Global Bundle Adjustment", Verbose::VERBOSITY_NORMAL);
     const bool bImuInit = pActiveMap->isImuInitialized();
 
+    // 从被打断的全局BA热启动时,初值已经包含了之前完成的迭代,只补足剩下的次数
+    int nIterations;
+    bool bIncremental;
+    {
+        unique_lock<mutex> lock(mMutexGBA);
+        nIterations = max(kMinGBAIterations, kGBAIterations - mnGBAItsDone);
+        bIncremental = mbIncrementalBA;
+        if(mbResetIncrementalBA || !bIncremental)
+        {
+            mIncrementalBA.Reset(static_cast<Map*>(NULL));
+            mbResetIncrementalBA = false;
+        }
+    }
+
 #ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_StartFGBA = std::chrono::steady_clock::now();
 #endif
 
-    if(!bImuInit)
-        Optimizer::GlobalBundleAdjustemnt(pActiveMap,10,&mbStopGBA,nLoopKF,false);
+    int nIts = 0;
+    if(!bImuInit && bIncremental)
+        // 沿用上一次全局BA保留的线性化结果和分解,只更新闭环改动的部分
+        nIts = Optimizer::IncrementalBundleAdjustment(pActiveMap,mIncrementalBA,nIterations,&mbStopGBA,nLoopKF);
+    else if(!bImuInit)
+        nIts = Optimizer::GlobalBundleAdjustemnt(pActiveMap,nIterations,&mbStopGBA,nLoopKF,false);
     else
         // 仅有一个地图且内部关键帧<200，并且IMU完成了第一阶段初始化后才会进行下面
         Optimizer::FullInertialBA(pActiveMap,7,false,nLoopKF,&mbStopGBA);
@@ -2419,220 +2375,348 @@ void LoopClosing::RunGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoop
             mpLocalMapper->RequestStop();
             // Wait until Local Mapping has effectively stopped
 
-            while(!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished())
-            {
-                usleep(1000);
-            }
-
-            // Get Map Mutex
-            unique_lock<mutex> lock(pActiveMap->mMutexMapUpdate);
-            // cout << "LC: Update Map Mutex adquired" << endl;
+            mpLocalMapper->WaitUntilStopped();
 
-            //pActiveMap->PrintEssentialGraph();
-            // Correct keyframes starting at map first keyframe
-            list<KeyFrame*> lpKFtoCheck(pActiveMap->mvpKeyFrameOrigins.begin(),pActiveMap->mvpKeyFrameOrigins.end());
+            UpdateMapWithGBA(pActiveMap, nLoopKF);
 
-            while(!lpKFtoCheck.empty())
-            {
-                KeyFrame* pKF = lpKFtoCheck.front();
-                const set<KeyFrame*> sChilds = pKF->GetChilds();
-                //cout << "---Updating KF " << pKF->mnId << " with " << sChilds.size() << " childs" << endl;
-                //cout << " KF mnBAGlobalForKF: " << pKF->mnBAGlobalForKF << endl;
-                cv::Mat Twc = pKF->GetPoseInverse();
-                //cout << "Twc: " << Twc << endl;
-                //cout << "GBA: Correct KeyFrames" << endl;
-                for(set<KeyFrame*>::const_iterator sit=sChilds.begin();sit!=sChilds.end();sit++)
-                {
-                    KeyFrame* pChild = *sit;
-                    if(!pChild || pChild->isBad())
-                        continue;
+            // TODO Check this update
+            // mpTracker->UpdateFrameIMU(1.0f, mpTracker->GetLastKeyFrame()->GetImuBias(), mpTracker->GetLastKeyFrame());
 
-                    if(pChild->mnBAGlobalForKF!=nLoopKF)
-                    {
-                        //cout << "++++New child with flag " << pChild->mnBAGlobalForKF << "; LoopKF: " << nLoopKF << endl;
-                        //cout << " child id: " << pChild->mnId << endl;
-                        cv::Mat Tchildc = pChild->GetPose()*Twc;
-                        //cout << "Child pose: " << Tchildc << endl;
-                        //cout << "pKF->mTcwGBA: " << pKF->mTcwGBA << endl;
-                        pChild->mTcwGBA = Tchildc*pKF->mTcwGBA;//*Tcorc*pKF->mTcwGBA;
-
-                        cv::Mat Rcor = pChild->mTcwGBA.rowRange(0,3).colRange(0,3).t()*pChild->GetRotation();
-                        if(!pChild->GetVelocity().empty()){
-                            //cout << "Child velocity: " << pChild->GetVelocity() << endl;
-                            pChild->mVwbGBA = Rcor*pChild->GetVelocity();
-                        }
-                        else
-                            Verbose::PrintMess("Child velocity empty!! ", Verbose::VERBOSITY_NORMAL);
+            mpLocalMapper->Release();
 
+            Verbose::PrintMess("Map updated!", Verbose::VERBOSITY_NORMAL);
+ 
+//            mpPointCloudMapping->mabIsUpdating = false;  // 强制让已有的更新停止，进行新的
+//            mpThreadDML = new thread(&PointCloudMapping::updatecloud, mpPointCloudMapping, std::ref(*pActiveMap));
+//            mpThreadDML->detach();
+            cout << "Map updated!" << endl;
 
-                        //cout << "Child bias: " << pChild->GetImuBias() << endl;
-                        pChild->mBiasGBA = pChild->GetImuBias();
+            mbResumeGBA = false;
+            mnGBAItsDone = 0;
+        }
+        else if(!bImuInit && nIts > 0)
+        {
+            // 被新的闭环或地图融合打断: 已经优化的结果留在 mTcwGBA 和 mPosGBA 中,下一次全局BA从这里热启动
+            Verbose::PrintMess("Global Bundle Adjustment preempted after " + to_string(nIts) + " iterations", Verbose::VERBOSITY_NORMAL);
+            mbResumeGBA = true;
+            mnResumeGBAKF = nLoopKF;
+            mnGBAItsDone += nIts;
+        }
 
+        mbFinishedGBA = true;
+        mbRunningGBA = false;
+        mcvGBA.notify_all();
+    }
 
-                        pChild->mnBAGlobalForKF=nLoopKF;
+#ifdef REGISTER_TIMES
+    std::chrono::steady_clock::time_point time_EndMapUpdate = std::chrono::steady_clock::now();
 
-                    }
-                    lpKFtoCheck.push_back(pChild);
-                }
+    double timeMapUpdate = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndMapUpdate - time_StartMapUpdate).count();
+    vTimeMapUpdate_ms.push_back(timeMapUpdate);
 
-                //cout << "-------Update pose" << endl;
-                pKF->mTcwBefGBA = pKF->GetPose();
-                //cout << "pKF->mTcwBefGBA: " << pKF->mTcwBefGBA << endl;
-                pKF->SetPose(pKF->mTcwGBA);
-                /*cv::Mat Tco_cn = pKF->mTcwBefGBA * pKF->mTcwGBA.inv();
-                cv::Vec3d trasl = Tco_cn.rowRange(0,3).col(3);
-                double dist = cv::norm(trasl);
-                cout << "GBA: KF " << pKF->mnId << " had been moved " << dist << " meters" << endl;
-                double desvX = 0;
-                double desvY = 0;
-                double desvZ = 0;
-                if(pKF->mbHasHessian)
-                {
-                    cv::Mat hessianInv = pKF->mHessianPose.inv();
-
-                    double covX = hessianInv.at<double>(3,3);
-                    desvX = std::sqrt(covX);
-                    double covY = hessianInv.at<double>(4,4);
-                    desvY = std::sqrt(covY);
-                    double covZ = hessianInv.at<double>(5,5);
-                    desvZ = std::sqrt(covZ);
-                    pKF->mbHasHessian = false;
-                }
-                if(dist > 1)
-                {
-                    cout << "--To much distance correction: It has " << pKF->GetConnectedKeyFrames().size() << " connected KFs" << endl;
-                    cout << "--It has " << pKF->GetCovisiblesByWeight(80).size() << " connected KF with 80 common matches or more" << endl;
-                    cout << "--It has " << pKF->GetCovisiblesByWeight(50).size() << " connected KF with 50 common matches or more" << endl;
-                    cout << "--It has " << pKF->GetCovisiblesByWeight(20).size() << " connected KF with 20 common matches or more" << endl;
+    double timeGBA = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndMapUpdate - time_StartFGBA).count();
+    vTimeGBATotal_ms.push_back(timeGBA);
+#endif
+}
 
-                    cout << "--STD in meters(x, y, z): " << desvX << ", " << desvY << ", " << desvZ << endl;
+/**
+ * @brief 用全局BA的结果更新地图. 全局BA运行期间局部建图还在工作,新的关键帧没有参与优化,
+ * 需要沿生成树把矫正量传播过去. 调用时局部建图必须已经停止
+ * @param[in] pActiveMap    全局BA优化的地图
+ * @param[in] nLoopKF       全局BA对应的闭环关键帧id,参与优化的关键帧和地图点的 mnBAGlobalForKF 等于它
+ */
+void LoopClosing::UpdateMapWithGBA(Map* pActiveMap, unsigned long nLoopKF)
+{
+    // Get Map Mutex
+    unique_lock<mutex> lock(pActiveMap->mMutexMapUpdate);
+    // cout << "LC: Update Map Mutex adquired" << endl;
 
+    //pActiveMap->PrintEssentialGraph();
+    // Correct keyframes starting at map first keyframe
+    list<KeyFrame*> lpKFtoCheck(pActiveMap->mvpKeyFrameOrigins.begin(),pActiveMap->mvpKeyFrameOrigins.end());
 
-                    string strNameFile = pKF->mNameFile;
-                    cv::Mat imLeft = cv::imread(strNameFile, CV_LOAD_IMAGE_UNCHANGED);
+    while(!lpKFtoCheck.empty())
+    {
+        KeyFrame* pKF = lpKFtoCheck.front();
+        const set<KeyFrame*> sChilds = pKF->GetChilds();
+        //cout << "---Updating KF " << pKF->mnId << " with " << sChilds.size() << " childs" << endl;
+        //cout << " KF mnBAGlobalForKF: " << pKF->mnBAGlobalForKF << endl;
+        cv::Mat Twc = pKF->GetPoseInverse();
+        //cout << "Twc: " << Twc << endl;
+        //cout << "GBA: Correct KeyFrames" << endl;
+        for(set<KeyFrame*>::const_iterator sit=sChilds.begin();sit!=sChilds.end();sit++)
+        {
+            KeyFrame* pChild = *sit;
+            if(!pChild || pChild->isBad())
+                continue;
 
-                    cv::cvtColor(imLeft, imLeft, CV_GRAY2BGR);
+            if(pChild->mnBAGlobalForKF!=nLoopKF)
+            {
+                //cout << "++++New child with flag " << pChild->mnBAGlobalForKF << "; LoopKF: " << nLoopKF << endl;
+                //cout << " child id: " << pChild->mnId << endl;
+                cv::Mat Tchildc = pChild->GetPose()*Twc;
+                //cout << "Child pose: " << Tchildc << endl;
+                //cout << "pKF->mTcwGBA: " << pKF->mTcwGBA << endl;
+                pChild->mTcwGBA = Tchildc*pKF->mTcwGBA;//*Tcorc*pKF->mTcwGBA;
+
+                cv::Mat Rcor = pChild->mTcwGBA.rowRange(0,3).colRange(0,3).t()*pChild->GetRotation();
+                if(!pChild->GetVelocity().empty()){
+                    //cout << "Child velocity: " << pChild->GetVelocity() << endl;
+                    pChild->mVwbGBA = Rcor*pChild->GetVelocity();
+                }
+                else
+                    Verbose::PrintMess("Child velocity empty!! ", Verbose::VERBOSITY_NORMAL);
 
-                    vector<MapPoint*> vpMapPointsKF = pKF->GetMapPointMatches();
-                    int num_MPs = 0;
-                    for(int i=0; i<vpMapPointsKF.size(); ++i)
-                    {
-                        if(!vpMapPointsKF[i] || vpMapPointsKF[i]->isBad())
-                        {
-                            continue;
-                        }
-                        num_MPs += 1;
-                        string strNumOBs = to_string(vpMapPointsKF[i]->Observations());
-                        cv::circle(imLeft, pKF->mvKeys[i].pt, 2, cv::Scalar(0, 255, 0));
-                        cv::putText(imLeft, strNumOBs, pKF->mvKeys[i].pt, CV_FONT_HERSHEY_DUPLEX, 1, cv::Scalar(255, 0, 0));
-                    }
-                    cout << "--It has " << num_MPs << " MPs matched in the map" << endl;
 
-                    string namefile = "./test_GBA/GBA_" + to_string(nLoopKF) + "_KF" + to_string(pKF->mnId) +"_D" + to_string(dist) +".png";
-                    cv::imwrite(namefile, imLeft);
-                }*/
+                //cout << "Child bias: " << pChild->GetImuBias() << endl;
+                pChild->mBiasGBA = pChild->GetImuBias();
 
 
-                if(pKF->bImu)
-                {
-                    //cout << "-------Update inertial values" << endl;
-                    pKF->mVwbBefGBA = pKF->GetVelocity();
-                    if (pKF->mVwbGBA.empty())
-                        Verbose::PrintMess("pKF->mVwbGBA is empty", Verbose::VERBOSITY_NORMAL);
-
-                    assert(!pKF->mVwbGBA.empty());
-                    pKF->SetVelocity(pKF->mVwbGBA);
-                    pKF->SetNewBias(pKF->mBiasGBA);                    
-                }
+                pChild->mnBAGlobalForKF=nLoopKF;
 
-                lpKFtoCheck.pop_front();
             }
+            lpKFtoCheck.push_back(pChild);
+        }
 
-            //cout << "GBA: Correct MapPoints" << endl;
-            // Correct MapPoints
-            const vector<MapPoint*> vpMPs = pActiveMap->GetAllMapPoints();
+        //cout << "-------Update pose" << endl;
+        pKF->mTcwBefGBA = pKF->GetPose();
+        //cout << "pKF->mTcwBefGBA: " << pKF->mTcwBefGBA << endl;
+        pKF->SetPose(pKF->mTcwGBA);
+        /*cv::Mat Tco_cn = pKF->mTcwBefGBA * pKF->mTcwGBA.inv();
+        cv::Vec3d trasl = Tco_cn.rowRange(0,3).col(3);
+        double dist = cv::norm(trasl);
+        cout << "GBA: KF " << pKF->mnId << " had been moved " << dist << " meters" << endl;
+        double desvX = 0;
+        double desvY = 0;
+        double desvZ = 0;
+        if(pKF->mbHasHessian)
+        {
+            cv::Mat hessianInv = pKF->mHessianPose.inv();
+
+            double covX = hessianInv.at<double>(3,3);
+            desvX = std::sqrt(covX);
+            double covY = hessianInv.at<double>(4,4);
+            desvY = std::sqrt(covY);
+            double covZ = hessianInv.at<double>(5,5);
+            desvZ = std::sqrt(covZ);
+            pKF->mbHasHessian = false;
+        }
+        if(dist > 1)
+        {
+            cout << "--To much distance correction: It has " << pKF->GetConnectedKeyFrames().size() << " connected KFs" << endl;
+            cout << "--It has " << pKF->GetCovisiblesByWeight(80).size() << " connected KF with 80 common matches or more" << endl;
+            cout << "--It has " << pKF->GetCovisiblesByWeight(50).size() << " connected KF with 50 common matches or more" << endl;
+            cout << "--It has " << pKF->GetCovisiblesByWeight(20).size() << " connected KF with 20 common matches or more" << endl;
 
-            // 遍历每一个地图点
-            for(size_t i=0; i<vpMPs.size(); i++)
-            {
-                MapPoint* pMP = vpMPs[i];
+            cout << "--STD in meters(x, y, z): " << desvX << ", " << desvY << ", " << desvZ << endl;
 
-                if(pMP->isBad())
-                    continue;
 
-                // NOTICE 并不是所有的地图点都会直接参与到全局BA优化中,但是大部分的地图点需要根据全局BA优化后的结果来重新纠正自己的位姿
-                // 如果这个地图点直接参与到了全局BA优化的过程,那么就直接重新设置器位姿即可
-                if(pMP->mnBAGlobalForKF==nLoopKF)
-                {
-                    // If optimized by Global BA, just update
-                    pMP->SetWorldPos(pMP->mPosGBA);
-                }
-                else // 如故这个地图点并没有直接参与到全局BA优化的过程中,那么就使用器参考关键帧的新位姿来优化自己的位姿
+            string strNameFile = pKF->mNameFile;
+            cv::Mat imLeft = cv::imread(strNameFile, CV_LOAD_IMAGE_UNCHANGED);
+
+            cv::cvtColor(imLeft, imLeft, CV_GRAY2BGR);
+
+            vector<MapPoint*> vpMapPointsKF = pKF->GetMapPointMatches();
+            int num_MPs = 0;
+            for(int i=0; i<vpMapPointsKF.size(); ++i)
+            {
+                if(!vpMapPointsKF[i] || vpMapPointsKF[i]->isBad())
                 {
-                    // Update according to the correction of its reference keyframe
-                    KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
-
-                    // 说明这个关键帧，在前面的过程中也没有因为“当前关键帧”得到全局BA优化 
-                    //? 可是,为什么会出现这种情况呢? 难道是因为这个地图点的参考关键帧设置成为了bad?
-                    if(pRefKF->mnBAGlobalForKF!=nLoopKF)
-                        continue;
-
-                    if(pRefKF->mTcwBefGBA.empty())
-                        continue;
-
-                    // Map to non-corrected camera
-                    cv::Mat Rcw = pRefKF->mTcwBefGBA.rowRange(0,3).colRange(0,3);
-                    cv::Mat tcw = pRefKF->mTcwBefGBA.rowRange(0,3).col(3);
-                    // 转换到其参考关键帧相机坐标系下的坐标
-                    cv::Mat Xc = Rcw*pMP->GetWorldPos()+tcw;
-
-                    // Backproject using corrected camera
-                    // 然后使用已经纠正过的参考关键帧的位姿,再将该地图点变换到世界坐标系下
-                    cv::Mat Twc = pRefKF->GetPoseInverse();
-                    cv::Mat Rwc = Twc.rowRange(0,3).colRange(0,3);
-                    cv::Mat twc = Twc.rowRange(0,3).col(3);
-
-                    pMP->SetWorldPos(Rwc*Xc+twc);
+                    continue;
                 }
+                num_MPs += 1;
+                string strNumOBs = to_string(vpMapPointsKF[i]->Observations());
+                cv::circle(imLeft, pKF->mvKeys[i].pt, 2, cv::Scalar(0, 255, 0));
+                cv::putText(imLeft, strNumOBs, pKF->mvKeys[i].pt, CV_FONT_HERSHEY_DUPLEX, 1, cv::Scalar(255, 0, 0));
             }
+            cout << "--It has " << num_MPs << " MPs matched in the map" << endl;
 
-            pActiveMap->InformNewBigChange();
-            pActiveMap->IncreaseChangeIndex();
+            string namefile = "./test_GBA/GBA_" + to_string(nLoopKF) + "_KF" + to_string(pKF->mnId) +"_D" + to_string(dist) +".png";
+            cv::imwrite(namefile, imLeft);
+        }*/
 
-            // TODO Check this update
-            // mpTracker->UpdateFrameIMU(1.0f, mpTracker->GetLastKeyFrame()->GetImuBias(), mpTracker->GetLastKeyFrame());
 
-            mpLocalMapper->Release();
+        if(pKF->bImu)
+        {
+            //cout << "-------Update inertial values" << endl;
+            pKF->mVwbBefGBA = pKF->GetVelocity();
+            if (pKF->mVwbGBA.empty())
+                Verbose::PrintMess("pKF->mVwbGBA is empty", Verbose::VERBOSITY_NORMAL);
+
+            assert(!pKF->mVwbGBA.empty());
+            pKF->SetVelocity(pKF->mVwbGBA);
+            pKF->SetNewBias(pKF->mBiasGBA);                    
+        }
 
-            Verbose::PrintMess("Map updated!", Verbose::VERBOSITY_NORMAL);
- 
-//            mpPointCloudMapping->mabIsUpdating = false;  // 强制让已有的更新停止，进行新的
-//            mpThreadDML = new thread(&PointCloudMapping::updatecloud, mpPointCloudMapping, std::ref(*pActiveMap));
-//            mpThreadDML->detach();
-            cout << "Map updated!" << endl;
+        lpKFtoCheck.pop_front();
+    }
+
+    //cout << "GBA: Correct MapPoints" << endl;
+    // Correct MapPoints
+    const vector<MapPoint*> vpMPs = pActiveMap->GetAllMapPoints();
+
+    // 遍历每一个地图点
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+
+        if(pMP->isBad())
+            continue;
+
+        // NOTICE 并不是所有的地图点都会直接参与到全局BA优化中,但是大部分的地图点需要根据全局BA优化后的结果来重新纠正自己的位姿
+        // 如果这个地图点直接参与到了全局BA优化的过程,那么就直接重新设置器位姿即可
+        if(pMP->mnBAGlobalForKF==nLoopKF)
+        {
+            // If optimized by Global BA, just update
+            pMP->SetWorldPos(pMP->mPosGBA);
         }
+        else // 如故这个地图点并没有直接参与到全局BA优化的过程中,那么就使用器参考关键帧的新位姿来优化自己的位姿
+        {
+            // Update according to the correction of its reference keyframe
+            KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
 
-        mbFinishedGBA = true;
-        mbRunningGBA = false;
+            // 说明这个关键帧，在前面的过程中也没有因为“当前关键帧”得到全局BA优化 
+            //? 可是,为什么会出现这种情况呢? 难道是因为这个地图点的参考关键帧设置成为了bad?
+            if(pRefKF->mnBAGlobalForKF!=nLoopKF)
+                continue;
+
+            if(pRefKF->mTcwBefGBA.empty())
+                continue;
+
+            // Map to non-corrected camera
+            cv::Mat Rcw = pRefKF->mTcwBefGBA.rowRange(0,3).colRange(0,3);
+            cv::Mat tcw = pRefKF->mTcwBefGBA.rowRange(0,3).col(3);
+            // 转换到其参考关键帧相机坐标系下的坐标
+            cv::Mat Xc = Rcw*pMP->GetWorldPos()+tcw;
+
+            // Backproject using corrected camera
+            // 然后使用已经纠正过的参考关键帧的位姿,再将该地图点变换到世界坐标系下
+            cv::Mat Twc = pRefKF->GetPoseInverse();
+            cv::Mat Rwc = Twc.rowRange(0,3).colRange(0,3);
+            cv::Mat twc = Twc.rowRange(0,3).col(3);
+
+            pMP->SetWorldPos(Rwc*Xc+twc);
+        }
     }
 
-#ifdef REGISTER_TIMES
-    std::chrono::steady_clock::time_point time_EndMapUpdate = std::chrono::steady_clock::now();
+    pActiveMap->InformNewBigChange();
+    pActiveMap->IncreaseChangeIndex();
+}
 
-    double timeMapUpdate = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndMapUpdate - time_StartMapUpdate).count();
-    vTimeMapUpdate_ms.push_back(timeMapUpdate);
+/**
+ * @brief 打断正在运行的全局BA. 优化器每次迭代检查一次停止标志,这里等全局BA线程退出,
+ * 它已经优化的结果留给下一次全局BA热启动(见 WarmStartGlobalBundleAdjustment)
+ * 必须在请求局部建图停止之前调用: 全局BA恰好已经优化完时,它会自己停下局部建图更新地图,然后放开局部建图
+ * @return 是否有全局BA被打断
+ */
+bool LoopClosing::PreemptGlobalBundleAdjustment()
+{
+    if(!isRunningGBA())
+        return false;
 
-    double timeGBA = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndMapUpdate - time_StartFGBA).count();
-    vTimeGBATotal_ms.push_back(timeGBA);
-#endif
+    thread* pThreadGBA;
+    {
+        unique_lock<mutex> lock(mMutexGBA);
+        mbStopGBA = true;
+        pThreadGBA = mpThreadGBA;
+        mpThreadGBA = NULL;
+    }
+
+    if(pThreadGBA)
+    {
+        cout << "GBA running... Preempt!" << endl;
+        pThreadGBA->join();
+        delete pThreadGBA;
+    }
+
+    unique_lock<mutex> lock(mMutexGBA);
+    // 记录全局BA次数
+    mnFullBAIdx++;
+    return true;
+}
+
+// 等待全局BA线程把 mbRunningGBA 置为false
+void LoopClosing::WaitUntilGBAFinished()
+{
+    unique_lock<mutex> lock(mMutexGBA);
+    mcvGBA.wait(lock, [this]{ return !mbRunningGBA; });
+}
+
+/**
+ * @brief 用被打断的全局BA的结果作为下一次全局BA的初值
+ * 被打断的全局BA把关键帧从 Tini 优化到了 Tgba,之后闭环(或地图融合)又把它矫正到了 Tcw.
+ * 把全局BA的改正量作用到矫正后的位姿上: Tcw' = Tgba*Tini^-1*Tcw. 矫正在局部是世界坐标系的刚体变换,
+ * 此时 Tcw' 就是同样变换后的 Tgba; 全局BA没有改动的关键帧保持矫正后的位姿. 地图点随参考关键帧一起变换.
+ * 单目时矫正带有尺度,改正量的平移部分只是近似,但它本身是小量
+ * 然后和全局BA正常结束时一样更新地图. 调用时局部建图必须已经停止
+ * @param[in] pMap 将要做全局BA的地图
+ */
+void LoopClosing::WarmStartGlobalBundleAdjustment(Map* pMap)
+{
+    unsigned long nResumeKF;
+    {
+        unique_lock<mutex> lock(mMutexGBA);
+        // 只有纯视觉的全局BA会留下结果
+        const bool bResume = mbResumeGBA && !pMap->isImuInitialized();
+        mbResumeGBA = false;
+        if(!bResume)
+        {
+            mnGBAItsDone = 0;
+            return;
+        }
+        nResumeKF = mnResumeGBAKF;
+    }
+
+    {
+        unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+
+        const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+        for(KeyFrame* pKF : vpKFs)
+        {
+            if(pKF->isBad() || pKF->mnBAGlobalForKF!=nResumeKF || pKF->mTcwIniGBA.empty())
+                continue;
+
+            const g2o::SE3Quat Tgba = Converter::toSE3Quat(pKF->mTcwGBA);
+            const g2o::SE3Quat Tini = Converter::toSE3Quat(pKF->mTcwIniGBA);
+            pKF->mTcwGBA = Converter::toCvMat(Tgba*Tini.inverse()*Converter::toSE3Quat(pKF->GetPose()));
+        }
+
+        const vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
+        for(MapPoint* pMP : vpMPs)
+        {
+            if(pMP->isBad() || pMP->mnBAGlobalForKF!=nResumeKF)
+                continue;
+
+            // 单目的矫正带有尺度变化,全局BA给出的点在参考关键帧下的深度不再适用.
+            // 这时以及参考关键帧没有参与优化时,按没有参与优化的地图点处理,只随参考关键帧移动
+            KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+            if(!mbFixScale || !pRefKF || pRefKF->mnBAGlobalForKF!=nResumeKF || pRefKF->mTcwIniGBA.empty())
+            {
+                pMP->mnBAGlobalForKF = 0;
+                continue;
+            }
+
+            // 在优化初值的参考关键帧坐标系下的坐标,再用矫正后的参考关键帧位姿反投影
+            const cv::Mat Tini = pRefKF->mTcwIniGBA;
+            const cv::Mat Tcw = pRefKF->GetPose();
+            const cv::Mat Xc = Tini.rowRange(0,3).colRange(0,3)*pMP->mPosGBA+Tini.rowRange(0,3).col(3);
+            pMP->mPosGBA = Tcw.rowRange(0,3).colRange(0,3).t()*(Xc-Tcw.rowRange(0,3).col(3));
+        }
+    }
+
+    UpdateMapWithGBA(pMap, nResumeKF);
+    Verbose::PrintMess("GBA warm started from the preempted estimate", Verbose::VERBOSITY_NORMAL);
 }
 
 // 由外部线程调用,请求终止当前线程
 void LoopClosing::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    // cout << "LC: Finish requested" << endl;
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        // cout << "LC: Finish requested" << endl;
+        mbFinishRequested = true;
+    }
+    WakeUp();
 }
 
 // 当前线程调用,查看是否有外部线程请求当前线程
@@ -2647,6 +2731,7 @@ void LoopClosing::SetFinish()
 {
     unique_lock<mutex> lock(mMutexFinish);
     mbFinished = true;
+    mcvFinished.notify_all();
 }
 
 // 由外部线程调用,判断当前回环检测线程是否已经正确终止了
@@ -2656,5 +2741,12 @@ bool LoopClosing::isFinished()
     return mbFinished;
 }
 
+// 由外部线程调用,等待回环检测线程退出
+void LoopClosing::WaitUntilFinished()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mcvFinished.wait(lock, [this]{ return mbFinished; });
+}
+
 
 } //namespace ORB_SLAM
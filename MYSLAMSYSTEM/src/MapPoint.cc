@@ -20,6 +20,7 @@
 #include "ORBmatcher.h"
 
 #include<mutex>
+#include<algorithm>
 
 namespace ORB_SLAM3
 {
@@ -27,6 +28,23 @@ namespace ORB_SLAM3
 long unsigned int MapPoint::nNextId=0;
 mutex MapPoint::mGlobalMutex;
 
+// 观测按关键帧id排序,用二分查找定位
+struct ObservationIdLess
+{
+    bool operator()(const MapPoint::Observation &obs, const long unsigned int id) const
+    {
+        return obs.nKFId < id;
+    }
+};
+
+static vector<MapPoint::Observation>::const_iterator FindObservation(const vector<MapPoint::Observation> &vObs, KeyFrame* pKF)
+{
+    vector<MapPoint::Observation>::const_iterator it = lower_bound(vObs.begin(), vObs.end(), pKF->mnId, ObservationIdLess());
+    if(it!=vObs.end() && it->pKF==pKF)
+        return it;
+    return vObs.end();
+}
+
 /** 
  * @brief 构造函数
  */
@@ -191,23 +209,30 @@ KeyFrame* MapPoint::GetReferenceKeyFrame()
 void MapPoint::AddObservation(KeyFrame* pKF, int idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    tuple<int,int> indexes;
+    // 写时复制: 正在遍历旧快照的线程不受影响
+    std::shared_ptr<vector<Observation> > pObs = mpObservations ?
+            std::make_shared<vector<Observation> >(*mpObservations) : std::make_shared<vector<Observation> >();
 
-    if(mObservations.count(pKF)){
-        indexes = mObservations[pKF];
-    }
-    else{
-        indexes = tuple<int,int>(-1,-1);
+    vector<Observation>::iterator it = lower_bound(pObs->begin(), pObs->end(), pKF->mnId, ObservationIdLess());
+    if(it==pObs->end() || it->pKF!=pKF)
+    {
+        // 如果没有添加过观测，记录下能观测到该MapPoint的KF
+        Observation obs;
+        obs.pKF = pKF;
+        obs.nKFId = pKF->mnId;
+        obs.leftIndex = -1;
+        obs.rightIndex = -1;
+        it = pObs->insert(it, obs);
     }
 
+    // 记录该MapPoint在KF中的索引
     if(pKF -> NLeft != -1 && idx >= pKF -> NLeft){
-        get<1>(indexes) = idx;
+        it->rightIndex = idx;
     }
     else{
-        get<0>(indexes) = idx;
+        it->leftIndex = idx;
     }
-    // 如果没有添加过观测，记录下能观测到该MapPoint的KF和该MapPoint在KF中的索引
-    mObservations[pKF]=indexes;
+    mpObservations = pObs;
 
     if(!pKF->mpCamera2 && pKF->mvuRight[idx]>=0)
         nObs+=2; // 双目或者rgbd
@@ -223,10 +248,10 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
     {
         unique_lock<mutex> lock(mMutexFeatures);
         // 查找这个要删除的观测,根据单目和双目类型的不同从其中删除当前地图点的被观测次数
-        if(mObservations.count(pKF))
+        vector<Observation>::const_iterator it;
+        if(mpObservations && (it=FindObservation(*mpObservations, pKF))!=mpObservations->end())
         {
-            tuple<int,int> indexes = mObservations[pKF];
-            int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
+            int leftIndex = it->leftIndex, rightIndex = it->rightIndex;
 
             if(leftIndex != -1){
                 if(!pKF->mpCamera2 && pKF->mvuRight[leftIndex]>=0)
@@ -238,11 +263,16 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
                 nObs--;
             }
 
-            mObservations.erase(pKF);
+            std::shared_ptr<vector<Observation> > pObs = std::make_shared<vector<Observation> >(*mpObservations);
+            pObs->erase(pObs->begin() + (it - mpObservations->begin()));
+            if(pObs->empty())
+                mpObservations.reset();
+            else
+                mpObservations = pObs;
 
             // 如果该keyFrame是参考帧，该Frame被删除后重新指定RefFrame
-            if(mpRefKF==pKF)
-                mpRefKF=mObservations.begin()->first;
+            if(mpRefKF==pKF && mpObservations)
+                mpRefKF=mpObservations->front().pKF;
 
             // If only 2 observations or less, discard point
             // 当观测到该点的相机数目少于2时，丢弃该点
@@ -259,8 +289,20 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
 // 能够观测到当前地图点的所有关键帧及该地图点在KF中的索引
 std::map<KeyFrame*, std::tuple<int,int>>  MapPoint::GetObservations()
 {
+    const ObservationSnapshot obs = GetObservationSnapshot();
+    map<KeyFrame*, tuple<int,int>> observations;
+    for(vector<Observation>::const_iterator it=obs->begin(), itend=obs->end(); it!=itend; it++)
+        observations.insert(make_pair(it->pKF, make_tuple(it->leftIndex, it->rightIndex)));
+    return observations;
+}
+
+// 热点循环中用快照或ForEachObservation代替GetObservations,避免每次复制std::map
+MapPoint::ObservationSnapshot MapPoint::GetObservationSnapshot()
+{
+    // 没有观测时返回共享的空快照,调用者不需要判断空指针
+    static const ObservationSnapshot empty = std::make_shared<const vector<Observation> >();
     unique_lock<mutex> lock(mMutexFeatures);
-    return mObservations;
+    return mpObservations ? mpObservations : empty;
 }
 
 /**
@@ -279,25 +321,28 @@ int MapPoint::Observations()
  */
 void MapPoint::SetBadFlag()
 {
-    map<KeyFrame*, tuple<int,int>> obs;
+    ObservationSnapshot obs;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPos);
         mbBad=true;
-        // 把mObservations转存到obs，obs和mObservations里存的是指针，赋值过程为浅拷贝
-        obs = mObservations;
-        // 把mObservations指向的内存释放，obs作为局部变量之后自动删除
-        mObservations.clear();
+        // 把观测快照转存到obs，只交换指针
+        obs = mpObservations;
+        // 清空观测，obs作为局部变量之后自动释放
+        mpObservations.reset();
     }
-    for(map<KeyFrame*, tuple<int,int>>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    if(obs)
     {
-        KeyFrame* pKF = mit->first;
-        int leftIndex = get<0>(mit -> second), rightIndex = get<1>(mit -> second);
-        if(leftIndex != -1){
-            pKF->EraseMapPointMatch(leftIndex);
-        }
-        if(rightIndex != -1){
-            pKF->EraseMapPointMatch(rightIndex);
+        for(vector<Observation>::const_iterator mit=obs->begin(), mend=obs->end(); mit!=mend; mit++)
+        {
+            KeyFrame* pKF = mit->pKF;
+            int leftIndex = mit->leftIndex, rightIndex = mit->rightIndex;
+            if(leftIndex != -1){
+                pKF->EraseMapPointMatch(leftIndex);
+            }
+            if(rightIndex != -1){
+                pKF->EraseMapPointMatch(rightIndex);
+            }
         }
     }
     // 擦除该MapPoint申请的内存
@@ -333,13 +378,13 @@ void MapPoint::Replace(MapPoint* pMP)
 
     // 清除当前地图点的信息，这一段和SetBadFlag函数相同
     int nvisible, nfound;
-    map<KeyFrame*,tuple<int,int>> obs;
+    ObservationSnapshot obs;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPos);
-        obs=mObservations;
+        obs=mpObservations;
         //清除当前地图点的原有观测
-        mObservations.clear();
+        mpObservations.reset();
         //当前的地图点被删除了
         mbBad=true;
         //暂存当前地图点的可视次数和被找到的次数
@@ -350,13 +395,14 @@ void MapPoint::Replace(MapPoint* pMP)
     }
 
     // 所有能观测到原地图点的关键帧都要复制到替换的地图点上
-    for(map<KeyFrame*,tuple<int,int>>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    const vector<Observation> vEmpty;
+    const vector<Observation> &vObs = obs ? *obs : vEmpty;
+    for(vector<Observation>::const_iterator mit=vObs.begin(), mend=vObs.end(); mit!=mend; mit++)
     {
         // Replace measurement in keyframe
-        KeyFrame* pKF = mit->first;
+        KeyFrame* pKF = mit->pKF;
 
-        tuple<int,int> indexes = mit -> second;
-        int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
+        int leftIndex = mit->leftIndex, rightIndex = mit->rightIndex;
         // 2.1 判断新点是否已经在pKF里面
         if(!pMP->IsInKeyFrame(pKF))
         {
@@ -452,31 +498,30 @@ void MapPoint::ComputeDistinctiveDescriptors()
     // Retrieve all observed descriptors
     vector<cv::Mat> vDescriptors;
 
-    map<KeyFrame*,tuple<int,int>> observations;
+    ObservationSnapshot observations;
 
     // Step 1 获取所有观测，跳过坏点
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         if(mbBad)
             return;
-        observations=mObservations;
+        observations=mpObservations;
     }
 
-    if(observations.empty())
+    if(!observations)
         return;
 
-    vDescriptors.reserve(observations.size());
+    vDescriptors.reserve(observations->size());
 
     // Step 2 遍历观测到3d点的所有关键帧，获得orb描述子，并插入到vDescriptors中
-    for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    for(vector<Observation>::const_iterator mit=observations->begin(), mend=observations->end(); mit!=mend; mit++)
     {
-        // mit->first取观测到该地图点的关键帧
-        // mit->second取该地图点在关键帧中的索引
-        KeyFrame* pKF = mit->first;
+        // mit->pKF取观测到该地图点的关键帧
+        // mit->leftIndex/rightIndex取该地图点在关键帧中的索引
+        KeyFrame* pKF = mit->pKF;
 
         if(!pKF->isBad()){
-            tuple<int,int> indexes = mit -> second;
-            int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
+            int leftIndex = mit->leftIndex, rightIndex = mit->rightIndex;
 
             if(leftIndex != -1){
                 vDescriptors.push_back(pKF->mDescriptors.row(leftIndex));
@@ -552,21 +597,21 @@ cv::Mat MapPoint::GetDescriptor()
 tuple<int,int> MapPoint::GetIndexInKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    if(mObservations.count(pKF))
-        return mObservations[pKF];
+    vector<Observation>::const_iterator it;
+    if(mpObservations && (it=FindObservation(*mpObservations, pKF))!=mpObservations->end())
+        return tuple<int,int>(it->leftIndex, it->rightIndex);
     else
         return tuple<int,int>(-1,-1);
 }
 
 /**
- * @brief return (mObservations.count(pKF));
+ * @brief 地图点是否被关键帧pKF观测到
  */
 bool MapPoint::IsInKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexFeatures);
     // 存在返回true，不存在返回false
-    // std::map.count 用法见：http://www.cplusplus.com/reference/map/map/count/
-    return (mObservations.count(pKF));
+    return mpObservations && FindObservation(*mpObservations, pKF)!=mpObservations->end();
 }
 
 /**
@@ -578,7 +623,7 @@ bool MapPoint::IsInKeyFrame(KeyFrame *pKF)
 void MapPoint::UpdateNormalAndDepth()
 {
     // Step 1 获得该地图点的相关信息
-    map<KeyFrame*,tuple<int,int>> observations;
+    ObservationSnapshot observations;
     KeyFrame* pRefKF;
     cv::Mat Pos;
     {
@@ -587,12 +632,12 @@ void MapPoint::UpdateNormalAndDepth()
         if(mbBad)
             return;
 
-        observations=mObservations; // 获得观测到该地图点的所有关键帧
+        observations=mpObservations; // 获得观测到该地图点的所有关键帧
         pRefKF=mpRefKF;             // 观测到该点的参考关键帧（第一次创建时的关键帧）
         Pos = mWorldPos.clone();    // 地图点在世界坐标系中的位置
     }
 
-    if(observations.empty())
+    if(!observations)
         return;
 
     // Step 2 计算该地图点的法线方向，也就是朝向等信息。
@@ -600,12 +645,11 @@ void MapPoint::UpdateNormalAndDepth()
     // 初始值为0向量，累加为归一化向量，最后除以总数n
     cv::Mat normal = cv::Mat::zeros(3,1,CV_32F);
     int n=0;
-    for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    for(vector<Observation>::const_iterator mit=observations->begin(), mend=observations->end(); mit!=mend; mit++)
     {
-        KeyFrame* pKF = mit->first;
+        KeyFrame* pKF = mit->pKF;
 
-        tuple<int,int> indexes = mit -> second;
-        int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
+        int leftIndex = mit->leftIndex, rightIndex = mit->rightIndex;
 
         if(leftIndex != -1){
             cv::Mat Owi = pKF->GetCameraCenter();
@@ -621,11 +665,15 @@ void MapPoint::UpdateNormalAndDepth()
         }
     }
 
+    // 观测快照中没有参考关键帧(快照之后参考关键帧被替换)时无法确定金字塔层,保留原来的距离范围
+    vector<Observation>::const_iterator itRef = FindObservation(*observations, pRefKF);
+    if(itRef==observations->end())
+        return;
+    const int leftIndex = itRef->leftIndex, rightIndex = itRef->rightIndex;
+
     cv::Mat PC = Pos - pRefKF->GetCameraCenter();                           // 参考关键帧相机指向地图点的向量（在世界坐标系下的表示）
     const float dist = cv::norm(PC);                                        // 该点到参考关键帧相机的距离
 
-    tuple<int ,int> indexes = observations[pRefKF];
-    int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
     int level;
     if(pRefKF -> NLeft == -1){
         level = pRefKF->mvKeysUn[leftIndex].octave;
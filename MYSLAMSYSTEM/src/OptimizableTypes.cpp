@@ -17,6 +17,7 @@
 */
 
 #include "OptimizableTypes.h"
+#include "ProjectionBatch.h"
 
 namespace ORB_SLAM3 {
     bool EdgeSE3ProjectXYZOnlyPose::read(std::istream& is){
@@ -118,7 +119,8 @@ namespace ORB_SLAM3 {
         _jacobianOplusXi = -pCamera->projectJac(X_r) * mTrl.rotation().toRotationMatrix() * SE3deriv;
     }
 
-    EdgeSE3ProjectXYZ::EdgeSE3ProjectXYZ() : BaseBinaryEdge<2, Eigen::Vector2d, g2o::VertexSBAPointXYZ, g2o::VertexSE3Expmap>() {
+    EdgeSE3ProjectXYZ::EdgeSE3ProjectXYZ() : BaseBinaryEdge<2, Eigen::Vector2d, g2o::VertexSBAPointXYZ, g2o::VertexSE3Expmap>(),
+        mpBatch(nullptr), mnBatchIdx(-1) {
     }
 
     bool EdgeSE3ProjectXYZ::read(std::istream& is){
@@ -151,6 +153,12 @@ namespace ORB_SLAM3 {
  * @brief 求解二维像素坐标关于位姿的雅克比矩阵 _jacobianOplusXj  二维像素坐标关于三维点世界坐标的雅克比矩阵 _jacobianOplusXi  
  */
     void EdgeSE3ProjectXYZ::linearizeOplus() {
+        if (mpBatch) {
+            _jacobianOplusXi = mpBatch->PointJacobian(mnBatchIdx);
+            _jacobianOplusXj = mpBatch->PoseJacobian(mnBatchIdx);
+            return;
+        }
+
         g2o::VertexSE3Expmap * vj = static_cast<g2o::VertexSE3Expmap *>(_vertices[1]);
         g2o::SE3Quat T(vj->estimate());
         g2o::VertexSBAPointXYZ* vi = static_cast<g2o::VertexSBAPointXYZ*>(_vertices[0]);
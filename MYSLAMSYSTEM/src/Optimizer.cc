@@ -30,15 +30,22 @@
 #include "Thirdparty/g2o/g2o/core/optimization_algorithm_levenberg.h"
 #include "Thirdparty/g2o/g2o/core/optimization_algorithm_gauss_newton.h"
 #include "Thirdparty/g2o/g2o/solvers/linear_solver_eigen.h"
+#include "Thirdparty/g2o/g2o/solvers/linear_solver_supernodal.h"
 #include "Thirdparty/g2o/g2o/types/types_six_dof_expmap.h"
 #include "Thirdparty/g2o/g2o/core/robust_kernel_impl.h"
 #include "Thirdparty/g2o/g2o/solvers/linear_solver_dense.h"
 #include "G2oTypes.h"
 #include "Converter.h"
+#include "Tracer.h"
+#include "PoseSolver.h"
 
 #include <mutex>
+#include <thread>
+#include <atomic>
 
 #include "OptimizableTypes.h"
+#include "ProjectionBatch.h"
+#include "ParallelFor.h"
 
 namespace ORB_SLAM3
 {
@@ -47,16 +54,37 @@ bool sortByVal(const pair<MapPoint *, int> &a, const pair<MapPoint *, int> &b)
 {
     return (a.second < b.second);
 }
+
+/**
+ * @brief 局部BA构造线性系统和Schur补时使用的线程数
+ * LocalMapping和Tracking、LoopClosing同时运行,最多使用4个线程
+ */
+static int LocalBANumThreads()
+{
+    const int nCores = static_cast<int>(std::thread::hardware_concurrency());
+    return std::max(1, std::min(nCores, 4));
+}
+
 /**************************************以下为单帧优化**************************************************************/
 
 /**
  * @brief 位姿优化，纯视觉时使用。优化目标：单帧的位姿
  * @param pFrame 待优化的帧
+ * @param bUseG2o 为true时即使单相机也使用g2o实现,用于和PoseSolver比较
  */
-int Optimizer::PoseOptimization(Frame *pFrame)
+int Optimizer::PoseOptimization(Frame *pFrame, const bool bUseG2o)
 {
+    TRACE_SCOPE("Optimizer::PoseOptimization");
     // 该优化函数主要用于Tracking线程中：运动跟踪、参考帧跟踪、地图跟踪、重定位
 
+    // 单相机(单目/双目/RGBD)时使用专用的位姿求解器,不再构造g2o图
+    // 每个线程一个求解器,缓冲区在多次调用之间复用(重定位时多个线程会同时调用)
+    if (!bUseG2o && PoseSolver::IsSupported(pFrame))
+    {
+        static thread_local PoseSolver solver;
+        return solver.Optimize(pFrame);
+    }
+
     // Step 1：构造g2o优化器, BlockSolver_6_3表示：位姿 _PoseDim 为6维，路标点 _LandmarkDim 是3维
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolver_6_3::LinearSolverType *linearSolver;
@@ -67,6 +95,8 @@ int Optimizer::PoseOptimization(Frame *pFrame)
 
     g2o::OptimizationAlgorithmLevenberg *solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
     optimizer.setAlgorithm(solver);
+    // 四轮优化只改变边的level,沿用第一轮的矩阵结构
+    optimizer.setStructureCaching(true);
 
     // 输入的帧中,有效的,参与优化过程的2D-3D点对
     int nInitialCorrespondences = 0;
@@ -74,7 +104,7 @@ int Optimizer::PoseOptimization(Frame *pFrame)
     // Set Frame vertex
     // Step 2：添加顶点：待优化当前帧的Tcw
     g2o::VertexSE3Expmap *vSE3 = new g2o::VertexSE3Expmap();
-    vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
+    vSE3->setEstimate(Converter::toSE3Quat(pFrame->GetPose_()));
     // 设置id，保证本次优化过程中id独立即可
     vSE3->setId(0);
     // 要优化的变量，所以不能固定
@@ -294,7 +324,7 @@ int Optimizer::PoseOptimization(Frame *pFrame)
     // 一共进行四次优化，每次会剔除外点
     for (size_t it = 0; it < 4; it++)
     {
-        vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
+        vSE3->setEstimate(Converter::toSE3Quat(pFrame->GetPose_()));
         // 其实就是初始化优化器,这里的参数0就算是不填写,默认也是0,也就是只对level为0的边进行优化
         optimizer.initializeOptimization(0);
         // 开始优化，优化10次
@@ -400,8 +430,7 @@ int Optimizer::PoseOptimization(Frame *pFrame)
     // Step 5 得到优化后的当前帧的位姿
     g2o::VertexSE3Expmap *vSE3_recov = static_cast<g2o::VertexSE3Expmap *>(optimizer.vertex(0));
     g2o::SE3Quat SE3quat_recov = vSE3_recov->estimate();
-    cv::Mat pose = Converter::toCvMat(SE3quat_recov);
-    pFrame->SetPose(pose);
+    pFrame->SetPose_(Converter::toMatx44f(SE3quat_recov));
 
     // 并且返回内点数目
     return nInitialCorrespondences - nBad;
@@ -421,6 +450,7 @@ int Optimizer::PoseOptimization(Frame *pFrame)
  */
 void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap, int &num_fixedKF, int &num_OptKF, int &num_MPs, int &num_edges)
 {
+    TRACE_SCOPE("Optimizer::LocalBundleAdjustment");
     // 该优化函数用于LocalMapping线程的局部BA优化
     // Local KeyFrames: First Breath Search from Current Keyframe
     list<KeyFrame *> lLocalKeyFrames;
@@ -476,10 +506,10 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap
     list<KeyFrame *> lFixedCameras;
     for (list<MapPoint *>::iterator lit = lLocalMapPoints.begin(), lend = lLocalMapPoints.end(); lit != lend; lit++)
     {
-        map<KeyFrame *, tuple<int, int>> observations = (*lit)->GetObservations();
-        for (map<KeyFrame *, tuple<int, int>>::iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++)
+        const MapPoint::ObservationSnapshot observations = (*lit)->GetObservationSnapshot();
+        for (vector<MapPoint::Observation>::const_iterator mit = observations->begin(), mend = observations->end(); mit != mend; mit++)
         {
-            KeyFrame *pKFi = mit->first;
+            KeyFrame *pKFi = mit->pKF;
 
             if (pKFi->mnBALocalForKF != pKF->mnId && pKFi->mnBAFixedForKF != pKF->mnId)
             {
@@ -543,6 +573,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap
     linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType>();
 
     g2o::BlockSolver_6_3 *solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+    // 边的线性化、Hessian的累加和Schur补多线程计算,所有边都是解析雅克比
+    solver_ptr->setNumThreads(LocalBANumThreads());
 
     g2o::OptimizationAlgorithmLevenberg *solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
     if (pMap->IsInertial())
@@ -550,6 +582,11 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap
 
     optimizer.setAlgorithm(solver);
     optimizer.setVerbose(false);
+    // 第二轮优化只是把外点的边移到level 1,沿用第一轮的Hessian块结构、Schur补结构和符号分解
+    optimizer.setStructureCaching(true);
+    // 单目投影边批量计算误差和雅克比,必须在optimizer之后定义,先于optimizer析构
+    ProjectionBatch projectionBatch;
+    optimizer.addBatchEvaluator(&projectionBatch);
 
     if (pbStopFlag)
         optimizer.setForceStopFlag(pbStopFlag);
@@ -644,21 +681,21 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap
         optimizer.addVertex(vPoint);
         nPoints++;
 
-        const map<KeyFrame *, tuple<int, int>> observations = pMP->GetObservations();
+        const MapPoint::ObservationSnapshot observations = pMP->GetObservationSnapshot();
 
         // Set edges
         //  步骤8：对每一对关联的MapPoint和KeyFrame构建边
-        for (map<KeyFrame *, tuple<int, int>>::const_iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++)
+        for (vector<MapPoint::Observation>::const_iterator mit = observations->begin(), mend = observations->end(); mit != mend; mit++)
         {
-            KeyFrame *pKFi = mit->first;
+            KeyFrame *pKFi = mit->pKF;
 
             if (!pKFi->isBad() && pKFi->GetMap() == pCurrentMap)
             {
-                const int leftIndex = get<0>(mit->second);
+                const int leftIndex = mit->leftIndex;
 
                 // Monocular observation
                 // 单目
-                if (leftIndex != -1 && pKFi->mvuRight[get<0>(mit->second)] < 0)
+                if (leftIndex != -1 && pKFi->mvuRight[mit->leftIndex] < 0)
                 {
                     const cv::KeyPoint &kpUn = pKFi->mvKeysUn[leftIndex];
                     Eigen::Matrix<double, 2, 1> obs;
@@ -685,11 +722,11 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap
 
                     nEdges++;
                 }
-                else if (leftIndex != -1 && pKFi->mvuRight[get<0>(mit->second)] >= 0) // Stereo observation
+                else if (leftIndex != -1 && pKFi->mvuRight[mit->leftIndex] >= 0) // Stereo observation
                 {
                     const cv::KeyPoint &kpUn = pKFi->mvKeysUn[leftIndex];
                     Eigen::Matrix<double, 3, 1> obs;
-                    const float kp_ur = pKFi->mvuRight[get<0>(mit->second)];
+                    const float kp_ur = pKFi->mvuRight[mit->leftIndex];
                     obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
 
                     g2o::EdgeStereoSE3ProjectXYZ *e = new g2o::EdgeStereoSE3ProjectXYZ();
@@ -721,7 +758,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap
 
                 if (pKFi->mpCamera2)
                 {
-                    int rightIndex = get<1>(mit->second);
+                    int rightIndex = mit->rightIndex;
 
                     if (rightIndex != -1)
                     {
@@ -932,15 +969,17 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap
  * @param[in] pbStopFlag            外部控制BA结束标志
  * @param[in] nLoopKF               形成了闭环的当前关键帧的id
  * @param[in] bRobust               是否使用鲁棒核函数
+ * @return 完成的迭代次数
  */
-void Optimizer::GlobalBundleAdjustemnt(Map *pMap, int nIterations, bool *pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+int Optimizer::GlobalBundleAdjustemnt(Map *pMap, int nIterations, bool *pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
 {
+    TRACE_SCOPE("Optimizer::GlobalBundleAdjustemnt");
     // 获取地图中的所有关键帧
     vector<KeyFrame *> vpKFs = pMap->GetAllKeyFrames();
     // 获取地图中的所有地图点
     vector<MapPoint *> vpMP = pMap->GetAllMapPoints();
     // 调用GBA
-    BundleAdjustment(vpKFs, vpMP, nIterations, pbStopFlag, nLoopKF, bRobust);
+    return BundleAdjustment(vpKFs, vpMP, nIterations, pbStopFlag, nLoopKF, bRobust);
 }
 
 /**
@@ -951,9 +990,10 @@ void Optimizer::GlobalBundleAdjustemnt(Map *pMap, int nIterations, bool *pbStopF
  * @param[in] pbStopFlag            外部控制BA结束标志
  * @param[in] nLoopKF               形成了闭环的当前关键帧的id
  * @param[in] bRobust               是否使用核函数
+ * @return 完成的迭代次数,被pbStopFlag打断时可能小于nIterations
  */
-void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP,
-                                    int nIterations, bool *pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+int Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP,
+                                int nIterations, bool *pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
 {
     // 不参与优化的地图点，下面会用到
     vector<bool> vbNotIncludedMP;
@@ -964,7 +1004,8 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolver_6_3::LinearSolverType *linearSolver;
 
-    linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType>();
+    // 全局BA的Schur补规模大、填充多,使用超节点Cholesky
+    linearSolver = new g2o::LinearSolverSupernodal<g2o::BlockSolver_6_3::PoseMatrixType>();
 
     g2o::BlockSolver_6_3 *solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
 
@@ -972,6 +1013,9 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
     g2o::OptimizationAlgorithmLevenberg *solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
     optimizer.setAlgorithm(solver);
     optimizer.setVerbose(false);
+    // 单目投影边批量计算误差和雅克比
+    ProjectionBatch projectionBatch;
+    optimizer.addBatchEvaluator(&projectionBatch);
     // 如果这个时候外部请求终止，那就结束
     // 注意这句执行之后，外部再请求结束BA，就结束不了了
     if (pbStopFlag)
@@ -1021,8 +1065,10 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
             continue;
 
         // 对于每一个能用的关键帧构造SE3顶点,其实就是当前关键帧的位姿
+        // 记下优化的初值,全局BA被打断后用它把结果叠加到之后矫正过的位姿上
+        pKF->mTcwIniGBA = pKF->GetPose();
         g2o::VertexSE3Expmap *vSE3 = new g2o::VertexSE3Expmap();
-        vSE3->setEstimate(Converter::toSE3Quat(pKF->GetPose()));
+        vSE3->setEstimate(Converter::toSE3Quat(pKF->mTcwIniGBA));
         vSE3->setId(pKF->mnId);
         // 只有第0帧关键帧不优化（参考基准）
         vSE3->setFixed(pKF->mnId == pMap->GetInitKFid());
@@ -1041,6 +1087,11 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
     // 遍历地图中的所有地图点
     for (size_t i = 0; i < vpMP.size(); i++)
     {
+        // 大地图上构建图本身就很耗时,构建过程中也响应外部的终止请求,此时还没有写入任何结果
+        if (pbStopFlag)
+            if (*pbStopFlag)
+                return 0;
+
         MapPoint *pMP = vpMP[i];
         // 跳过无效地图点
         if (pMP->isBad())
@@ -1061,16 +1112,16 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         optimizer.addVertex(vPoint);
 
         // 边的关系，其实就是点和关键帧之间观测的关系
-        const map<KeyFrame *, tuple<int, int>> observations = pMP->GetObservations();
+        const MapPoint::ObservationSnapshot observations = pMP->GetObservationSnapshot();
 
         // 边计数
         int nEdges = 0;
         // SET EDGES
         //  Step 3：向优化器添加投影边（是在遍历地图点、添加地图点的顶点的时候顺便添加的）
         //  遍历观察到当前地图点的所有关键帧
-        for (map<KeyFrame *, tuple<int, int>>::const_iterator mit = observations.begin(); mit != observations.end(); mit++)
+        for (vector<MapPoint::Observation>::const_iterator mit = observations->begin(), mend = observations->end(); mit != mend; mit++)
         {
-            KeyFrame *pKF = mit->first;
+            KeyFrame *pKF = mit->pKF;
             // 滤出不合法的关键帧
             if (pKF->isBad() || pKF->mnId > maxKFid)
                 continue;
@@ -1078,9 +1129,9 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
                 continue;
             nEdges++;
 
-            const int leftIndex = get<0>(mit->second);
+            const int leftIndex = mit->leftIndex;
 
-            if (leftIndex != -1 && pKF->mvuRight[get<0>(mit->second)] < 0)
+            if (leftIndex != -1 && pKF->mvuRight[mit->leftIndex] < 0)
             {
                 // 如果是单目相机按照下面操作
                 const cv::KeyPoint &kpUn = pKF->mvKeysUn[leftIndex];
@@ -1127,7 +1178,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
                 const cv::KeyPoint &kpUn = pKF->mvKeysUn[leftIndex];
 
                 Eigen::Matrix<double, 3, 1> obs;
-                const float kp_ur = pKF->mvuRight[get<0>(mit->second)];
+                const float kp_ur = pKF->mvuRight[mit->leftIndex];
                 obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
 
                 // 对于双目输入，g2o也有专门的误差边
@@ -1166,7 +1217,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
 
             if (pKF->mpCamera2)
             {
-                int rightIndex = get<1>(mit->second);
+                int rightIndex = mit->rightIndex;
 
                 if (rightIndex != -1 && rightIndex < pKF->mvKeysRight.size())
                 {
@@ -1212,11 +1263,15 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         }
     }
 
+    if (pbStopFlag)
+        if (*pbStopFlag)
+            return 0;
+
     // Optimize!
     // Step 4：开始优化
     optimizer.setVerbose(false);
     optimizer.initializeOptimization();
-    optimizer.optimize(nIterations);
+    const int nDone = optimizer.optimize(nIterations);
     Verbose::PrintMess("BA: End of the optimization", Verbose::VERBOSITY_NORMAL);
 
     // Recover optimized data
@@ -1340,6 +1395,122 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
             pMP->mnBAGlobalForKF = nLoopKF;
         }
     }
+
+    return nDone;
+}
+
+/**
+ * @brief 增量式的全局BA,闭环后代替 GlobalBundleAdjustemnt (纯视觉地图)
+ * 先把地图的当前状态同步到iba中(只有变化的部分会改动它保存的信息矩阵),再做增量优化,
+ * 结果和 GlobalBundleAdjustemnt 一样写到 mTcwGBA / mPosGBA 中,由闭环线程更新地图
+ * @param[in] pMap                  地图
+ * @param[in] iba                   在多次调用之间保留状态的增量优化器,地图变了就重置
+ * @param[in] nIterations           最多迭代次数
+ * @param[in] pbStopFlag            外部控制BA结束标志
+ * @param[in] nLoopKF               形成了闭环的当前关键帧的id
+ * @return 完成的迭代次数
+ */
+int Optimizer::IncrementalBundleAdjustment(Map *pMap, IncrementalBA &iba, int nIterations, bool *pbStopFlag, const unsigned long nLoopKF)
+{
+    TRACE_SCOPE("Optimizer::IncrementalBundleAdjustment");
+    if (iba.GetMap() != pMap)
+        iba.Reset(pMap);
+
+    // 关键帧按id(创建的先后)加入,新关键帧排在消元顺序的末尾
+    vector<KeyFrame *> vpKFs = pMap->GetAllKeyFrames();
+    sort(vpKFs.begin(), vpKFs.end(), KeyFrame::lId);
+    vector<MapPoint *> vpMP = pMap->GetAllMapPoints();
+    const unsigned long nInitKFid = pMap->GetInitKFid();
+
+    // Step 1 同步关键帧和地图点
+    iba.BeginSync();
+    for (size_t i = 0; i < vpKFs.size(); i++)
+    {
+        KeyFrame *pKF = vpKFs[i];
+        if (pKF->isBad())
+            continue;
+
+        IncrementalBA::Calibration calib;
+        calib.fx = pKF->fx;
+        calib.fy = pKF->fy;
+        calib.cx = pKF->cx;
+        calib.cy = pKF->cy;
+        calib.bf = pKF->mbf;
+        calib.pCamera = pKF->mpCamera->GetType() == pKF->mpCamera->CAM_PINHOLE ? static_cast<GeometricCamera *>(NULL) : pKF->mpCamera;
+
+        pKF->mTcwIniGBA = pKF->GetPose();
+        iba.SetPose(pKF->mnId, Converter::toSE3Quat(pKF->mTcwIniGBA), pKF->mnId == nInitKFid, calib);
+    }
+
+    IncrementalBA::Observations vObs;
+    for (size_t i = 0; i < vpMP.size(); i++)
+    {
+        // 同步过程中响应外部的终止请求. 已经同步的地图点保持一致,不调用 EndSync,
+        // 没有出现的变量留到下一次同步再处理
+        if (pbStopFlag)
+            if (*pbStopFlag)
+                return 0;
+
+        MapPoint *pMP = vpMP[i];
+        if (pMP->isBad())
+            continue;
+
+        // 只使用左目的观测,与 BundleAdjustment 中的单目边和双目边相同
+        const MapPoint::ObservationSnapshot observations = pMP->GetObservationSnapshot();
+        vObs.clear();
+        for (vector<MapPoint::Observation>::const_iterator mit = observations->begin(), mend = observations->end(); mit != mend; mit++)
+        {
+            KeyFrame *pKF = mit->pKF;
+            const int leftIndex = mit->leftIndex;
+            if (pKF->isBad() || leftIndex == -1)
+                continue;
+
+            const cv::KeyPoint &kpUn = pKF->mvKeysUn[leftIndex];
+            IncrementalBA::Observation obs;
+            obs.nPoseId = pKF->mnId;
+            obs.obs << kpUn.pt.x, kpUn.pt.y, pKF->mvuRight[leftIndex];
+            obs.invSigma2 = pKF->mvInvLevelSigma2[kpUn.octave];
+            vObs.push_back(obs);
+        }
+        iba.SetPoint(pMP->mnId, Converter::toVector3d(pMP->GetWorldPos()), vObs);
+    }
+    iba.EndSync();
+
+    // Step 2 增量优化
+    const int nDone = iba.Optimize(nIterations, pbStopFlag);
+
+    const IncrementalBA::Stats stats = iba.GetStats();
+    Verbose::PrintMess("IBA: " + to_string(nDone) + " its, " + to_string(stats.nColumns) + " KFs, " + to_string(stats.nPoints) + " MPs, relinearized " +
+                           to_string(stats.nRelinPoses) + " KFs / " + to_string(stats.nRelinPoints) + " MPs, refactored " + to_string(stats.nRefactored) +
+                           " columns" + (stats.bRebuilt ? " (rebuilt)" : ""),
+                       Verbose::VERBOSITY_NORMAL);
+
+    // Step 3 结果先保存在 mTcwGBA / mPosGBA 中,由闭环线程更新到地图
+    for (size_t i = 0; i < vpKFs.size(); i++)
+    {
+        KeyFrame *pKF = vpKFs[i];
+        g2o::SE3Quat SE3quat;
+        if (pKF->isBad() || !iba.GetPose(pKF->mnId, SE3quat))
+            continue;
+
+        pKF->mTcwGBA.create(4, 4, CV_32F);
+        Converter::toCvMat(SE3quat).copyTo(pKF->mTcwGBA);
+        pKF->mnBAGlobalForKF = nLoopKF;
+    }
+
+    for (size_t i = 0; i < vpMP.size(); i++)
+    {
+        MapPoint *pMP = vpMP[i];
+        Eigen::Vector3d Xw;
+        if (pMP->isBad() || !iba.GetPoint(pMP->mnId, Xw))
+            continue;
+
+        pMP->mPosGBA.create(3, 1, CV_32F);
+        Converter::toCvMat(Xw).copyTo(pMP->mPosGBA);
+        pMP->mnBAGlobalForKF = nLoopKF;
+    }
+
+    return nDone;
 }
 
 /**
@@ -1369,9 +1540,11 @@ void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const l
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolverX::LinearSolverType *linearSolver;
 
-    linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolverX::PoseMatrixType>();
+    linearSolver = new g2o::LinearSolverSupernodal<g2o::BlockSolverX::PoseMatrixType>();
 
     g2o::BlockSolverX *solver_ptr = new g2o::BlockSolverX(linearSolver);
+    // 视觉边并行线性化,惯性边(多元边)在主线程串行处理
+    solver_ptr->setNumThreads(LocalBANumThreads());
 
     g2o::OptimizationAlgorithmLevenberg *solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
     solver->setUserLambdaInit(1e-5);
@@ -1585,6 +1758,10 @@ void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const l
     // 5. 添加关于mp的节点与边，这段比较好理解，很传统的视觉上的重投影误差
     for (size_t i = 0; i < vpMPs.size(); i++)
     {
+        if (pbStopFlag)
+            if (*pbStopFlag)
+                return;
+
         MapPoint *pMP = vpMPs[i];
         g2o::VertexSBAPointXYZ *vPoint = new g2o::VertexSBAPointXYZ();
         vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
@@ -1593,25 +1770,25 @@ void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const l
         vPoint->setMarginalized(true);
         optimizer.addVertex(vPoint);
 
-        const map<KeyFrame *, tuple<int, int>> observations = pMP->GetObservations();
+        const MapPoint::ObservationSnapshot observations = pMP->GetObservationSnapshot();
 
         bool bAllFixed = true;
 
         // Set edges
         //  遍历所有能观测到这个点的关键帧
-        for (map<KeyFrame *, tuple<int, int>>::const_iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++)
+        for (vector<MapPoint::Observation>::const_iterator mit = observations->begin(), mend = observations->end(); mit != mend; mit++)
         {
-            KeyFrame *pKFi = mit->first;
+            KeyFrame *pKFi = mit->pKF;
 
             if (pKFi->mnId > maxKFid)
                 continue;
 
             if (!pKFi->isBad())
             {
-                const int leftIndex = get<0>(mit->second);
+                const int leftIndex = mit->leftIndex;
                 cv::KeyPoint kpUn;
                 // 添加边
-                if (leftIndex != -1 && pKFi->mvuRight[get<0>(mit->second)] < 0) // Monocular observation
+                if (leftIndex != -1 && pKFi->mvuRight[mit->leftIndex] < 0) // Monocular observation
                 {
                     kpUn = pKFi->mvKeysUn[leftIndex];
                     Eigen::Matrix<double, 2, 1> obs;
@@ -1667,7 +1844,7 @@ void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const l
 
                 if (pKFi->mpCamera2)
                 { // Monocular right observation
-                    int rightIndex = get<1>(mit->second);
+                    int rightIndex = mit->rightIndex;
 
                     if (rightIndex != -1 && rightIndex < pKFi->mvKeysRight.size())
                     {
@@ -2310,7 +2487,8 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
 void Optimizer::OptimizeEssentialGraph(Map *pMap, KeyFrame *pLoopKF, KeyFrame *pCurKF,
                                         const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                         const LoopClosing::KeyFrameAndPose &CorrectedSim3,
-                                        const map<KeyFrame *, set<KeyFrame *>> &LoopConnections, const bool &bFixScale)
+                                        const map<KeyFrame *, set<KeyFrame *>> &LoopConnections, const bool &bFixScale,
+                                        EssentialGraph *pEssentialGraph)
 {
     // Setup optimizer
     // Step 1：构造优化器
@@ -2318,8 +2496,9 @@ void Optimizer::OptimizeEssentialGraph(Map *pMap, KeyFrame *pLoopKF, KeyFrame *p
     optimizer.setVerbose(false);
     // 指定线性方程求解器使用Eigen的块求解器
     // 7表示位姿是sim3  3表示三维点坐标维度
+    // 本质图有大量回环边,稀疏Cholesky的填充较多,使用超节点Cholesky
     g2o::BlockSolver_7_3::LinearSolverType *linearSolver =
-        new g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType>();
+        new g2o::LinearSolverSupernodal<g2o::BlockSolver_7_3::PoseMatrixType>();
     // 构造线性求解器
     g2o::BlockSolver_7_3 *solver_ptr = new g2o::BlockSolver_7_3(linearSolver);
     // 使用LM算法进行非线性迭代
@@ -2448,143 +2627,129 @@ void Optimizer::OptimizeEssentialGraph(Map *pMap, KeyFrame *pLoopKF, KeyFrame *p
     int count_spa_tree = 0;
     int count_cov = 0;
     int count_imu = 0;
-    int count_kf = 0;
     // Set normal edges
     // 4. 添加跟踪时形成的边、闭环匹配成功形成的边
-    for (size_t i = 0, iend = vpKFs.size(); i < iend; i++)
+    // 4.0 连接关系从pEssentialGraph中读取,只有连接关系变化过的关键帧重新读取
+    EssentialGraph localGraph(minFeat);
+    if (!pEssentialGraph)
+        pEssentialGraph = &localGraph;
+    if (pEssentialGraph->GetMap() != pMap || pEssentialGraph->GetMinFeat() != minFeat)
+        pEssentialGraph->Reset(pMap);
+    pEssentialGraph->Update(vpKFs);
+
+    // 校正前的sim3: 共视帧用NonCorrectedSim3中的,其余关键帧vScw里面装的都是矫正前的
+    auto GetNonCorrectedSim3 = [&](KeyFrame *pKFx) {
+        LoopClosing::KeyFrameAndPose::const_iterator it = NonCorrectedSim3.find(pKFx);
+        return it != NonCorrectedSim3.end() ? it->second : vScw[pKFx->mnId];
+    };
+
+    // 每个关键帧的边及其测量值(校正前的相对位姿)由多个线程计算,之后串行加入优化器
+    struct EssentialEdge
     {
-        count_kf = 0;
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        unsigned long nIDj;
+        int nType; // 0:生成树 1:闭环 2:共视 3:imu
+        g2o::Sim3 Sji;
+    };
+    typedef vector<EssentialEdge, Eigen::aligned_allocator<EssentialEdge>> EssentialEdges;
+    vector<EssentialEdges> vEdges(vpKFs.size());
+
+    ParallelFor(vpKFs.size(), [&](const int i) {
         KeyFrame *pKF = vpKFs[i];
+        const EssentialGraph::Node *pNode = pEssentialGraph->GetNode(pKF);
+        if (!pNode || pKF->isBad())
+            return;
 
-        const int nIDi = pKF->mnId;
-
-        g2o::Sim3 Swi; // 校正前的sim3
-
-        LoopClosing::KeyFrameAndPose::const_iterator iti = NonCorrectedSim3.find(pKF);
-        // 找到的话说明是关键帧的共视帧，没找到表示非共视帧，非共视帧vScw[nIDi]里面装的都是矫正前的
-        // 所以不管怎样说 Swi都是校正前的
-        if (iti != NonCorrectedSim3.end())
-            Swi = (iti->second).inverse();
-        else
-            Swi = vScw[nIDi].inverse();
-
-        KeyFrame *pParentKF = pKF->GetParent();
+        const unsigned long nIDi = pKF->mnId;
+        const g2o::Sim3 Swi = GetNonCorrectedSim3(pKF).inverse();
+        EssentialEdges &vEdgesi = vEdges[i];
+        EssentialEdge edge;
 
         // Spanning tree edge
         // 4.1 只添加扩展树的边（有父关键帧）
-        if (pParentKF)
+        if (pNode->pParent)
         {
-            int nIDj = pParentKF->mnId;
-
-            g2o::Sim3 Sjw;
-
-            LoopClosing::KeyFrameAndPose::const_iterator itj = NonCorrectedSim3.find(pParentKF);
-
-            if (itj != NonCorrectedSim3.end())
-                Sjw = itj->second;
-            else
-                Sjw = vScw[nIDj];
-
-            // 又是未校正的结果作为观测值
-            g2o::Sim3 Sji = Sjw * Swi;
-
-            g2o::EdgeSim3 *e = new g2o::EdgeSim3();
-            e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(nIDj)));
-            e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(nIDi)));
-            e->setMeasurement(Sji);
-            count_kf++;
-            count_spa_tree++;
-            e->information() = matLambda;
-            optimizer.addEdge(e);
+            edge.nIDj = pNode->pParent->mnId;
+            edge.nType = 0;
+            edge.Sji = GetNonCorrectedSim3(pNode->pParent) * Swi;
+            vEdgesi.push_back(edge);
         }
 
         // Loop edges
         // 4.2 添加在CorrectLoop函数中AddLoopEdge函数添加的闭环连接边（当前帧与闭环匹配帧之间的连接关系）
         // 使用经过Sim3调整前关键帧之间的相对关系作为边
-        const set<KeyFrame *> sLoopEdges = pKF->GetLoopEdges();
-        for (set<KeyFrame *>::const_iterator sit = sLoopEdges.begin(), send = sLoopEdges.end(); sit != send; sit++)
+        for (size_t k = 0; k < pNode->vpLoopEdges.size(); k++)
         {
-            KeyFrame *pLKF = *sit;
-            if (pLKF->mnId < pKF->mnId)
+            KeyFrame *pLKF = pNode->vpLoopEdges[k];
+            if (pLKF->mnId < nIDi)
             {
-                g2o::Sim3 Slw;
-
-                LoopClosing::KeyFrameAndPose::const_iterator itl = NonCorrectedSim3.find(pLKF);
-
-                if (itl != NonCorrectedSim3.end())
-                    Slw = itl->second;
-                else
-                    Slw = vScw[pLKF->mnId];
-
-                g2o::Sim3 Sli = Slw * Swi;
-                g2o::EdgeSim3 *el = new g2o::EdgeSim3();
-                el->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(pLKF->mnId)));
-                el->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(nIDi)));
-                el->setMeasurement(Sli);
-                el->information() = matLambda;
-                optimizer.addEdge(el);
-                count_kf++;
-                count_loop++;
+                edge.nIDj = pLKF->mnId;
+                edge.nType = 1;
+                edge.Sji = GetNonCorrectedSim3(pLKF) * Swi;
+                vEdgesi.push_back(edge);
             }
         }
 
         // Covisibility graph edges
         // 4.3 对有很好共视关系的关键帧也作为边进行优化
         // 使用经过Sim3调整前关键帧之间的相对关系作为边
-        const vector<KeyFrame *> vpConnectedKFs = pKF->GetCovisiblesByWeight(minFeat);
-        for (vector<KeyFrame *>::const_iterator vit = vpConnectedKFs.begin(); vit != vpConnectedKFs.end(); vit++)
+        for (size_t k = 0; k < pNode->vpCovisibles.size(); k++)
         {
-            KeyFrame *pKFn = *vit;
-            if (pKFn && pKFn != pParentKF && !pKF->hasChild(pKFn) && !sLoopEdges.count(pKFn))
+            KeyFrame *pKFn = pNode->vpCovisibles[k];
+            if (!pKFn->isBad() && pKFn->mnId < nIDi)
             {
-                if (!pKFn->isBad() && pKFn->mnId < pKF->mnId)
-                {
-                    if (sInsertedEdges.count(make_pair(min(pKF->mnId, pKFn->mnId), max(pKF->mnId, pKFn->mnId))))
-                        continue;
-
-                    g2o::Sim3 Snw;
-
-                    LoopClosing::KeyFrameAndPose::const_iterator itn = NonCorrectedSim3.find(pKFn);
-
-                    if (itn != NonCorrectedSim3.end())
-                        Snw = itn->second;
-                    else
-                        Snw = vScw[pKFn->mnId];
+                if (sInsertedEdges.count(make_pair(min(nIDi, pKFn->mnId), max(nIDi, pKFn->mnId))))
+                    continue;
 
-                    g2o::Sim3 Sni = Snw * Swi;
-
-                    g2o::EdgeSim3 *en = new g2o::EdgeSim3();
-                    en->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(pKFn->mnId)));
-                    en->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(nIDi)));
-                    en->setMeasurement(Sni);
-                    en->information() = matLambda;
-                    optimizer.addEdge(en);
-                    count_kf++;
-                    count_cov++;
-                }
+                edge.nIDj = pKFn->mnId;
+                edge.nType = 2;
+                edge.Sji = GetNonCorrectedSim3(pKFn) * Swi;
+                vEdgesi.push_back(edge);
             }
         }
 
         // Inertial edges if inertial
         // 如果是imu的话还会找前一帧做优化
-        if (pKF->bImu && pKF->mPrevKF)
+        KeyFrame *pPrevKF = pKF->mPrevKF;
+        if (pKF->bImu && pPrevKF)
         {
-            g2o::Sim3 Spw;
-            LoopClosing::KeyFrameAndPose::const_iterator itp = NonCorrectedSim3.find(pKF->mPrevKF);
-            if (itp != NonCorrectedSim3.end())
-                Spw = itp->second;
+            edge.nIDj = pPrevKF->mnId;
+            edge.nType = 3;
+            edge.Sji = GetNonCorrectedSim3(pPrevKF) * Swi;
+            vEdgesi.push_back(edge);
+        }
+    });
+
+    // 4.4 串行加入优化器. 另一端不在优化器中(已删除或不属于这个地图)的边跳过
+    for (size_t i = 0, iend = vpKFs.size(); i < iend; i++)
+    {
+        const EssentialEdges &vEdgesi = vEdges[i];
+        if (vEdgesi.empty())
+            continue;
+
+        g2o::OptimizableGraph::Vertex *vi = dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(vpKFs[i]->mnId));
+        for (size_t k = 0; k < vEdgesi.size(); k++)
+        {
+            const EssentialEdge &edge = vEdgesi[k];
+            g2o::OptimizableGraph::Vertex *vj = dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(edge.nIDj));
+            if (!vi || !vj)
+                continue;
+
+            g2o::EdgeSim3 *e = new g2o::EdgeSim3();
+            e->setVertex(1, vj);
+            e->setVertex(0, vi);
+            e->setMeasurement(edge.Sji);
+            e->information() = matLambda;
+            optimizer.addEdge(e);
+
+            if (edge.nType == 0)
+                count_spa_tree++;
+            else if (edge.nType == 1)
+                count_loop++;
+            else if (edge.nType == 2)
+                count_cov++;
             else
-                Spw = vScw[pKF->mPrevKF->mnId];
-
-            g2o::Sim3 Spi = Spw * Swi;
-            g2o::EdgeSim3 *ep = new g2o::EdgeSim3();
-            ep->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(pKF->mPrevKF->mnId)));
-            ep->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(nIDi)));
-            ep->setMeasurement(Spi);
-            ep->information() = matLambda;
-            optimizer.addEdge(ep);
-            count_kf++;
-            count_imu++;
+                count_imu++;
         }
     }
 
@@ -2622,12 +2787,12 @@ void Optimizer::OptimizeEssentialGraph(Map *pMap, KeyFrame *pLoopKF, KeyFrame *p
 
     // Correct points. Transform to "non-optimized" reference keyframe pose and transform back with optimized pose
     // 7. 步骤5和步骤6优化得到关键帧的位姿后，MapPoints根据参考帧优化前后的相对关系调整自己的位置
-    for (size_t i = 0, iend = vpMPs.size(); i < iend; i++)
-    {
+    // 每个地图点只依赖自己的参考关键帧,多线程处理
+    ParallelFor(vpMPs.size(), [&](const int i) {
         MapPoint *pMP = vpMPs[i];
 
         if (pMP->isBad())
-            continue;
+            return;
 
         int nIDr;
         // 该MapPoint经过Sim3调整过，(LoopClosing.cpp，CorrectLoop函数，步骤2.2_
@@ -2657,7 +2822,7 @@ void Optimizer::OptimizeEssentialGraph(Map *pMap, KeyFrame *pLoopKF, KeyFrame *p
         pMP->SetWorldPos(cvCorrectedP3Dw);
 
         pMP->UpdateNormalAndDepth();
-    }
+    });
 
     pMap->IncreaseChangeIndex();
 }
@@ -2684,7 +2849,7 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map *pMap, KeyFrame *pLoopKF, KeyFram
     g2o::SparseOptimizer optimizer;
     optimizer.setVerbose(false);
     g2o::BlockSolverX::LinearSolverType *linearSolver =
-        new g2o::LinearSolverEigen<g2o::BlockSolverX::PoseMatrixType>();
+        new g2o::LinearSolverSupernodal<g2o::BlockSolverX::PoseMatrixType>();
     g2o::BlockSolverX *solver_ptr = new g2o::BlockSolverX(linearSolver);
 
     g2o::OptimizationAlgorithmLevenberg *solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
@@ -3027,11 +3192,17 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pMainKF, vector<KeyFrame *> vpAd
     linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType>();
 
     g2o::BlockSolver_6_3 *solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+    solver_ptr->setNumThreads(LocalBANumThreads());
 
     g2o::OptimizationAlgorithmLevenberg *solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
     optimizer.setAlgorithm(solver);
 
     optimizer.setVerbose(false);
+    // 第二轮优化只去掉外点,沿用第一轮的矩阵结构
+    optimizer.setStructureCaching(true);
+    // 单目投影边批量计算误差和雅克比
+    ProjectionBatch projectionBatch;
+    optimizer.addBatchEvaluator(&projectionBatch);
 
     if (pbStopFlag)
         optimizer.setForceStopFlag(pbStopFlag);
@@ -3168,24 +3339,24 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pMainKF, vector<KeyFrame *> vpAd
         vPoint->setMarginalized(true);
         optimizer.addVertex(vPoint);
 
-        const map<KeyFrame *, tuple<int, int>> observations = pMPi->GetObservations();
+        const MapPoint::ObservationSnapshot observations = pMPi->GetObservationSnapshot();
         int nEdges = 0;
         // SET EDGES
-        for (map<KeyFrame *, tuple<int, int>>::const_iterator mit = observations.begin(); mit != observations.end(); mit++)
+        for (vector<MapPoint::Observation>::const_iterator mit = observations->begin(), mend = observations->end(); mit != mend; mit++)
         {
 
-            KeyFrame *pKF = mit->first;// 跳过的条件  1. 帧坏了 2. 帧靠后 3. 不在参与优化帧的里面 4. 在左相机上不存在这个三维点
-            if (pKF->isBad() || pKF->mnId > maxKFid || pKF->mnBALocalForMerge != pMainKF->mnId || !pKF->GetMapPoint(get<0>(mit->second)))
+            KeyFrame *pKF = mit->pKF;// 跳过的条件  1. 帧坏了 2. 帧靠后 3. 不在参与优化帧的里面 4. 在左相机上不存在这个三维点
+            if (pKF->isBad() || pKF->mnId > maxKFid || pKF->mnBALocalForMerge != pMainKF->mnId || !pKF->GetMapPoint(mit->leftIndex))
                 continue;
 
             nEdges++;
 
-            const cv::KeyPoint &kpUn = pKF->mvKeysUn[get<0>(mit->second)];
+            const cv::KeyPoint &kpUn = pKF->mvKeysUn[mit->leftIndex];
 
-            if(!(pKF->mvuRight[get<0>(mit->second)]<0)){   //rgbd和stereo
+            if(!(pKF->mvuRight[mit->leftIndex]<0)){   //rgbd和stereo
                 mpObsMPs[pMPi] += 2;
                 Eigen::Matrix<double, 3, 1> obs;
-                const float kp_ur = pKF->mvuRight[get<0>(mit->second)];
+                const float kp_ur = pKF->mvuRight[mit->leftIndex];
                 obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
 
                 g2o::EdgeStereoSE3ProjectXYZ *e = new g2o::EdgeStereoSE3ProjectXYZ();
@@ -3347,17 +3518,17 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pMainKF, vector<KeyFrame *> vpAd
         if (pMPi->isBad())
             continue;
 
-        const map<KeyFrame *, tuple<int, int>> observations = pMPi->GetObservations();
-        for (map<KeyFrame *, tuple<int, int>>::const_iterator mit = observations.begin(); mit != observations.end(); mit++)
+        const MapPoint::ObservationSnapshot observations = pMPi->GetObservationSnapshot();
+        for (vector<MapPoint::Observation>::const_iterator mit = observations->begin(), mend = observations->end(); mit != mend; mit++)
         {
 
-            KeyFrame *pKF = mit->first;
-            if (pKF->isBad() || pKF->mnId > maxKFid || pKF->mnBALocalForKF != pMainKF->mnId || !pKF->GetMapPoint(get<0>(mit->second)))
+            KeyFrame *pKF = mit->pKF;
+            if (pKF->isBad() || pKF->mnId > maxKFid || pKF->mnBALocalForKF != pMainKF->mnId || !pKF->GetMapPoint(mit->leftIndex))
                 continue;
 
-            const cv::KeyPoint &kpUn = pKF->mvKeysUn[get<0>(mit->second)];
+            const cv::KeyPoint &kpUn = pKF->mvKeysUn[mit->leftIndex];
 
-            if (pKF->mvuRight[get<0>(mit->second)] < 0) // Monocular
+            if (pKF->mvuRight[mit->leftIndex] < 0) // Monocular
             {
                 mpObsFinalKFs[pKF]++;
             }
@@ -3467,7 +3638,7 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame *pCurKF, vector<KeyFrame *> &vpF
     g2o::SparseOptimizer optimizer;
     optimizer.setVerbose(false);
     g2o::BlockSolver_7_3::LinearSolverType *linearSolver =
-        new g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType>();
+        new g2o::LinearSolverSupernodal<g2o::BlockSolver_7_3::PoseMatrixType>();
     g2o::BlockSolver_7_3 *solver_ptr = new g2o::BlockSolver_7_3(linearSolver);
     g2o::OptimizationAlgorithmLevenberg *solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
 
@@ -3957,6 +4128,8 @@ void Optimizer::MergeInertialBA(KeyFrame *pCurrKF, KeyFrame *pMergeKF, bool *pbS
     linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolverX::PoseMatrixType>();
 
     g2o::BlockSolverX *solver_ptr = new g2o::BlockSolverX(linearSolver);
+    // 视觉边并行线性化,惯性边(多元边)在主线程串行处理
+    solver_ptr->setNumThreads(LocalBANumThreads());
 
     g2o::OptimizationAlgorithmLevenberg *solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
 
@@ -4194,13 +4367,13 @@ void Optimizer::MergeInertialBA(KeyFrame *pCurrKF, KeyFrame *pMergeKF, bool *pbS
         // 添加顶点
         optimizer.addVertex(vPoint);
 
-        const map<KeyFrame *, tuple<int, int>> observations = pMP->GetObservations();
+        const MapPoint::ObservationSnapshot observations = pMP->GetObservationSnapshot();
 
         // Create visual constraints
         // 添加重投影边
-        for (map<KeyFrame *, tuple<int, int>>::const_iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++)
+        for (vector<MapPoint::Observation>::const_iterator mit = observations->begin(), mend = observations->end(); mit != mend; mit++)
         {
-            KeyFrame *pKFi = mit->first;
+            KeyFrame *pKFi = mit->pKF;
 
             if (!pKFi)
                 continue;
@@ -4220,9 +4393,9 @@ void Optimizer::MergeInertialBA(KeyFrame *pCurrKF, KeyFrame *pMergeKF, bool *pbS
             if (!pKFi->isBad())
             {
                 // 3D点的观测
-                const cv::KeyPoint &kpUn = pKFi->mvKeysUn[get<0>(mit->second)];
+                const cv::KeyPoint &kpUn = pKFi->mvKeysUn[mit->leftIndex];
                 // 如果是单目观测
-                if (pKFi->mvuRight[get<0>(mit->second)] < 0) // Monocular observation
+                if (pKFi->mvuRight[mit->leftIndex] < 0) // Monocular observation
                 {
                     // 投影
                     Eigen::Matrix<double, 2, 1> obs;
@@ -4251,7 +4424,7 @@ void Optimizer::MergeInertialBA(KeyFrame *pCurrKF, KeyFrame *pMergeKF, bool *pbS
                 //双目
                 else // stereo observation
                 {
-                    const float kp_ur = pKFi->mvuRight[get<0>(mit->second)];
+                    const float kp_ur = pKFi->mvuRight[mit->leftIndex];
                     Eigen::Matrix<double, 3, 1> obs;
                     obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
 
@@ -24,6 +24,7 @@
 #include <pcl/filters/statistical_outlier_removal.h>
 #include "Converter.h"
 #include "System.h"
+#include "Tracer.h"
 
 #include <pcl/filters/passthrough.h>
 
@@ -80,6 +81,7 @@ void PointCloudMapping::insertKeyFrame(KeyFrame *kf)
 //通过传入的当前地图Atlas储存关键帧的列表生成彩色点云地图  mlNewKeyFrameForDenseMap->mlNewKeyFrames->lNewKeyFrames
 void PointCloudMapping::generatePointCloud(KeyFrame *kf) //,Eigen::Isometry3d T
 {
+    TRACE_SCOPE("PointCloudMapping::generatePointCloud");
     pcl::PointCloud<pcl::PointXYZRGBA>::Ptr pPointCloud(new pcl::PointCloud<pcl::PointXYZRGBA>);
     // point cloud is null ptr
     for (int m = 0; m < kf->imDepth.rows; m += 3)
@@ -110,6 +112,7 @@ void PointCloudMapping::generatePointCloud(KeyFrame *kf) //,Eigen::Isometry3d T
 
 void PointCloudMapping::viewer()
 {
+    Tracer::SetThreadName("PointCloudMapping");
     pcl::visualization::CloudViewer viewer("viewer");
     //////
 //    //声明octomap变量
@@ -0,0 +1,365 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PoseSolver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+#include <Eigen/Dense>
+
+#include "Frame.h"
+#include "MapPoint.h"
+#include "Converter.h"
+#include "CameraModels/GeometricCamera.h"
+
+namespace ORB_SLAM3
+{
+
+// 与原g2o实现相同的阈值: 自由度为2/3的卡方分布,显著性水平0.05
+static const double chi2Mono = 5.991;
+static const double chi2Stereo = 7.815;
+// LM参数,与 g2o::OptimizationAlgorithmLevenberg 的默认值一致
+static const double lmTau = 1e-5;
+static const double lmGoodStepUpperScale = 2. / 3.;
+static const double lmGoodStepLowerScale = 1. / 3.;
+static const int lmMaxTrialsAfterFailure = 10;
+
+PoseSolver::PoseSolver() : mpCamera(static_cast<GeometricCamera *>(NULL)), mbPinhole(true),
+                           fx(0), fy(0), cx(0), cy(0), mbf(0)
+{
+}
+
+bool PoseSolver::IsSupported(const Frame *pFrame)
+{
+    return !pFrame->mpCamera2;
+}
+
+int PoseSolver::ComputeError(const Eigen::Matrix3d &Rcw, const Eigen::Vector3d &tcw, const size_t k,
+                             Eigen::Vector3d &Xc, Eigen::Vector3d &e) const
+{
+    Xc.noalias() = Rcw * Eigen::Vector3d(mvXw[k], mvYw[k], mvZw[k]);
+    Xc += tcw;
+
+    if (mvUr[k] < 0)
+    {
+        if (mbPinhole)
+        {
+            const double invz = 1.0 / Xc[2];
+            e[0] = mvU[k] - (fx * Xc[0] * invz + cx);
+            e[1] = mvV[k] - (fy * Xc[1] * invz + cy);
+        }
+        else
+        {
+            const Eigen::Vector2d uv = mpCamera->project(Xc);
+            e[0] = mvU[k] - uv[0];
+            e[1] = mvV[k] - uv[1];
+        }
+        e[2] = 0;
+        return 2;
+    }
+
+    // 双目: 与 g2o::EdgeStereoSE3ProjectXYZOnlyPose::cam_project 相同
+    const double invz = 1.0 / Xc[2];
+    const double u = fx * Xc[0] * invz + cx;
+    e[0] = mvU[k] - u;
+    e[1] = mvV[k] - (fy * Xc[1] * invz + cy);
+    e[2] = mvUr[k] - (u - mbf * invz);
+    return 3;
+}
+
+double PoseSolver::ComputeChi2(const g2o::SE3Quat &Tcw, const bool bRobust) const
+{
+    const Eigen::Matrix3d Rcw = Tcw.rotation().toRotationMatrix();
+    const Eigen::Vector3d tcw = Tcw.translation();
+    const double deltaMono = sqrt(chi2Mono);
+    const double deltaStereo = sqrt(chi2Stereo);
+
+    double chi2Sum = 0;
+    Eigen::Vector3d Xc, e;
+    for (size_t k = 0, kend = mvIdx.size(); k < kend; k++)
+    {
+        if (!mvbInlier[k])
+            continue;
+
+        const int dim = ComputeError(Rcw, tcw, k, Xc, e);
+        const double chi2 = mvInvSigma2[k] * e.squaredNorm();
+
+        // Huber核: rho(s) = s (s<=delta^2), 2*delta*sqrt(s)-delta^2 (s>delta^2)
+        const double delta = dim == 2 ? deltaMono : deltaStereo;
+        if (bRobust && chi2 > delta * delta)
+            chi2Sum += 2 * delta * sqrt(chi2) - delta * delta;
+        else
+            chi2Sum += chi2;
+    }
+    return chi2Sum;
+}
+
+void PoseSolver::BuildSystem(const g2o::SE3Quat &Tcw, const bool bRobust,
+                             Eigen::Matrix<double, 6, 6> &H, Eigen::Matrix<double, 6, 1> &b) const
+{
+    const Eigen::Matrix3d Rcw = Tcw.rotation().toRotationMatrix();
+    const Eigen::Vector3d tcw = Tcw.translation();
+    const double deltaMono = sqrt(chi2Mono);
+    const double deltaStereo = sqrt(chi2Stereo);
+
+    H.setZero();
+    b.setZero();
+
+    Eigen::Vector3d Xc, e;
+    Eigen::Matrix<double, 3, 3> P;  // 投影对相机坐标的雅克比
+    Eigen::Matrix<double, 3, 6> J;  // 误差对位姿扰动的雅克比
+    for (size_t k = 0, kend = mvIdx.size(); k < kend; k++)
+    {
+        if (!mvbInlier[k])
+            continue;
+
+        const int dim = ComputeError(Rcw, tcw, k, Xc, e);
+        const double x = Xc[0], y = Xc[1], z = Xc[2];
+        const double invz = 1.0 / z;
+        const double invz_2 = invz * invz;
+
+        if (dim == 2 && !mbPinhole)
+        {
+            P.topRows<2>() = mpCamera->projectJac(Xc);
+        }
+        else
+        {
+            P(0, 0) = fx * invz;
+            P(0, 1) = 0;
+            P(0, 2) = -fx * x * invz_2;
+            P(1, 0) = 0;
+            P(1, 1) = fy * invz;
+            P(1, 2) = -fy * y * invz_2;
+        }
+        if (dim == 3)
+        {
+            P(2, 0) = P(0, 0);
+            P(2, 1) = 0;
+            P(2, 2) = P(0, 2) + mbf * invz_2;
+        }
+
+        // 左乘扰动 Xc' = exp(dx)*Xc, dx = [omega, upsilon],
+        // dXc/dx = [-Xc^, I],与 EdgeSE3ProjectXYZOnlyPose::linearizeOplus 一致. J = -P * dXc/dx
+        for (int r = 0; r < dim; r++)
+        {
+            const double p0 = P(r, 0), p1 = P(r, 1), p2 = P(r, 2);
+            J(r, 0) = p1 * z - p2 * y;
+            J(r, 1) = p2 * x - p0 * z;
+            J(r, 2) = p0 * y - p1 * x;
+            J(r, 3) = -p0;
+            J(r, 4) = -p1;
+            J(r, 5) = -p2;
+        }
+
+        // 信息矩阵为 invSigma2*I,鲁棒核只缩放权重(与g2o的 robustInformation 相同)
+        double w = mvInvSigma2[k];
+        if (bRobust)
+        {
+            const double chi2 = w * e.squaredNorm();
+            const double delta = dim == 2 ? deltaMono : deltaStereo;
+            if (chi2 > delta * delta)
+                w *= delta / sqrt(chi2);
+        }
+
+        if (dim == 2)
+        {
+            const Eigen::Matrix<double, 2, 6> J2 = J.topRows<2>();
+            H.noalias() += w * J2.transpose() * J2;
+            b.noalias() -= w * J2.transpose() * e.head<2>();
+        }
+        else
+        {
+            H.noalias() += w * J.transpose() * J;
+            b.noalias() -= w * J.transpose() * e;
+        }
+    }
+}
+
+void PoseSolver::Solve(g2o::SE3Quat &Tcw, const int nIterations, const bool bRobust) const
+{
+    // 没有参与优化的观测时g2o什么也不做
+    if (std::find(mvbInlier.begin(), mvbInlier.end(), 1) == mvbInlier.end())
+        return;
+
+    Eigen::Matrix<double, 6, 6> H, Hl;
+    Eigen::Matrix<double, 6, 1> b, dx;
+
+    double currentChi = ComputeChi2(Tcw, bRobust);
+    double lambda = 0, ni = 2;
+    int nBad = 0;
+
+    for (int iter = 0; iter < nIterations; iter++)
+    {
+        const double iniChi = currentChi;
+        BuildSystem(Tcw, bRobust, H, b);
+
+        if (iter == 0)
+        {
+            lambda = lmTau * H.diagonal().cwiseAbs().maxCoeff();
+            ni = 2;
+        }
+
+        double rho = 0;
+        int qmax = 0;
+        do
+        {
+            Hl = H;
+            Hl.diagonal().array() += lambda;
+            Eigen::LDLT<Eigen::Matrix<double, 6, 6> > ldlt(Hl);
+            dx = ldlt.solve(b);
+
+            const g2o::SE3Quat Tnew = g2o::SE3Quat::exp(dx) * Tcw;
+            double tempChi = ComputeChi2(Tnew, bRobust);
+            if (ldlt.info() != Eigen::Success || !ldlt.isPositive())
+                tempChi = std::numeric_limits<double>::max();
+
+            rho = (currentChi - tempChi) / (dx.dot(lambda * dx + b) + 1e-3);
+
+            if (rho > 0 && std::isfinite(tempChi))
+            {
+                double alpha = 1. - pow((2 * rho - 1), 3);
+                alpha = std::min(alpha, lmGoodStepUpperScale);
+                lambda *= std::max(lmGoodStepLowerScale, alpha);
+                ni = 2;
+                currentChi = tempChi;
+                Tcw = Tnew;
+            }
+            else
+            {
+                lambda *= ni;
+                ni *= 2;
+            }
+            qmax++;
+        } while (rho < 0 && qmax < lmMaxTrialsAfterFailure);
+
+        if (qmax == lmMaxTrialsAfterFailure || rho == 0)
+            break;
+
+        // 下降太小连续3次则提前结束
+        if ((iniChi - currentChi) * 1e3 < iniChi)
+            nBad++;
+        else
+            nBad = 0;
+
+        if (nBad >= 3)
+            break;
+    }
+}
+
+int PoseSolver::Optimize(Frame *pFrame)
+{
+    const int N = pFrame->N;
+
+    mvXw.clear();
+    mvYw.clear();
+    mvZw.clear();
+    mvU.clear();
+    mvV.clear();
+    mvUr.clear();
+    mvInvSigma2.clear();
+    mvIdx.clear();
+
+    mpCamera = pFrame->mpCamera;
+    mbPinhole = mpCamera->GetType() == mpCamera->CAM_PINHOLE;
+    fx = pFrame->fx;
+    fy = pFrame->fy;
+    cx = pFrame->cx;
+    cy = pFrame->cy;
+    mbf = pFrame->mbf;
+
+    // Step 1: 收集2D-3D对应关系,地图点坐标在锁内一次读完
+    int nInitialCorrespondences = 0;
+    {
+        std::unique_lock<std::mutex> lock(MapPoint::mGlobalMutex);
+
+        for (int i = 0; i < N; i++)
+        {
+            MapPoint *pMP = pFrame->mvpMapPoints[i];
+            if (!pMP)
+                continue;
+
+            nInitialCorrespondences++;
+            pFrame->mvbOutlier[i] = false;
+
+            const cv::KeyPoint &kpUn = pFrame->mvKeysUn[i];
+            const cv::Matx31f Xw = pMP->GetWorldPos2();
+            mvXw.push_back(Xw(0));
+            mvYw.push_back(Xw(1));
+            mvZw.push_back(Xw(2));
+            mvU.push_back(kpUn.pt.x);
+            mvV.push_back(kpUn.pt.y);
+            mvUr.push_back(pFrame->mvuRight[i]);
+            mvInvSigma2.push_back(pFrame->mvInvLevelSigma2[kpUn.octave]);
+            mvIdx.push_back(i);
+        }
+    }
+
+    if (nInitialCorrespondences < 3)
+        return 0;
+
+    const size_t M = mvIdx.size();
+    mvbInlier.assign(M, 1);
+
+    // Step 2: 四轮优化,每轮10次迭代,每轮都从初始位姿开始,结束后重新划分内外点
+    // 外点不参与下一轮优化,但之后可能重新成为内点. 最后一轮不使用鲁棒核
+    const g2o::SE3Quat T0 = Converter::toSE3Quat(pFrame->GetPose_());
+    g2o::SE3Quat Tcw = T0;
+    int nBad = 0;
+    Eigen::Vector3d Xc, e;
+    for (int it = 0; it < 4; it++)
+    {
+        Tcw = T0;
+        Solve(Tcw, 10, it < 3);
+
+        const Eigen::Matrix3d Rcw = Tcw.rotation().toRotationMatrix();
+        const Eigen::Vector3d tcw = Tcw.translation();
+
+        nBad = 0;
+        for (size_t k = 0; k < M; k++)
+        {
+            const int dim = ComputeError(Rcw, tcw, k, Xc, e);
+            const double chi2 = mvInvSigma2[k] * e.squaredNorm();
+            const int idx = mvIdx[k];
+
+            if (chi2 > (dim == 2 ? chi2Mono : chi2Stereo))
+            {
+                pFrame->mvbOutlier[idx] = true;
+                mvbInlier[k] = 0;
+                nBad++;
+            }
+            else
+            {
+                pFrame->mvbOutlier[idx] = false;
+                mvbInlier[k] = 1;
+            }
+        }
+
+        if (M < 10)
+            break;
+    }
+
+    // Step 3: 写回位姿
+    pFrame->SetPose_(Converter::toMatx44f(Tcw));
+
+    return nInitialCorrespondences - nBad;
+}
+
+} // namespace ORB_SLAM3
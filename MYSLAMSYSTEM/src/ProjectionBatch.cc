@@ -0,0 +1,260 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ProjectionBatch.h"
+
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+#include "OptimizableTypes.h"
+
+namespace ORB_SLAM3
+{
+
+static const double kPadPoint[3] = {0.0, 0.0, 1.0};
+
+ProjectionBatch::ProjectionBatch(): mnEdges(0)
+{
+}
+
+ProjectionBatch::~ProjectionBatch()
+{
+    Release();
+}
+
+void ProjectionBatch::Release()
+{
+    for(size_t i = 0; i < mvpEdges.size(); i++)
+        mvpEdges[i]->mpBatch = nullptr;
+    mvpEdges.clear();
+    mvpErrors.clear();
+    mvpPoints.clear();
+    mnEdges = 0;
+    mvpPoses.clear();
+    mvPoseData.clear();
+    mvBlocks.clear();
+}
+
+void ProjectionBatch::setActiveEdges(const std::vector<g2o::OptimizableGraph::Edge *> &activeEdges, std::vector<bool> &taken)
+{
+    Release();
+
+    struct Entry
+    {
+        int nPose;
+        GeometricCamera *pCamera;
+        g2o::OptimizableGraph::Edge *pEdge;
+        int *pBatchIdx;
+        const double *pPoint;
+        const double *pObs;
+    };
+    std::vector<Entry> vEntries;
+    std::unordered_map<g2o::VertexSE3Expmap *, int> poseIdx;
+
+    auto AddPose = [&](g2o::VertexSE3Expmap *pVertex) {
+        auto it = poseIdx.find(pVertex);
+        if(it != poseIdx.end())
+            return it->second;
+        const int idx = mvpPoses.size();
+        poseIdx[pVertex] = idx;
+        mvpPoses.push_back(pVertex);
+        return idx;
+    };
+
+    for(size_t k = 0; k < activeEdges.size(); k++)
+    {
+        if(taken[k])
+            continue;
+
+        g2o::OptimizableGraph::Edge *pEdge = activeEdges[k];
+        Entry entry;
+        entry.pEdge = pEdge;
+        if(EdgeSE3ProjectXYZ *e = dynamic_cast<EdgeSE3ProjectXYZ *>(pEdge))
+        {
+            if(!e->pCamera || e->pCamera->GetType() != e->pCamera->CAM_PINHOLE)
+                continue;
+            e->mpBatch = this;
+            mvpEdges.push_back(e);
+            entry.nPose = AddPose(static_cast<g2o::VertexSE3Expmap *>(e->vertex(1)));
+            entry.pCamera = e->pCamera;
+            entry.pBatchIdx = &e->mnBatchIdx;
+            entry.pPoint = static_cast<const g2o::VertexSBAPointXYZ *>(e->vertex(0))->estimate().data();
+            entry.pObs = e->measurement().data();
+        }
+        else
+            continue;
+
+        vEntries.push_back(entry);
+        taken[k] = true;
+    }
+
+    mnEdges = vEntries.size();
+    mvPoseData.resize(mvpPoses.size());
+    if(vEntries.empty())
+        return;
+
+    // 按位姿和相机分组,组内的边共用位姿和内参
+    std::stable_sort(vEntries.begin(), vEntries.end(), [](const Entry &a, const Entry &b) {
+        return a.nPose < b.nPose || (a.nPose == b.nPose && std::less<GeometricCamera *>()(a.pCamera, b.pCamera));
+    });
+
+    int l = LANES;
+    for(size_t i = 0; i < vEntries.size(); i++)
+    {
+        const Entry &entry = vEntries[i];
+        if(l == LANES || entry.nPose != vEntries[i - 1].nPose || entry.pCamera != vEntries[i - 1].pCamera)
+        {
+            mvBlocks.emplace_back();
+            Block &block = mvBlocks.back();
+            block.u.setZero();
+            block.v.setZero();
+            block.Jpose[4].setZero();
+            block.Jpose[9].setZero();
+            block.fx = entry.pCamera->getParameter(0);
+            block.fy = entry.pCamera->getParameter(1);
+            block.cx = entry.pCamera->getParameter(2);
+            block.cy = entry.pCamera->getParameter(3);
+            block.nPose = entry.nPose;
+            mvpErrors.resize(mvBlocks.size() * LANES, nullptr);
+            mvpPoints.resize(mvBlocks.size() * LANES, nullptr);
+            l = 0;
+        }
+
+        Block &block = mvBlocks.back();
+        const int idx = (mvBlocks.size() - 1) * LANES + l;
+        block.u[l] = entry.pObs[0];
+        block.v[l] = entry.pObs[1];
+        mvpErrors[idx] = entry.pEdge->errorData();
+        mvpPoints[idx] = entry.pPoint;
+        *entry.pBatchIdx = idx;
+        l++;
+    }
+}
+
+void ProjectionBatch::UpdatePoses()
+{
+    for(size_t p = 0; p < mvpPoses.size(); p++)
+    {
+        const g2o::SE3Quat &Tcw = mvpPoses[p]->estimate();
+        mvPoseData[p].leftCols<3>() = Tcw.rotation().toRotationMatrix();
+        mvPoseData[p].col(3) = Tcw.translation();
+    }
+}
+
+void ProjectionBatch::Evaluate(const bool bJacobians)
+{
+    UpdatePoses();
+
+    for(size_t b = 0; b < mvBlocks.size(); b++)
+    {
+        Block &block = mvBlocks[b];
+        const Eigen::Matrix<double, 3, 4> &T = mvPoseData[block.nPose];
+        const double *const *ppPoints = &mvpPoints[b * LANES];
+        double *const *ppErrors = &mvpErrors[b * LANES];
+
+        // 读取三维点的当前估计. 空位用一个深度为1的点填充,避免除0
+        Lane X, Y, Z;
+        for(int l = 0; l < LANES; l++)
+        {
+            const double *P = ppPoints[l] ? ppPoints[l] : kPadPoint;
+            X[l] = P[0];
+            Y[l] = P[1];
+            Z[l] = P[2];
+        }
+
+        // Pc = Rcw*Pw + tcw
+        const Lane x = T(0, 0) * X + T(0, 1) * Y + T(0, 2) * Z + T(0, 3);
+        const Lane y = T(1, 0) * X + T(1, 1) * Y + T(1, 2) * Z + T(1, 3);
+        const Lane z = T(2, 0) * X + T(2, 1) * Y + T(2, 2) * Z + T(2, 3);
+        const Lane invz = z.inverse();
+        const Lane xn = x * invz;
+        const Lane yn = y * invz;
+
+        const Lane eu = block.u - (block.fx * xn + block.cx);
+        const Lane ev = block.v - (block.fy * yn + block.cy);
+        for(int l = 0; l < LANES && ppErrors[l]; l++)
+        {
+            ppErrors[l][0] = eu[l];
+            ppErrors[l][1] = ev[l];
+        }
+
+        if(!bJacobians)
+            continue;
+
+        // 与 EdgeSE3ProjectXYZ::linearizeOplus 相同: J = -P * [-Pc^ I], P为投影关于Pc的雅克比
+        const Lane fxz = block.fx * invz;
+        const Lane fyz = block.fy * invz;
+        Lane *J = block.Jpose;
+        J[0] = block.fx * xn * yn;
+        J[1] = -block.fx * (1.0 + xn * xn);
+        J[2] = block.fx * yn;
+        J[3] = -fxz;
+        J[5] = fxz * xn;
+        J[6] = block.fy * (1.0 + yn * yn);
+        J[7] = -block.fy * xn * yn;
+        J[8] = -block.fy * xn;
+        J[10] = -fyz;
+        J[11] = fyz * yn;
+
+        // -P * Rcw
+        for(int c = 0; c < 3; c++)
+        {
+            block.Jpoint[c] = fxz * (xn * T(2, c) - T(0, c));
+            block.Jpoint[3 + c] = fyz * (yn * T(2, c) - T(1, c));
+        }
+    }
+}
+
+void ProjectionBatch::computeErrors()
+{
+    if(mvBlocks.empty())
+        return;
+    Evaluate(false);
+}
+
+void ProjectionBatch::linearize()
+{
+    if(mvBlocks.empty())
+        return;
+    Evaluate(true);
+}
+
+Eigen::Matrix<double, 2, 6> ProjectionBatch::PoseJacobian(const int idx) const
+{
+    const Block &block = mvBlocks[idx / LANES];
+    const int l = idx % LANES;
+    Eigen::Matrix<double, 2, 6> J;
+    for(int r = 0; r < 2; r++)
+        for(int c = 0; c < 6; c++)
+            J(r, c) = block.Jpose[6 * r + c][l];
+    return J;
+}
+
+Eigen::Matrix<double, 2, 3> ProjectionBatch::PointJacobian(const int idx) const
+{
+    const Block &block = mvBlocks[idx / LANES];
+    const int l = idx % LANES;
+    Eigen::Matrix<double, 2, 3> J;
+    for(int r = 0; r < 2; r++)
+        for(int c = 0; c < 3; c++)
+            J(r, c) = block.Jpoint[3 * r + c][l];
+    return J;
+}
+
+} // namespace ORB_SLAM3
@@ -50,7 +50,10 @@ System::System(const string &strVocFile,                //词袋文件所在路
                 mpViewer(static_cast<Viewer*>(NULL)),   // 空对象指针
                 mbReset(false), mbResetActiveMap(false),// ?重新设置ActiveMap  
                 mbActivateLocalizationMode(false),      // 是否开启局部定位功能开关
-                mbDeactivateLocalizationMode(false)     // 
+                mbDeactivateLocalizationMode(false),    // 
+                mptStereoPreprocess(NULL), mptStereoTracking(NULL),  // 双目跟踪流水线,StartStereoPipeline时开启
+                mnPipelineQueueSize(0), mnPipelinePending(0), mbPipelineRunning(false), mbPipelineFinish(false),
+                mbPipelineTracking(false)
 {
     // Output welcome message
     cout << endl <<
@@ -93,7 +96,12 @@ System::System(const string &strVocFile,                //词袋文件所在路
     //建立一个新的ORB字典
     mpVocabulary = new ORBVocabulary();
     //读取预训练好的ORB字典并返回成功/失败标志
-    bool bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
+    // .bin 后缀的是 tools/bin_vocabulary 转出的二进制字典,内存映射加载,不用逐行解析文本
+    bool bVocLoad = false;
+    if(strVocFile.size() > 4 && strVocFile.compare(strVocFile.size() - 4, 4, ".bin") == 0)
+        bVocLoad = mpVocabulary->loadFromBinaryFile(strVocFile);
+    else
+        bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
     //如果加载失败，就输出错误信息
     if(!bVocLoad)
     {
@@ -156,6 +164,32 @@ System::System(const string &strVocFile,                //词袋文件所在路
     else
         mpLocalMapper->mbFarPoints = false;
 
+    // 热路径计时,默认关闭
+    cv::FileNode nodeTracing = fsSettings["System.Tracing"];
+    if(!nodeTracing.empty() && (int)nodeTracing != 0)
+    {
+        cv::FileNode nodeOutput = fsSettings["System.TracingOutput"];
+        if(!nodeOutput.empty())
+            mStrTracingOutput = (string)nodeOutput;
+        EnableTracing(true);
+    }
+
+    // 闭环后使用增量式的全局BA(只对纯视觉地图),默认关闭
+    cv::FileNode nodeIncrementalBA = fsSettings["LoopClosing.IncrementalBA"];
+    if(!nodeIncrementalBA.empty() && (int)nodeIncrementalBA != 0)
+    {
+        cout << "Incremental global BA enabled" << endl;
+        mpLoopCloser->SetIncrementalBA(true);
+    }
+
+    // 闭环/融合检测时几何验证的候选关键帧数,候选帧由多个线程同时验证
+    cv::FileNode nodeBoWCandidates = fsSettings["LoopClosing.NumBoWCandidates"];
+    if(!nodeBoWCandidates.empty() && (int)nodeBoWCandidates > 0)
+    {
+        cout << "Loop closing verifies " << (int)nodeBoWCandidates << " BoW candidates" << endl;
+        mpLoopCloser->SetNumBoWCandidates((int)nodeBoWCandidates);
+    }
+
 
 
     //Set pointers between threads
@@ -182,6 +216,31 @@ cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const
         exit(-1);
     }   
 
+    CheckModeAndReset();
+
+    cv::Mat Tcw = mpTracker->GrabImageStereo(imLeft,imRight,timestamp);
+
+    unique_lock<mutex> lock2(mMutexState);
+    mTrackingState = mpTracker->mState;
+    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
+    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+
+    return Tcw;
+}
+
+bool System::ModeOrResetPending()
+{
+    {
+        unique_lock<mutex> lock(mMutexMode);
+        if(mbActivateLocalizationMode || mbDeactivateLocalizationMode)
+            return true;
+    }
+    unique_lock<mutex> lock(mMutexReset);
+    return mbReset || mbResetActiveMap;
+}
+
+void System::CheckModeAndReset()
+{
     // Check mode change
     {
         unique_lock<mutex> lock(mMutexMode);
@@ -190,10 +249,7 @@ cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const
             mpLocalMapper->RequestStop();
 
             // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+            mpLocalMapper->WaitUntilStopped();
 
             mpTracker->InformOnlyTracking(true);
             mbActivateLocalizationMode = false;
@@ -222,15 +278,283 @@ cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const
             mbResetActiveMap = false;
         }
     }
+}
 
-    cv::Mat Tcw = mpTracker->GrabImageStereo(imLeft,imRight,timestamp);
+// 开启双目跟踪流水线: 预处理线程(读图、灰度转换、特征提取)与跟踪线程(位姿估计)并行
+// 不能与TrackStereo混用
+void System::StartStereoPipeline(const TrackCallback &callback, const int nQueueSize)
+{
+    if(mSensor!=STEREO)
+    {
+        cerr << "ERROR: the stereo pipeline can only be used with a Stereo sensor." << endl;
+        exit(-1);
+    }
 
-    unique_lock<mutex> lock2(mMutexState);
-    mTrackingState = mpTracker->mState;
-    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
-    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+    unique_lock<mutex> lock(mMutexPipeline);
+    if(mbPipelineRunning)
+        return;
 
-    return Tcw;
+    mTrackCallback = callback;
+    mnPipelineQueueSize = std::max(nQueueSize, 1);
+    mnPipelinePending = 0;
+    mbPipelineFinish = false;
+    mbPipelineTracking = false;
+    mbPipelineRunning = true;
+    mFrameScheduler.Reset();
+
+    mptStereoPreprocess = new thread(&ORB_SLAM3::System::RunStereoPreprocess, this);
+    mptStereoTracking = new thread(&ORB_SLAM3::System::RunStereoTracking, this);
+}
+
+bool System::SubmitStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp)
+{
+    StereoRequest request;
+    request.timestamp = timestamp;
+    // 拷贝一份,调用者可以立即复用自己的图像
+    request.imLeft = imLeft.clone();
+    request.imRight = imRight.clone();
+    return PushStereoRequest(request);
+}
+
+bool System::SubmitStereo(const string &strImageLeft, const string &strImageRight, const double &timestamp)
+{
+    StereoRequest request;
+    request.timestamp = timestamp;
+    request.strImageLeft = strImageLeft;
+    request.strImageRight = strImageRight;
+    return PushStereoRequest(request);
+}
+
+bool System::PushStereoRequest(StereoRequest &request)
+{
+    // 按时间戳控制输入节奏(实时回放)
+    request.submitTime = mFrameScheduler.Pace(request.timestamp);
+
+    const FrameScheduler::ePolicy policy = mFrameScheduler.GetPolicy();
+    int nDropped = 0;
+    {
+        unique_lock<mutex> lock(mMutexPipeline);
+        // BLOCK: 输入队列满时阻塞,防止提交速度超过处理速度
+        if(policy == FrameScheduler::BLOCK)
+            mcvPipeline.wait(lock, [&]{ return !mbPipelineRunning || mbPipelineFinish || mqStereoRequests.size() < mnPipelineQueueSize; });
+        if(!mbPipelineRunning || mbPipelineFinish)
+            return false;
+
+        // 其他策略从不阻塞,而是丢弃旧帧
+        if(policy == FrameScheduler::LATEST_FRAME_WINS)
+        {
+            nDropped = mqStereoRequests.size();
+            mqStereoRequests.clear();
+        }
+        else if(policy == FrameScheduler::BOUNDED_LATENCY && mqStereoRequests.size() >= mnPipelineQueueSize)
+        {
+            mqStereoRequests.pop_front();
+            nDropped = 1;
+        }
+
+        mqStereoRequests.push_back(request);
+        mnPipelinePending += 1 - nDropped;
+        mFrameScheduler.RecordSubmitted(request.timestamp);
+    }
+    for(int i=0; i<nDropped; i++)
+        mFrameScheduler.RecordDropped();
+    mcvPipeline.notify_all();
+    return true;
+}
+
+void System::SetFramePolicy(const FrameScheduler::ePolicy policy, const double maxLatency)
+{
+    mFrameScheduler.SetPolicy(policy, maxLatency);
+    mcvPipeline.notify_all();
+}
+
+void System::SetFramePacing(const double rate)
+{
+    mFrameScheduler.SetPacing(rate);
+}
+
+FrameScheduler::Stats System::GetFrameStats()
+{
+    return mFrameScheduler.GetStats();
+}
+
+KeyFrameScheduler::Stats System::GetKeyFrameStats()
+{
+    return mpTracker->GetKeyFrameScheduler()->GetStats();
+}
+
+SPSCQueue<KeyFrame*>::Stats System::GetLocalMappingQueueStats()
+{
+    return mpLocalMapper->GetKeyFrameQueueStats();
+}
+
+SPSCQueue<KeyFrame*>::Stats System::GetLoopClosingQueueStats()
+{
+    return mpLoopCloser->GetKeyFrameQueueStats();
+}
+
+void System::EnableTracing(const bool bEnabled)
+{
+    if(bEnabled)
+        Tracer::SetThreadName("Main");
+    Tracer::SetEnabled(bEnabled);
+}
+
+void System::SaveTracing(const string &strPrefix)
+{
+    Tracer::PrintStats();
+    if(Tracer::SaveStatsCSV(strPrefix + "_stages.csv"))
+        cout << "Stage timing saved to " << strPrefix << "_stages.csv" << endl;
+    if(Tracer::SaveChromeTrace(strPrefix + "_trace.json"))
+        cout << "Trace saved to " << strPrefix << "_trace.json" << endl;
+}
+
+void System::FlushStereoPipeline()
+{
+    unique_lock<mutex> lock(mMutexPipeline);
+    mcvPipeline.wait(lock, [&]{ return mnPipelinePending == 0; });
+}
+
+void System::StopStereoPipeline()
+{
+    {
+        unique_lock<mutex> lock(mMutexPipeline);
+        if(!mbPipelineRunning)
+            return;
+    }
+
+    FlushStereoPipeline();
+
+    {
+        unique_lock<mutex> lock(mMutexPipeline);
+        mbPipelineFinish = true;
+    }
+    mcvPipeline.notify_all();
+
+    mptStereoPreprocess->join();
+    mptStereoTracking->join();
+    delete mptStereoPreprocess;
+    delete mptStereoTracking;
+    mptStereoPreprocess = NULL;
+    mptStereoTracking = NULL;
+
+    unique_lock<mutex> lock(mMutexPipeline);
+    mbPipelineRunning = false;
+}
+
+// 流水线第一阶段: 读图并构造Frame,结果按提交顺序放入mqStereoInputs
+// 模式切换和复位也在这里进行: 复位会修改Frame的静态状态(帧ID、初始化标志、上一帧灰度图),
+// 必须等已经预处理好的帧都跟踪完、跟踪阶段空闲,并且在构造下一帧之前执行
+// 丢帧只在构造Frame之前进行: 构造Frame会推进动态检测用的上一帧灰度图,构造好的帧必须被跟踪
+void System::RunStereoPreprocess()
+{
+    Tracer::SetThreadName("StereoPreprocess");
+    while(1)
+    {
+        StereoRequest request;
+        int nDropped = 0;
+        {
+            unique_lock<mutex> lock(mMutexPipeline);
+            // 不阻塞的策略下最多提前预处理一帧,等跟踪阶段取走上一帧时再选择当时最新的请求
+            mcvPipeline.wait(lock, [&]{
+                const size_t nAhead = mFrameScheduler.GetPolicy() == FrameScheduler::BLOCK ? mnPipelineQueueSize : 1;
+                return mbPipelineFinish || (!mqStereoRequests.empty() && mqStereoInputs.size() < nAhead); });
+            if(mqStereoRequests.empty())
+                break;
+            request = mqStereoRequests.front();
+            mqStereoRequests.pop_front();
+
+            // 有更新的帧排队时,LATEST_FRAME_WINS直接跳到最新帧,BOUNDED_LATENCY跳过等待过久的帧,保证总有帧被处理
+            const bool bLatest = mFrameScheduler.GetPolicy() == FrameScheduler::LATEST_FRAME_WINS;
+            while(!mqStereoRequests.empty() && (bLatest || mFrameScheduler.IsStale(request.submitTime)))
+            {
+                request = mqStereoRequests.front();
+                mqStereoRequests.pop_front();
+                nDropped++;
+            }
+            mnPipelinePending -= nDropped;
+        }
+        for(int i=0; i<nDropped; i++)
+            mFrameScheduler.RecordDropped();
+        mcvPipeline.notify_all();
+
+        if(ModeOrResetPending())
+        {
+            {
+                unique_lock<mutex> lock(mMutexPipeline);
+                mcvPipeline.wait(lock, [&]{ return mqStereoInputs.empty() && !mbPipelineTracking; });
+            }
+            // 只有本线程向跟踪阶段提供帧,此时跟踪阶段一直空闲
+            CheckModeAndReset();
+        }
+
+        if(!request.strImageLeft.empty())
+        {
+            request.imLeft = cv::imread(request.strImageLeft,cv::IMREAD_UNCHANGED);
+            request.imRight = cv::imread(request.strImageRight,cv::IMREAD_UNCHANGED);
+        }
+
+        StereoInput* pInput = new StereoInput();
+        pInput->timestamp = request.timestamp;
+        pInput->submitTime = request.submitTime;
+        if(request.imLeft.empty() || request.imRight.empty())
+            cerr << endl << "Failed to load image at: " << request.strImageLeft << endl;
+        else
+            mpTracker->PreprocessStereo(request.imLeft, request.imRight, request.timestamp, *pInput);
+
+        // 取请求前已经保证队列有空位,只有本线程入队
+        {
+            unique_lock<mutex> lock(mMutexPipeline);
+            mqStereoInputs.push_back(pInput);
+        }
+        mcvPipeline.notify_all();
+    }
+}
+
+// 流水线第二阶段: 按顺序跟踪预处理好的帧并通过回调返回位姿
+void System::RunStereoTracking()
+{
+    Tracer::SetThreadName("StereoTracking");
+    while(1)
+    {
+        // 预处理好的帧都要跟踪,丢帧已经在预处理阶段完成
+        StereoInput* pInput;
+        {
+            unique_lock<mutex> lock(mMutexPipeline);
+            mcvPipeline.wait(lock, [&]{ return !mqStereoInputs.empty() || mbPipelineFinish; });
+            if(mqStereoInputs.empty())
+                break;
+            pInput = mqStereoInputs.front();
+            mqStereoInputs.pop_front();
+            mbPipelineTracking = true;
+        }
+        mcvPipeline.notify_all();
+
+        // 读图失败的帧不参与跟踪,返回空位姿
+        cv::Mat Tcw;
+        if(!pInput->imLeft.empty())
+        {
+            Tcw = mpTracker->TrackStereoInput(*pInput);
+            mFrameScheduler.RecordTracked(pInput->timestamp, pInput->submitTime);
+
+            unique_lock<mutex> lock2(mMutexState);
+            mTrackingState = mpTracker->mState;
+            mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
+            mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+        }
+
+        if(mTrackCallback)
+            mTrackCallback(pInput->timestamp, Tcw);
+
+        delete pInput;
+
+        {
+            unique_lock<mutex> lock(mMutexPipeline);
+            mnPipelinePending--;
+            mbPipelineTracking = false;
+        }
+        mcvPipeline.notify_all();
+    }
 }
 
 cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp, string filename)
@@ -248,10 +572,7 @@ cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const doub
         {
             mpLocalMapper->RequestStop();
             // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+            mpLocalMapper->WaitUntilStopped();
 
             mpTracker->InformOnlyTracking(true);
             mbActivateLocalizationMode = false;
@@ -305,10 +626,7 @@ cv::Mat System::TrackStereo_RGBD(const cv::Mat &imLeft, const cv::Mat &imRight,
             mpLocalMapper->RequestStop();
 
             // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+            mpLocalMapper->WaitUntilStopped();
 
             mpTracker->InformOnlyTracking(true);
             mbActivateLocalizationMode = false;
@@ -375,6 +693,8 @@ void System::save()
 
 void System::Shutdown()
 {
+    StopStereoPipeline();
+
 //    mpLocalMapper->RequestFinish();
 //    mpLoopCloser->RequestFinish();
 //    mpPointCloudMapping->shutdown();
@@ -382,8 +702,7 @@ void System::Shutdown()
     if(mpViewer)
     {
         mpViewer->RequestFinish();
-        while(!mpViewer->isFinished())
-            usleep(5000);
+        mpViewer->WaitUntilFinished();
     }
 
     mpLocalMapper->RequestFinish();
@@ -392,19 +711,9 @@ void System::Shutdown()
     cout<< "Shutdown "<<endl;
 
     // Wait until all thread have effectively stopped
-    while(!mpLocalMapper->isFinished() || !mpLoopCloser->isFinished() || mpLoopCloser->isRunningGBA())
-    {
-//        if(!mpLocalMapper->isFinished())
-//            cout << "mpLocalMapper is not finished" << endl;
-//        if(!mpLoopCloser->isFinished())
-//            cout << "mpLoopCloser is not finished" << endl;
-//        if(mpLoopCloser->isRunningGBA()){
-//            cout << "mpLoopCloser is running GBA" << endl;
-//            cout << "break anyway..." << endl;
-//            break;
-//        }
-        usleep(5000);
-    }
+    mpLocalMapper->WaitUntilFinished();
+    mpLoopCloser->WaitUntilFinished();
+    mpLoopCloser->WaitUntilGBAFinished();
 
 //    if(mpViewer)
 //        pangolin::BindToContext("ORB-SLAM2: Map Viewer");
@@ -412,6 +721,14 @@ void System::Shutdown()
 #ifdef REGISTER_TIMES
     mpTracker->PrintTimeStats();
 #endif
+
+    if(Tracer::IsEnabled())
+    {
+        if(mStrTracingOutput.empty())
+            Tracer::PrintStats();
+        else
+            SaveTracing(mStrTracingOutput);
+    }
 }
 
 
@@ -0,0 +1,399 @@
+//
+// 热路径计时: RAII作用域计时器,每个线程一个无锁环形缓冲区,每个阶段一个HDR延迟直方图
+//
+
+#include "Tracer.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace ORB_SLAM3
+{
+
+std::atomic<bool> Tracer::mbEnabled(false);
+
+// 单生产者(所属线程)/单消费者(收集线程)的无锁环形缓冲区
+class Tracer::ThreadBuffer
+{
+public:
+    static const uint64_t CAPACITY = 1 << 14;
+
+    ThreadBuffer(const int id) : mnId(id), mHead(0), mTail(0), mDropped(0) {}
+
+    // 所属线程调用. 缓冲区满时丢弃事件
+    // 返回true表示缓冲区刚达到半满,需要唤醒收集线程
+    bool Push(const Event &e)
+    {
+        const uint64_t head = mHead.load(std::memory_order_relaxed);
+        const uint64_t size = head - mTail.load(std::memory_order_acquire);
+        if(size >= CAPACITY)
+        {
+            mDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        mvEvents[head & (CAPACITY-1)] = e;
+        mHead.store(head+1, std::memory_order_release);
+        return size+1 == CAPACITY/2;
+    }
+
+    // 收集线程调用
+    template<class F> void Drain(F f)
+    {
+        const uint64_t tail = mTail.load(std::memory_order_relaxed);
+        const uint64_t head = mHead.load(std::memory_order_acquire);
+        for(uint64_t i=tail; i<head; i++)
+            f(mvEvents[i & (CAPACITY-1)]);
+        mTail.store(head, std::memory_order_release);
+    }
+
+    int mnId;
+    std::string mName;
+    std::atomic<uint64_t> mHead;
+    std::atomic<uint64_t> mTail;
+    std::atomic<uint64_t> mDropped;
+    Event mvEvents[CAPACITY];
+};
+
+// HDR直方图: 每个2的幂区间再线性分成32个子桶,相对误差约3%
+class Tracer::Histogram
+{
+public:
+    static const int SUB_BITS = 5;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int BUCKETS = 64 * SUB_BUCKETS;
+
+    Histogram() { Clear(); }
+
+    void Clear()
+    {
+        for(int i=0; i<BUCKETS; i++)
+            mvCounts[i].store(0, std::memory_order_relaxed);
+        mCount.store(0, std::memory_order_relaxed);
+        mSum.store(0, std::memory_order_relaxed);
+        mMax.store(0, std::memory_order_relaxed);
+    }
+
+    static int Index(const uint64_t v)
+    {
+        if(v < (uint64_t)SUB_BUCKETS)
+            return v;
+        const int msb = 63 - __builtin_clzll(v);
+        const int shift = msb - SUB_BITS;
+        return ((shift+1) << SUB_BITS) + ((v >> shift) & (SUB_BUCKETS-1));
+    }
+
+    // 桶的中间值
+    static double Value(const int idx)
+    {
+        if(idx < SUB_BUCKETS)
+            return idx;
+        const int shift = (idx >> SUB_BITS) - 1;
+        const uint64_t lower = (uint64_t)(SUB_BUCKETS + (idx & (SUB_BUCKETS-1))) << shift;
+        return lower + 0.5 * (double)(1ull << shift);
+    }
+
+    void Add(const uint64_t v)
+    {
+        mvCounts[Index(v)].fetch_add(1, std::memory_order_relaxed);
+        mCount.fetch_add(1, std::memory_order_relaxed);
+        mSum.fetch_add(v, std::memory_order_relaxed);
+        uint64_t m = mMax.load(std::memory_order_relaxed);
+        while(v > m && !mMax.compare_exchange_weak(m, v, std::memory_order_relaxed));
+    }
+
+    double Percentile(const double p) const
+    {
+        const uint64_t total = mCount.load(std::memory_order_relaxed);
+        if(total == 0)
+            return 0;
+        const uint64_t target = std::max<uint64_t>(1, (uint64_t)(p * total + 0.5));
+        uint64_t acc = 0;
+        for(int i=0; i<BUCKETS; i++)
+        {
+            acc += mvCounts[i].load(std::memory_order_relaxed);
+            if(acc >= target)
+                return Value(i);
+        }
+        return mMax.load(std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> mvCounts[BUCKETS];
+    std::atomic<uint64_t> mCount;
+    std::atomic<uint64_t> mSum;
+    std::atomic<uint64_t> mMax;
+};
+
+Tracer& Tracer::Instance()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Tracer() : mT0(std::chrono::steady_clock::now()), mnStages(0), mnDroppedEvents(0),
+    mptCollector(NULL), mbStopCollector(false), mbCollectRequested(false)
+{
+    mvHistograms = new Histogram[MAX_STAGES];
+}
+
+Tracer::~Tracer()
+{
+    {
+        unique_lock<mutex> lock(mMutexCollector);
+        mbStopCollector = true;
+    }
+    mcvCollector.notify_one();
+    if(mptCollector)
+    {
+        mptCollector->join();
+        delete mptCollector;
+    }
+    // 线程缓冲区不释放: 线程退出后其thread_local指针可能仍被析构顺序之外的代码使用
+}
+
+void Tracer::SetEnabled(const bool bEnabled)
+{
+    Tracer &t = Instance();
+    if(bEnabled)
+    {
+        unique_lock<mutex> lock(t.mMutexCollector);
+        if(!t.mptCollector)
+            t.mptCollector = new thread(&Tracer::RunCollector, &t);
+    }
+    mbEnabled.store(bEnabled, std::memory_order_relaxed);
+}
+
+int Tracer::RegisterStage(const char* name)
+{
+    Tracer &t = Instance();
+    unique_lock<mutex> lock(t.mMutexStages);
+    const int n = t.mnStages.load();
+    for(int i=0; i<n; i++)
+        if(t.mvStageNames[i] == name)
+            return i;
+    if(n >= MAX_STAGES)
+    {
+        cerr << "Tracer: too many stages, " << name << " is merged into the last one" << endl;
+        return MAX_STAGES-1;
+    }
+    t.mvStageNames[n] = name;
+    t.mnStages.store(n+1);
+    return n;
+}
+
+uint64_t Tracer::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Instance().mT0).count();
+}
+
+Tracer::ThreadBuffer* Tracer::GetThreadBuffer()
+{
+    static thread_local ThreadBuffer* pBuffer = NULL;
+    if(!pBuffer)
+    {
+        unique_lock<mutex> lock(mMutexBuffers);
+        pBuffer = new ThreadBuffer(mvBuffers.size());
+        mvBuffers.push_back(pBuffer);
+    }
+    return pBuffer;
+}
+
+void Tracer::SetThreadName(const std::string &name)
+{
+    Tracer &t = Instance();
+    ThreadBuffer* pBuffer = t.GetThreadBuffer();
+    unique_lock<mutex> lock(t.mMutexBuffers);
+    pBuffer->mName = name;
+}
+
+void Tracer::Record(const int stage, const uint64_t start, const uint64_t end)
+{
+    Tracer &t = Instance();
+    const uint64_t duration = end > start ? end - start : 0;
+    t.mvHistograms[stage].Add(duration);
+
+    Event e;
+    e.start = start;
+    e.duration = duration;
+    e.stage = stage;
+    if(t.GetThreadBuffer()->Push(e))
+        t.WakeCollector();
+}
+
+// 每个缓冲区半满时只调用一次,加锁的开销可以忽略
+void Tracer::WakeCollector()
+{
+    {
+        unique_lock<mutex> lock(mMutexCollector);
+        mbCollectRequested = true;
+    }
+    mcvCollector.notify_one();
+}
+
+// 把所有线程缓冲区中的事件搬到mvEvents. 事件数超过上限后只保留直方图
+void Tracer::Collect()
+{
+    static const size_t MAX_EVENTS = 1 << 22;
+
+    vector<ThreadBuffer*> vBuffers;
+    {
+        unique_lock<mutex> lock(mMutexBuffers);
+        vBuffers = mvBuffers;
+    }
+
+    unique_lock<mutex> lock(mMutexEvents);
+    for(size_t i=0; i<vBuffers.size(); i++)
+    {
+        ThreadBuffer* pBuffer = vBuffers[i];
+        pBuffer->Drain([&](const Event &e){
+            if(mvEvents.size() < MAX_EVENTS)
+                mvEvents.push_back(make_pair(pBuffer->mnId, e));
+            else
+                mnDroppedEvents++;
+        });
+    }
+}
+
+void Tracer::RunCollector()
+{
+    while(1)
+    {
+        {
+            unique_lock<mutex> lock(mMutexCollector);
+            mcvCollector.wait(lock, [this]{ return mbStopCollector || mbCollectRequested; });
+            if(mbStopCollector)
+                break;
+            mbCollectRequested = false;
+        }
+        Collect();
+    }
+}
+
+std::vector<Tracer::StageStats> Tracer::GetStats()
+{
+    Tracer &t = Instance();
+    vector<StageStats> vStats;
+    const int n = t.mnStages.load();
+    for(int i=0; i<n; i++)
+    {
+        const Histogram &h = t.mvHistograms[i];
+        const uint64_t count = h.mCount.load(std::memory_order_relaxed);
+        if(count == 0)
+            continue;
+
+        StageStats s;
+        {
+            unique_lock<mutex> lock(t.mMutexStages);
+            s.name = t.mvStageNames[i];
+        }
+        s.count = count;
+        s.mean = 1e-6 * h.mSum.load(std::memory_order_relaxed) / count;
+        s.p50 = 1e-6 * h.Percentile(0.50);
+        s.p90 = 1e-6 * h.Percentile(0.90);
+        s.p99 = 1e-6 * h.Percentile(0.99);
+        s.max = 1e-6 * h.mMax.load(std::memory_order_relaxed);
+        vStats.push_back(s);
+    }
+    return vStats;
+}
+
+void Tracer::PrintStats()
+{
+    vector<StageStats> vStats = GetStats();
+    if(vStats.empty())
+        return;
+
+    cout << endl << "Stage timing (ms)" << endl;
+    cout << left << setw(40) << "stage" << right << setw(10) << "count" << setw(10) << "mean"
+         << setw(10) << "p50" << setw(10) << "p90" << setw(10) << "p99" << setw(10) << "max" << endl;
+    cout << fixed << setprecision(3);
+    for(size_t i=0; i<vStats.size(); i++)
+    {
+        const StageStats &s = vStats[i];
+        cout << left << setw(40) << s.name << right << setw(10) << s.count << setw(10) << s.mean
+             << setw(10) << s.p50 << setw(10) << s.p90 << setw(10) << s.p99 << setw(10) << s.max << endl;
+    }
+    cout.unsetf(ios::floatfield);
+}
+
+bool Tracer::SaveStatsCSV(const std::string &filename)
+{
+    ofstream f(filename.c_str());
+    if(!f.is_open())
+        return false;
+
+    vector<StageStats> vStats = GetStats();
+    f << "stage,count,mean_ms,p50_ms,p90_ms,p99_ms,max_ms" << endl;
+    f << fixed << setprecision(4);
+    for(size_t i=0; i<vStats.size(); i++)
+    {
+        const StageStats &s = vStats[i];
+        f << s.name << "," << s.count << "," << s.mean << "," << s.p50 << "," << s.p90 << ","
+          << s.p99 << "," << s.max << endl;
+    }
+    return true;
+}
+
+// Chrome trace event format, 可以在 chrome://tracing 或 Perfetto 中打开
+bool Tracer::SaveChromeTrace(const std::string &filename)
+{
+    Tracer &t = Instance();
+    t.Collect();
+
+    ofstream f(filename.c_str());
+    if(!f.is_open())
+        return false;
+
+    vector<string> vNames;
+    {
+        unique_lock<mutex> lock(t.mMutexStages);
+        vNames.assign(t.mvStageNames, t.mvStageNames + t.mnStages.load());
+    }
+
+    f << "{\"traceEvents\":[" << endl;
+    bool bFirst = true;
+    {
+        unique_lock<mutex> lock(t.mMutexBuffers);
+        for(size_t i=0; i<t.mvBuffers.size(); i++)
+        {
+            if(t.mvBuffers[i]->mName.empty())
+                continue;
+            f << (bFirst ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << t.mvBuffers[i]->mnId
+              << ",\"args\":{\"name\":\"" << t.mvBuffers[i]->mName << "\"}}";
+            bFirst = false;
+        }
+    }
+
+    f << fixed << setprecision(3);
+    unique_lock<mutex> lock(t.mMutexEvents);
+    for(size_t i=0; i<t.mvEvents.size(); i++)
+    {
+        const Event &e = t.mvEvents[i].second;
+        f << (bFirst ? "" : ",\n") << "{\"name\":\"" << vNames[e.stage] << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << t.mvEvents[i].first
+          << ",\"ts\":" << 1e-3 * e.start << ",\"dur\":" << 1e-3 * e.duration << "}";
+        bFirst = false;
+    }
+    f << endl << "]}" << endl;
+
+    if(t.mnDroppedEvents > 0)
+        cout << "Tracer: " << t.mnDroppedEvents << " events not kept in the trace (histograms are complete)" << endl;
+    return true;
+}
+
+void Tracer::Clear()
+{
+    Tracer &t = Instance();
+    t.Collect();
+    for(int i=0; i<MAX_STAGES; i++)
+        t.mvHistograms[i].Clear();
+
+    unique_lock<mutex> lock(t.mMutexEvents);
+    t.mvEvents.clear();
+    t.mnDroppedEvents = 0;
+}
+
+} // namespace ORB_SLAM3
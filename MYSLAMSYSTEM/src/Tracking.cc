@@ -28,6 +28,8 @@
 #include "Initializer.h"
 #include "G2oTypes.h"
 #include "Optimizer.h"
+#include "Tracer.h"
+#include "ParallelFor.h"
 
 #include <iostream>
 
@@ -1006,6 +1008,7 @@ bool Tracking::ParseCamParamFile(cv::FileStorage &fSettings)
     // Max/Min Frames to insert keyframes and to check relocalisation
     mMinFrames = 0;
     mMaxFrames = fps;
+    mKeyFrameScheduler.SetFrameRate(fps);
 
     cout << "- fps: " << fps << endl;
 
@@ -1281,6 +1284,11 @@ void Tracking::SetStepByStep(bool bSet)
     bStepByStep = bSet;
 }
 
+KeyFrameScheduler* Tracking::GetKeyFrameScheduler()
+{
+    return &mKeyFrameScheduler;
+}
+
 
 // 输入左右目图像，可以为RGB、BGR、RGBA、GRAY
 // 1、将图像转为mImGray和imGrayRight并初始化mCurrentFrame
@@ -1288,46 +1296,52 @@ void Tracking::SetStepByStep(bool bSet)
 // 输出世界坐标系到该帧相机坐标系的变换矩阵
 cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp)
 {
-    mimLeft = imRectLeft.clone();
-    mimRight = imRectRight.clone();
+    StereoInput input;
+    PreprocessStereo(imRectLeft, imRectRight, timestamp, input);
+    return TrackStereoInput(input);
+}
 
-    mImRGB = imRectLeft.clone();
-    mImRight = imRectRight.clone();
+// 双目预处理: 灰度转换并构造Frame(ORB特征提取、动态点检测、双目匹配)
+void Tracking::PreprocessStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp, StereoInput &input)
+{
+    input.timestamp = timestamp;
+    input.imLeft = imRectLeft.clone();
+    input.imRight = imRectRight.clone();
 
     cv::Mat imGrayRight = imRectRight.clone();
 
 
     // step 1 ：将RGB或RGBA图像转为灰度图像
-    if(mImRGB.channels()==3)
+    if(input.imLeft.channels()==3)
     {
         if(mbRGB)
         {
-            cvtColor(mImRGB,mImGray,cv::COLOR_RGB2GRAY);
+            cvtColor(input.imLeft,input.imGray,cv::COLOR_RGB2GRAY);
             cvtColor(imGrayRight,imGrayRight,cv::COLOR_RGB2GRAY);
         }
         else
         {
-            cvtColor(mImRGB,mImGray,cv::COLOR_BGR2GRAY);
+            cvtColor(input.imLeft,input.imGray,cv::COLOR_BGR2GRAY);
             cvtColor(imGrayRight,imGrayRight,cv::COLOR_BGR2GRAY);
         }
     }
     // 这里考虑得十分周全,甚至连四通道的图像都考虑到了
-    else if(mImRGB.channels()==4)
+    else if(input.imLeft.channels()==4)
     {
         if(mbRGB)
         {
-            cvtColor(mImRGB,mImGray,cv::COLOR_RGBA2GRAY);
+            cvtColor(input.imLeft,input.imGray,cv::COLOR_RGBA2GRAY);
             cvtColor(imGrayRight,imGrayRight,cv::COLOR_RGBA2GRAY);
         }
         else
         {
-            cvtColor(mImRGB,mImGray,cv::COLOR_BGRA2GRAY);
+            cvtColor(input.imLeft,input.imGray,cv::COLOR_BGRA2GRAY);
             cvtColor(imGrayRight,imGrayRight,cv::COLOR_BGRA2GRAY);
         }
     }
-    else if(mImRGB.channels()==1)
+    else if(input.imLeft.channels()==1)
     {
-        mImGray = mImRGB.clone();
+        input.imGray = input.imLeft.clone();
     }
 
 
@@ -1337,10 +1351,10 @@ cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRe
 
 
     if (mSensor == System::STEREO && !mpCamera2)
-        mCurrentFrame = Frame(
-        mImGray,                //左目图像
+        input.frame = Frame(
+        input.imGray,           //左目图像
         imGrayRight,            //右目图像
-        mImRGB,
+        input.imLeft,
         mpPythonClient,
         timestamp,              //时间戳
         mpORBextractorLeft,     //左目特征提取器
@@ -1352,6 +1366,21 @@ cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRe
 		mThDepth,				//远点,近点的区分阈值
 		mpCamera,               //相机模型
         this);
+}
+
+// 对预处理好的双目输入进行跟踪
+cv::Mat Tracking::TrackStereoInput(StereoInput &input)
+{
+    mimLeft = input.imLeft;
+    mimRight = input.imRight;
+
+    mImRGB = input.imLeft;
+    mImRight = input.imRight;
+    mImGray = input.imGray;
+
+    mCurrentFrame = input.frame;
+    // 帧ID在跟踪阶段按跟踪顺序分配,复位后从0重新开始
+    mCurrentFrame.mnId = Frame::nNextId++;
 
 //    mCurrentFrame.mNameFile = filename;
     mCurrentFrame.mnDataset = mnNumDataset;
@@ -1816,6 +1845,7 @@ bool Tracking::PredictStateIMU()
  */
 void Tracking::Track()
 {
+    TRACE_SCOPE("Tracking::Track");
 
     if (bStepByStep)
     {
@@ -2220,11 +2250,8 @@ void Tracking::Track()
             // Step 9.1 更新恒速运动模型 TrackWithMotionModel 中的mVelocity
             if(!mLastFrame.mTcw.empty() && !mCurrentFrame.mTcw.empty())
             {
-                cv::Mat LastTwc = cv::Mat::eye(4,4,CV_32F);
-                mLastFrame.GetRotationInverse().copyTo(LastTwc.rowRange(0,3).colRange(0,3));
-                mLastFrame.GetCameraCenter().copyTo(LastTwc.rowRange(0,3).col(3));
                 // mVelocity = Tcl = Tcw * Twl,表示上一帧到当前帧的变换， 其中 Twl = LastTwc
-                mVelocity = mCurrentFrame.mTcw*LastTwc;
+                mVelocity = mCurrentFrame.GetPose_()*mLastFrame.GetPoseInverse_();
                 mbVelocity = true;
             }
             else {
@@ -2405,6 +2432,8 @@ void Tracking::StereoInitialization()
 
         mvpLocalKeyFrames.push_back(pKFini);
         mvpLocalMapPoints=mpAtlas->GetAllMapPoints();
+        mvLocalMapPointPos.clear();
+        mvLocalPointClusters.clear();
         mpReferenceKF = pKFini;
         mCurrentFrame.mpReferenceKF = pKFini;
 
@@ -2499,6 +2528,7 @@ void Tracking::CheckReplacedInLastFrame()
  **/
 bool Tracking::TrackReferenceKeyFrame()
 {
+    TRACE_SCOPE("Tracking::TrackReferenceKeyFrame");
     // Step 1：将当前帧的描述子转化为BoW向量
     mCurrentFrame.ComputeBoW();
 
@@ -2572,7 +2602,7 @@ void Tracking::UpdateLastFrame()
     // 将上一帧的世界坐标系下的位姿计算出来
     // l:last, r:reference, w:world
     // Tlw = Tlr*Trw 
-    mLastFrame.SetPose(Tlr*pRef->GetPose()); 
+    mLastFrame.SetPose_(Converter::toMatx44f(Tlr)*pRef->GetPose_());
 
     // 如果上一帧为关键帧，或者单目/单目惯性的情况，不进入下面环节，直接退出
 //    if(mnLastKeyFrameId==mLastFrame.mnId || !mbOnlyTracking)
@@ -2663,6 +2693,7 @@ void Tracking::UpdateLastFrame()
  */
 bool Tracking::TrackWithMotionModel()
 {
+    TRACE_SCOPE("Tracking::TrackWithMotionModel");
     // 最小距离 < 0.9*次小距离 匹配成功，检查旋转
     ORBmatcher matcher(0.9,true);
 
@@ -2670,7 +2701,7 @@ bool Tracking::TrackWithMotionModel()
     UpdateLastFrame();
 
     // Step 2 根据之前估计的速度，用恒速模型得到当前帧的初始位姿。
-    mCurrentFrame.SetPose(mVelocity*mLastFrame.mTcw);
+    mCurrentFrame.SetPose_(mVelocity*mLastFrame.GetPose_());
 
     // 清空当前帧的地图点，包括临时地图点
     fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
@@ -2764,6 +2795,7 @@ bool Tracking::TrackWithMotionModel()
  */
 bool Tracking::TrackLocalMap()
 {
+    TRACE_SCOPE("Tracking::TrackLocalMap");
 
     // We have an estimation of the camera pose and some map points tracked in the frame.
     // We retrieve the local map and try to find matches to points in the local map.
@@ -2879,6 +2911,7 @@ bool Tracking::TrackLocalMap()
  */
 bool Tracking::NeedNewKeyFrame()
 {
+    TRACE_SCOPE("Tracking::NeedNewKeyFrame");
     // 如果是IMU模式并且当前地图中未完成IMU初始化
     if(((mSensor == System::IMU_MONOCULAR) || (mSensor == System::IMU_STEREO)) && !mpAtlas->GetCurrentMap()->isImuInitialized())
     {
@@ -2982,12 +3015,17 @@ bool Tracking::NeedNewKeyFrame()
             thRefRatio = 0.90f;
     }
 
+    // LocalMapping跟不上时降低阈值,减少关键帧
+    thRefRatio = mKeyFrameScheduler.AdaptRefRatio(thRefRatio);
+
     // Condition 1a: More than "MaxFrames" have passed from last keyframe insertion
     // Step 7.2：很长时间没有插入关键帧，可以插入
     const bool c1a = mCurrentFrame.mnId>=mnLastKeyFrameId+mMaxFrames;
     // Condition 1b: More than "MinFrames" have passed and Local Mapping is idle
     // Step 7.3：满足插入关键帧的最小间隔并且localMapper处于空闲状态，可以插入
-    const bool c1b = ((mCurrentFrame.mnId>=mnLastKeyFrameId+mMinFrames) && bLocalMappingIdle);
+    // LocalMapping负载高时最小间隔不短于它处理一个关键帧的时间
+    const int nMinFrames = mKeyFrameScheduler.AdaptMinFrames(mMinFrames, mMaxFrames);
+    const bool c1b = ((mCurrentFrame.mnId>=mnLastKeyFrameId+nMinFrames) && bLocalMappingIdle);
     //Condition 1c: tracking is weak
 	// Step 7.4：在双目，RGB-D的情况下当前帧跟踪到的点比参考关键帧的0.25倍还少，或者满足bNeedToInsertClose
     const bool c1c = mSensor!=System::MONOCULAR && mSensor!=System::IMU_MONOCULAR && mSensor!=System::IMU_STEREO &&  //只考虑在纯双目，RGB-D的情况
@@ -3026,33 +3064,18 @@ bool Tracking::NeedNewKeyFrame()
     {
         // If the mapping accepts keyframes, insert keyframe.
         // Otherwise send a signal to interrupt BA
-        // Step 7.6：local mapping空闲时可以直接插入，不空闲的时候要根据情况插入
-        if(bLocalMappingIdle)
-        {
-            //可以插入关键帧
-            return true;
-        }
-        else
-        {
+        // Step 7.6：local mapping空闲时可以直接插入，不空闲的时候由调度器根据LocalMapping的负载决定
+        // 跟踪变弱(c1c)或IMU的时间条件(c3,c4)触发时不能推迟
+        // 双目或双目+IMU或RGB-D模式下关键帧可以在LocalMapping的队列中等待，单目关键帧比较密集，不排队
+        const bool bCritical = (c1c && c2) || c3 || c4;
+        const bool bQueueAllowed = mSensor!=System::MONOCULAR && mSensor!=System::IMU_MONOCULAR;
+        const KeyFrameScheduler::eDecision decision =
+            mKeyFrameScheduler.Decide(bLocalMappingIdle, mpLocalMapper->KeyframesInQueue(), bCritical, bQueueAllowed);
+
+        if(decision==KeyFrameScheduler::INTERRUPT_AND_INSERT || decision==KeyFrameScheduler::INTERRUPT)
             mpLocalMapper->InterruptBA();
-            if(mSensor!=System::MONOCULAR  && mSensor!=System::IMU_MONOCULAR)
-            {
-                // 双目或双目+IMU或RGB-D模式下，如队列里没有阻塞太多关键帧，可以插入
-                // tracking插入关键帧不是直接插入，而且先插入到mlNewKeyFrames中，
-                // 然后localmapper再逐个pop出来插入到mspKeyFrames
-                if(mpLocalMapper->KeyframesInQueue()<3)
-                    //队列中的关键帧数目不是很多,可以插入
-                    return true;
-                else
-                    //队列中缓冲的关键帧数目太多,暂时不能插入
-                    return false;
-            }
-            else
-                //对于单目情况,就直接无法插入关键帧了
-                //? 为什么这里对单目情况的处理不一样?
-                //回答：可能是单目关键帧相对比较密集
-                return false;
-        }
+
+        return decision==KeyFrameScheduler::INSERT || decision==KeyFrameScheduler::INTERRUPT_AND_INSERT;
     }
     else
         //不满足上面的条件,自然不能插入关键帧
@@ -3069,6 +3092,7 @@ bool Tracking::NeedNewKeyFrame()
  */
 void Tracking::CreateNewKeyFrame()
 {
+    TRACE_SCOPE("Tracking::CreateNewKeyFrame");
 	// 如果局部建图线程正在初始化或关闭了,就无法插入关键帧
     if(mpLocalMapper->IsInitializing())
         return;
@@ -3230,6 +3254,7 @@ void Tracking::CreateNewKeyFrame()
  */
 void Tracking::SearchLocalPoints()
 {
+    TRACE_SCOPE("Tracking::SearchLocalPoints");
     // Do not search map points already matched
     // Step 1：遍历当前帧的地图点，标记这些地图点不参与之后的投影搜索匹配
     for(vector<MapPoint*>::iterator vit=mCurrentFrame.mvpMapPoints.begin(), vend=mCurrentFrame.mvpMapPoints.end(); vit!=vend; vit++)
@@ -3259,28 +3284,49 @@ void Tracking::SearchLocalPoints()
 
     // Project points in frame and check its visibility
     // Step 2：判断所有局部地图点中除当前帧地图点外的点，是否在当前帧视野范围内
-    for(vector<MapPoint*>::iterator vit=mvpLocalMapPoints.begin(), vend=mvpLocalMapPoints.end(); vit!=vend; vit++)
+    // 局部地图点已在UpdateLocalPoints中分组并读取了坐标时，先用每组的包围球剔除整组在视野外的点
+    const bool bClusters = mvLocalMapPointPos.size()==mvpLocalMapPoints.size();
+    const int nClusters = bClusters ? mvLocalPointClusters.size() : 1;
+    for(int c=0; c<nClusters; c++)
     {
-        MapPoint* pMP = *vit;
+        const int begin = bClusters ? mvLocalPointClusters[c].begin : 0;
+        const int end = bClusters ? mvLocalPointClusters[c].end : (int)mvpLocalMapPoints.size();
+        const bool bInView = !bClusters || mCurrentFrame.IsSphereInFrustum(mvLocalPointClusters[c].center, mvLocalPointClusters[c].radius);
 
-        // 已经被当前帧观测到的地图点肯定在视野范围内，跳过
-        if(pMP->mnLastFrameSeen == mCurrentFrame.mnId)
-            continue;
-        // 跳过坏点
-        if(pMP->isBad())
-            continue;
-        // Project (this fills MapPoint variables for matching)
-        // 判断地图点是否在在当前帧视野内
-        if(mCurrentFrame.isInFrustum(pMP,0.5))
-        {
-        	// 观测到该点的帧数加1
-            pMP->IncreaseVisible();
-            // 只有在视野范围内的地图点才参与之后的投影匹配
-            nToMatch++;
-        }
-        if(pMP->mbTrackInView)
+        for(int i=begin; i<end; i++)
         {
-            mCurrentFrame.mmProjectPoints[pMP->mnId] = cv::Point2f(pMP->mTrackProjX, pMP->mTrackProjY);
+            MapPoint* pMP = mvpLocalMapPoints[i];
+
+            // 已经被当前帧观测到的地图点肯定在视野范围内，跳过
+            if(pMP->mnLastFrameSeen == mCurrentFrame.mnId)
+                continue;
+            // 整组都在视野外，不参与投影匹配
+            if(!bInView)
+            {
+                pMP->mbTrackInView = false;
+                pMP->mbTrackInViewR = false;
+                pMP->mTrackProjX = -1;
+                pMP->mTrackProjY = -1;
+                continue;
+            }
+            // 跳过坏点
+            if(pMP->isBad())
+                continue;
+            // Project (this fills MapPoint variables for matching)
+            // 判断地图点是否在在当前帧视野内
+            const bool bInFrustum = bClusters ? mCurrentFrame.isInFrustum(pMP,mvLocalMapPointPos[i],0.5)
+                                              : mCurrentFrame.isInFrustum(pMP,0.5);
+            if(bInFrustum)
+            {
+                // 观测到该点的帧数加1
+                pMP->IncreaseVisible();
+                // 只有在视野范围内的地图点才参与之后的投影匹配
+                nToMatch++;
+            }
+            if(pMP->mbTrackInView)
+            {
+                mCurrentFrame.mmProjectPoints[pMP->mnId] = cv::Point2f(pMP->mTrackProjX, pMP->mTrackProjY);
+            }
         }
     }
 
@@ -3324,6 +3370,7 @@ void Tracking::SearchLocalPoints()
  */
 void Tracking::UpdateLocalMap()
 {
+    TRACE_SCOPE("Tracking::UpdateLocalMap");
     // This is for visualization
     // 设置参考地图点用于绘图显示局部地图点（红色）
     mpAtlas->SetReferenceMapPoints(mvpLocalMapPoints);
@@ -3341,6 +3388,84 @@ void Tracking::UpdateLocalPoints()
 {
     // Step 1：清空局部地图点
     mvpLocalMapPoints.clear();
+    mvLocalMapPointPos.clear();
+    mvLocalPointClusters.clear();
+
+    // [begin,end)的点坐标的包围盒
+    auto boundingBox = [&](const int begin, const int end, cv::Matx31f &minPos, cv::Matx31f &maxPos){
+        minPos = mvLocalMapPointPos[begin];
+        maxPos = mvLocalMapPointPos[begin];
+        for(int i=begin+1; i<end; i++)
+        {
+            const cv::Matx31f &P = mvLocalMapPointPos[i];
+            for(int k=0; k<3; k++)
+            {
+                minPos(k) = min(minPos(k), P(k));
+                maxPos(k) = max(maxPos(k), P(k));
+            }
+        }
+    };
+
+    // 把[begin,end)的点作为一组,用坐标的包围盒计算包围球
+    auto closeCluster = [&](const int begin, const int end){
+        cv::Matx31f minPos, maxPos;
+        boundingBox(begin, end, minPos, maxPos);
+        LocalPointCluster cluster;
+        cluster.begin = begin;
+        cluster.end = end;
+        cluster.center = 0.5f*(minPos+maxPos);
+        cluster.radius = 0.5f*cv::norm(maxPos-minPos);
+        mvLocalPointClusters.push_back(cluster);
+    };
+
+    // 把一个关键帧的点[begin, 当前末尾)按Morton序(Z序)重排后每LOCAL_POINT_CLUSTER_SIZE个点分一组,
+    // 按插入顺序分组时同一组的点可能分散在整个视野里,包围球过大而剔除不掉
+    std::vector<std::pair<unsigned int,int> > vMortonIdx;
+    std::vector<MapPoint*> vpSortedMPs;
+    std::vector<cv::Matx31f> vSortedPos;
+    auto sortAndCluster = [&](const int begin){
+        const int end = mvpLocalMapPoints.size();
+        if(end-begin > LOCAL_POINT_CLUSTER_SIZE)
+        {
+            // 每个坐标在包围盒内量化到10位,按位交织成30位的Morton码
+            cv::Matx31f minPos, maxPos;
+            boundingBox(begin, end, minPos, maxPos);
+            float scale[3];
+            for(int k=0; k<3; k++)
+                scale[k] = maxPos(k)>minPos(k) ? 1023.f/(maxPos(k)-minPos(k)) : 0.f;
+            auto spreadBits = [](unsigned int x){
+                x = (x | (x << 16)) & 0x030000FF;
+                x = (x | (x <<  8)) & 0x0300F00F;
+                x = (x | (x <<  4)) & 0x030C30C3;
+                x = (x | (x <<  2)) & 0x09249249;
+                return x;
+            };
+
+            vMortonIdx.clear();
+            for(int i=begin; i<end; i++)
+            {
+                const cv::Matx31f &P = mvLocalMapPointPos[i];
+                unsigned int code = 0;
+                for(int k=0; k<3; k++)
+                    code |= spreadBits(static_cast<unsigned int>((P(k)-minPos(k))*scale[k])) << k;
+                vMortonIdx.push_back(make_pair(code, i));
+            }
+            sort(vMortonIdx.begin(), vMortonIdx.end());
+
+            vpSortedMPs.clear();
+            vSortedPos.clear();
+            for(size_t j=0; j<vMortonIdx.size(); j++)
+            {
+                vpSortedMPs.push_back(mvpLocalMapPoints[vMortonIdx[j].second]);
+                vSortedPos.push_back(mvLocalMapPointPos[vMortonIdx[j].second]);
+            }
+            copy(vpSortedMPs.begin(), vpSortedMPs.end(), mvpLocalMapPoints.begin()+begin);
+            copy(vSortedPos.begin(), vSortedPos.end(), mvLocalMapPointPos.begin()+begin);
+        }
+
+        for(int b=begin; b<end; b+=LOCAL_POINT_CLUSTER_SIZE)
+            closeCluster(b, min(end, b+LOCAL_POINT_CLUSTER_SIZE));
+    };
 
     int count_pts = 0;
 	// Step 2：遍历局部关键帧 mvpLocalKeyFrames
@@ -3348,6 +3473,7 @@ void Tracking::UpdateLocalPoints()
     {
         KeyFrame* pKF = *itKF;
         const vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+        const int clusterBegin = mvpLocalMapPoints.size();
 
         // step 2：将局部关键帧的地图点添加到mvpLocalMapPoints
         for(vector<MapPoint*>::const_iterator itMP=vpMPs.begin(), itEndMP=vpMPs.end(); itMP!=itEndMP; itMP++)
@@ -3364,9 +3490,11 @@ void Tracking::UpdateLocalPoints()
             {
                 count_pts++;
                 mvpLocalMapPoints.push_back(pMP);
+                mvLocalMapPointPos.push_back(pMP->GetWorldPos2());
                 pMP->mnTrackReferenceForFrame=mCurrentFrame.mnId;
             }
         }
+        sortAndCluster(clusterBegin);
     }
 }
 
@@ -3384,7 +3512,20 @@ void Tracking::UpdateLocalKeyFrames()
 {
     // Each map point vote for the keyframes in which it has been observed
     // Step 1：遍历当前帧的地图点，记录所有能观测到当前帧地图点的关键帧
-    map<KeyFrame*,int> keyframeCounter;
+    // 票数直接记在关键帧的mnTrackVotes上,用轮次号代替清空,得票的关键帧按首次得票顺序放入mvpVotedKeyFrames
+    mnKFVoteEpoch++;
+    mvpVotedKeyFrames.clear();
+    auto voteKeyFrame = [&](KeyFrame* pKF, int, int){
+        if(pKF->mnTrackVotesEpoch!=mnKFVoteEpoch)
+        {
+            pKF->mnTrackVotesEpoch = mnKFVoteEpoch;
+            pKF->mnTrackVotes = 0;
+            mvpVotedKeyFrames.push_back(pKF);
+        }
+        // 同一个关键帧看到的地图点会累加到该关键帧计数
+        // 所以最后mnTrackVotes表示该关键帧看到了多少当前帧(mCurrentFrame)的地图点，也就是共视程度
+        pKF->mnTrackVotes++;
+    };
     // 如果IMU未初始化 或者 刚刚完成重定位
     if(!mpAtlas->isImuInitialized() || (mCurrentFrame.mnId<mnLastRelocFrameId+2))
     {
@@ -3395,15 +3536,9 @@ void Tracking::UpdateLocalKeyFrames()
             {
                 if(!pMP->isBad())
                 {
-                	// 得到观测到该地图点的关键帧和该地图点在关键帧中的索引
-                    const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
+                	// 遍历观测到该地图点的关键帧(不复制观测容器)
                 	// 由于一个地图点可以被多个关键帧观测到,因此对于每一次观测,都对观测到这个地图点的关键帧进行累计投票
-                    for(map<KeyFrame*,tuple<int,int>>::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-	                    // 这里的操作非常精彩！
-	                    // map[key] = value，当要插入的键存在时，会覆盖键对应的原来的值。如果键不存在，则添加一组键值对
-	                    // it->first 是地图点看到的关键帧，同一个关键帧看到的地图点会累加到该关键帧计数
-	                    // 所以最后keyframeCounter 第一个参数表示某个关键帧，第2个参数表示该关键帧看到了多少当前帧(mCurrentFrame)的地图点，也就是共视程度
-                        keyframeCounter[it->first]++;
+                    pMP->ForEachObservation(voteKeyFrame);
                 }
                 else
                 {
@@ -3425,9 +3560,7 @@ void Tracking::UpdateLocalKeyFrames()
                     continue;
                 if(!pMP->isBad())
                 {
-                    const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
-                    for(map<KeyFrame*,tuple<int,int>>::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-                        keyframeCounter[it->first]++;
+                    pMP->ForEachObservation(voteKeyFrame);
                 }
                 else
                 {
@@ -3446,22 +3579,22 @@ void Tracking::UpdateLocalKeyFrames()
     // 先清空局部关键帧
     mvpLocalKeyFrames.clear();
     // 先申请3倍内存，不够后面再加
-    mvpLocalKeyFrames.reserve(3*keyframeCounter.size());
+    mvpLocalKeyFrames.reserve(3*mvpVotedKeyFrames.size());
 
     // All keyframes that observe a map point are included in the local map. Also check which keyframe shares most points
     // Step 2.1 类型1：能观测到当前帧地图点的关键帧作为局部关键帧 （将邻居拉拢入伙）（一级共视关键帧） 
-    for(map<KeyFrame*,int>::const_iterator it=keyframeCounter.begin(), itEnd=keyframeCounter.end(); it!=itEnd; it++)
+    for(vector<KeyFrame*>::const_iterator it=mvpVotedKeyFrames.begin(), itEnd=mvpVotedKeyFrames.end(); it!=itEnd; it++)
     {
-        KeyFrame* pKF = it->first;
+        KeyFrame* pKF = *it;
 
         // 如果设定为要删除的，跳过
         if(pKF->isBad())
             continue;
         
         // 寻找具有最大观测数目的关键帧
-        if(it->second>max)
+        if(pKF->mnTrackVotes>max)
         {
-            max=it->second;
+            max=pKF->mnTrackVotes;
             pKFmax=pKF;
         }
 
@@ -3578,6 +3711,7 @@ void Tracking::UpdateLocalKeyFrames()
  */
 bool Tracking::Relocalization()
 {
+    TRACE_SCOPE("Tracking::Relocalization");
 //    Verbose::PrintMess("Starting relocalization", Verbose::VERBOSITY_NORMAL);
     // Compute Bag of Words Vector
     // Step 1: 计算当前帧特征点的Bow映射
@@ -3596,216 +3730,191 @@ bool Tracking::Relocalization()
 
     const int nKFs = vpCandidateKFs.size();
 
-    // We perform first an ORB matching with each candidate
-    // If enough matches are found we setup a PnP solver
-    ORBmatcher matcher(0.75,true);
+    // Step 3：并行地用每个候选关键帧求解当前帧位姿
+    // 每个线程持有一份当前帧的副本, 从共享计数器领取下一个候选关键帧, 先完成的线程自动接手剩余的候选
+    // 任一候选的内点达到50个即重定位成功, 其它线程在下一轮RANSAC前退出
+    const int nThreads = ParallelNumThreads(nKFs);
+    vector<Frame> vFrames(nThreads, mCurrentFrame);
+    atomic<bool> bFound(false);
+    atomic<int> nWinner(-1);
+
+    ParallelFor(nKFs, 1, nThreads, [&](const int i, const int t){
+        if(bFound.load())
+            return;
+        if(RelocalizeWithCandidate(vpCandidateKFs[i], vFrames[t], bFound))
+        {
+            // 只采用第一个成功的候选
+            bool bExpected = false;
+            if(bFound.compare_exchange_strong(bExpected, true))
+                nWinner = t;
+        }
+    });
+
+    // 折腾了这么久还是没有匹配上，重定位失败
+    if(nWinner < 0)
+    {
+        return false;
+    }
+    else
+    {
+        // 如果匹配上了,说明当前帧重定位成功了, 采用该候选得到的位姿和匹配
+        const Frame &frame = vFrames[nWinner];
+        mCurrentFrame.SetPose(frame.mTcw);
+        mCurrentFrame.mvpMapPoints = frame.mvpMapPoints;
+        mCurrentFrame.mvbOutlier = frame.mvbOutlier;
+
+        // 记录成功重定位帧的id，防止短时间多次重定位
+        mnLastRelocFrameId = mCurrentFrame.mnId;
+        cout << "Relocalized!!" << endl;
+        return true;
+    }
 
-    // 每个关键帧的解算器
-    vector<MLPnPsolver*> vpMLPnPsolvers;
-    vpMLPnPsolvers.resize(nKFs);
+}
 
-    // 每个关键帧和当前帧中特征点的匹配关系
-    vector<vector<MapPoint*> > vvpMapPointMatches;
-    vvpMapPointMatches.resize(nKFs);
+bool Tracking::RelocalizeWithCandidate(KeyFrame* pKF, Frame &frame, const std::atomic<bool> &bFound)
+{
+    TRACE_SCOPE("Tracking::RelocalizeWithCandidate");
+    if(pKF->isBad())
+        return false;
 
-    // 放弃某个关键帧的标记  
-    vector<bool> vbDiscarded;
-    vbDiscarded.resize(nKFs);
+    // We perform first an ORB matching with the candidate
+    // If enough matches are found we setup a PnP solver
+    ORBmatcher matcher(0.75,true);
 
-    // 有效的候选关键帧数目
-    int nCandidates=0;
+    // 当前帧和候选关键帧用BoW进行快速匹配，匹配结果记录在vpMapPointMatches，nmatches表示匹配的数目
+    vector<MapPoint*> vpMapPointMatches;
+    int nmatches = matcher.SearchByBoW(pKF,frame,vpMapPointMatches);
+    // 如果和当前帧的匹配数小于15,那么只能放弃这个关键帧
+    if(nmatches<15)
+        return false;
 
-    // Step 3：遍历所有的候选关键帧，通过BoW进行快速匹配，用匹配结果初始化PnP Solver
-    for(int i=0; i<nKFs; i++)
-    {
-        KeyFrame* pKF = vpCandidateKFs[i];
-        if(pKF->isBad())
-            vbDiscarded[i] = true;
-        else
-        {
-            // 当前帧和候选关键帧用BoW进行快速匹配，匹配结果记录在vvpMapPointMatches，nmatches表示匹配的数目
-            int nmatches = matcher.SearchByBoW(pKF,mCurrentFrame,vvpMapPointMatches[i]);
-            // 如果和当前帧的匹配数小于15,那么只能放弃这个关键帧
-            if(nmatches<15)
-            {
-                vbDiscarded[i] = true;
-                continue;
-            }
-            else
-            {
-                // 如果匹配数目够用，用匹配结果初始化MLPnPsolver
-                // ? 为什么用MLPnP? 因为考虑了鱼眼相机模型，解耦某些关系？
-                // 参考论文《MLPNP-A REAL-TIME MAXIMUM LIKELIHOOD SOLUTION TO THE PERSPECTIVE-N-POINT PROBLEM》
-                MLPnPsolver* pSolver = new MLPnPsolver(mCurrentFrame,vvpMapPointMatches[i]);
-                // 构造函数调用了一遍，这里重新设置参数
-                pSolver->SetRansacParameters(
-                    0.99,                    // 模型最大概率值，默认0.9
-                    10,                      // 内点的最小阈值，默认8
-                    300,                     // 最大迭代次数，默认300
-                    6,                       // 最小集，每次采样六个点，即最小集应该设置为6，论文里面写着I > 5
-                    0.5,                     // 理论最少内点个数，这里是按照总数的比例计算，所以epsilon是比例，默认是0.4
-                    5.991);                  // 卡方检验阈值 //This solver needs at least 6 points
-                vpMLPnPsolvers[i] = pSolver;
-            }
-        }
-    }
+    // 如果匹配数目够用，用匹配结果初始化MLPnPsolver
+    // ? 为什么用MLPnP? 因为考虑了鱼眼相机模型，解耦某些关系？
+    // 参考论文《MLPNP-A REAL-TIME MAXIMUM LIKELIHOOD SOLUTION TO THE PERSPECTIVE-N-POINT PROBLEM》
+    MLPnPsolver solver(frame,vpMapPointMatches);
+    // 构造函数调用了一遍，这里重新设置参数
+    solver.SetRansacParameters(
+        0.99,                    // 模型最大概率值，默认0.9
+        10,                      // 内点的最小阈值，默认8
+        300,                     // 最大迭代次数，默认300
+        6,                       // 最小集，每次采样六个点，即最小集应该设置为6，论文里面写着I > 5
+        0.5,                     // 理论最少内点个数，这里是按照总数的比例计算，所以epsilon是比例，默认是0.4
+        5.991);                  // 卡方检验阈值 //This solver needs at least 6 points
 
-    // Alternatively perform some iterations of P4P RANSAC
-    // Until we found a camera pose supported by enough inliers
-    // 足够的内点才能匹配使用PNP算法，MLPnP需要至少6个点
-    // 是否已经找到相匹配的关键帧的标志
-    bool bMatch = false;
     ORBmatcher matcher2(0.9,true);
 
-    // Step 4: 通过一系列操作,直到找到能够匹配上的关键帧
-    // 为什么搞这么复杂？答：是担心误闭环
-    while(nCandidates>0 && !bMatch)
+    // Perform some iterations of P4P RANSAC
+    // Until we found a camera pose supported by enough inliers
+    // 表示RANSAC已经没有更多的迭代次数可用 -- 也就是说数据不够好，RANSAC也已经尽力了。。。
+    bool bNoMore = false;
+    while(!bNoMore && !bFound.load())
     {
-        //遍历当前所有的候选关键帧
-        for(int i=0; i<nKFs; i++)
-        {
-            // 忽略放弃的
-            if(vbDiscarded[i])
-                continue;
-
-            // Perform 5 Ransac Iterations
-            // 内点标记
-            vector<bool> vbInliers;
-
-            // 内点数
-            int nInliers;
+        // Perform 5 Ransac Iterations
+        // 内点标记
+        vector<bool> vbInliers;
 
-            // 表示RANSAC已经没有更多的迭代次数可用 -- 也就是说数据不够好，RANSAC也已经尽力了。。。
-            bool bNoMore;
+        // 内点数
+        int nInliers;
 
-            // Step 4.1：通过MLPnP算法估计姿态，迭代5次
-            MLPnPsolver* pSolver = vpMLPnPsolvers[i];
-            // PnP算法的入口函数
-            cv::Mat Tcw = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
+        // Step 4.1：通过MLPnP算法估计姿态，迭代5次
+        cv::Mat Tcw = solver.iterate(5,bNoMore,vbInliers,nInliers);
 
-            // If Ransac reachs max. iterations discard keyframe
-            // bNoMore 为true 表示已经超过了RANSAC最大迭代次数，就放弃当前关键帧
-            if(bNoMore)
-            {
-                vbDiscarded[i]=true;
-                nCandidates--;
-            }
+        // If a Camera Pose is computed, optimize
+        if(Tcw.empty())
+            continue;
 
-            // If a Camera Pose is computed, optimize
-            if(!Tcw.empty())
-            {
-                // Step 4.2：如果MLPnP 计算出了位姿，对内点进行BA优化
-                Tcw.copyTo(mCurrentFrame.mTcw);
+        // Step 4.2：如果MLPnP 计算出了位姿，对内点进行BA优化
+        frame.SetPose(Tcw);
 
-                // MLPnP 里RANSAC后的内点的集合
-                set<MapPoint*> sFound;
+        // MLPnP 里RANSAC后的内点的集合
+        set<MapPoint*> sFound;
 
-                const int np = vbInliers.size();
+        const int np = vbInliers.size();
 
-                // 遍历所有内点
-                for(int j=0; j<np; j++)
-                {
-                    if(vbInliers[j])
-                    {
-                        mCurrentFrame.mvpMapPoints[j]=vvpMapPointMatches[i][j];
-                        sFound.insert(vvpMapPointMatches[i][j]);
-                    }
-                    else
-                        mCurrentFrame.mvpMapPoints[j]=NULL;
-                }
+        // 遍历所有内点
+        for(int j=0; j<np; j++)
+        {
+            if(vbInliers[j])
+            {
+                frame.mvpMapPoints[j]=vpMapPointMatches[j];
+                sFound.insert(vpMapPointMatches[j]);
+            }
+            else
+                frame.mvpMapPoints[j]=NULL;
+        }
 
-                // 只优化位姿,不优化地图点的坐标，返回的是内点的数量
-                int nGood = Optimizer::PoseOptimization(&mCurrentFrame);
+        // 只优化位姿,不优化地图点的坐标，返回的是内点的数量
+        int nGood = Optimizer::PoseOptimization(&frame);
 
-                // 如果优化之后的内点数目不多，跳过了当前候选关键帧,但是却没有放弃当前帧的重定位
-                if(nGood<10)
-                    continue;
+        // 如果优化之后的内点数目不多，继续RANSAC,但是却没有放弃这个候选关键帧
+        if(nGood<10)
+            continue;
 
-                // 删除外点对应的地图点,这里直接设为空指针
-                for(int io =0; io<mCurrentFrame.N; io++)
-                    if(mCurrentFrame.mvbOutlier[io])
-                        mCurrentFrame.mvpMapPoints[io]=static_cast<MapPoint*>(NULL);
+        // 删除外点对应的地图点,这里直接设为空指针
+        for(int io =0; io<frame.N; io++)
+            if(frame.mvbOutlier[io])
+                frame.mvpMapPoints[io]=static_cast<MapPoint*>(NULL);
 
-                // If few inliers, search by projection in a coarse window and optimize again
-                // Step 4.3：如果内点较少，则通过投影的方式对之前未匹配的点进行匹配，再进行优化求解
-                // 前面的匹配关系是用词袋匹配过程得到的
-                if(nGood<50)
+        // If few inliers, search by projection in a coarse window and optimize again
+        // Step 4.3：如果内点较少，则通过投影的方式对之前未匹配的点进行匹配，再进行优化求解
+        // 前面的匹配关系是用词袋匹配过程得到的
+        if(nGood<50)
+        {
+            // 通过投影的方式将关键帧中未匹配的地图点投影到当前帧中, 生成新的匹配
+            int nadditional =matcher2.SearchByProjection(
+                frame,                   // 当前帧
+                pKF,                     // 关键帧
+                sFound,                  // 已经找到的地图点集合，不会用于PNP
+                10,                      // 窗口阈值，会乘以金字塔尺度
+                100);                    // 匹配的ORB描述子距离应该小于这个阈值
+
+            // 如果通过投影过程新增了比较多的匹配特征点对
+            if(nadditional+nGood>=50)
+            {
+                // 根据投影匹配的结果，再次采用3D-2D pnp BA优化位姿
+                nGood = Optimizer::PoseOptimization(&frame);
+
+                // If many inliers but still not enough, search by projection again in a narrower window
+                // the camera has been already optimized with many points
+                // Step 4.4：如果BA后内点数还是比较少(<50)但是还不至于太少(>30)，可以挽救一下, 最后垂死挣扎 
+                // 重新执行上一步 4.3的过程，只不过使用更小的搜索窗口
+                // 这里的位姿已经使用了更多的点进行了优化,应该更准，所以使用更小的窗口搜索
+                if(nGood>30 && nGood<50)
                 {
-                    // 通过投影的方式将关键帧中未匹配的地图点投影到当前帧中, 生成新的匹配
-                    int nadditional =matcher2.SearchByProjection(
-                        mCurrentFrame,           // 当前帧
-                        vpCandidateKFs[i],       // 关键帧
-                        sFound,                  // 已经找到的地图点集合，不会用于PNP
-                        10,                      // 窗口阈值，会乘以金字塔尺度
-                        100);                    // 匹配的ORB描述子距离应该小于这个阈值
-
-                    // 如果通过投影过程新增了比较多的匹配特征点对
-                    if(nadditional+nGood>=50)
+                    // 用更小窗口、更严格的描述子阈值，重新进行投影搜索匹配
+                    sFound.clear();
+                    for(int ip =0; ip<frame.N; ip++)
+                        if(frame.mvpMapPoints[ip])
+                            sFound.insert(frame.mvpMapPoints[ip]);
+                    nadditional =matcher2.SearchByProjection(
+                        frame,                      // 当前帧
+                        pKF,                        // 候选的关键帧
+                        sFound,                     // 已经找到的地图点，不会用于PNP
+                        3,                          // 新的窗口阈值，会乘以金字塔尺度
+                        64);                        // 匹配的ORB描述子距离应该小于这个阈值
+
+                    // Final optimization
+                    // 如果成功挽救回来，匹配数目达到要求，最后BA优化一下
+                    if(nGood+nadditional>=50)
                     {
-                        // 根据投影匹配的结果，再次采用3D-2D pnp BA优化位姿
-                        nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-
-                        // If many inliers but still not enough, search by projection again in a narrower window
-                        // the camera has been already optimized with many points
-                        // Step 4.4：如果BA后内点数还是比较少(<50)但是还不至于太少(>30)，可以挽救一下, 最后垂死挣扎 
-                        // 重新执行上一步 4.3的过程，只不过使用更小的搜索窗口
-                        // 这里的位姿已经使用了更多的点进行了优化,应该更准，所以使用更小的窗口搜索
-                        if(nGood>30 && nGood<50)
-                        {
-                            // 用更小窗口、更严格的描述子阈值，重新进行投影搜索匹配
-                            sFound.clear();
-                            for(int ip =0; ip<mCurrentFrame.N; ip++)
-                                if(mCurrentFrame.mvpMapPoints[ip])
-                                    sFound.insert(mCurrentFrame.mvpMapPoints[ip]);
-                            nadditional =matcher2.SearchByProjection(
-                                mCurrentFrame,              // 当前帧
-                                vpCandidateKFs[i],          // 候选的关键帧
-                                sFound,                     // 已经找到的地图点，不会用于PNP
-                                3,                          // 新的窗口阈值，会乘以金字塔尺度
-                                64);                        // 匹配的ORB描述子距离应该小于这个阈值
-
-                            // Final optimization
-                            // 如果成功挽救回来，匹配数目达到要求，最后BA优化一下
-                            if(nGood+nadditional>=50)
-                            {
-                                nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-                                //更新地图点
-                                for(int io =0; io<mCurrentFrame.N; io++)
-                                    if(mCurrentFrame.mvbOutlier[io])
-                                        mCurrentFrame.mvpMapPoints[io]=NULL;
-                            }
-                            //如果还是不能够满足就放弃了
-                        }
+                        nGood = Optimizer::PoseOptimization(&frame);
+                        //更新地图点
+                        for(int io =0; io<frame.N; io++)
+                            if(frame.mvbOutlier[io])
+                                frame.mvpMapPoints[io]=NULL;
                     }
-                }
-
-
-                // If the pose is supported by enough inliers stop ransacs and continue
-                // 如果对于当前的候选关键帧已经有足够的内点(50个)了,那么就认为重定位成功
-                if(nGood>=50)
-                {
-                    bMatch = true;
-                    // 只要有一个候选关键帧重定位成功，就退出循环，不考虑其他候选关键帧了
-                    break;
+                    //如果还是不能够满足就放弃了
                 }
             }
-        }//一直运行,知道已经没有足够的关键帧,或者是已经有成功匹配上的关键帧
-    }
+        }
 
-    // 折腾了这么久还是没有匹配上，重定位失败
-    if(!bMatch)
-    {
-        return false;
-    }
-    else
-    {
-        // 如果匹配上了,说明当前帧重定位成功了(当前帧已经有了自己的位姿)
-        // 记录成功重定位帧的id，防止短时间多次重定位
-        mnLastRelocFrameId = mCurrentFrame.mnId;
-        cout << "Relocalized!!" << endl;
-        return true;
+        // If the pose is supported by enough inliers stop ransacs and continue
+        // 如果对于当前的候选关键帧已经有足够的内点(50个)了,那么就认为重定位成功
+        if(nGood>=50)
+            return true;
     }
 
+    return false;
 }
 
 //整个追踪线程执行复位操作
@@ -3816,8 +3925,7 @@ void Tracking::Reset(bool bLocMap)
     if(mpViewer)
     {
         mpViewer->RequestStop();
-        while(!mpViewer->isStopped())
-            usleep(3000);
+        mpViewer->WaitUntilStopped();
     }
 
     // Reset Local Mapping
@@ -3868,6 +3976,8 @@ void Tracking::Reset(bool bLocMap)
     mpReferenceKF = static_cast<KeyFrame*>(NULL);
     mpLastKeyFrame = static_cast<KeyFrame*>(NULL);
     mvIniMatches.clear();
+    // 关键帧调度的负载估计和统计属于旧地图
+    mKeyFrameScheduler.Reset();
 
     if(mpViewer)
         mpViewer->Release();
@@ -3881,8 +3991,7 @@ void Tracking::ResetActiveMap(bool bLocMap)
     if(mpViewer)
     {
         mpViewer->RequestStop();
-        while(!mpViewer->isStopped())
-            usleep(3000);
+        mpViewer->WaitUntilStopped();
     }
 
     Map* pMap = mpAtlas->GetCurrentMap();
@@ -3910,6 +4019,7 @@ void Tracking::ResetActiveMap(bool bLocMap)
     mnLastInitFrameId = Frame::nNextId;
     mnLastRelocFrameId = mnLastInitFrameId;
     mState = NO_IMAGES_YET;
+    mKeyFrameScheduler.Reset();
 
     if(mpInitializer)
     {
@@ -297,10 +297,9 @@ void Viewer::Run()
 
         if(Stop())
         {
-            while(isStopped())
-            {
-                usleep(3000);
-            }
+            // 等待 Release
+            unique_lock<mutex> lock(mMutexStop);
+            mcvStop.wait(lock, [this]{ return !mbStopped; });
         }
 
         if(CheckFinish())
@@ -328,6 +327,7 @@ void Viewer::SetFinish()
 {
     unique_lock<mutex> lock(mMutexFinish);
     mbFinished = true;
+    mcvFinished.notify_all();
 }
 
 bool Viewer::isFinished()
@@ -336,6 +336,12 @@ bool Viewer::isFinished()
     return mbFinished;
 }
 
+void Viewer::WaitUntilFinished()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mcvFinished.wait(lock, [this]{ return mbFinished; });
+}
+
 void Viewer::RequestStop()
 {
     unique_lock<mutex> lock(mMutexStop);
@@ -349,6 +355,12 @@ bool Viewer::isStopped()
     return mbStopped;
 }
 
+void Viewer::WaitUntilStopped()
+{
+    unique_lock<mutex> lock(mMutexStop);
+    mcvStop.wait(lock, [this]{ return mbStopped; });
+}
+
 bool Viewer::Stop()
 {
     unique_lock<mutex> lock(mMutexStop);
@@ -360,6 +372,7 @@ bool Viewer::Stop()
     {
         mbStopped = true;
         mbStopRequested = false;
+        mcvStop.notify_all();
         return true;
     }
 
@@ -371,6 +384,7 @@ void Viewer::Release()
 {
     unique_lock<mutex> lock(mMutexStop);
     mbStopped = false;
+    mcvStop.notify_all();
 }
 
 void Viewer::SetTrackingPause()
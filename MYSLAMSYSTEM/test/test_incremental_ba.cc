@@ -0,0 +1,323 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// 在一个小的合成地图上比较 Optimizer::IncrementalBundleAdjustment 和 Optimizer::GlobalBundleAdjustemnt:
+// 两者从相同的初值出发,优化后的关键帧位姿和地图点坐标应当在容差内一致.
+// 第二轮追加关键帧和地图点并扰动已有的估计,检查沿用上一轮状态的增量求解仍然与全局BA一致
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "Frame.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "Map.h"
+#include "Optimizer.h"
+#include "IncrementalBA.h"
+#include "Converter.h"
+#include "CameraModels/Pinhole.h"
+
+using namespace std;
+using namespace ORB_SLAM3;
+
+namespace
+{
+
+int nFailures = 0;
+
+void Check(const bool bCondition, const char* what, const double value)
+{
+    if(!bCondition)
+    {
+        printf("FAILED: %s (%g)\n", what, value);
+        nFailures++;
+    }
+}
+
+const float fx = 500.f, fy = 500.f, cx = 320.f, cy = 240.f;
+const float bf = 50.f;      // 基线0.1m
+
+// 容差: 增量BA在所有增量都低于重新线性化阈值(5mm, 2e-3rad)时结束
+const double kTolRot = 2e-3;
+const double kTolTrans = 5e-3;
+const double kTolPoint = 1e-2;
+
+std::mt19937 rng(7);
+
+double Gauss(const double sigma)
+{
+    std::normal_distribution<double> d(0.0, sigma);
+    return d(rng);
+}
+
+double Uniform(const double a, const double b)
+{
+    std::uniform_real_distribution<double> d(a, b);
+    return d(rng);
+}
+
+g2o::SE3Quat Perturb(const g2o::SE3Quat &T, const double sigmaRot, const double sigmaTrans)
+{
+    g2o::Vector6d d;
+    d << Gauss(sigmaRot), Gauss(sigmaRot), Gauss(sigmaRot), Gauss(sigmaTrans), Gauss(sigmaTrans), Gauss(sigmaTrans);
+    return g2o::SE3Quat::exp(d) * T;
+}
+
+// 合成场景: 真值位姿、真值地图点,以及按真值投影(加噪声)得到的关键帧和地图点
+struct Scene
+{
+    Map* pMap;
+    GeometricCamera* pCamera;
+    vector<g2o::SE3Quat> vTcwGt;
+    vector<Eigen::Vector3d> vXwGt;
+    vector<KeyFrame*> vpKFs;
+    vector<MapPoint*> vpMPs;
+};
+
+g2o::SE3Quat GroundTruthPose(const int i)
+{
+    const Eigen::Vector3d C(0.3*i, 0.02*i, 0.0);
+    const Eigen::Quaterniond q(Eigen::AngleAxisd(0.03*i, Eigen::Vector3d::UnitY()));
+    const g2o::SE3Quat Twc(q, C);
+    return Twc.inverse();
+}
+
+// 创建第i个关键帧,观测所有地图点. 每4个观测中有1个是单目观测
+KeyFrame* CreateKeyFrame(Scene &scene, const int i, const g2o::SE3Quat &Tcw0)
+{
+    const g2o::SE3Quat &Tcw = scene.vTcwGt[i];
+    const int N = scene.vXwGt.size();
+
+    Frame F;
+    F.mnId = i;
+    F.mTimeStamp = i;
+    F.N = N;
+    F.Nleft = -1;
+    F.Nright = -1;
+    F.mbf = bf;
+    F.mb = bf/fx;
+    F.mThDepth = 40.f*F.mb;
+    F.mpCamera = scene.pCamera;
+    F.mpCamera2 = NULL;
+    F.mpPythonClient = NULL;
+    F.mnScaleLevels = 1;
+    F.mfScaleFactor = 1.f;
+    F.mfLogScaleFactor = 0.f;
+    F.mvScaleFactors.assign(1, 1.f);
+    F.mvLevelSigma2.assign(1, 1.f);
+    F.mvInvLevelSigma2.assign(1, 1.f);
+    F.mTlr = cv::Mat::eye(4, 4, CV_32F);
+    F.mTcw = Converter::toCvMat(Tcw0);
+    F.mvpMapPoints.assign(N, static_cast<MapPoint*>(NULL));
+
+    for(int j=0; j<N; j++)
+    {
+        const Eigen::Vector3d Xc = Tcw.map(scene.vXwGt[j]);
+        cv::KeyPoint kp;
+        kp.pt.x = fx*Xc(0)/Xc(2) + cx + Gauss(0.5);
+        kp.pt.y = fy*Xc(1)/Xc(2) + cy + Gauss(0.5);
+        kp.octave = 0;
+        F.mvKeys.push_back(kp);
+        F.mvKeysUn.push_back(kp);
+        const bool bMono = (i+j)%4 == 0;
+        F.mvuRight.push_back(bMono ? -1.f : kp.pt.x - bf/Xc(2) + Gauss(0.5));
+        F.mvDepth.push_back(bMono ? -1.f : Xc(2));
+    }
+
+    KeyFrame* pKF = new KeyFrame(F, scene.pMap, NULL);
+    scene.pMap->AddKeyFrame(pKF);
+    scene.vpKFs.push_back(pKF);
+    return pKF;
+}
+
+void AddObservations(Scene &scene, KeyFrame* pKF)
+{
+    for(size_t j=0; j<scene.vpMPs.size(); j++)
+    {
+        scene.vpMPs[j]->AddObservation(pKF, j);
+        pKF->AddMapPoint(scene.vpMPs[j], j);
+    }
+}
+
+// 优化的初值: 关键帧位姿和地图点坐标
+struct State
+{
+    vector<cv::Mat> vTcw;
+    vector<cv::Mat> vXw;
+};
+
+State Save(const Scene &scene)
+{
+    State s;
+    for(size_t i=0; i<scene.vpKFs.size(); i++)
+        s.vTcw.push_back(scene.vpKFs[i]->GetPose().clone());
+    for(size_t j=0; j<scene.vpMPs.size(); j++)
+        s.vXw.push_back(scene.vpMPs[j]->GetWorldPos().clone());
+    return s;
+}
+
+void Restore(Scene &scene, const State &s)
+{
+    for(size_t i=0; i<scene.vpKFs.size(); i++)
+    {
+        scene.vpKFs[i]->SetPose(s.vTcw[i]);
+        scene.vpKFs[i]->mTcwGBA.release();
+        scene.vpKFs[i]->mnBAGlobalForKF = 0;
+    }
+    for(size_t j=0; j<scene.vpMPs.size(); j++)
+    {
+        scene.vpMPs[j]->SetWorldPos(s.vXw[j]);
+        scene.vpMPs[j]->mPosGBA.release();
+        scene.vpMPs[j]->mnBAGlobalForKF = 0;
+    }
+}
+
+// 读取优化结果(mTcwGBA / mPosGBA)
+bool Collect(const Scene &scene, const unsigned long nLoopKF, vector<g2o::SE3Quat> &vTcw, vector<Eigen::Vector3d> &vXw)
+{
+    vTcw.clear();
+    vXw.clear();
+    for(size_t i=0; i<scene.vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = scene.vpKFs[i];
+        if(pKF->mnBAGlobalForKF != nLoopKF || pKF->mTcwGBA.empty())
+            return false;
+        vTcw.push_back(Converter::toSE3Quat(pKF->mTcwGBA));
+    }
+    for(size_t j=0; j<scene.vpMPs.size(); j++)
+    {
+        MapPoint* pMP = scene.vpMPs[j];
+        if(pMP->mnBAGlobalForKF != nLoopKF || pMP->mPosGBA.empty())
+            return false;
+        vXw.push_back(Converter::toVector3d(pMP->mPosGBA));
+    }
+    return true;
+}
+
+void Compare(const char* round, const vector<g2o::SE3Quat> &vTcwA, const vector<Eigen::Vector3d> &vXwA,
+             const vector<g2o::SE3Quat> &vTcwB, const vector<Eigen::Vector3d> &vXwB)
+{
+    double maxRot = 0, maxTrans = 0, maxPoint = 0;
+    for(size_t i=0; i<vTcwA.size(); i++)
+    {
+        // 比较相机中心,与关键帧的世界坐标系误差一致
+        const g2o::Vector6d d = (vTcwA[i].inverse() * vTcwB[i]).log();
+        maxRot = max(maxRot, d.head<3>().norm());
+        maxTrans = max(maxTrans, (vTcwA[i].inverse().translation() - vTcwB[i].inverse().translation()).norm());
+    }
+    for(size_t j=0; j<vXwA.size(); j++)
+        maxPoint = max(maxPoint, (vXwA[j] - vXwB[j]).norm());
+
+    printf("%s: max difference rot %.2e rad, trans %.2e m, point %.2e m\n", round, maxRot, maxTrans, maxPoint);
+    Check(maxRot < kTolRot, "keyframe rotations agree", maxRot);
+    Check(maxTrans < kTolTrans, "keyframe positions agree", maxTrans);
+    Check(maxPoint < kTolPoint, "map points agree", maxPoint);
+}
+
+// 从同一初值分别运行全局BA和增量BA,比较结果
+void RunRound(const char* round, Scene &scene, IncrementalBA &iba, const unsigned long nLoopKF)
+{
+    const State ini = Save(scene);
+
+    vector<g2o::SE3Quat> vTcwGBA, vTcwIBA;
+    vector<Eigen::Vector3d> vXwGBA, vXwIBA;
+
+    Restore(scene, ini);
+    const int nGBA = Optimizer::GlobalBundleAdjustemnt(scene.pMap, 20, NULL, nLoopKF, false);
+    Check(nGBA > 0, "global BA iterated", nGBA);
+    Check(Collect(scene, nLoopKF, vTcwGBA, vXwGBA), "global BA wrote every keyframe and map point", 0);
+
+    Restore(scene, ini);
+    const int nIBA = Optimizer::IncrementalBundleAdjustment(scene.pMap, iba, 20, NULL, nLoopKF);
+    Check(nIBA > 0, "incremental BA iterated", nIBA);
+    Check(Collect(scene, nLoopKF, vTcwIBA, vXwIBA), "incremental BA wrote every keyframe and map point", 0);
+
+    if(vTcwGBA.size() == scene.vpKFs.size() && vTcwIBA.size() == scene.vpKFs.size())
+        Compare(round, vTcwGBA, vXwGBA, vTcwIBA, vXwIBA);
+
+    // 结果作为下一轮的初值
+    Restore(scene, ini);
+    for(size_t i=0; i<scene.vpKFs.size() && i<vTcwGBA.size(); i++)
+        scene.vpKFs[i]->SetPose(Converter::toCvMat(vTcwGBA[i]));
+    for(size_t j=0; j<scene.vpMPs.size() && j<vXwGBA.size(); j++)
+        scene.vpMPs[j]->SetWorldPos(Converter::toCvMat(vXwGBA[j]));
+}
+
+} // namespace
+
+int main()
+{
+    const int nKFs = 6, nNewKFs = 2, nMPs = 60;
+
+    Scene scene;
+    scene.pMap = new Map();
+    vector<float> vCalib;
+    vCalib.push_back(fx);
+    vCalib.push_back(fy);
+    vCalib.push_back(cx);
+    vCalib.push_back(cy);
+    scene.pCamera = new Pinhole(vCalib);
+    Frame::fx = fx;
+    Frame::fy = fy;
+    Frame::cx = cx;
+    Frame::cy = cy;
+    Frame::invfx = 1.f/fx;
+    Frame::invfy = 1.f/fy;
+
+    for(int i=0; i<nKFs+nNewKFs; i++)
+        scene.vTcwGt.push_back(GroundTruthPose(i));
+    for(int j=0; j<nMPs; j++)
+        scene.vXwGt.push_back(Eigen::Vector3d(Uniform(-2.0, 3.5), Uniform(-1.5, 1.5), Uniform(4.0, 8.0)));
+
+    // 第一个关键帧是地图的初始关键帧,位姿固定在真值
+    for(int i=0; i<nKFs; i++)
+        CreateKeyFrame(scene, i, i==0 ? scene.vTcwGt[0] : Perturb(scene.vTcwGt[i], 0.01, 0.03));
+    for(int j=0; j<nMPs; j++)
+    {
+        const Eigen::Vector3d Xw = scene.vXwGt[j] + Eigen::Vector3d(Gauss(0.05), Gauss(0.05), Gauss(0.05));
+        MapPoint* pMP = new MapPoint(Converter::toCvMat(Xw), scene.vpKFs[0], scene.pMap);
+        scene.pMap->AddMapPoint(pMP);
+        scene.vpMPs.push_back(pMP);
+    }
+    for(int i=0; i<nKFs; i++)
+        AddObservations(scene, scene.vpKFs[i]);
+
+    IncrementalBA iba;
+    iba.Reset(scene.pMap);
+    RunRound("round 1", scene, iba, scene.vpKFs.back()->mnId);
+
+    // 第二轮: 新增关键帧,并像闭环矫正那样扰动已有的估计,增量BA沿用上一轮的状态
+    for(int i=nKFs; i<nKFs+nNewKFs; i++)
+        AddObservations(scene, CreateKeyFrame(scene, i, Perturb(scene.vTcwGt[i], 0.01, 0.03)));
+    for(size_t i=1; i<scene.vpKFs.size(); i++)
+        scene.vpKFs[i]->SetPose(Converter::toCvMat(Perturb(Converter::toSE3Quat(scene.vpKFs[i]->GetPose()), 0.005, 0.02)));
+    RunRound("round 2", scene, iba, scene.vpKFs.back()->mnId);
+
+    const IncrementalBA::Stats stats = iba.GetStats();
+    Check(stats.nPoses == nKFs+nNewKFs, "incremental BA tracks every keyframe", stats.nPoses);
+    Check(stats.nPoints == nMPs, "incremental BA tracks every map point", stats.nPoints);
+
+    if(nFailures)
+    {
+        printf("%d check(s) failed\n", nFailures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,244 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// KeyFrameDatabase 的并发查询测试:
+// 1. 4个线程不停地做重定位和闭环候选查询,同时1个线程 add/erase/clearMap,写者必须能完成
+// 2. 数据库不再变化后,多个线程同时查询的结果与单线程查询的结果相同
+// 用 -fsanitize=thread 编译时同时检查数据竞争
+
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "KeyFrameDatabase.h"
+#include "KeyFrame.h"
+#include "Frame.h"
+#include "Map.h"
+#include "ORBVocabulary.h"
+
+using namespace std;
+using namespace ORB_SLAM3;
+
+namespace
+{
+
+int nFailures = 0;
+
+void Check(const bool bCondition, const char* what)
+{
+    if(!bCondition)
+    {
+        printf("FAILED: %s\n", what);
+        nFailures++;
+    }
+}
+
+const int kNumKFs = 300;
+const int kNumQueryThreads = 4;
+const int kNumWriterOps = 2000;
+
+// 由随机描述子训练一个小词典,只是为了给倒排表提供单词数和打分方式
+void CreateVocabulary(ORBVocabulary &voc, std::mt19937 &rng)
+{
+    vector<vector<cv::Mat> > vvFeatures(20);
+    for(size_t i=0; i<vvFeatures.size(); i++)
+    {
+        for(int j=0; j<50; j++)
+        {
+            cv::Mat desc(1, 32, CV_8U);
+            for(int b=0; b<32; b++)
+                desc.at<unsigned char>(b) = rng() & 0xff;
+            vvFeatures[i].push_back(desc);
+        }
+    }
+    voc.create(vvFeatures);
+}
+
+DBoW2::BowVector RandomBowVector(std::mt19937 &rng, const unsigned int nWords)
+{
+    DBoW2::BowVector v;
+    for(int i=0; i<20; i++)
+        v.addWeight(rng() % nWords, 0.01 + (rng() % 100) / 100.0);
+    v.normalize(DBoW2::L1);
+    return v;
+}
+
+KeyFrame* CreateKeyFrame(Map* pMap, const int i, const DBoW2::BowVector &bowVec)
+{
+    Frame F;
+    F.mnId = i;
+    F.mTimeStamp = i;
+    F.N = 0;
+    F.Nleft = -1;
+    F.Nright = -1;
+    F.mpCamera = NULL;
+    F.mpCamera2 = NULL;
+    F.mpPythonClient = NULL;
+    F.mTlr = cv::Mat::eye(4, 4, CV_32F);
+    F.mTcw = cv::Mat::eye(4, 4, CV_32F);
+    F.mBowVec = bowVec;
+    return new KeyFrame(F, pMap, NULL);
+}
+
+// 一次查询的结果,按指针排序后便于比较
+struct QueryResult
+{
+    vector<KeyFrame*> vpReloc;
+    vector<KeyFrame*> vpLoop;
+    vector<KeyFrame*> vpMerge;
+};
+
+QueryResult Query(KeyFrameDatabase &db, Map* pMap, KeyFrame* pKF)
+{
+    QueryResult r;
+    Frame F;
+    F.mBowVec = pKF->mBowVec;
+    r.vpReloc = db.DetectRelocalizationCandidates(&F, pMap);
+    db.DetectNBestCandidates(pKF, r.vpLoop, r.vpMerge, 3);
+    sort(r.vpReloc.begin(), r.vpReloc.end());
+    sort(r.vpLoop.begin(), r.vpLoop.end());
+    sort(r.vpMerge.begin(), r.vpMerge.end());
+    return r;
+}
+
+bool operator==(const QueryResult &a, const QueryResult &b)
+{
+    return a.vpReloc == b.vpReloc && a.vpLoop == b.vpLoop && a.vpMerge == b.vpMerge;
+}
+
+} // namespace
+
+int main()
+{
+    std::mt19937 rng(2);
+
+    ORBVocabulary voc(5, 3);
+    CreateVocabulary(voc, rng);
+    Check(voc.size() > 0, "vocabulary has words");
+    if(voc.size() == 0)
+        return 1;
+
+    KeyFrameDatabase db(voc);
+    Map* pMap = new Map();
+
+    vector<KeyFrame*> vpKFs;
+    for(int i=0; i<kNumKFs; i++)
+    {
+        KeyFrame* pKF = CreateKeyFrame(pMap, i, RandomBowVector(rng, voc.size()));
+        pMap->AddKeyFrame(pKF);
+        vpKFs.push_back(pKF);
+    }
+    // 随机的共视关系,供分组打分使用
+    for(int i=0; i<kNumKFs; i++)
+    {
+        for(int j=0; j<12; j++)
+        {
+            KeyFrame* pKFj = vpKFs[rng() % kNumKFs];
+            if(pKFj == vpKFs[i])
+                continue;
+            const int weight = 15 + rng() % 100;
+            vpKFs[i]->AddConnection(pKFj, weight);
+            pKFj->AddConnection(vpKFs[i], weight);
+        }
+    }
+
+    // 1. 查询线程与写线程同时运行
+    {
+        std::atomic<bool> bStop(false);
+        std::atomic<long> nQueries(0);
+        vector<thread> vThreads;
+        for(int t=0; t<kNumQueryThreads; t++)
+        {
+            vThreads.push_back(thread([&, t]{
+                std::mt19937 r(100 + t);
+                while(!bStop)
+                {
+                    Query(db, pMap, vpKFs[r() % kNumKFs]);
+                    nQueries++;
+                }
+            }));
+        }
+
+        vector<bool> vbIn(kNumKFs, false);
+        for(int s=0; s<kNumWriterOps; s++)
+        {
+            const int i = rng() % kNumKFs;
+            if(vbIn[i])
+                db.erase(vpKFs[i]);
+            else
+                db.add(vpKFs[i]);
+            vbIn[i] = !vbIn[i];
+            if(s % 700 == 699)
+            {
+                db.clearMap(pMap);
+                fill(vbIn.begin(), vbIn.end(), false);
+            }
+        }
+        // 写者在查询不断的情况下完成了所有操作
+        bStop = true;
+        for(size_t t=0; t<vThreads.size(); t++)
+            vThreads[t].join();
+
+        printf("writer finished %d operations, %ld concurrent queries\n", kNumWriterOps, nQueries.load());
+        Check(nQueries.load() > 0, "queries ran while the writer was active");
+    }
+
+    // 2. 固定的数据库上,并发查询与单线程查询结果一致
+    {
+        db.clear();
+        for(int i=0; i<kNumKFs; i++)
+            db.add(vpKFs[i]);
+
+        vector<QueryResult> vReference(kNumKFs);
+        for(int i=0; i<kNumKFs; i++)
+            vReference[i] = Query(db, pMap, vpKFs[i]);
+
+        int nNonEmpty = 0;
+        for(int i=0; i<kNumKFs; i++)
+            nNonEmpty += !vReference[i].vpReloc.empty();
+        Check(nNonEmpty > 0, "relocalization finds candidates");
+
+        std::atomic<int> nMismatches(0);
+        vector<thread> vThreads;
+        for(int t=0; t<kNumQueryThreads; t++)
+        {
+            // 相邻线程查询的关键帧有一半重叠,同一个关键帧会被同时查询
+            vThreads.push_back(thread([&, t]{
+                for(int rep=0; rep<5; rep++)
+                    for(int i=t; i<kNumKFs; i+=kNumQueryThreads/2)
+                        if(!(Query(db, pMap, vpKFs[i]) == vReference[i]))
+                            nMismatches++;
+            }));
+        }
+        for(size_t t=0; t<vThreads.size(); t++)
+            vThreads[t].join();
+
+        Check(nMismatches.load() == 0, "concurrent queries match single-threaded queries");
+    }
+
+    if(nFailures)
+    {
+        printf("%d check(s) failed\n", nFailures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
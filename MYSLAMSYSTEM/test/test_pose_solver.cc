@@ -0,0 +1,239 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// PoseSolver 与 g2o 实现的 Optimizer::PoseOptimization 的比较:
+// 在同一个合成帧上分别运行两者,内点数、外点标记和优化后的位姿应当一致.
+// 分别测试单目、单目+双目混合,以及含有外点的情况
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "Frame.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "Map.h"
+#include "Optimizer.h"
+#include "Converter.h"
+#include "CameraModels/Pinhole.h"
+
+using namespace std;
+using namespace ORB_SLAM3;
+
+namespace
+{
+
+int nFailures = 0;
+
+void Check(const bool bCondition, const char* what, const double value)
+{
+    if(!bCondition)
+    {
+        printf("FAILED: %s (%g)\n", what, value);
+        nFailures++;
+    }
+}
+
+const float fx = 500.f, fy = 500.f, cx = 320.f, cy = 240.f;
+const float bf = 50.f;      // 基线0.1m
+const int kNumPoints = 200;
+
+// 两种实现的阻尼策略相同,差别只来自浮点运算顺序
+const double kTolRot = 1e-5;
+const double kTolTrans = 1e-5;
+
+std::mt19937 rng(5);
+
+double Gauss(const double sigma)
+{
+    std::normal_distribution<double> d(0.0, sigma);
+    return d(rng);
+}
+
+double Uniform(const double a, const double b)
+{
+    std::uniform_real_distribution<double> d(a, b);
+    return d(rng);
+}
+
+// 合成观测: 真值位姿下投影地图点并加噪声,部分观测替换为远离投影的外点
+struct Observations
+{
+    g2o::SE3Quat TcwGt;
+    vector<cv::KeyPoint> vKeys;
+    vector<float> vuRight;
+    vector<bool> vbOutlierGt;
+};
+
+Observations CreateObservations(const vector<MapPoint*> &vpMPs, const float stereoRatio, const float outlierRatio)
+{
+    Observations obs;
+    const Eigen::Quaterniond q(Eigen::AngleAxisd(0.1, Eigen::Vector3d(0.2, 1.0, 0.1).normalized()));
+    obs.TcwGt = g2o::SE3Quat(q, Eigen::Vector3d(0.2, -0.1, 0.3));
+
+    for(size_t j=0; j<vpMPs.size(); j++)
+    {
+        const Eigen::Vector3d Xc = obs.TcwGt.map(Converter::toVector3d(vpMPs[j]->GetWorldPos()));
+        cv::KeyPoint kp;
+        kp.octave = j%4;
+        const double sigma = pow(1.2, kp.octave);
+        kp.pt.x = fx*Xc(0)/Xc(2) + cx + Gauss(0.5*sigma);
+        kp.pt.y = fy*Xc(1)/Xc(2) + cy + Gauss(0.5*sigma);
+        const bool bOutlier = Uniform(0.0, 1.0) < outlierRatio;
+        if(bOutlier)
+        {
+            kp.pt.x += (j%2 ? 1.0 : -1.0) * Uniform(20.0, 40.0);
+            kp.pt.y += Uniform(-40.0, 40.0);
+        }
+        const bool bStereo = Uniform(0.0, 1.0) < stereoRatio;
+        obs.vKeys.push_back(kp);
+        obs.vuRight.push_back(bStereo ? kp.pt.x - bf/Xc(2) + Gauss(0.5*sigma) : -1.f);
+        obs.vbOutlierGt.push_back(bOutlier);
+    }
+    return obs;
+}
+
+void FillFrame(Frame &F, GeometricCamera* pCamera, const vector<MapPoint*> &vpMPs, const Observations &obs, const g2o::SE3Quat &Tcw0)
+{
+    const int N = vpMPs.size();
+    F.mnId = 1;
+    F.N = N;
+    F.Nleft = -1;
+    F.Nright = -1;
+    F.mbf = bf;
+    F.mb = bf/fx;
+    F.mThDepth = 40.f*F.mb;
+    F.mpCamera = pCamera;
+    F.mpCamera2 = NULL;
+    F.mpPythonClient = NULL;
+    F.mnScaleLevels = 4;
+    F.mfScaleFactor = 1.2f;
+    F.mfLogScaleFactor = log(1.2f);
+    F.mvScaleFactors.clear();
+    F.mvLevelSigma2.clear();
+    F.mvInvLevelSigma2.clear();
+    for(int l=0; l<F.mnScaleLevels; l++)
+    {
+        const float s = pow(1.2f, l);
+        F.mvScaleFactors.push_back(s);
+        F.mvLevelSigma2.push_back(s*s);
+        F.mvInvLevelSigma2.push_back(1.f/(s*s));
+    }
+    F.mTlr = cv::Mat::eye(4, 4, CV_32F);
+    F.mvKeys = obs.vKeys;
+    F.mvKeysUn = obs.vKeys;
+    F.mvuRight = obs.vuRight;
+    F.mvDepth.assign(N, -1.f);
+    F.mvpMapPoints = vpMPs;
+    F.mvbOutlier.assign(N, false);
+    F.SetPose_(Converter::toMatx44f(Tcw0));
+}
+
+void RunCase(const char* name, GeometricCamera* pCamera, const vector<MapPoint*> &vpMPs,
+             const float stereoRatio, const float outlierRatio)
+{
+    const Observations obs = CreateObservations(vpMPs, stereoRatio, outlierRatio);
+    g2o::Vector6d d;
+    d << 0.02, -0.01, 0.015, 0.05, 0.03, -0.04;
+    const g2o::SE3Quat Tcw0 = g2o::SE3Quat::exp(d) * obs.TcwGt;
+
+    Frame FSolver, FG2o;
+    FillFrame(FSolver, pCamera, vpMPs, obs, Tcw0);
+    FillFrame(FG2o, pCamera, vpMPs, obs, Tcw0);
+
+    const int nGoodSolver = Optimizer::PoseOptimization(&FSolver);
+    const int nGoodG2o = Optimizer::PoseOptimization(&FG2o, true);
+
+    const g2o::SE3Quat TcwSolver = Converter::toSE3Quat(FSolver.GetPose_());
+    const g2o::SE3Quat TcwG2o = Converter::toSE3Quat(FG2o.GetPose_());
+    const g2o::Vector6d diff = (TcwG2o.inverse() * TcwSolver).log();
+    const g2o::Vector6d err = (obs.TcwGt.inverse() * TcwSolver).log();
+
+    int nFlagMismatch = 0, nMissedOutliers = 0, nOutliersGt = 0;
+    for(int i=0; i<FSolver.N; i++)
+    {
+        nFlagMismatch += FSolver.mvbOutlier[i] != FG2o.mvbOutlier[i];
+        nOutliersGt += obs.vbOutlierGt[i];
+        nMissedOutliers += obs.vbOutlierGt[i] && !FSolver.mvbOutlier[i];
+    }
+
+    printf("%s: inliers %d/%d, %d outliers, pose difference rot %.2e trans %.2e, error to ground truth rot %.2e trans %.2e\n",
+           name, nGoodSolver, nGoodG2o, nOutliersGt, diff.head<3>().norm(), diff.tail<3>().norm(),
+           err.head<3>().norm(), err.tail<3>().norm());
+
+    Check(nGoodSolver == nGoodG2o, "same number of inliers", nGoodSolver - nGoodG2o);
+    Check(nFlagMismatch == 0, "same outlier flags", nFlagMismatch);
+    Check(diff.head<3>().norm() < kTolRot, "rotations agree", diff.head<3>().norm());
+    Check(diff.tail<3>().norm() < kTolTrans, "translations agree", diff.tail<3>().norm());
+    Check(nMissedOutliers == 0, "every injected outlier is flagged", nMissedOutliers);
+    Check(err.head<3>().norm() < 5e-3 && err.tail<3>().norm() < 2e-2, "pose converges to ground truth", err.tail<3>().norm());
+}
+
+} // namespace
+
+int main()
+{
+    vector<float> vCalib;
+    vCalib.push_back(fx);
+    vCalib.push_back(fy);
+    vCalib.push_back(cx);
+    vCalib.push_back(cy);
+    GeometricCamera* pCamera = new Pinhole(vCalib);
+    Frame::fx = fx;
+    Frame::fy = fy;
+    Frame::cx = cx;
+    Frame::cy = cy;
+    Frame::invfx = 1.f/fx;
+    Frame::invfy = 1.f/fy;
+
+    // 地图点需要一个参考关键帧
+    Map* pMap = new Map();
+    Frame F0;
+    F0.mnId = 0;
+    F0.N = 0;
+    F0.Nleft = -1;
+    F0.Nright = -1;
+    F0.mpCamera = pCamera;
+    F0.mpCamera2 = NULL;
+    F0.mpPythonClient = NULL;
+    F0.mTlr = cv::Mat::eye(4, 4, CV_32F);
+    F0.mTcw = cv::Mat::eye(4, 4, CV_32F);
+    KeyFrame* pRefKF = new KeyFrame(F0, pMap, NULL);
+
+    vector<MapPoint*> vpMPs;
+    for(int j=0; j<kNumPoints; j++)
+    {
+        const Eigen::Vector3d Xw(Uniform(-3.0, 3.0), Uniform(-2.0, 2.0), Uniform(4.0, 10.0));
+        MapPoint* pMP = new MapPoint(Converter::toCvMat(Xw), pRefKF, pMap);
+        pMap->AddMapPoint(pMP);
+        vpMPs.push_back(pMP);
+    }
+
+    RunCase("monocular", pCamera, vpMPs, 0.f, 0.f);
+    RunCase("stereo", pCamera, vpMPs, 0.5f, 0.f);
+    RunCase("monocular with outliers", pCamera, vpMPs, 0.f, 0.15f);
+    RunCase("stereo with outliers", pCamera, vpMPs, 0.5f, 0.15f);
+
+    if(nFailures)
+    {
+        printf("%d check(s) failed\n", nFailures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
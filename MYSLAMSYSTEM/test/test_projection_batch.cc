@@ -0,0 +1,268 @@
+/**
+ * This file is part of ORB-SLAM3
+ *
+ * Copyright (C) 2017-2020 Carlos Campos, Richard Elvira, Juan J. Gómez Rodríguez, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ * Copyright (C) 2014-2016 Raúl Mur-Artal, José M.M. Montiel and Juan D. Tardós, University of Zaragoza.
+ *
+ * ORB-SLAM3 is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ORB-SLAM3 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ORB-SLAM3.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// ProjectionBatch 与逐边计算的比较: 在同一个合成BA问题上分别构建注册和不注册 ProjectionBatch 的优化器,
+// 检查误差、雅克比和优化结果一致. 双目边不被批量计算,与单目边混在一起检查分组是否正确
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <Eigen/StdVector>
+
+#include "Thirdparty/g2o/g2o/core/sparse_optimizer.h"
+#include "Thirdparty/g2o/g2o/core/block_solver.h"
+#include "Thirdparty/g2o/g2o/core/optimization_algorithm_levenberg.h"
+#include "Thirdparty/g2o/g2o/core/robust_kernel_impl.h"
+#include "Thirdparty/g2o/g2o/solvers/linear_solver_eigen.h"
+#include "Thirdparty/g2o/g2o/types/types_six_dof_expmap.h"
+
+#include "OptimizableTypes.h"
+#include "ProjectionBatch.h"
+#include "CameraModels/Pinhole.h"
+
+using namespace std;
+using namespace ORB_SLAM3;
+
+namespace
+{
+
+int nFailures = 0;
+
+void Check(const bool bCondition, const char* what, const double value)
+{
+    if(!bCondition)
+    {
+        printf("FAILED: %s (%g)\n", what, value);
+        nFailures++;
+    }
+}
+
+const int kNumPoses = 5;
+const int kNumPoints = 300;
+const double fx = 450.0, fy = 455.0, cx = 320.0, cy = 240.0, bf = 45.0;
+
+// 构建合成BA问题. 同一个种子得到完全相同的图
+struct Problem
+{
+    vector<g2o::SE3Quat, Eigen::aligned_allocator<g2o::SE3Quat> > vTcw;
+    vector<Eigen::Vector3d> vXw;
+    struct Obs
+    {
+        int nPose, nPoint;
+        Eigen::Vector3d z;      // z[2]<0 为单目观测
+        bool bRobust;
+    };
+    vector<Obs> vObs;
+};
+
+Problem CreateProblem()
+{
+    std::mt19937 rng(11);
+    std::normal_distribution<double> noise(0.0, 1.0);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+
+    Problem problem;
+    vector<g2o::SE3Quat, Eigen::aligned_allocator<g2o::SE3Quat> > vTcwGt;
+    for(int i=0; i<kNumPoses; i++)
+    {
+        const Eigen::Quaterniond q(Eigen::AngleAxisd(0.05*i, Eigen::Vector3d::UnitY()));
+        const g2o::SE3Quat Tcw = g2o::SE3Quat(q, Eigen::Vector3d(0.2*i, 0.0, 0.0)).inverse();
+        vTcwGt.push_back(Tcw);
+        g2o::Vector6d d;
+        for(int k=0; k<6; k++)
+            d[k] = i==0 ? 0.0 : 0.01*noise(rng);
+        problem.vTcw.push_back(g2o::SE3Quat::exp(d) * Tcw);
+    }
+
+    for(int j=0; j<kNumPoints; j++)
+    {
+        const Eigen::Vector3d Xw(3.0*uniform(rng), 2.0*uniform(rng), 6.0 + 2.0*uniform(rng));
+        problem.vXw.push_back(Xw + 0.05*Eigen::Vector3d(noise(rng), noise(rng), noise(rng)));
+        for(int i=0; i<kNumPoses; i++)
+        {
+            const Eigen::Vector3d Xc = vTcwGt[i].map(Xw);
+            Problem::Obs obs;
+            obs.nPose = i;
+            obs.nPoint = j;
+            obs.z[0] = fx*Xc[0]/Xc[2] + cx + noise(rng);
+            obs.z[1] = fy*Xc[1]/Xc[2] + cy + noise(rng);
+            obs.z[2] = (i+j)%3 == 0 ? obs.z[0] - bf/Xc[2] + noise(rng) : -1.0;
+            obs.bRobust = (i+j)%2 == 0;
+            problem.vObs.push_back(obs);
+        }
+    }
+    return problem;
+}
+
+void BuildGraph(const Problem &problem, GeometricCamera* pCamera, g2o::SparseOptimizer &optimizer)
+{
+    g2o::BlockSolver_6_3::LinearSolverType* linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType>();
+    g2o::BlockSolver_6_3* solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+    optimizer.setAlgorithm(new g2o::OptimizationAlgorithmLevenberg(solver_ptr));
+    optimizer.setVerbose(false);
+
+    for(int i=0; i<kNumPoses; i++)
+    {
+        g2o::VertexSE3Expmap* vSE3 = new g2o::VertexSE3Expmap();
+        vSE3->setEstimate(problem.vTcw[i]);
+        vSE3->setId(i);
+        vSE3->setFixed(i==0);
+        optimizer.addVertex(vSE3);
+    }
+    for(int j=0; j<kNumPoints; j++)
+    {
+        g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
+        vPoint->setEstimate(problem.vXw[j]);
+        vPoint->setId(kNumPoses + j);
+        vPoint->setMarginalized(true);
+        optimizer.addVertex(vPoint);
+    }
+
+    for(size_t k=0; k<problem.vObs.size(); k++)
+    {
+        const Problem::Obs &obs = problem.vObs[k];
+        g2o::OptimizableGraph::Vertex* vPoint = static_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(kNumPoses + obs.nPoint));
+        g2o::OptimizableGraph::Vertex* vPose = static_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(obs.nPose));
+        if(obs.z[2] < 0)
+        {
+            EdgeSE3ProjectXYZ* e = new EdgeSE3ProjectXYZ();
+            e->setVertex(0, vPoint);
+            e->setVertex(1, vPose);
+            e->setMeasurement(obs.z.head<2>());
+            e->setInformation(Eigen::Matrix2d::Identity());
+            e->pCamera = pCamera;
+            if(obs.bRobust)
+            {
+                g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+                rk->setDelta(sqrt(5.991));
+                e->setRobustKernel(rk);
+            }
+            optimizer.addEdge(e);
+        }
+        else
+        {
+            g2o::EdgeStereoSE3ProjectXYZ* e = new g2o::EdgeStereoSE3ProjectXYZ();
+            e->setVertex(0, vPoint);
+            e->setVertex(1, vPose);
+            e->setMeasurement(obs.z);
+            e->setInformation(Eigen::Matrix3d::Identity());
+            e->fx = fx;
+            e->fy = fy;
+            e->cx = cx;
+            e->cy = cy;
+            e->bf = bf;
+            optimizer.addEdge(e);
+        }
+    }
+}
+
+double RelativeDifference(const Eigen::MatrixXd &a, const Eigen::MatrixXd &b)
+{
+    return (a - b).norm() / max(1.0, b.norm());
+}
+
+} // namespace
+
+int main()
+{
+    vector<float> vCalib;
+    vCalib.push_back(fx);
+    vCalib.push_back(fy);
+    vCalib.push_back(cx);
+    vCalib.push_back(cy);
+    Pinhole camera(vCalib);
+
+    const Problem problem = CreateProblem();
+    int nMono = 0;
+    for(size_t k=0; k<problem.vObs.size(); k++)
+        nMono += problem.vObs[k].z[2] < 0;
+
+    // 逐边计算的参考
+    g2o::SparseOptimizer reference;
+    BuildGraph(problem, &camera, reference);
+    reference.initializeOptimization();
+
+    // ProjectionBatch 必须在优化器之后定义,先于优化器析构
+    g2o::SparseOptimizer batched;
+    ProjectionBatch projectionBatch;
+    BuildGraph(problem, &camera, batched);
+    batched.addBatchEvaluator(&projectionBatch);
+    batched.initializeOptimization();
+
+    Check(projectionBatch.Size() == (size_t)nMono, "every monocular pinhole edge is batched", projectionBatch.Size());
+
+    // 误差
+    reference.computeActiveErrors();
+    batched.computeActiveErrors();
+    const vector<g2o::OptimizableGraph::Edge*> &vRef = reference.activeEdges();
+    const vector<g2o::OptimizableGraph::Edge*> &vBatch = batched.activeEdges();
+    Check(vRef.size() == vBatch.size(), "same number of active edges", vBatch.size());
+
+    double maxError = 0, maxJacobian = 0;
+    projectionBatch.linearize();
+    for(size_t k=0; k<vRef.size() && k<vBatch.size(); k++)
+    {
+        EdgeSE3ProjectXYZ* eRef = dynamic_cast<EdgeSE3ProjectXYZ*>(vRef[k]);
+        EdgeSE3ProjectXYZ* eBatch = dynamic_cast<EdgeSE3ProjectXYZ*>(vBatch[k]);
+        if(!eRef || !eBatch)
+            continue;
+        maxError = max(maxError, RelativeDifference(eBatch->error(), eRef->error()));
+
+        eRef->linearizeOplus();
+        eBatch->linearizeOplus();
+        maxJacobian = max(maxJacobian, RelativeDifference(eBatch->jacobianOplusXi(), eRef->jacobianOplusXi()));
+        maxJacobian = max(maxJacobian, RelativeDifference(eBatch->jacobianOplusXj(), eRef->jacobianOplusXj()));
+    }
+    printf("max relative difference: error %.2e, jacobian %.2e\n", maxError, maxJacobian);
+    Check(maxError < 1e-10, "errors match the per-edge computation", maxError);
+    Check(maxJacobian < 1e-10, "jacobians match the per-edge computation", maxJacobian);
+    Check(fabs(batched.activeRobustChi2() - reference.activeRobustChi2()) < 1e-8 * max(1.0, reference.activeRobustChi2()),
+          "robust chi2 matches", batched.activeRobustChi2() - reference.activeRobustChi2());
+
+    // 优化结果
+    const int nItsRef = reference.optimize(10);
+    const int nItsBatch = batched.optimize(10);
+    Check(nItsRef == nItsBatch, "same number of iterations", nItsBatch - nItsRef);
+
+    double maxPose = 0, maxPoint = 0;
+    for(int i=0; i<kNumPoses; i++)
+    {
+        const g2o::SE3Quat Tref = static_cast<g2o::VertexSE3Expmap*>(reference.vertex(i))->estimate();
+        const g2o::SE3Quat Tbatch = static_cast<g2o::VertexSE3Expmap*>(batched.vertex(i))->estimate();
+        maxPose = max(maxPose, (Tref.inverse() * Tbatch).log().norm());
+    }
+    for(int j=0; j<kNumPoints; j++)
+    {
+        const Eigen::Vector3d Xref = static_cast<g2o::VertexSBAPointXYZ*>(reference.vertex(kNumPoses + j))->estimate();
+        const Eigen::Vector3d Xbatch = static_cast<g2o::VertexSBAPointXYZ*>(batched.vertex(kNumPoses + j))->estimate();
+        maxPoint = max(maxPoint, (Xref - Xbatch).norm());
+    }
+    printf("max difference after optimization: pose %.2e, point %.2e\n", maxPose, maxPoint);
+    Check(maxPose < 1e-8, "optimized poses match", maxPose);
+    Check(maxPoint < 1e-8, "optimized points match", maxPoint);
+
+    if(nFailures)
+    {
+        printf("%d check(s) failed\n", nFailures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}